@@ -1174,6 +1174,97 @@ text_offset_top(struct rectangle *allocation)
 	return allocation->height / 2;
 }
 
+/* Gets the colour of a solid source as 0xAARRGGBB. */
+static bool
+source_get_color(cairo_t *cr, uint32_t *color)
+{
+	double r, g, b, a;
+
+	if (cairo_pattern_get_rgba(cairo_get_source(cr),
+				   &r, &g, &b, &a) != CAIRO_STATUS_SUCCESS)
+		return false;
+
+	*color = (uint32_t) (a * 255.0 + 0.5) << 24 |
+		 (uint32_t) (r * 255.0 + 0.5) << 16 |
+		 (uint32_t) (g * 255.0 + 0.5) << 8 |
+		 (uint32_t) (b * 255.0 + 0.5);
+
+	return true;
+}
+
+/* Draws the glyphs of a plain layout in the solid source colour of cr
+ * through the toolkit's glyph cache; layouts with attributes need
+ * pango's decorations, and missing glyphs pango's hex boxes. */
+static void
+text_entry_show_layout(struct text_entry *entry, cairo_t *cr)
+{
+	struct glyph_cache *cache;
+	PangoLayoutIter *iter;
+	PangoLayoutRun *run;
+	PangoGlyphInfo *info;
+	PangoRectangle logical;
+	cairo_scaled_font_t *font;
+	cairo_glyph_t glyphs[256];
+	uint32_t color;
+	int i, n, x, baseline;
+
+	if (pango_layout_get_attributes(entry->layout) ||
+	    !source_get_color(cr, &color)) {
+		pango_cairo_show_layout(cr, entry->layout);
+		return;
+	}
+
+	cache = display_get_glyph_cache(window_get_display(entry->window));
+	iter = pango_layout_get_iter(entry->layout);
+	do {
+		run = pango_layout_iter_get_run_readonly(iter);
+		if (!run)
+			continue;
+
+		pango_layout_iter_get_run_extents(iter, NULL, &logical);
+		baseline = pango_layout_iter_get_baseline(iter);
+		font = pango_cairo_font_get_scaled_font(
+				PANGO_CAIRO_FONT(run->item->analysis.font));
+
+		for (i = 0; i < run->glyphs->num_glyphs; i++)
+			if (run->glyphs->glyphs[i].glyph &
+			    PANGO_GLYPH_UNKNOWN_FLAG)
+				break;
+		if (!font || i < run->glyphs->num_glyphs) {
+			cairo_move_to(cr, (double) logical.x / PANGO_SCALE,
+				      (double) baseline / PANGO_SCALE);
+			pango_cairo_show_glyph_string(cr,
+						      run->item->analysis.font,
+						      run->glyphs);
+			continue;
+		}
+
+		x = logical.x;
+		n = 0;
+		for (i = 0; i < run->glyphs->num_glyphs; i++) {
+			info = &run->glyphs->glyphs[i];
+
+			if (info->glyph != PANGO_GLYPH_EMPTY) {
+				glyphs[n].index = info->glyph;
+				glyphs[n].x = (double) (x + info->geometry.x_offset) /
+					      PANGO_SCALE;
+				glyphs[n].y = (double) (baseline + info->geometry.y_offset) /
+					      PANGO_SCALE;
+				n++;
+			}
+			x += info->geometry.width;
+
+			if (n == ARRAY_LENGTH(glyphs) ||
+			    i == run->glyphs->num_glyphs - 1) {
+				glyph_cache_show_glyphs(cache, cr, font,
+							color, glyphs, n);
+				n = 0;
+			}
+		}
+	} while (pango_layout_iter_next_run(iter));
+	pango_layout_iter_free(iter);
+}
+
 static void
 text_entry_redraw_handler(struct widget *widget, void *data)
 {
@@ -1220,7 +1311,7 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 
 	text_entry_update_layout(entry);
 
-	pango_cairo_show_layout(cr, entry->layout);
+	text_entry_show_layout(entry, cr);
 
 	text_entry_draw_cursor(entry, cr);
 
@@ -26,6 +26,7 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +57,7 @@ static char *option_font;
 static int option_font_size;
 static char *option_term;
 static char *option_shell;
+static int option_benchmark;
 
 static struct wl_list terminal_list;
 
@@ -405,6 +407,11 @@ attr_init(struct attr *data_attr, struct attr attr, int n)
 	}
 }
 
+union decoded_attr {
+	struct attr attr;
+	uint32_t key;
+};
+
 enum escape_state {
 	escape_state_normal = 0,
 	escape_state_escape,
@@ -472,6 +479,7 @@ struct terminal {
 	cairo_font_extents_t extents;
 	double average_width;
 	cairo_scaled_font_t *font_normal, *font_bold;
+	struct glyph_cache *glyph_cache;
 	uint32_t hide_cursor_serial;
 	int size_in_title;
 
@@ -484,6 +492,18 @@ struct terminal {
 	int selection_end_row, selection_end_col;
 	struct wl_list link;
 	int pace_pipe;
+
+	/* The cells as last painted, to find the rows that changed */
+	union utf8_char *shadow_data;
+	union decoded_attr *shadow_attr, *shadow_scratch;
+	int shadow_width, shadow_height;
+	int shadow_cursor_row, shadow_cursor_col;
+
+	/* Throughput counters for --benchmark */
+	struct timespec bench_start;
+	uint64_t bench_bytes;
+	uint32_t bench_frames;
+	uint64_t bench_rows;
 };
 
 /* Create default tab stops, every 8 characters */
@@ -576,11 +596,6 @@ terminal_get_attr_row(struct terminal *terminal, int row)
 	return (void *) terminal->data_attr + index * terminal->attr_pitch;
 }
 
-union decoded_attr {
-	struct attr attr;
-	uint32_t key;
-};
-
 static void
 terminal_decode_attr(struct terminal *terminal, int row, int col,
 		     union decoded_attr *decoded)
@@ -938,6 +953,17 @@ terminal_set_color(struct terminal *terminal, cairo_t *cr, int index)
 			      terminal->color_table[index].a);
 }
 
+static uint32_t
+terminal_get_argb(struct terminal *terminal, int index)
+{
+	struct terminal_color *c = &terminal->color_table[index];
+
+	return (uint32_t) lround(c->a * 255) << 24 |
+	       (uint32_t) lround(c->r * 255) << 16 |
+	       (uint32_t) lround(c->g * 255) << 8 |
+	       (uint32_t) lround(c->b * 255);
+}
+
 static void
 terminal_send_selection(struct terminal *terminal, int fd)
 {
@@ -1002,12 +1028,13 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 			font = run->terminal->font_bold;
 		else
 			font = run->terminal->font_normal;
-		cairo_set_scaled_font(run->cr, font);
-		terminal_set_color(run->terminal, run->cr,
-				   run->attr.attr.fg);
 
 		if (!(run->attr.attr.a & ATTRMASK_CONCEALED))
-			cairo_show_glyphs (run->cr, run->glyphs, run->count);
+			glyph_cache_show_glyphs(run->terminal->glyph_cache,
+						run->cr, font,
+						terminal_get_argb(run->terminal,
+								  run->attr.attr.fg),
+						run->glyphs, run->count);
 		run->g = run->glyphs;
 		run->count = 0;
 	}
@@ -1037,131 +1064,225 @@ glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 }
 
 
-static void
-redraw_handler(struct widget *widget, void *data)
+static bool
+terminal_resize_shadow(struct terminal *terminal)
 {
-	struct terminal *terminal = data;
-	struct rectangle allocation;
-	cairo_t *cr;
-	int top_margin, side_margin;
-	int row, col, cursor_x, cursor_y;
-	union utf8_char *p_row;
-	union decoded_attr attr;
-	int text_x, text_y;
-	cairo_surface_t *surface;
-	double d;
-	struct glyph_run run;
-	cairo_font_extents_t extents;
-	double average_width;
-	double unichar_width;
+	int cells = terminal->width * terminal->height;
 
-	surface = window_get_surface(terminal->window);
-	widget_get_allocation(terminal->widget, &allocation);
-	cr = widget_cairo_create(terminal->widget);
-	cairo_rectangle(cr, allocation.x, allocation.y,
-			allocation.width, allocation.height);
-	cairo_clip(cr);
-	cairo_push_group(cr);
+	if (terminal->shadow_width == terminal->width &&
+	    terminal->shadow_height == terminal->height)
+		return false;
 
-	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	terminal_set_color(terminal, cr, terminal->color_scheme->border);
-	cairo_paint(cr);
+	free(terminal->shadow_data);
+	free(terminal->shadow_attr);
+	free(terminal->shadow_scratch);
+	terminal->shadow_data = xzalloc(cells * sizeof *terminal->shadow_data);
+	terminal->shadow_attr = xzalloc(cells * sizeof *terminal->shadow_attr);
+	terminal->shadow_scratch =
+		xzalloc(terminal->width * sizeof *terminal->shadow_scratch);
+	terminal->shadow_width = terminal->width;
+	terminal->shadow_height = terminal->height;
 
-	cairo_set_scaled_font(cr, terminal->font_normal);
+	return true;
+}
 
-	extents = terminal->extents;
-	average_width = terminal->average_width;
-	side_margin = (allocation.width - terminal->width * average_width) / 2;
-	top_margin = (allocation.height - terminal->height * extents.height) / 2;
+/* Decode a row and compare it with what was painted last time,
+ * updating the shadow copy. Returns true if the row changed. */
+static bool
+terminal_update_shadow_row(struct terminal *terminal, int row)
+{
+	union utf8_char *p_row = terminal_get_row(terminal, row);
+	union utf8_char *s_row;
+	union decoded_attr *s_attr, *attr = terminal->shadow_scratch;
+	int col;
 
-	cairo_set_line_width(cr, 1.0);
-	cairo_translate(cr, allocation.x + side_margin,
-			allocation.y + top_margin);
-	/* paint the background */
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
+	s_row = &terminal->shadow_data[row * terminal->width];
+	s_attr = &terminal->shadow_attr[row * terminal->width];
 
-			if (attr.attr.bg == terminal->color_scheme->border)
-				continue;
+	for (col = 0; col < terminal->width; col++)
+		terminal_decode_attr(terminal, row, col, &attr[col]);
 
-			if (is_wide(p_row[col]))
-				unichar_width = 2 * average_width;
-			else
-				unichar_width = average_width;
-
-			terminal_set_color(terminal, cr, attr.attr.bg);
-			cairo_move_to(cr, col * average_width,
-				      row * extents.height);
-			cairo_rel_line_to(cr, unichar_width, 0);
-			cairo_rel_line_to(cr, 0, extents.height);
-			cairo_rel_line_to(cr, -unichar_width, 0);
-			cairo_close_path(cr);
+	if (memcmp(s_row, p_row, terminal->width * sizeof *p_row) == 0 &&
+	    memcmp(s_attr, attr, terminal->width * sizeof *attr) == 0)
+		return false;
+
+	memcpy(s_row, p_row, terminal->width * sizeof *p_row);
+	memcpy(s_attr, attr, terminal->width * sizeof *attr);
+
+	return true;
+}
+
+static void
+terminal_draw_row(struct terminal *terminal, cairo_t *cr, int row,
+		  bool outline_cursor)
+{
+	union utf8_char *p_row;
+	union decoded_attr *attr, end;
+	struct glyph_run run;
+	double average_width = terminal->average_width;
+	double height = terminal->extents.height;
+	double top = row * height;
+	int col, start, text_x, text_y;
+	double d;
+
+	p_row = &terminal->shadow_data[row * terminal->width];
+	attr = &terminal->shadow_attr[row * terminal->width];
+
+	/* paint the background, one rectangle per run of cells
+	 * sharing a colour */
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	start = 0;
+	for (col = 1; col <= terminal->width; col++) {
+		if (col < terminal->width &&
+		    attr[col].attr.bg == attr[start].attr.bg)
+			continue;
+
+		if (attr[start].attr.bg != terminal->color_scheme->border) {
+			terminal_set_color(terminal, cr, attr[start].attr.bg);
+			cairo_rectangle(cr, start * average_width, top,
+					(col - start) * average_width, height);
 			cairo_fill(cr);
 		}
+		start = col;
 	}
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
-
-			glyph_run_flush(&run, attr);
-
-			text_x = col * average_width;
-			text_y = extents.ascent + row * extents.height;
-			if (attr.attr.a & ATTRMASK_UNDERLINE) {
-				terminal_set_color(terminal, cr, attr.attr.fg);
-				cairo_move_to(cr, text_x, (double)text_y + 1.5);
-				cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
-				cairo_stroke(cr);
-			}
+	for (col = 0; col < terminal->width; col++) {
+		glyph_run_flush(&run, attr[col]);
+
+		text_x = col * average_width;
+		text_y = terminal->extents.ascent + top;
+		if (attr[col].attr.a & ATTRMASK_UNDERLINE) {
+			terminal_set_color(terminal, cr, attr[col].attr.fg);
+			cairo_move_to(cr, text_x, (double)text_y + 1.5);
+			cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
+			cairo_stroke(cr);
+		}
 
-			/* skip space glyph (RLE) we use as a placeholder of
-			   the right half of a double-width character,
-			   because RLE is not available in every font. */
-			if (p_row[col].ch == 0x200B)
-				continue;
+		/* skip space glyph (RLE) we use as a placeholder of
+		   the right half of a double-width character,
+		   because RLE is not available in every font. */
+		if (p_row[col].ch == 0x200B)
+			continue;
 
-			glyph_run_add(&run, text_x, text_y, &p_row[col]);
-		}
+		glyph_run_add(&run, text_x, text_y, &p_row[col]);
 	}
 
-	attr.key = ~0;
-	glyph_run_flush(&run, attr);
+	end.key = ~0;
+	glyph_run_flush(&run, end);
 
-	if ((terminal->mode & MODE_SHOW_CURSOR) &&
-	    !window_has_focus(terminal->window)) {
+	if (outline_cursor) {
 		d = 0.5;
 
+		/* the glyph cache leaves the source alone */
+		terminal_set_color(terminal, cr,
+				   attr[terminal->column].attr.fg);
 		cairo_set_line_width(cr, 1);
 		cairo_move_to(cr, terminal->column * average_width + d,
-			      terminal->row * extents.height + d);
+			      top + d);
 		cairo_rel_line_to(cr, average_width - 2 * d, 0);
-		cairo_rel_line_to(cr, 0, extents.height - 2 * d);
+		cairo_rel_line_to(cr, 0, height - 2 * d);
 		cairo_rel_line_to(cr, -average_width + 2 * d, 0);
 		cairo_close_path(cr);
 
 		cairo_stroke(cr);
 	}
+}
+
+static void
+redraw_handler(struct widget *widget, void *data)
+{
+	struct terminal *terminal = data;
+	struct rectangle allocation;
+	cairo_t *cr;
+	int top_margin, side_margin;
+	int row, cursor_x, cursor_y, cursor_row;
+	bool full, cursor_moved, changed;
+	double height = terminal->extents.height;
+
+	widget_get_allocation(terminal->widget, &allocation);
+	side_margin = (allocation.width -
+		       terminal->width * terminal->average_width) / 2;
+	top_margin = (allocation.height - terminal->height * height) / 2;
+
+	/* Only rows whose cells differ from the last frame get
+	 * repainted and damaged, unless the toolkit lost the previous
+	 * contents. */
+	full = terminal_resize_shadow(terminal) ||
+	       widget_needs_full_redraw(widget);
+
+	if ((terminal->mode & MODE_SHOW_CURSOR) &&
+	    !window_has_focus(terminal->window))
+		cursor_row = terminal->row;
+	else
+		cursor_row = -1;
+	cursor_moved = cursor_row != terminal->shadow_cursor_row ||
+		       terminal->column != terminal->shadow_cursor_col;
+
+	cr = widget_cairo_create(terminal->widget);
+	cairo_rectangle(cr, allocation.x, allocation.y,
+			allocation.width, allocation.height);
+	cairo_clip(cr);
+
+	if (full) {
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		terminal_set_color(terminal, cr,
+				   terminal->color_scheme->border);
+		cairo_paint(cr);
+	}
+
+	cairo_set_line_width(cr, 1.0);
+	cairo_translate(cr, allocation.x + side_margin,
+			allocation.y + top_margin);
+
+	for (row = 0; row < terminal->height; row++) {
+		changed = terminal_update_shadow_row(terminal, row);
+		if (cursor_moved && (row == cursor_row ||
+				     row == terminal->shadow_cursor_row))
+			changed = true;
+
+		if (!full && !changed)
+			continue;
+
+		if (!full) {
+			cairo_save(cr);
+			cairo_rectangle(cr, -side_margin, row * height,
+					allocation.width, height);
+			cairo_clip(cr);
+			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+			terminal_set_color(terminal, cr,
+					   terminal->color_scheme->border);
+			cairo_paint(cr);
+		}
+
+		terminal_draw_row(terminal, cr, row, row == cursor_row);
+
+		if (!full) {
+			cairo_restore(cr);
+			widget_damage(widget, allocation.x,
+				      allocation.y + top_margin + row * height,
+				      allocation.width, height);
+		}
+
+		if (option_benchmark > 0)
+			terminal->bench_rows++;
+	}
+
+	terminal->shadow_cursor_row = cursor_row;
+	terminal->shadow_cursor_col = terminal->column;
+	if (option_benchmark > 0)
+		terminal->bench_frames++;
 
-	cairo_pop_group_to_source(cr);
-	cairo_paint(cr);
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 
 	if (terminal->send_cursor_position) {
 		cursor_x = side_margin + allocation.x +
-				terminal->column * average_width;
+				terminal->column * terminal->average_width;
 		cursor_y = top_margin + allocation.y +
-				terminal->row * extents.height;
+				terminal->row * height;
 		window_set_text_cursor_position(terminal->window,
 						cursor_x, cursor_y);
 		terminal->send_cursor_position = 0;
@@ -2182,7 +2303,7 @@ terminal_data(struct terminal *terminal, const char *data, size_t length)
 		} /* if */
 	} /* for */
 
-	window_schedule_redraw(terminal->window);
+	widget_schedule_partial_redraw(terminal->widget);
 }
 
 static void
@@ -2344,7 +2465,7 @@ handle_bound_key(struct terminal *terminal,
 		terminal->row++;
 		terminal->selection_start_row++;
 		terminal->selection_end_row++;
-		widget_schedule_redraw(terminal->widget);
+		widget_schedule_partial_redraw(terminal->widget);
 		return 1;
 
 	case XKB_KEY_Down:
@@ -2359,7 +2480,7 @@ handle_bound_key(struct terminal *terminal,
 		terminal->row--;
 		terminal->selection_start_row--;
 		terminal->selection_end_row--;
-		widget_schedule_redraw(terminal->widget);
+		widget_schedule_partial_redraw(terminal->widget);
 		return 1;
 
 	default:
@@ -2586,7 +2707,7 @@ key_handler(struct window *window, struct input *input, uint32_t time,
 			terminal->selection_end_row -= d;
 			terminal->start = terminal->saved_start;
 			terminal->scrolling = 0;
-			widget_schedule_redraw(terminal->widget);
+			widget_schedule_partial_redraw(terminal->widget);
 		}
 
 		terminal_write(terminal, ch, len);
@@ -2777,7 +2898,7 @@ click_handler(struct widget *widget, struct terminal *terminal,
 	terminal->selection_end_x = terminal->selection_start_x = x;
 	terminal->selection_end_y = terminal->selection_start_y = y;
 	if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 }
 
 static void
@@ -2826,7 +2947,7 @@ motion_handler(struct widget *widget,
 				   &terminal->selection_end_y);
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 	}
 
 	return CURSOR_IBEAM;
@@ -2877,7 +2998,7 @@ axis_handler(struct widget *widget,
 		terminal->selection_start_row -= lines;
 		terminal->selection_end_row -= lines;
 
-		widget_schedule_redraw(widget);
+		widget_schedule_partial_redraw(widget);
 	}
 }
 
@@ -2924,7 +3045,7 @@ touch_motion_handler(struct widget *widget, struct input *input,
 		terminal->selection_end_y = (int)y;
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			widget_schedule_partial_redraw(widget);
 	}
 }
 
@@ -2957,6 +3078,7 @@ terminal_create(struct display *display)
 	init_color_table(terminal);
 
 	terminal->display = display;
+	terminal->glyph_cache = display_get_glyph_cache(display);
 	terminal->margin = 5;
 	terminal->buffer_height = 1024;
 	terminal->end = 1;
@@ -3000,6 +3122,9 @@ terminal_create(struct display *display)
 
 	cairo_font_extents(cr, &terminal->extents);
 
+	/* Keep rows on whole pixels, so each can be repainted alone */
+	terminal->extents.height = ceil(terminal->extents.height);
+
 	/* Compute the average ascii glyph width */
 	cairo_text_extents(cr, TERMINAL_DRAW_SINGLE_WIDE_CHARACTERS,
 			   &text_extents);
@@ -3019,6 +3144,37 @@ terminal_create(struct display *display)
 	return terminal;
 }
 
+static void
+terminal_benchmark_report(struct terminal *terminal)
+{
+	struct glyph_cache_stats stats;
+	struct timespec now;
+	double elapsed, mib;
+
+	if (option_benchmark <= 0 || terminal->bench_bytes == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - terminal->bench_start.tv_sec) +
+		  (now.tv_nsec - terminal->bench_start.tv_nsec) / 1e9;
+	mib = terminal->bench_bytes / (1024.0 * 1024.0);
+
+	printf("%.1f MiB in %.3f s: %.1f MiB/s, %u frames, "
+	       "%.1f rows repainted per frame\n",
+	       mib, elapsed, elapsed > 0 ? mib / elapsed : 0.0,
+	       terminal->bench_frames,
+	       terminal->bench_frames ?
+	       (double) terminal->bench_rows / terminal->bench_frames : 0.0);
+
+	glyph_cache_get_stats(terminal->glyph_cache, &stats);
+	printf("glyph cache: %.1f%% hits of %" PRIu64 " lookups, "
+	       "%u glyphs in %zu of %zu KiB, %u flushes\n",
+	       stats.hits + stats.misses ?
+	       100.0 * stats.hits / (stats.hits + stats.misses) : 0.0,
+	       stats.hits + stats.misses, stats.entries,
+	       stats.bytes / 1024, stats.max_bytes / 1024, stats.flushes);
+}
+
 static void
 terminal_destroy(struct terminal *terminal)
 {
@@ -3030,28 +3186,87 @@ terminal_destroy(struct terminal *terminal)
 	if (wl_list_empty(&terminal_list))
 		display_exit(terminal->display);
 
+	free(terminal->shadow_data);
+	free(terminal->shadow_attr);
+	free(terminal->shadow_scratch);
 	free(terminal->title);
 	free(terminal);
 }
 
+/* Upper bound on what one wakeup consumes, so that a flood of
+ * output cannot starve input handling and redraws. */
+#define MAX_READ_PER_DISPATCH (1024 * 1024)
+
 static void
 io_handler(struct task *task, uint32_t events)
 {
 	struct terminal *terminal =
 		container_of(task, struct terminal, io_task);
-	char buffer[256];
-	int len;
+	char buffer[16384];
+	size_t total = 0;
+	ssize_t len;
+
+	/* Parse everything that is pending; the redraw this schedules
+	 * waits for the next frame callback, so all of it is painted
+	 * at once. */
+	while ((events & EPOLLIN) && total < MAX_READ_PER_DISPATCH) {
+		len = read(terminal->master, buffer, sizeof buffer);
+		if (len < 0 && errno == EAGAIN)
+			break;
+		if (len < 0) {
+			terminal_benchmark_report(terminal);
+			terminal_destroy(terminal);
+			return;
+		}
+		if (len == 0)
+			break;
+
+		if (option_benchmark > 0) {
+			if (terminal->bench_bytes == 0)
+				clock_gettime(CLOCK_MONOTONIC,
+					      &terminal->bench_start);
+			terminal->bench_bytes += len;
+		}
+
+		terminal_data(terminal, buffer, len);
+		total += len;
+
+		if ((size_t) len < sizeof buffer)
+			break;
+	}
 
 	if (events & EPOLLHUP) {
+		terminal_benchmark_report(terminal);
 		terminal_destroy(terminal);
-		return;
 	}
+}
 
-	len = read(terminal->master, buffer, sizeof buffer);
-	if (len < 0)
-		terminal_destroy(terminal);
-	else
-		terminal_data(terminal, buffer, len);
+/* Stand-in for `cat` of a large file: writes size MiB of coloured
+ * text lines to the pty. */
+static void
+benchmark_write(int size)
+{
+	char chunk[65536];
+	uint64_t left = (uint64_t) size * 1024 * 1024;
+	size_t len;
+	ssize_t written;
+	int line = 0;
+
+	while (left > 0) {
+		for (len = 0; len + 128 <= sizeof chunk; line++)
+			len += snprintf(chunk + len, 128,
+					"\e[3%dm%08d\e[0m The quick brown fox "
+					"jumps over the lazy dog, "
+					"\e[1mtwice\e[0m.\n",
+					line % 8, line);
+		if (len > left)
+			len = left;
+
+		written = write(STDOUT_FILENO, chunk, len);
+		if (written < 0)
+			return;
+		left -= written;
+	}
 }
 
 static int
@@ -3087,6 +3302,10 @@ terminal_run(struct terminal *terminal, const char *path)
 			ret = read(pipes[0], &tmp, 1);
 		} while (ret == -1 && errno == EINTR);
 		close(pipes[0]);
+		if (option_benchmark > 0) {
+			benchmark_write(option_benchmark);
+			exit(EXIT_SUCCESS);
+		}
 		setenv("TERM", option_term, 1);
 		setenv("COLORTERM", option_term, 1);
 		if (execl(path, path, NULL)) {
@@ -3123,6 +3342,7 @@ static const struct weston_option terminal_options[] = {
 	{ WESTON_OPTION_STRING, "font", 0, &option_font },
 	{ WESTON_OPTION_INTEGER, "font-size", 0, &option_font_size },
 	{ WESTON_OPTION_STRING, "shell", 0, &option_shell },
+	{ WESTON_OPTION_INTEGER, "benchmark", 0, &option_benchmark },
 };
 
 int main(int argc, char *argv[])
@@ -3157,7 +3377,8 @@ int main(int argc, char *argv[])
 		       "  --maximized or -m\n"
 		       "  --font=NAME\n"
 		       "  --font-size=SIZE\n"
-		       "  --shell=NAME\n", argv[0]);
+		       "  --shell=NAME\n"
+		       "  --benchmark=MIB\n", argv[0]);
 		return 1;
 	}
 
@@ -0,0 +1,190 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Prints the contents of a file-backed flight recorder, as created by
+ * weston --flight-rec-file, in chronological order. Works on the file left
+ * behind by a crashed compositor as well as on a live one.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "shared/flight-rec-format.h"
+
+static void
+write_all(FILE *out, const char *data, size_t len)
+{
+	if (len > 0 && fwrite(data, 1, len, out) != len)
+		fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+}
+
+static int
+dump_flight_rec(const char *path, bool verbose, FILE *out)
+{
+	const struct weston_flight_rec_file_header *header;
+	const char *buf;
+	struct stat st;
+	uint32_t append_pos;
+	uint32_t size;
+	void *map;
+	int ret = -1;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening '%s': %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Error: fstat failed: %s\n", strerror(errno));
+		goto out_close;
+	}
+
+	if ((size_t) st.st_size < sizeof(*header)) {
+		fprintf(stderr, "Error: '%s' is too short.\n", path);
+		goto out_close;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Error: mmap failed: %s\n", strerror(errno));
+		goto out_close;
+	}
+
+	header = map;
+	if (memcmp(header->magic, WESTON_FLIGHT_REC_MAGIC,
+		   sizeof(header->magic)) != 0) {
+		fprintf(stderr, "Error: '%s' is not a flight recorder file.\n",
+			path);
+		goto out_unmap;
+	}
+
+	if (header->version != WESTON_FLIGHT_REC_VERSION) {
+		fprintf(stderr, "Error: unsupported flight recorder version %u.\n",
+			header->version);
+		goto out_unmap;
+	}
+
+	size = header->size;
+	append_pos = header->append_pos;
+	if (header->header_size < sizeof(*header) ||
+	    (uint64_t) header->header_size + size > (uint64_t) st.st_size ||
+	    append_pos > size) {
+		fprintf(stderr, "Error: '%s' has an inconsistent header.\n",
+			path);
+		goto out_unmap;
+	}
+
+	if (verbose) {
+		fprintf(stderr, "Flight recorder of pid %u, %u bytes, %s.\n",
+			header->pid, size,
+			(header->flags & WESTON_FLIGHT_REC_FLAG_CLOSED) ?
+			"closed cleanly" : "not closed (crashed or still running)");
+	}
+
+	buf = (const char *) map + header->header_size;
+	if (header->overlap) {
+		/* oldest data starts right after the last write */
+		write_all(out, buf + append_pos, size - append_pos);
+		write_all(out, buf, append_pos);
+	} else {
+		write_all(out, buf, append_pos);
+	}
+	fflush(out);
+	ret = 0;
+
+out_unmap:
+	munmap(map, st.st_size);
+out_close:
+	close(fd);
+
+	return ret;
+}
+
+static void
+print_help(void)
+{
+	fprintf(stderr,
+		"Usage: weston-flight-rec [options] FILE\n"
+		"\n"
+		"Prints the contents of a flight recorder file written by\n"
+		"weston --flight-rec-file=FILE, oldest data first.\n"
+		"\n"
+		"Options:\n"
+		"  -v, --verbose\tPrint information about the recorder to stderr\n"
+		"  -h, --help\tThis help text, and exit\n"
+		"\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{ 0 }
+	};
+	bool verbose = false;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "vh", opts, NULL)) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			print_help();
+			return EXIT_SUCCESS;
+		default:
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (dump_flight_rec(argv[optind], verbose, stdout) < 0)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -148,6 +148,8 @@ struct display {
 
 	int data_device_manager_version;
 	struct wp_viewporter *viewporter;
+
+	struct glyph_cache *glyph_cache;
 };
 
 struct window_output {
@@ -155,6 +157,8 @@ struct window_output {
 	struct wl_list link;
 };
 
+#define MAX_DAMAGE_RECTS 32
+
 struct toysurface {
 	/*
 	 * Prepare the surface for drawing. Ensure there is a surface
@@ -169,13 +173,25 @@ struct toysurface {
 				    int32_t width, int32_t height, uint32_t flags,
 				    enum wl_output_transform buffer_transform, int32_t buffer_scale);
 
+	/*
+	 * Bring the Cairo surface returned by prepare() up to date with
+	 * what the previous swap() posted, so that only the damaged
+	 * areas need to be redrawn.
+	 * Returns 0 on success, and negative if the contents cannot be
+	 * restored and everything must be redrawn.
+	 */
+	int (*repair)(struct toysurface *base);
+
 	/*
 	 * Post the surface to the server, returning the server allocation
 	 * rectangle. The Cairo surface from prepare() must be destroyed
 	 * after calling this.
+	 * damage lists the damage_count changed areas in surface
+	 * coordinates, or is NULL if everything changed.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     const struct rectangle *damage, int damage_count,
 		     struct rectangle *server_allocation);
 
 	/*
@@ -210,6 +226,14 @@ struct surface {
 	struct wl_callback *frame_cb;
 	uint32_t last_time;
 
+	/* Damage reported through widget_damage() for the frame being
+	 * drawn. full_damage is set by any redraw that was not asked
+	 * for with widget_schedule_partial_redraw(), and whenever the
+	 * previous contents of the buffer are lost. */
+	struct rectangle damage[MAX_DAMAGE_RECTS];
+	int damage_count;
+	int full_damage;
+
 	struct rectangle allocation;
 	struct rectangle server_allocation;
 
@@ -574,9 +598,17 @@ egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
 	return cairo_surface_reference(surface->cairo_surface);
 }
 
+static int
+egl_window_surface_repair(struct toysurface *base)
+{
+	/* EGL does not tell us the age of the back buffer */
+	return -1;
+}
+
 static void
 egl_window_surface_swap(struct toysurface *base,
 			enum wl_output_transform buffer_transform, int32_t buffer_scale,
+			const struct rectangle *damage, int damage_count,
 			struct rectangle *server_allocation)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
@@ -664,6 +696,7 @@ egl_window_surface_create(struct display *display,
 		return NULL;
 
 	surface->base.prepare = egl_window_surface_prepare;
+	surface->base.repair = egl_window_surface_repair;
 	surface->base.swap = egl_window_surface_swap;
 	surface->base.acquire = egl_window_surface_acquire;
 	surface->base.release = egl_window_surface_release;
@@ -946,6 +979,8 @@ struct shm_surface_leaf {
 
 	struct shm_pool *resize_pool;
 	int busy;
+	/* the swap that posted the current contents, 0 if undefined */
+	uint32_t seq;
 };
 
 static void
@@ -963,6 +998,11 @@ shm_surface_leaf_release(struct shm_surface_leaf *leaf)
 
 #define MAX_LEAVES 3
 
+struct shm_surface_damage {
+	struct rectangle rects[MAX_DAMAGE_RECTS];
+	int count; /* -1 for the whole buffer */
+};
+
 struct shm_surface {
 	struct toysurface base;
 	struct display *display;
@@ -972,6 +1012,11 @@ struct shm_surface {
 
 	struct shm_surface_leaf leaf[MAX_LEAVES];
 	struct shm_surface_leaf *current;
+
+	/* Number of swaps so far, and the buffer damage of the last
+	 * MAX_LEAVES of them, indexed by seq % MAX_LEAVES. */
+	uint32_t seq;
+	struct shm_surface_damage history[MAX_LEAVES];
 };
 
 static struct shm_surface *
@@ -1009,8 +1054,8 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct shm_surface *surface = data;
 	struct shm_surface_leaf *leaf;
+	struct shm_surface_leaf *free_found;
 	int i;
-	int free_found;
 
 	shm_surface_buffer_state_debug(surface, "buffer_release before");
 
@@ -1023,18 +1068,23 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 	}
 	assert(i < MAX_LEAVES && "unknown buffer released");
 
-	/* Leave one free leaf with storage, release others */
-	free_found = 0;
+	/* Leave one free leaf with storage, release others. Keep the
+	 * one with the newest contents, it is the cheapest to repair. */
+	free_found = NULL;
 	for (i = 0; i < MAX_LEAVES; i++) {
 		leaf = &surface->leaf[i];
 
 		if (!leaf->cairo_surface || leaf->busy)
 			continue;
 
-		if (!free_found)
-			free_found = 1;
-		else
+		if (!free_found) {
+			free_found = leaf;
+		} else if (leaf->seq > free_found->seq) {
+			shm_surface_leaf_release(free_found);
+			free_found = leaf;
+		} else {
 			shm_surface_leaf_release(leaf);
+		}
 	}
 
 	shm_surface_buffer_state_debug(surface, "buffer_release  after");
@@ -1058,12 +1108,15 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	surface->dx = dx;
 	surface->dy = dy;
 
-	/* pick a free buffer, preferably one that already has storage */
+	/* pick a free buffer, preferably one that already has storage,
+	 * and of those the one with the newest contents */
 	for (i = 0; i < MAX_LEAVES; i++) {
 		if (surface->leaf[i].busy)
 			continue;
 
-		if (!leaf || surface->leaf[i].cairo_surface)
+		if (!leaf || (surface->leaf[i].cairo_surface &&
+			      (!leaf->cairo_surface ||
+			       surface->leaf[i].seq >= leaf->seq)))
 			leaf = &surface->leaf[i];
 	}
 	DBG_OBJ(surface->surface, "pick leaf %d\n",
@@ -1119,6 +1172,7 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 
 	wl_buffer_add_listener(leaf->data->buffer,
 			       &shm_surface_buffer_listener, surface);
+	leaf->seq = 0;
 
 out:
 	surface->current = leaf;
@@ -1126,13 +1180,101 @@ out:
 	return cairo_surface_reference(leaf->cairo_surface);
 }
 
+static void
+shm_surface_copy_rect(cairo_surface_t *dst, cairo_surface_t *src,
+		      const struct rectangle *rect)
+{
+	int stride = cairo_image_surface_get_stride(src);
+	int width = cairo_image_surface_get_width(src);
+	int height = cairo_image_surface_get_height(src);
+	unsigned char *s, *d;
+	int x1, y1, x2, y2, y;
+
+	x1 = MAX(rect->x, 0);
+	y1 = MAX(rect->y, 0);
+	x2 = MIN(rect->x + rect->width, width);
+	y2 = MIN(rect->y + rect->height, height);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	s = cairo_image_surface_get_data(src) + y1 * stride + x1 * 4;
+	d = cairo_image_surface_get_data(dst) + y1 * stride + x1 * 4;
+	for (y = y1; y < y2; y++) {
+		memcpy(d, s, (x2 - x1) * 4);
+		s += stride;
+		d += stride;
+	}
+}
+
+static int
+shm_surface_repair(struct toysurface *base)
+{
+	struct shm_surface *surface = to_shm_surface(base);
+	struct shm_surface_leaf *leaf = surface->current;
+	struct shm_surface_leaf *last = NULL;
+	struct shm_surface_damage *damage;
+	struct rectangle all;
+	uint32_t seq;
+	int i;
+
+	if (leaf->seq == 0 || surface->seq - leaf->seq > MAX_LEAVES)
+		return -1;
+
+	if (leaf->seq == surface->seq)
+		return 0;
+
+	for (i = 0; i < MAX_LEAVES; i++) {
+		if (surface->leaf[i].cairo_surface &&
+		    surface->leaf[i].seq == surface->seq)
+			last = &surface->leaf[i];
+	}
+
+	all.x = 0;
+	all.y = 0;
+	all.width = cairo_image_surface_get_width(leaf->cairo_surface);
+	all.height = cairo_image_surface_get_height(leaf->cairo_surface);
+
+	if (!last ||
+	    cairo_image_surface_get_width(last->cairo_surface) != all.width ||
+	    cairo_image_surface_get_height(last->cairo_surface) != all.height)
+		return -1;
+
+	/* Copy everything the leaf missed from the newest buffer */
+	cairo_surface_flush(last->cairo_surface);
+	cairo_surface_flush(leaf->cairo_surface);
+	for (seq = leaf->seq + 1; seq != surface->seq + 1; seq++) {
+		damage = &surface->history[seq % MAX_LEAVES];
+
+		if (damage->count < 0) {
+			shm_surface_copy_rect(leaf->cairo_surface,
+					      last->cairo_surface, &all);
+			break;
+		}
+
+		for (i = 0; i < damage->count; i++)
+			shm_surface_copy_rect(leaf->cairo_surface,
+					      last->cairo_surface,
+					      &damage->rects[i]);
+	}
+	cairo_surface_mark_dirty(leaf->cairo_surface);
+
+	leaf->seq = surface->seq;
+
+	return 0;
+}
+
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 const struct rectangle *damage, int damage_count,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	struct shm_surface_damage *history;
+	struct rectangle *r;
+	int use_buffer_damage;
+	int i;
 
 	server_allocation->width =
 		cairo_image_surface_get_width(leaf->cairo_surface);
@@ -1143,16 +1285,51 @@ shm_surface_swap(struct toysurface *base,
 				&server_allocation->width,
 				&server_allocation->height);
 
+	surface->seq++;
+	history = &surface->history[surface->seq % MAX_LEAVES];
+
+	/* Partial damage is only tracked for untransformed buffers,
+	 * where surface and buffer coordinates differ by the scale. */
+	if (buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		damage = NULL;
+
+	use_buffer_damage = wl_surface_get_version(surface->surface) >=
+			    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (damage) {
+		history->count = damage_count;
+		for (i = 0; i < damage_count; i++) {
+			r = &history->rects[i];
+			r->x = damage[i].x * buffer_scale;
+			r->y = damage[i].y * buffer_scale;
+			r->width = damage[i].width * buffer_scale;
+			r->height = damage[i].height * buffer_scale;
+
+			if (use_buffer_damage)
+				wl_surface_damage_buffer(surface->surface,
+							 r->x, r->y,
+							 r->width, r->height);
+			else
+				wl_surface_damage(surface->surface,
+						  damage[i].x, damage[i].y,
+						  damage[i].width,
+						  damage[i].height);
+		}
+	} else {
+		history->count = -1;
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
+	}
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
 	leaf->busy = 1;
+	leaf->seq = surface->seq;
 	surface->current = NULL;
 }
 
@@ -1188,6 +1365,7 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 
 	surface = xzalloc(sizeof *surface);
 	surface->base.prepare = shm_surface_prepare;
+	surface->base.repair = shm_surface_repair;
 	surface->base.swap = shm_surface_swap;
 	surface->base.acquire = shm_surface_acquire;
 	surface->base.release = shm_surface_release;
@@ -1200,6 +1378,345 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 	return &surface->base;
 }
 
+/*
+ * Glyph cache: every (font, glyph, colour) combination is rasterised
+ * once into an atlas page and then blitted from there. Pages are
+ * filled shelf by shelf; when the memory budget is used up, the whole
+ * cache is flushed and starts over.
+ */
+
+#define GLYPH_CACHE_PAGE_SIZE 512
+#define GLYPH_CACHE_PAGE_BYTES (GLYPH_CACHE_PAGE_SIZE * GLYPH_CACHE_PAGE_SIZE * 4)
+#define GLYPH_CACHE_MAX_BYTES (8 * 1024 * 1024)
+#define GLYPH_CACHE_BUCKETS 1024
+
+struct glyph_cache_page {
+	cairo_surface_t *surface;
+	cairo_pattern_t *pattern;
+	int shelf_x, shelf_y, shelf_height;
+	struct wl_list link;
+};
+
+struct glyph_cache_entry {
+	struct glyph_cache_entry *next;
+	cairo_scaled_font_t *font;
+	unsigned long index;
+	uint32_t color;
+
+	/* NULL for glyphs that draw nothing, like spaces */
+	struct glyph_cache_page *page;
+	int x, y, width, height;
+	/* top left corner relative to the glyph origin */
+	int dx, dy;
+};
+
+struct glyph_cache_font {
+	cairo_scaled_font_t *font;
+	struct wl_list link;
+};
+
+struct glyph_cache {
+	struct glyph_cache_entry *buckets[GLYPH_CACHE_BUCKETS];
+	struct wl_list page_list;
+	struct wl_list font_list;
+	struct glyph_cache_stats stats;
+};
+
+static struct glyph_cache *
+glyph_cache_create(size_t max_bytes)
+{
+	struct glyph_cache *cache;
+
+	cache = xzalloc(sizeof *cache);
+	wl_list_init(&cache->page_list);
+	wl_list_init(&cache->font_list);
+	cache->stats.max_bytes = max_bytes;
+
+	return cache;
+}
+
+static void
+glyph_cache_flush(struct glyph_cache *cache)
+{
+	struct glyph_cache_entry *entry, *next;
+	struct glyph_cache_page *page, *ptmp;
+	struct glyph_cache_font *font, *ftmp;
+	int i;
+
+	for (i = 0; i < GLYPH_CACHE_BUCKETS; i++) {
+		for (entry = cache->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+		cache->buckets[i] = NULL;
+	}
+
+	wl_list_for_each_safe(page, ptmp, &cache->page_list, link) {
+		cairo_pattern_destroy(page->pattern);
+		cairo_surface_destroy(page->surface);
+		wl_list_remove(&page->link);
+		free(page);
+	}
+
+	/* The references keep font pointers from being reused while
+	 * entries are keyed on them. */
+	wl_list_for_each_safe(font, ftmp, &cache->font_list, link) {
+		cairo_scaled_font_destroy(font->font);
+		wl_list_remove(&font->link);
+		free(font);
+	}
+
+	cache->stats.entries = 0;
+	cache->stats.bytes = 0;
+}
+
+static void
+glyph_cache_destroy(struct glyph_cache *cache)
+{
+	glyph_cache_flush(cache);
+	free(cache);
+}
+
+static struct glyph_cache_entry **
+glyph_cache_bucket(struct glyph_cache *cache, cairo_scaled_font_t *font,
+		   unsigned long index, uint32_t color)
+{
+	uint32_t h;
+
+	h = (uint32_t) ((uintptr_t) font >> 4) * 31;
+	h ^= (uint32_t) index * 0x9e3779b1;
+	h ^= color * 0x85ebca6b;
+	h ^= h >> 16;
+
+	return &cache->buckets[h & (GLYPH_CACHE_BUCKETS - 1)];
+}
+
+static void
+glyph_cache_add_font(struct glyph_cache *cache, cairo_scaled_font_t *font)
+{
+	struct glyph_cache_font *f;
+
+	wl_list_for_each(f, &cache->font_list, link)
+		if (f->font == font)
+			return;
+
+	f = xzalloc(sizeof *f);
+	f->font = cairo_scaled_font_reference(font);
+	wl_list_insert(&cache->font_list, &f->link);
+}
+
+static struct glyph_cache_page *
+glyph_cache_alloc(struct glyph_cache *cache, int width, int height,
+		  int *x, int *y)
+{
+	struct glyph_cache_page *page = NULL;
+
+	if (!wl_list_empty(&cache->page_list)) {
+		page = container_of(cache->page_list.next,
+				    struct glyph_cache_page, link);
+
+		if (page->shelf_x + width > GLYPH_CACHE_PAGE_SIZE) {
+			page->shelf_x = 0;
+			page->shelf_y += page->shelf_height;
+			page->shelf_height = 0;
+		}
+
+		if (page->shelf_y + height > GLYPH_CACHE_PAGE_SIZE)
+			page = NULL;
+	}
+
+	if (!page) {
+		if (cache->stats.bytes + GLYPH_CACHE_PAGE_BYTES >
+		    cache->stats.max_bytes) {
+			glyph_cache_flush(cache);
+			cache->stats.flushes++;
+		}
+
+		page = xzalloc(sizeof *page);
+		page->surface =
+			cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						   GLYPH_CACHE_PAGE_SIZE,
+						   GLYPH_CACHE_PAGE_SIZE);
+		page->pattern = cairo_pattern_create_for_surface(page->surface);
+		cairo_pattern_set_filter(page->pattern, CAIRO_FILTER_NEAREST);
+		wl_list_insert(&cache->page_list, &page->link);
+		cache->stats.bytes += GLYPH_CACHE_PAGE_BYTES;
+	}
+
+	*x = page->shelf_x;
+	*y = page->shelf_y;
+	page->shelf_x += width;
+	page->shelf_height = MAX(page->shelf_height, height);
+
+	return page;
+}
+
+static struct glyph_cache_entry *
+glyph_cache_insert(struct glyph_cache *cache, cairo_scaled_font_t *font,
+		   unsigned long index, uint32_t color)
+{
+	struct glyph_cache_entry *entry, **bucket;
+	cairo_glyph_t glyph = { index, 0, 0 };
+	cairo_text_extents_t extents;
+	cairo_font_options_t *options;
+	int x1, y1, x2, y2;
+	cairo_t *cr;
+
+	cairo_scaled_font_glyph_extents(font, &glyph, 1, &extents);
+
+	/* one pixel of slack around the ink for antialiasing */
+	x1 = floor(extents.x_bearing) - 1;
+	y1 = floor(extents.y_bearing) - 1;
+	x2 = ceil(extents.x_bearing + extents.width) + 1;
+	y2 = ceil(extents.y_bearing + extents.height) + 1;
+	if (x2 - x1 > GLYPH_CACHE_PAGE_SIZE || y2 - y1 > GLYPH_CACHE_PAGE_SIZE)
+		return NULL;
+
+	entry = xzalloc(sizeof *entry);
+	entry->index = index;
+	entry->color = color;
+
+	if (extents.width > 0 && extents.height > 0) {
+		entry->width = x2 - x1;
+		entry->height = y2 - y1;
+		entry->dx = x1;
+		entry->dy = y1;
+		entry->page = glyph_cache_alloc(cache, entry->width,
+						entry->height,
+						&entry->x, &entry->y);
+
+		cr = cairo_create(entry->page->surface);
+		cairo_rectangle(cr, entry->x, entry->y,
+				entry->width, entry->height);
+		cairo_clip(cr);
+		cairo_set_scaled_font(cr, font);
+
+		/* Pages are copied out as colour and alpha, which cannot
+		 * hold the per-channel coverage of subpixel antialiasing. */
+		options = cairo_font_options_create();
+		cairo_scaled_font_get_font_options(font, options);
+		if (cairo_font_options_get_antialias(options) !=
+		    CAIRO_ANTIALIAS_NONE) {
+			cairo_font_options_set_antialias(options,
+							 CAIRO_ANTIALIAS_GRAY);
+			cairo_set_font_options(cr, options);
+		}
+		cairo_font_options_destroy(options);
+
+		cairo_set_source_rgba(cr,
+				      ((color >> 16) & 0xff) / 255.0,
+				      ((color >> 8) & 0xff) / 255.0,
+				      (color & 0xff) / 255.0,
+				      (color >> 24) / 255.0);
+		glyph.x = entry->x - x1;
+		glyph.y = entry->y - y1;
+		cairo_show_glyphs(cr, &glyph, 1);
+		cairo_destroy(cr);
+	}
+
+	/* after the allocation, which may have flushed the cache */
+	glyph_cache_add_font(cache, font);
+	entry->font = font;
+	bucket = glyph_cache_bucket(cache, font, index, color);
+	entry->next = *bucket;
+	*bucket = entry;
+	cache->stats.entries++;
+
+	return entry;
+}
+
+static struct glyph_cache_entry *
+glyph_cache_lookup(struct glyph_cache *cache, cairo_scaled_font_t *font,
+		   unsigned long index, uint32_t color)
+{
+	struct glyph_cache_entry *entry;
+
+	entry = *glyph_cache_bucket(cache, font, index, color);
+	for (; entry; entry = entry->next) {
+		if (entry->font == font && entry->index == index &&
+		    entry->color == color)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void
+glyph_cache_show_uncached(cairo_t *cr, cairo_scaled_font_t *font,
+			  uint32_t color, const cairo_glyph_t *glyphs,
+			  int num_glyphs)
+{
+	cairo_set_scaled_font(cr, font);
+	cairo_set_source_rgba(cr,
+			      ((color >> 16) & 0xff) / 255.0,
+			      ((color >> 8) & 0xff) / 255.0,
+			      (color & 0xff) / 255.0,
+			      (color >> 24) / 255.0);
+	cairo_show_glyphs(cr, glyphs, num_glyphs);
+}
+
+void
+glyph_cache_show_glyphs(struct glyph_cache *cache, cairo_t *cr,
+			cairo_scaled_font_t *font, uint32_t color,
+			const cairo_glyph_t *glyphs, int num_glyphs)
+{
+	struct glyph_cache_entry *entry;
+	cairo_matrix_t matrix;
+	int i, x, y;
+
+	cairo_save(cr);
+
+	/* Atlas glyphs are rasterised for whole device pixels; leave
+	 * anything scaled, rotated or at a fractional offset to cairo. */
+	cairo_get_matrix(cr, &matrix);
+	if (matrix.xx != 1.0 || matrix.yy != 1.0 ||
+	    matrix.xy != 0.0 || matrix.yx != 0.0 ||
+	    matrix.x0 != floor(matrix.x0) || matrix.y0 != floor(matrix.y0)) {
+		glyph_cache_show_uncached(cr, font, color, glyphs, num_glyphs);
+		cairo_restore(cr);
+		return;
+	}
+
+	for (i = 0; i < num_glyphs; i++) {
+		entry = glyph_cache_lookup(cache, font,
+					   glyphs[i].index, color);
+		if (entry) {
+			cache->stats.hits++;
+		} else {
+			cache->stats.misses++;
+			entry = glyph_cache_insert(cache, font,
+						   glyphs[i].index, color);
+		}
+
+		if (!entry) {
+			glyph_cache_show_uncached(cr, font, color,
+						  &glyphs[i], 1);
+			continue;
+		}
+
+		if (!entry->page)
+			continue;
+
+		x = lround(glyphs[i].x) + entry->dx;
+		y = lround(glyphs[i].y) + entry->dy;
+		cairo_matrix_init_translate(&matrix,
+					    entry->x - x, entry->y - y);
+		cairo_pattern_set_matrix(entry->page->pattern, &matrix);
+		cairo_set_source(cr, entry->page->pattern);
+		cairo_rectangle(cr, x, y, entry->width, entry->height);
+		cairo_fill(cr);
+	}
+
+	cairo_restore(cr);
+}
+
+void
+glyph_cache_get_stats(struct glyph_cache *cache,
+		      struct glyph_cache_stats *stats)
+{
+	*stats = cache->stats;
+}
+
 /*
  * The following correspondences between file names and cursors was copied
  * from: https://bugs.kde.org/attachment.cgi?id=67313
@@ -1417,7 +1934,11 @@ surface_flush(struct surface *surface)
 
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  surface->full_damage ? NULL : surface->damage,
+				  surface->damage_count,
 				  &surface->server_allocation);
+	surface->damage_count = 0;
+	surface->full_damage = 0;
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -2028,12 +2549,68 @@ window_schedule_redraw_task(struct window *window);
 
 void
 widget_schedule_redraw(struct widget *widget)
+{
+	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
+	widget->surface->redraw_needed = 1;
+	widget->surface->full_damage = 1;
+	window_schedule_redraw_task(widget->window);
+}
+
+void
+widget_schedule_partial_redraw(struct widget *widget)
 {
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
 	widget->surface->redraw_needed = 1;
 	window_schedule_redraw_task(widget->window);
 }
 
+int
+widget_needs_full_redraw(struct widget *widget)
+{
+	return widget->surface->full_damage;
+}
+
+void
+widget_damage(struct widget *widget,
+	      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle *last;
+	int32_t x2, y2;
+
+	if (surface->full_damage || width <= 0 || height <= 0)
+		return;
+
+	/* Widgets work in window coordinates, the damage list is kept in
+	 * surface coordinates. */
+	x -= surface->allocation.x;
+	y -= surface->allocation.y;
+
+	/* Grow the previous rectangle when the new one continues it
+	 * downwards, as consecutive rows usually do, and fold
+	 * everything into the last slot once the list is full. */
+	if (surface->damage_count > 0) {
+		last = &surface->damage[surface->damage_count - 1];
+		if ((last->x == x && last->width == width &&
+		     last->y + last->height == y) ||
+		    surface->damage_count == MAX_DAMAGE_RECTS) {
+			x2 = MAX(last->x + last->width, x + width);
+			y2 = MAX(last->y + last->height, y + height);
+			last->x = MIN(last->x, x);
+			last->y = MIN(last->y, y);
+			last->width = x2 - last->x;
+			last->height = y2 - last->y;
+			return;
+		}
+	}
+
+	last = &surface->damage[surface->damage_count++];
+	last->x = x;
+	last->y = y;
+	last->width = width;
+	last->height = height;
+}
+
 void
 widget_set_use_cairo(struct widget *widget,
 		     int use_cairo)
@@ -2315,6 +2892,10 @@ frame_redraw_handler(struct widget *widget, void *data)
 	if (window->fullscreen)
 		return;
 
+	/* The decorations are still intact from the previous frame */
+	if (!widget_needs_full_redraw(widget))
+		return;
+
 	cr = widget_cairo_create(widget);
 
 	frame_repaint(frame->frame, cr);
@@ -4572,6 +5153,12 @@ surface_redraw(struct surface *surface)
 		return -1;
 	}
 
+	/* A partial redraw draws on top of the previous frame */
+	if (!surface->full_damage &&
+	    (surface->window->redraw_needed || !surface->widget->use_cairo ||
+	     surface->toysurface->repair(surface->toysurface) < 0))
+		surface->full_damage = 1;
+
 	surface->frame_cb = wl_surface_frame(surface->surface);
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
@@ -4655,8 +5242,10 @@ window_schedule_redraw(struct window *window)
 
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
+	wl_list_for_each(surface, &window->subsurface_list, link) {
 		surface->redraw_needed = 1;
+		surface->full_damage = 1;
+	}
 
 	window_schedule_redraw_task(window);
 }
@@ -5235,6 +5824,7 @@ surface_create(struct window *window)
 	surface->window = window;
 	surface->surface = wl_compositor_create_surface(display->compositor);
 	surface->buffer_scale = 1;
+	surface->full_damage = 1;
 	wl_surface_add_listener(surface->surface, &surface_listener, window);
 
 	wl_list_insert(&window->subsurface_list, &surface->link);
@@ -6038,7 +6628,8 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 
 	if (strcmp(interface, "wl_compositor") == 0) {
 		d->compositor = wl_registry_bind(registry, id,
-						 &wl_compositor_interface, 3);
+						 &wl_compositor_interface,
+						 MIN(version, 4));
 	} else if (strcmp(interface, "wl_output") == 0) {
 		display_add_output(d, id);
 	} else if (strcmp(interface, "wl_seat") == 0) {
@@ -6365,6 +6956,9 @@ display_destroy(struct display *display)
 		theme_destroy(display->theme);
 	destroy_cursors(display);
 
+	if (display->glyph_cache)
+		glyph_cache_destroy(display->glyph_cache);
+
 #ifdef HAVE_CAIRO_EGL
 	if (display->argb_device)
 		fini_egl(display);
@@ -6449,6 +7043,16 @@ display_get_output(struct display *display)
 	return container_of(display->output_list.next, struct output, link);
 }
 
+struct glyph_cache *
+display_get_glyph_cache(struct display *display)
+{
+	if (!display->glyph_cache)
+		display->glyph_cache =
+			glyph_cache_create(GLYPH_CACHE_MAX_BYTES);
+
+	return display->glyph_cache;
+}
+
 struct wl_compositor *
 display_get_compositor(struct display *display)
 {
@@ -37,6 +37,7 @@
 
 struct window;
 struct widget;
+struct glyph_cache;
 struct display;
 struct input;
 struct output;
@@ -77,6 +78,36 @@ display_get_cairo_device(struct display *display);
 struct wl_compositor *
 display_get_compositor(struct display *display);
 
+/*
+ * A glyph atlas shared by all windows of the display. Each (font,
+ * glyph, colour) combination is rasterised once and then copied from
+ * the atlas; the atlas is flushed when it reaches its memory budget.
+ */
+struct glyph_cache *
+display_get_glyph_cache(struct display *display);
+
+struct glyph_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint32_t entries;
+	uint32_t flushes;
+	size_t bytes;
+	size_t max_bytes;
+};
+
+/*
+ * Draws glyphs like cairo_show_glyphs() with font and color (as
+ * 0xAARRGGBB) set on cr. Glyph positions are rounded to whole pixels.
+ */
+void
+glyph_cache_show_glyphs(struct glyph_cache *cache, cairo_t *cr,
+			cairo_scaled_font_t *font, uint32_t color,
+			const cairo_glyph_t *glyphs, int num_glyphs);
+
+void
+glyph_cache_get_stats(struct glyph_cache *cache,
+		      struct glyph_cache_stats *stats);
+
 struct output *
 display_get_output(struct display *display);
 
@@ -605,6 +636,24 @@ void
 window_uninhibit_redraw(struct window *window);
 void
 widget_schedule_redraw(struct widget *widget);
+
+/*
+ * Schedules a redraw that keeps the previous contents of the widget's
+ * surface: only the areas passed to widget_damage() from the redraw
+ * handlers are sent to the server. If widget_needs_full_redraw()
+ * returns true in the redraw handler, the previous contents were not
+ * available and everything must be drawn as usual. Damage is given in
+ * the same window coordinates as the widget allocation.
+ */
+void
+widget_schedule_partial_redraw(struct widget *widget);
+
+int
+widget_needs_full_redraw(struct widget *widget);
+
+void
+widget_damage(struct widget *widget,
+	      int32_t x, int32_t y, int32_t width, int32_t height);
 void
 widget_set_use_cairo(struct widget *widget, int use_cairo);
 
@@ -51,6 +51,7 @@
 #include "shared/os-compatibility.h"
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
 #include "git-version.h"
 #include <libweston/version.h>
 #include "weston.h"
@@ -68,6 +69,7 @@
 #define WINDOW_TITLE "Weston Compositor"
 /* flight recorder size (in bytes) */
 #define DEFAULT_FLIGHT_REC_SIZE (5 * 1024 * 1024)
+#define MIN_FLIGHT_REC_SIZE 2
 #define DEFAULT_FLIGHT_REC_SCOPES "log,drm-backend"
 
 struct wet_output_config {
@@ -126,13 +128,81 @@ struct wet_compositor {
 	pid_t autolaunch_pid;
 	bool autolaunch_watch;
 	bool use_color_manager;
+	struct wl_listener first_frame_listener;
+	struct wl_listener first_frame_output_destroy_listener;
 };
 
 static FILE *weston_logfile = NULL;
 static struct weston_log_scope *log_scope;
 static struct weston_log_scope *protocol_scope;
+static struct weston_log_scope *startup_scope;
+static struct timespec startup_begin;
 static int cached_tm_mday = -1;
 
+/** Record a finished startup phase in the "startup" log scope
+ *
+ * \param phase What was being done.
+ * \param name What it was done to, or NULL.
+ * \param begin When the phase started.
+ */
+static void
+wet_startup_trace(const char *phase, const char *name,
+		  const struct timespec *begin)
+{
+	struct timespec now;
+	char timestr[128];
+
+	if (!weston_log_scope_is_enabled(startup_scope))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	weston_log_scope_printf(startup_scope,
+				"%s %s%s%s: %.1f ms, done at %.1f ms\n",
+				weston_log_scope_timestamp(startup_scope,
+							   timestr,
+							   sizeof timestr),
+				phase, name ? " " : "", name ? name : "",
+				timespec_sub_to_nsec(&now, begin) / 1e6,
+				timespec_sub_to_nsec(&now, &startup_begin) / 1e6);
+}
+
+static void
+wet_startup_first_frame_done(struct wet_compositor *wet)
+{
+	wl_list_remove(&wet->first_frame_listener.link);
+	wl_list_init(&wet->first_frame_listener.link);
+	wl_list_remove(&wet->first_frame_output_destroy_listener.link);
+	wl_list_init(&wet->first_frame_output_destroy_listener.link);
+}
+
+static void
+wet_startup_first_frame_output_destroyed(struct wl_listener *listener,
+					 void *data)
+{
+	struct wet_compositor *wet =
+		container_of(listener, struct wet_compositor,
+			     first_frame_output_destroy_listener);
+
+	wet_startup_first_frame_done(wet);
+}
+
+static void
+wet_startup_first_frame(struct wl_listener *listener, void *data)
+{
+	struct wet_compositor *wet =
+		container_of(listener, struct wet_compositor,
+			     first_frame_listener);
+	struct weston_output *output = data;
+	struct timespec now;
+
+	wet_startup_first_frame_done(wet);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	weston_log("First frame on output %s after %.1f ms\n", output->name,
+		   timespec_sub_to_nsec(&now, &startup_begin) / 1e6);
+	wet_startup_trace("first frame on", output->name, &startup_begin);
+}
+
 static void
 custom_handler(const char *fmt, va_list arg)
 {
@@ -656,6 +726,15 @@ usage(int error_code)
 		"  -f, --flight-rec-scopes=SCOPE\n\t\t\tSpecify log scopes to "
 			"subscribe to.\n\t\t\tCan specify multiple scopes, "
 			"each followed by comma\n"
+		"  --flight-rec-file=FILE\n\t\t\tKeep the flight recorder in "
+			"FILE, so that it\n\t\t\tsurvives a crash\n"
+		"  --flight-rec-size=BYTES\n\t\t\tSize of the flight recorder, "
+			"defaults to 5 MiB\n"
+		"  --record-events=FILE\tRecord surface commits, input and "
+			"outputs to FILE\n"
+		"  --replay-events=FILE\tReplay FILE recorded with "
+			"--record-events,\n\t\t\tthen exit; headless backend "
+			"only\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -974,6 +1053,7 @@ load_modules(struct weston_compositor *ec, const char *modules,
 {
 	const char *p, *end;
 	char buffer[256];
+	struct timespec begin;
 
 	if (modules == NULL)
 		return 0;
@@ -990,8 +1070,10 @@ load_modules(struct weston_compositor *ec, const char *modules,
 				   "in weston.ini\n");
 			*xwayland = true;
 		} else {
+			clock_gettime(CLOCK_MONOTONIC, &begin);
 			if (wet_load_module(ec, buffer, argc, argv) < 0)
 				return -1;
+			wet_startup_trace("module", buffer, &begin);
 		}
 
 		p = end;
@@ -1060,6 +1142,31 @@ out:
 	return ret;
 }
 
+/* $XDG_CACHE_HOME/weston, or ~/.cache/weston; nowhere if neither is set */
+static int
+wet_set_keymap_cache_dir(struct weston_compositor *ec)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char *dir;
+	int ret;
+
+	if (cache_home && cache_home[0] == '/')
+		ret = asprintf(&dir, "%s/weston", cache_home);
+	else if (home && home[0] == '/')
+		ret = asprintf(&dir, "%s/.cache/weston", home);
+	else
+		return 0;
+
+	if (ret < 0)
+		return -1;
+
+	ret = weston_compositor_set_xkb_keymap_cache_dir(ec, dir);
+	free(dir);
+
+	return ret;
+}
+
 static int
 weston_compositor_init_config(struct weston_compositor *ec,
 			      struct weston_config *config)
@@ -1067,6 +1174,7 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct wet_compositor *compositor = to_wet_compositor(ec);
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	bool keymap_cache;
 	int repaint_msec;
 	bool color_management;
 	bool cal;
@@ -1087,6 +1195,10 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	if (weston_compositor_set_xkb_rule_names(ec, &xkb_names) < 0)
 		return -1;
 
+	weston_config_section_get_bool(s, "keymap-cache", &keymap_cache, false);
+	if (keymap_cache && wet_set_keymap_cache_dir(ec) < 0)
+		return -1;
+
 	weston_config_section_get_int(s, "repeat-rate",
 				      &ec->kb_repeat_rate, 40);
 	weston_config_section_get_int(s, "repeat-delay",
@@ -3277,6 +3389,12 @@ sigint_helper(int sig)
 	raise(SIGUSR2);
 }
 
+static void
+replay_done(struct weston_compositor *compositor, void *data)
+{
+	weston_compositor_exit(compositor);
+}
+
 WL_EXPORT int
 wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 {
@@ -3294,6 +3412,12 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	char *log = NULL;
 	char *log_scopes = NULL;
 	char *flight_rec_scopes = NULL;
+	char *flight_rec_file = NULL;
+	uint32_t flight_rec_size = DEFAULT_FLIGHT_REC_SIZE;
+	char *record_events = NULL;
+	char *replay_events = NULL;
+	struct weston_output *output;
+	struct timespec phase;
 	char *server_socket = NULL;
 	int32_t idle_time = -1;
 	int32_t help = 0;
@@ -3336,9 +3460,17 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
 		{ WESTON_OPTION_STRING, "logger-scopes", 'l', &log_scopes },
 		{ WESTON_OPTION_STRING, "flight-rec-scopes", 'f', &flight_rec_scopes },
+		{ WESTON_OPTION_STRING, "flight-rec-file", 0, &flight_rec_file },
+		{ WESTON_OPTION_UNSIGNED_INTEGER, "flight-rec-size", 0, &flight_rec_size },
+		{ WESTON_OPTION_STRING, "record-events", 0, &record_events },
+		{ WESTON_OPTION_STRING, "replay-events", 0, &replay_events },
 	};
 
+	clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+
 	wl_list_init(&wet.layoutput_list);
+	wl_list_init(&wet.first_frame_listener.link);
+	wl_list_init(&wet.first_frame_output_destroy_listener.link);
 
 	os_fd_set_cloexec(fileno(stdin));
 
@@ -3357,6 +3489,13 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		return EXIT_SUCCESS;
 	}
 
+	if (flight_rec_size < MIN_FLIGHT_REC_SIZE) {
+		fprintf(stderr, "--flight-rec-size must be at least %d bytes\n",
+			MIN_FLIGHT_REC_SIZE);
+		free(cmdline);
+		return EXIT_FAILURE;
+	}
+
 	log_ctx = weston_log_ctx_create();
 	if (!log_ctx) {
 		fprintf(stderr, "Failed to initialize weston debug framework.\n");
@@ -3365,6 +3504,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 
 	log_scope = weston_log_ctx_add_log_scope(log_ctx, "log",
 			"Weston and Wayland log\n", NULL, NULL, NULL);
+	startup_scope = weston_log_ctx_add_log_scope(log_ctx, "startup",
+			"Duration of each startup phase\n", NULL, NULL, NULL);
 
 	if (!weston_log_file_open(log))
 		return EXIT_FAILURE;
@@ -3376,8 +3517,22 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (!flight_rec_scopes)
 		flight_rec_scopes = DEFAULT_FLIGHT_REC_SCOPES;
 
-	if (flight_rec_scopes && strlen(flight_rec_scopes) > 0)
-		flight_rec = weston_log_subscriber_create_flight_rec(DEFAULT_FLIGHT_REC_SIZE);
+	if (flight_rec_scopes && strlen(flight_rec_scopes) > 0) {
+		if (flight_rec_file) {
+			flight_rec = weston_log_subscriber_create_flight_rec_file(flight_rec_file,
+										  flight_rec_size);
+			if (!flight_rec) {
+				fprintf(stderr, "Failed to create flight recorder "
+					"file '%s': %s\n", flight_rec_file,
+					strerror(errno));
+				free(flight_rec_file);
+				flight_rec_file = NULL;
+			}
+		}
+
+		if (!flight_rec)
+			flight_rec = weston_log_subscriber_create_flight_rec(flight_rec_size);
+	}
 
 	weston_log_subscribe_to_scopes(log_ctx, logger, flight_rec,
 				       log_scopes, flight_rec_scopes);
@@ -3393,6 +3548,8 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	log_uname();
 
 	weston_log("Flight recorder: %s\n", flight_rec ? "enabled" : "disabled");
+	if (flight_rec && flight_rec_file)
+		weston_log_continue(STAMP_SPACE "backed by %s\n", flight_rec_file);
 	verify_xdg_runtime_dir();
 
 	display = wl_display_create();
@@ -3436,8 +3593,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	sigaddset(&mask, SIGUSR1);
 	pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	if (load_configuration(&config, noconfig, config_file) < 0)
 		goto out_signals;
+	wet_startup_trace("configuration", NULL, &phase);
 	wet.config = config;
 	wet.parsed_options = NULL;
 
@@ -3461,11 +3620,13 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 			backend = weston_choose_default_backend();
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	wet.compositor = weston_compositor_create(display, log_ctx, &wet, test_data);
 	if (wet.compositor == NULL) {
 		weston_log("fatal: failed to create compositor\n");
 		goto out;
 	}
+	wet_startup_trace("compositor", NULL, &phase);
 
 	protocol_scope =
 		weston_log_ctx_add_log_scope(log_ctx, "proto",
@@ -3483,16 +3644,26 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 						    flight_rec_key_binding_handler,
 						    flight_rec);
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	if (weston_compositor_init_config(wet.compositor, config) < 0)
 		goto out;
+	wet_startup_trace("core settings", NULL, &phase);
+
+	/* The keymap is not needed before the backend sets up the seats,
+	 * get it ready while the backend initialises the renderer. */
+	if (weston_compositor_build_xkb_keymap_async(wet.compositor) < 0)
+		weston_log("warning: cannot compile the keymap in the "
+			   "background\n");
 
 	weston_config_section_get_bool(section, "require-input",
 				       &wet.compositor->require_input, true);
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	if (load_backend(wet.compositor, backend, &argc, argv, config) < 0) {
 		weston_log("fatal: failed to create compositor backend\n");
 		goto out;
 	}
+	wet_startup_trace("backend", backend, &phase);
 
 	if (test_data && !check_compositor_capabilities(wet.compositor,
 				test_data->test_quirks.required_capabilities)) {
@@ -3543,8 +3714,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 		weston_config_section_get_string(section, "shell", &shell,
 						 "desktop-shell.so");
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	if (wet_load_shell(wet.compositor, shell, &argc, argv) < 0)
 		goto out;
+	wet_startup_trace("shell", shell, &phase);
 
 	weston_config_section_get_string(section, "modules", &modules, "");
 	if (load_modules(wet.compositor, modules, &argc, argv, &xwayland) < 0)
@@ -3558,8 +3731,10 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 					       false);
 	}
 	if (xwayland) {
+		clock_gettime(CLOCK_MONOTONIC, &phase);
 		if (wet_load_xwayland(wet.compositor) < 0)
 			goto out;
+		wet_startup_trace("xwayland", NULL, &phase);
 	}
 
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
@@ -3581,8 +3756,39 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	if (argc > 1)
 		goto out;
 
+	if (record_events &&
+	    weston_compositor_start_event_capture(wet.compositor,
+						  record_events) < 0)
+		goto out;
+
+	if (replay_events) {
+		if (!strstr(backend, "headless-backend.so")) {
+			weston_log("fatal: --replay-events requires the "
+				   "headless backend\n");
+			goto out;
+		}
+
+		if (weston_compositor_replay_events(wet.compositor,
+						    replay_events,
+						    replay_done, NULL) < 0)
+			goto out;
+	}
+
 	weston_compositor_wake(wet.compositor);
 
+	if (!wl_list_empty(&wet.compositor->output_list)) {
+		output = container_of(wet.compositor->output_list.next,
+				      struct weston_output, link);
+		wet.first_frame_listener.notify = wet_startup_first_frame;
+		wl_signal_add(&output->frame_signal,
+			      &wet.first_frame_listener);
+		wet.first_frame_output_destroy_listener.notify =
+			wet_startup_first_frame_output_destroyed;
+		weston_output_add_destroy_listener(output,
+				&wet.first_frame_output_destroy_listener);
+	}
+	wet_startup_trace("startup", NULL, &startup_begin);
+
 	if (execute_autolaunch(&wet, config) < 0)
 		goto out;
 
@@ -3597,6 +3803,7 @@ wet_main(int argc, char *argv[], const struct weston_testsuite_data *test_data)
 	ret = wet.compositor->exit_code;
 
 out:
+	wet_startup_first_frame_done(&wet);
 	wet_compositor_destroy_layout(&wet);
 
 	/* free(NULL) is valid, and it won't be NULL if it's used */
@@ -3617,6 +3824,8 @@ out_signals:
 	wl_display_destroy(display);
 
 out_display:
+	weston_log_scope_destroy(startup_scope);
+	startup_scope = NULL;
 	weston_log_scope_destroy(log_scope);
 	log_scope = NULL;
 	weston_log_subscriber_destroy(logger);
@@ -3634,6 +3843,9 @@ out_display:
 	free(option_modules);
 	free(log);
 	free(log_scopes);
+	free(flight_rec_file);
+	free(record_events);
+	free(replay_events);
 	free(modules);
 
 	return ret;
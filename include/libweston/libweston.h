@@ -185,6 +185,8 @@ struct weston_testsuite_quirks {
 	bool gl_force_full_upload;
 	/** Ensure GL shadow fb is used, and always repaint it fully. */
 	bool gl_force_full_redraw_of_shadow_fb;
+	/** Enable GL-renderer's cache of stable bottom layers. */
+	bool gl_layer_cache;
 	/** Required enum weston_capability bit mask, otherwise skip run. */
 	uint32_t required_capabilities;
 };
@@ -303,6 +305,26 @@ struct weston_output_color_outcome {
 	struct weston_color_transform *from_blend_to_output;
 };
 
+/** Aggregated hot-path counters of an output
+ *
+ * These are plain increments done by libweston core and the renderers, cheap
+ * enough to be always compiled in. They are reported and reset through the
+ * "perf-counters" and "perf-counters-reset" log scopes.
+ *
+ * \ingroup output
+ * \internal
+ */
+struct weston_perf_counters {
+	uint64_t repaints;		/**< weston_output_repaint() calls */
+	uint64_t paint_nodes;		/**< paint nodes repainted on the output */
+	uint64_t region_rects;		/**< rectangles painted by the renderer */
+	uint64_t upload_bytes;		/**< SHM bytes uploaded to textures */
+	uint64_t shm_uploads;		/**< glTex(Sub)Image2D calls for SHM */
+	uint64_t read_pixels_bytes;	/**< bytes read back by read_pixels */
+	uint64_t missed_deadlines;	/**< frames finished past the deadline */
+	uint64_t frame_callbacks;	/**< wl_surface.frame callbacks sent */
+};
+
 /** Content producer for heads
  *
  * \rst
@@ -417,6 +439,8 @@ struct weston_output {
 
 	struct weston_output_color_outcome *color_outcome;
 
+	struct weston_perf_counters perf;
+
 	int (*enable)(struct weston_output *output);
 	int (*disable)(struct weston_output *output);
 
@@ -1145,6 +1169,8 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	char *xkb_keymap_cache_dir;
+	struct weston_xkb_keymap_job *xkb_keymap_job;
 
 	int32_t kb_repeat_rate;
 	int32_t kb_repeat_delay;
@@ -1187,6 +1213,12 @@ struct weston_compositor {
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
 	struct weston_log_scope *libseat_debug;
+	struct weston_log_scope *perf_counters;
+	struct weston_log_scope *perf_counters_reset;
+
+	/* Event capture and replay, see event-capture.c */
+	struct weston_event_capture *event_capture;
+	struct weston_event_replay *event_replay;
 
 	struct content_protection *content_protection;
 };
@@ -1479,6 +1511,18 @@ struct weston_pointer_constraint {
 	struct wl_listener surface_activate_listener;
 };
 
+/** Running estimate of how often, and how much of, a surface changes
+ *
+ * Updated on every commit attaching a new buffer or adding damage;
+ * consumers usually want the per-repaint snapshot in weston_paint_node.
+ */
+struct weston_surface_update_stats {
+	struct timespec last_update; /**< presentation clock, last update */
+	float interval_ms; /**< average time between updates */
+	float damage_area; /**< average damaged area per update */
+	uint32_t updates; /**< content updates committed so far */
+};
+
 struct weston_surface {
 	struct wl_resource *resource;
 	struct wl_signal destroy_signal; /* callback argument: this surface */
@@ -1527,6 +1571,7 @@ struct weston_surface {
 	int32_t width_from_buffer; /* before applying viewport */
 	int32_t height_from_buffer;
 	bool keep_buffer; /* for backends to prevent early release */
+	struct weston_surface_update_stats update_stats;
 
 	/* wp_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
@@ -1929,6 +1974,11 @@ weston_output_get_destroy_listener(struct weston_output *output,
 int
 weston_compositor_set_xkb_rule_names(struct weston_compositor *ec,
 				     struct xkb_rule_names *names);
+int
+weston_compositor_set_xkb_keymap_cache_dir(struct weston_compositor *ec,
+					   const char *dir);
+int
+weston_compositor_build_xkb_keymap_async(struct weston_compositor *ec);
 
 /* String literal of spaces, the same width as the timestamp. */
 #define STAMP_SPACE "               "
@@ -2176,6 +2226,22 @@ int
 weston_compositor_enable_touch_calibrator(struct weston_compositor *compositor,
 				weston_touch_calibration_save_func save);
 
+int
+weston_compositor_start_event_capture(struct weston_compositor *compositor,
+				      const char *path);
+
+void
+weston_compositor_stop_event_capture(struct weston_compositor *compositor);
+
+typedef void (*weston_event_replay_done_func_t)(struct weston_compositor *compositor,
+						void *data);
+
+int
+weston_compositor_replay_events(struct weston_compositor *compositor,
+				const char *path,
+				weston_event_replay_done_func_t done,
+				void *data);
+
 struct weston_log_context *
 weston_log_ctx_create(void);
 
@@ -126,6 +126,9 @@ weston_log_subscriber_create_log(FILE *dump_to);
 struct weston_log_subscriber *
 weston_log_subscriber_create_flight_rec(size_t size);
 
+struct weston_log_subscriber *
+weston_log_subscriber_create_flight_rec_file(const char *path, size_t size);
+
 void
 weston_log_subscriber_display_flight_rec(struct weston_log_subscriber *sub);
 
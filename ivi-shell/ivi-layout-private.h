@@ -32,6 +32,19 @@
 #include "ivi-layout-export.h"
 #include <libweston-desktop/libweston-desktop.h>
 
+/* An entry in an ivi_layout_id_map, embedded in what it maps to */
+struct ivi_layout_id_entry {
+	struct wl_list link;	/* ivi_layout_id_map::buckets */
+	uint32_t id;
+};
+
+/* Hash map from IDs to surfaces or layers, chained in buckets */
+struct ivi_layout_id_map {
+	struct wl_list *buckets;	/* ivi_layout_id_entry::link */
+	uint32_t bucket_count;		/* zero or a power of two */
+	uint32_t count;
+};
+
 struct ivi_layout_view {
 	struct wl_list link;	/* ivi_layout::view_list */
 	struct wl_list surf_link;	/*ivi_layout_surface::view_list */
@@ -50,6 +63,8 @@ struct ivi_layout_surface {
 	struct wl_signal property_changed;
 	int32_t update_count;
 	uint32_t id_surface;
+	struct ivi_layout_id_entry id_entry;	/* ivi_layout::surface_ids */
+	struct wl_list dirty_link;	/* ivi_layout::dirty_surface_list */
 
 	struct ivi_layout *layout;
 	struct weston_surface *surface;
@@ -68,6 +83,8 @@ struct ivi_layout_layer {
 	struct wl_list link;	/* ivi_layout::layer_list */
 	struct wl_signal property_changed;
 	uint32_t id_layer;
+	struct ivi_layout_id_entry id_entry;	/* ivi_layout::layer_ids */
+	struct wl_list dirty_link;	/* ivi_layout::dirty_layer_list */
 
 	struct ivi_layout *layout;
 	struct ivi_layout_screen *on_screen;
@@ -86,6 +103,18 @@ struct ivi_layout_layer {
 		struct wl_list link;	/* ivi_layout_screen::order.layer_list */
 	} order;
 
+	/*
+	 * An unmapped view carrying the layer-local to global transformation
+	 * and the clip of the layer. The views on the layer use it as their
+	 * transformation parent when they can.
+	 */
+	struct {
+		struct weston_surface *surface;
+		struct weston_view *view;
+		struct weston_transform transform;
+		bool dirty;
+	} parent;
+
 	int32_t ref_count;
 };
 
@@ -97,6 +126,16 @@ struct ivi_layout {
 	struct wl_list screen_list;	/* ivi_layout_screen::link */
 	struct wl_list view_list;	/* ivi_layout_view::link */
 
+	/* surfaces with an ID, and layers */
+	struct ivi_layout_id_map surface_ids;	/* ivi_layout_surface::id_entry */
+	struct ivi_layout_id_map layer_ids;	/* ivi_layout_layer::id_entry */
+
+	/* what ivi_layout_commit_changes has to look at */
+	struct wl_list dirty_surface_list;	/* ivi_layout_surface::dirty_link */
+	struct wl_list dirty_layer_list;	/* ivi_layout_layer::dirty_link */
+	bool view_list_dirty;
+	int mapped_view_count;
+
 	struct {
 		struct wl_signal created;
 		struct wl_signal removed;
@@ -120,8 +159,29 @@ struct ivi_layout *get_instance(void);
 struct ivi_layout_transition;
 
 struct ivi_layout_transition_set {
-	struct wl_event_source  *event_source;
+	struct weston_compositor *compositor;
+	struct wl_event_source  *event_source;	/* when no output repaints */
 	struct wl_list          transition_list;
+
+	/* advances all transitions once per frame of the clock output */
+	struct weston_animation animation;
+	struct weston_output *clock_output;
+	struct wl_listener clock_output_destroy_listener;
+	struct timespec last_tick;	/* transition time never goes back */
+
+	struct weston_log_scope *stats_scope;
+	struct {
+		uint64_t frames;
+		uint64_t steps;		/* transitions advanced */
+		uint32_t max_active;
+		struct timespec last_frame;	/* zero when not running */
+		int64_t interval_min_nsec;
+		int64_t interval_max_nsec;
+		int64_t interval_sum_nsec;
+		uint64_t intervals;
+		int64_t work_max_nsec;	/* advancing and committing */
+		int64_t work_sum_nsec;
+	} stats;
 };
 
 typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
@@ -129,6 +189,12 @@ typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
 struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec);
 
+void
+ivi_layout_transition_set_destroy(struct ivi_layout_transition_set *transitions);
+
+void
+ivi_layout_transition_set_schedule(struct ivi_layout_transition_set *transitions);
+
 void
 ivi_layout_transition_move_resize_view(struct ivi_layout_surface *surface,
 				       int32_t dest_x, int32_t dest_y,
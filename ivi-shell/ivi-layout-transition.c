@@ -27,14 +27,23 @@
 
 #include <time.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+
+#include <libweston/weston-log.h>
 
 #include "ivi-shell.h"
 #include "ivi-layout-export.h"
 #include "ivi-layout-private.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/* pace of the transitions while there is no output to follow */
+#define TRANSITION_FALLBACK_FPS 60
 
 struct ivi_layout_transition;
 
@@ -126,9 +135,10 @@ ivi_layout_remove_all_surface_transitions(struct ivi_layout_surface *surface)
 static void
 tick_transition(struct ivi_layout_transition *transition, uint32_t timestamp)
 {
-	const double t = timestamp - transition->time_start;
+	/* wrap-around safe, and never negative */
+	const int32_t t = MAX((int32_t) (timestamp - transition->time_start), 0);
 
-	if (transition->time_duration <= t) {
+	if (transition->time_duration <= (uint32_t) t) {
 		transition->time_elapsed = transition->time_duration;
 		transition->is_done = 1;
 	} else {
@@ -156,56 +166,325 @@ do_transition_frame(struct ivi_layout_transition *transition,
 		layout_transition_destroy(transition);
 }
 
+static void
+layout_transition_stats_update(struct ivi_layout_transition_set *transitions,
+			       const struct timespec *frame_time,
+			       const struct timespec *work_begin,
+			       uint32_t active)
+{
+	struct timespec work_end;
+	int64_t interval, work;
+
+	clock_gettime(transitions->compositor->presentation_clock, &work_end);
+	work = timespec_sub_to_nsec(&work_end, work_begin);
+
+	transitions->stats.frames++;
+	transitions->stats.steps += active;
+	transitions->stats.max_active = MAX(transitions->stats.max_active,
+					    active);
+	transitions->stats.work_sum_nsec += work;
+	transitions->stats.work_max_nsec = MAX(transitions->stats.work_max_nsec,
+					       work);
+
+	if (!timespec_is_zero(&transitions->stats.last_frame)) {
+		interval = timespec_sub_to_nsec(frame_time,
+						&transitions->stats.last_frame);
+		if (transitions->stats.intervals == 0 ||
+		    interval < transitions->stats.interval_min_nsec)
+			transitions->stats.interval_min_nsec = interval;
+		transitions->stats.interval_max_nsec =
+			MAX(transitions->stats.interval_max_nsec, interval);
+		transitions->stats.interval_sum_nsec += interval;
+		transitions->stats.intervals++;
+	}
+	transitions->stats.last_frame = *frame_time;
+}
+
+/*
+ * Advances every running transition to the given frame time, or to the
+ * previous tick if that was later, then commits all the property changes
+ * they made at once.
+ */
+static void
+layout_transition_tick(struct ivi_layout_transition_set *transitions,
+		       const struct timespec *frame_time)
+{
+	struct timespec work_begin;
+	struct timespec tick_time = *frame_time;
+	uint32_t msec;
+	uint32_t active = 0;
+	struct transition_node *node = NULL;
+	struct transition_node *next = NULL;
+
+	clock_gettime(transitions->compositor->presentation_clock, &work_begin);
+
+	/* The timer ticks at the current time, but an output at its last
+	 * presentation, which can be earlier than the previous tick when
+	 * the pacing moves over to it. */
+	if (timespec_sub_to_nsec(&tick_time, &transitions->last_tick) < 0)
+		tick_time = transitions->last_tick;
+	transitions->last_tick = tick_time;
+	msec = timespec_to_msec(&tick_time);
+
+	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
+		do_transition_frame(node->transition, msec);
+		active++;
+	}
+
+	ivi_layout_commit_changes();
+
+	layout_transition_stats_update(transitions, &tick_time, &work_begin,
+				       active);
+}
+
+/*
+ * Whether the output is going to repaint anyway, and so can run the next
+ * tick in its frame without a repaint forced on it.
+ */
+static bool
+layout_transition_output_is_repainting(struct weston_output *output)
+{
+	return !output->destroying && output->repaint_needed &&
+	       output->repaint_status != REPAINT_NOT_SCHEDULED;
+}
+
+/*
+ * Picks the output whose frames pace the transitions: the current clock
+ * output as long as it keeps repainting, or else one of the outputs the
+ * last tick damaged.
+ */
+static struct weston_output *
+layout_transition_pick_clock_output(struct ivi_layout_transition_set *transitions)
+{
+	struct weston_compositor *ec = transitions->compositor;
+	struct weston_output *output = transitions->clock_output;
+
+	if (ec->state == WESTON_COMPOSITOR_SLEEPING ||
+	    ec->state == WESTON_COMPOSITOR_OFFSCREEN)
+		return NULL;
+
+	if (output && layout_transition_output_is_repainting(output))
+		return output;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (layout_transition_output_is_repainting(output))
+			return output;
+	}
+
+	return NULL;
+}
+
+static void
+layout_transition_set_clock_output(struct ivi_layout_transition_set *transitions,
+				   struct weston_output *output)
+{
+	if (transitions->clock_output == output)
+		return;
+
+	if (transitions->clock_output) {
+		wl_list_remove(&transitions->animation.link);
+		wl_list_init(&transitions->animation.link);
+		wl_list_remove(&transitions->clock_output_destroy_listener.link);
+		wl_list_init(&transitions->clock_output_destroy_listener.link);
+	}
+
+	transitions->clock_output = output;
+	if (output)
+		wl_signal_add(&output->destroy_signal,
+			      &transitions->clock_output_destroy_listener);
+}
+
+/*
+ * Runs the next tick in the next frame of the clock output, or after
+ * timer_msec when no output is going to repaint.
+ */
+static void
+layout_transition_schedule_tick(struct ivi_layout_transition_set *transitions,
+				int timer_msec)
+{
+	struct weston_output *output;
+
+	output = layout_transition_pick_clock_output(transitions);
+	layout_transition_set_clock_output(transitions, output);
+
+	if (!output) {
+		wl_event_source_timer_update(transitions->event_source,
+					     timer_msec);
+		return;
+	}
+
+	if (wl_list_empty(&transitions->animation.link)) {
+		wl_event_source_timer_update(transitions->event_source, 0);
+		wl_list_insert(&output->animation_list,
+			       &transitions->animation.link);
+	}
+}
+
+static void
+layout_transition_stop(struct ivi_layout_transition_set *transitions)
+{
+	wl_list_remove(&transitions->animation.link);
+	wl_list_init(&transitions->animation.link);
+	wl_event_source_timer_update(transitions->event_source, 0);
+
+	timespec_from_nsec(&transitions->stats.last_frame, 0);
+}
+
+static void
+layout_transition_animation_frame(struct weston_animation *animation,
+				  struct weston_output *output,
+				  const struct timespec *time)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(animation, struct ivi_layout_transition_set,
+			     animation);
+
+	layout_transition_tick(transitions, time);
+
+	if (wl_list_empty(&transitions->transition_list)) {
+		layout_transition_stop(transitions);
+		return;
+	}
+
+	layout_transition_schedule_tick(transitions,
+					1000 / TRANSITION_FALLBACK_FPS);
+}
+
 static int32_t
 layout_transition_frame(void *data)
 {
 	struct ivi_layout_transition_set *transitions = data;
-	uint32_t fps = 30;
-	struct timespec timestamp = {};
-	uint32_t msec = 0;
-	struct transition_node *node = NULL;
-	struct transition_node *next = NULL;
+	struct timespec now;
 
 	if (wl_list_empty(&transitions->transition_list)) {
-		wl_event_source_timer_update(transitions->event_source, 0);
+		layout_transition_stop(transitions);
 		return 1;
 	}
 
-	wl_event_source_timer_update(transitions->event_source, 1000 / fps);
+	clock_gettime(transitions->compositor->presentation_clock, &now);
+	layout_transition_tick(transitions, &now);
 
-	clock_gettime(CLOCK_MONOTONIC, &timestamp);/* FIXME */
-	msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
-
-	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
-		do_transition_frame(node->transition, msec);
+	if (wl_list_empty(&transitions->transition_list)) {
+		layout_transition_stop(transitions);
+		return 1;
 	}
 
-	ivi_layout_commit_changes();
+	layout_transition_schedule_tick(transitions,
+					1000 / TRANSITION_FALLBACK_FPS);
 	return 1;
 }
 
+static void
+layout_transition_clock_output_destroyed(struct wl_listener *listener,
+					 void *data)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(listener, struct ivi_layout_transition_set,
+			     clock_output_destroy_listener);
+
+	layout_transition_set_clock_output(transitions, NULL);
+
+	ivi_layout_transition_set_schedule(transitions);
+}
+
+void
+ivi_layout_transition_set_schedule(struct ivi_layout_transition_set *transitions)
+{
+	if (wl_list_empty(&transitions->transition_list))
+		return;
+
+	/* already running */
+	if (!wl_list_empty(&transitions->animation.link))
+		return;
+
+	layout_transition_schedule_tick(transitions, 1);
+}
+
+/**
+ * Called when the 'ivi-transitions' debug scope is bound by a client. This
+ * one-shot weston-debug scope prints the frame statistics of the
+ * transitions, and then terminates the stream.
+ */
+static void
+layout_transition_stats_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct ivi_layout_transition_set *transitions = data;
+	uint64_t intervals = MAX(transitions->stats.intervals, 1);
+	uint64_t frames = MAX(transitions->stats.frames, 1);
+
+	weston_log_subscription_printf(sub,
+		"ivi-layout transitions:\n"
+		"\tframes: %" PRIu64 "\n"
+		"\ttransition steps: %" PRIu64 "\n"
+		"\tmax concurrent transitions: %" PRIu32 "\n"
+		"\tframe interval min/avg/max: %.3f/%.3f/%.3f ms\n"
+		"\tadvance and commit avg/max: %.3f/%.3f ms\n",
+		transitions->stats.frames, transitions->stats.steps,
+		transitions->stats.max_active,
+		transitions->stats.interval_min_nsec / 1e6,
+		transitions->stats.interval_sum_nsec / 1e6 / intervals,
+		transitions->stats.interval_max_nsec / 1e6,
+		transitions->stats.work_sum_nsec / 1e6 / frames,
+		transitions->stats.work_max_nsec / 1e6);
+
+	weston_log_subscription_complete(sub);
+}
+
 struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec)
 {
 	struct ivi_layout_transition_set *transitions;
 	struct wl_event_loop *loop;
 
-	transitions = malloc(sizeof(*transitions));
+	transitions = zalloc(sizeof(*transitions));
 	if (transitions == NULL) {
 		weston_log("%s: memory allocation fails\n", __func__);
 		return NULL;
 	}
 
+	transitions->compositor = ec;
 	wl_list_init(&transitions->transition_list);
 
+	transitions->animation.frame = layout_transition_animation_frame;
+	wl_list_init(&transitions->animation.link);
+	transitions->clock_output_destroy_listener.notify =
+		layout_transition_clock_output_destroyed;
+	wl_list_init(&transitions->clock_output_destroy_listener.link);
+
 	loop = wl_display_get_event_loop(ec->wl_display);
 	transitions->event_source =
 		wl_event_loop_add_timer(loop, layout_transition_frame,
 					transitions);
 
+	transitions->stats_scope =
+		weston_compositor_add_log_scope(ec, "ivi-transitions",
+						"Frame statistics of the ivi-layout transitions\n",
+						layout_transition_stats_cb,
+						NULL, transitions);
+
 	return transitions;
 }
 
+void
+ivi_layout_transition_set_destroy(struct ivi_layout_transition_set *transitions)
+{
+	struct transition_node *node;
+	struct transition_node *next;
+
+	if (!transitions)
+		return;
+
+	wl_list_for_each_safe(node, next, &transitions->transition_list, link)
+		layout_transition_destroy(node->transition);
+
+	weston_log_scope_destroy(transitions->stats_scope);
+	wl_list_remove(&transitions->animation.link);
+	wl_list_remove(&transitions->clock_output_destroy_listener.link);
+	wl_event_source_remove(transitions->event_source);
+
+	free(transitions);
+}
+
 static bool
 layout_transition_register(struct ivi_layout_transition *trans)
 {
@@ -108,34 +108,123 @@ get_instance(void)
 }
 
 /**
- * Internal API to add/remove an ivi_layer to/from ivi_screen.
+ * Internal API to look up surfaces and layers by their ID.
  */
-static struct ivi_layout_surface *
-get_surface(struct wl_list *surf_list, uint32_t id_surface)
+#define ID_MAP_INITIAL_BUCKETS 64
+
+static uint32_t
+id_map_bucket(const struct ivi_layout_id_map *map, uint32_t id)
 {
-	struct ivi_layout_surface *ivisurf;
+	/* IDs are often consecutive or share their high bits */
+	uint32_t hash = id * 0x9e3779b1u;
 
-	wl_list_for_each(ivisurf, surf_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
+	hash ^= hash >> 16;
+
+	return hash & (map->bucket_count - 1);
+}
+
+static struct ivi_layout_id_entry *
+id_map_lookup(const struct ivi_layout_id_map *map, uint32_t id)
+{
+	struct ivi_layout_id_entry *entry;
+
+	if (map->bucket_count == 0)
+		return NULL;
+
+	wl_list_for_each(entry, &map->buckets[id_map_bucket(map, id)], link) {
+		if (entry->id == id)
+			return entry;
 	}
 
 	return NULL;
 }
 
-static struct ivi_layout_layer *
-get_layer(struct wl_list *layer_list, uint32_t id_layer)
+/* Keeps the old buckets when it cannot allocate, lookups just get slower */
+static void
+id_map_resize(struct ivi_layout_id_map *map, uint32_t bucket_count)
 {
-	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_id_map old = *map;
+	struct ivi_layout_id_entry *entry, *next;
+	uint32_t i;
 
-	wl_list_for_each(ivilayer, layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
+	map->buckets = calloc(bucket_count, sizeof *map->buckets);
+	if (!map->buckets) {
+		*map = old;
+		return;
+	}
+	map->bucket_count = bucket_count;
+
+	for (i = 0; i < bucket_count; i++)
+		wl_list_init(&map->buckets[i]);
+
+	for (i = 0; i < old.bucket_count; i++) {
+		wl_list_for_each_safe(entry, next, &old.buckets[i], link) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&map->buckets[id_map_bucket(map, entry->id)],
+				       &entry->link);
 		}
 	}
 
-	return NULL;
+	free(old.buckets);
+}
+
+static int
+id_map_insert(struct ivi_layout_id_map *map,
+	      struct ivi_layout_id_entry *entry, uint32_t id)
+{
+	if (map->bucket_count == 0)
+		id_map_resize(map, ID_MAP_INITIAL_BUCKETS);
+	else if (map->count >= map->bucket_count * 2)
+		id_map_resize(map, map->bucket_count * 2);
+
+	if (map->bucket_count == 0)
+		return -1;
+
+	entry->id = id;
+	wl_list_insert(&map->buckets[id_map_bucket(map, id)], &entry->link);
+	map->count++;
+
+	return 0;
+}
+
+/* The entry's link must have been initialised, or inserted */
+static void
+id_map_remove(struct ivi_layout_id_map *map, struct ivi_layout_id_entry *entry)
+{
+	if (wl_list_empty(&entry->link))
+		return;
+
+	wl_list_remove(&entry->link);
+	wl_list_init(&entry->link);
+	map->count--;
+}
+
+static void
+id_map_release(struct ivi_layout_id_map *map)
+{
+	free(map->buckets);
+	map->buckets = NULL;
+	map->bucket_count = 0;
+	map->count = 0;
+}
+
+/**
+ * Internal API to queue what ivi_layout_commit_changes has to look at.
+ */
+static void
+surface_mark_dirty(struct ivi_layout_surface *ivisurf)
+{
+	if (wl_list_empty(&ivisurf->dirty_link))
+		wl_list_insert(ivisurf->layout->dirty_surface_list.prev,
+			       &ivisurf->dirty_link);
+}
+
+static void
+layer_mark_dirty(struct ivi_layout_layer *ivilayer)
+{
+	if (wl_list_empty(&ivilayer->dirty_link))
+		wl_list_insert(ivilayer->layout->dirty_layer_list.prev,
+			       &ivilayer->dirty_link);
 }
 
 static bool
@@ -147,6 +236,8 @@ ivi_view_is_rendered(struct ivi_layout_view *view)
 static void
 ivi_view_destroy(struct ivi_layout_view *ivi_view)
 {
+	ivi_view->on_layer->layout->view_list_dirty = true;
+
 	wl_list_remove(&ivi_view->transform.link);
 	wl_list_remove(&ivi_view->link);
 	wl_list_remove(&ivi_view->surf_link);
@@ -246,6 +337,8 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	}
 
 	wl_list_remove(&ivisurf->link);
+	wl_list_remove(&ivisurf->dirty_link);
+	id_map_remove(&layout->surface_ids, &ivisurf->id_entry);
 
 	wl_list_for_each_safe(ivi_view, next, &ivisurf->view_list, surf_link) {
 		ivi_view_destroy(ivi_view);
@@ -552,14 +645,179 @@ calc_surface_to_global_matrix_and_mask_to_weston_surface(
 				      result);
 }
 
+/*
+ * The transformation of the layer's parent view maps layer-local
+ * coordinates to global ones, and its mask is the destination rectangle
+ * of the layer clipped to the screen, in layer-local coordinates.
+ */
 static void
-update_prop(struct ivi_layout_view *ivi_view)
+update_layer_transform(struct ivi_layout_layer *ivilayer)
+{
+	const struct ivi_layout_layer_properties *lp = &ivilayer->prop;
+	struct weston_output *output = ivilayer->on_screen->output;
+	struct weston_view *view = ivilayer->parent.view;
+	struct weston_matrix *m = &ivilayer->parent.transform.matrix;
+	struct ivi_rectangle layer_source_rect =   { lp->source_x,
+						     lp->source_y,
+						     lp->source_width,
+						     lp->source_height };
+	struct ivi_rectangle layer_dest_rect =     { lp->dest_x,
+						     lp->dest_y,
+						     lp->dest_width,
+						     lp->dest_height };
+	struct ivi_rectangle screen_dest_rect =    { output->x,
+						     output->y,
+						     output->width,
+						     output->height };
+	struct ivi_rectangle layer_dest_rect_in_global =
+						   { lp->dest_x + output->x,
+						     lp->dest_y + output->y,
+						     lp->dest_width,
+						     lp->dest_height };
+	struct ivi_rectangle layer_dest_rect_in_global_intersected;
+	struct ivi_rectangle r;
+
+	wl_list_remove(&ivilayer->parent.transform.link);
+	weston_matrix_init(m);
+
+	calc_transformation_matrix(&layer_source_rect, &layer_dest_rect, m);
+	weston_matrix_translate(m, output->x, output->y, 0.0f);
+
+	wl_list_insert(&view->geometry.transformation_list,
+		       &ivilayer->parent.transform.link);
+
+	ivi_rectangle_intersect(&layer_dest_rect_in_global, &screen_dest_rect,
+				&layer_dest_rect_in_global_intersected);
+	calc_inverse_matrix_transform(m,
+				      &layer_dest_rect_in_global_intersected,
+				      &layer_source_rect, &r);
+
+	/* this dirties the geometry of all the views on the layer */
+	weston_view_set_mask(view, r.x, r.y, r.width, r.height);
+	weston_output_schedule_repaint(output);
+}
+
+/*
+ * Returns the view the views on the layer inherit the layer's
+ * transformation from, or NULL when they cannot, and have to be
+ * transformed and clipped on their own.
+ */
+static struct weston_view *
+get_layer_transform_view(struct ivi_layout_layer *ivilayer)
+{
+	const struct ivi_layout_layer_properties *lp = &ivilayer->prop;
+
+	if (!ivilayer->on_screen ||
+	    lp->source_width <= 0 || lp->source_height <= 0 ||
+	    lp->dest_width <= 0 || lp->dest_height <= 0)
+		return NULL;
+
+	if (!ivilayer->parent.view) {
+		ivilayer->parent.surface =
+			weston_surface_create(ivilayer->layout->compositor);
+		if (!ivilayer->parent.surface)
+			return NULL;
+
+		ivilayer->parent.view =
+			weston_view_create(ivilayer->parent.surface);
+		if (!ivilayer->parent.view) {
+			weston_surface_unref(ivilayer->parent.surface);
+			ivilayer->parent.surface = NULL;
+			return NULL;
+		}
+
+		ivilayer->parent.dirty = true;
+	}
+
+	if (ivilayer->parent.dirty) {
+		update_layer_transform(ivilayer);
+		ivilayer->parent.dirty = false;
+	}
+
+	return ivilayer->parent.view;
+}
+
+/*
+ * A child view is clipped by its parent's mask only, so the surface must
+ * not be cropped by its source rectangle.
+ */
+static bool
+ivi_surface_is_cropped(struct ivi_layout_surface *ivisurf)
+{
+	const struct ivi_layout_surface_properties *sp = &ivisurf->prop;
+
+	return sp->source_x > 0 || sp->source_y > 0 ||
+	       sp->source_x + sp->source_width < ivisurf->surface->width ||
+	       sp->source_y + sp->source_height < ivisurf->surface->height;
+}
+
+static bool
+ivi_view_inherits_layer_transform(struct ivi_layout_view *ivi_view)
+{
+	struct weston_view *parent = get_layer_transform_view(ivi_view->on_layer);
+
+	return parent && ivi_view->view->geometry.parent == parent;
+}
+
+/*
+ * Computes the transformation of the view from the committed source and
+ * destination rectangles, and how it is clipped.
+ */
+static void
+update_view_transform(struct ivi_layout_view *ivi_view)
 {
 	struct ivi_layout_surface *ivisurf = ivi_view->ivisurf;
 	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
 	struct ivi_layout_screen *iviscrn = ivilayer->on_screen;
+	struct weston_view *parent = NULL;
 	struct ivi_rectangle r;
-	bool can_calc = true;
+	struct ivi_rectangle surface_source_rect = {
+		ivisurf->prop.source_x, ivisurf->prop.source_y,
+		ivisurf->prop.source_width, ivisurf->prop.source_height
+	};
+	struct ivi_rectangle surface_dest_rect = {
+		ivisurf->prop.dest_x, ivisurf->prop.dest_y,
+		ivisurf->prop.dest_width, ivisurf->prop.dest_height
+	};
+
+	if (ivisurf->prop.source_width == 0 || ivisurf->prop.source_height == 0 ||
+	    ivisurf->prop.dest_width == 0 || ivisurf->prop.dest_height == 0)
+		return;
+
+	wl_list_remove(&ivi_view->transform.link);
+	weston_matrix_init(&ivi_view->transform.matrix);
+
+	if (!ivi_surface_is_cropped(ivisurf))
+		parent = get_layer_transform_view(ivilayer);
+
+	if (parent) {
+		calc_transformation_matrix(&surface_source_rect,
+					   &surface_dest_rect,
+					   &ivi_view->transform.matrix);
+		weston_view_set_transform_parent(ivi_view->view, parent);
+	} else {
+		calc_surface_to_global_matrix_and_mask_to_weston_surface(
+			iviscrn, ivilayer, ivisurf,
+			&ivi_view->transform.matrix, &r);
+
+		/* a view with a parent cannot have a mask */
+		weston_view_set_transform_parent(ivi_view->view, NULL);
+		weston_view_set_mask(ivi_view->view,
+				     r.x, r.y, r.width, r.height);
+	}
+
+	wl_list_insert(&ivi_view->view->geometry.transformation_list,
+		       &ivi_view->transform.link);
+
+	weston_view_geometry_dirty(ivi_view->view);
+	weston_view_update_transform(ivi_view->view);
+}
+
+static void
+update_prop(struct ivi_layout_view *ivi_view)
+{
+	struct ivi_layout_surface *ivisurf = ivi_view->ivisurf;
+	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
 
 	/*In case of no prop change, this just returns*/
 	if (!ivilayer->prop.event_mask && !ivisurf->prop.event_mask)
@@ -567,31 +825,13 @@ update_prop(struct ivi_layout_view *ivi_view)
 
 	update_opacity(ivilayer, ivisurf, ivi_view->view);
 
-	if (ivisurf->prop.source_width == 0 || ivisurf->prop.source_height == 0) {
+	if (ivisurf->prop.source_width == 0 || ivisurf->prop.source_height == 0)
 		weston_log("ivi-shell: source rectangle is not yet set by ivi_layout_surface_set_source_rectangle\n");
-		can_calc = false;
-	}
 
-	if (ivisurf->prop.dest_width == 0 || ivisurf->prop.dest_height == 0) {
+	if (ivisurf->prop.dest_width == 0 || ivisurf->prop.dest_height == 0)
 		weston_log("ivi-shell: destination rectangle is not yet set by ivi_layout_surface_set_destination_rectangle\n");
-		can_calc = false;
-	}
 
-	if (can_calc) {
-		wl_list_remove(&ivi_view->transform.link);
-		weston_matrix_init(&ivi_view->transform.matrix);
-
-		calc_surface_to_global_matrix_and_mask_to_weston_surface(
-			iviscrn, ivilayer, ivisurf, &ivi_view->transform.matrix, &r);
-
-		weston_view_set_mask(ivi_view->view, r.x, r.y, r.width, r.height);
-		wl_list_insert(&ivi_view->view->geometry.transformation_list,
-			       &ivi_view->transform.link);
-
-		weston_view_set_transform_parent(ivi_view->view, NULL);
-		weston_view_geometry_dirty(ivi_view->view);
-		weston_view_update_transform(ivi_view->view);
-	}
+	update_view_transform(ivi_view);
 
 	ivisurf->update_count++;
 
@@ -607,20 +847,65 @@ ivi_view_is_mapped(struct ivi_layout_view *ivi_view)
 		ivi_view->ivisurf->prop.visibility);
 }
 
+/*
+ * Only the layer of the view changed. When that is its opacity, or its
+ * rectangles and the view inherits its transformation, the view itself
+ * needs no new transformation.
+ */
+static void
+update_prop_from_layer(struct ivi_layout_view *ivi_view)
+{
+	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
+	uint32_t event_mask = ivilayer->prop.event_mask;
+	uint32_t geometry_mask = IVI_NOTIFICATION_SOURCE_RECT |
+				 IVI_NOTIFICATION_DEST_RECT;
+
+	if ((event_mask & ~(geometry_mask | IVI_NOTIFICATION_OPACITY)) ||
+	    ((event_mask & geometry_mask) &&
+	     !ivi_view_inherits_layer_transform(ivi_view))) {
+		update_prop(ivi_view);
+		return;
+	}
+
+	update_opacity(ivilayer, ivi_view->ivisurf, ivi_view->view);
+	weston_view_schedule_repaint(ivi_view->view);
+}
+
 static void
 commit_changes(struct ivi_layout *layout)
 {
-	struct ivi_layout_view *ivi_view  = NULL;
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_surface *ivisurf;
+	struct ivi_layout_view *ivi_view;
 
-	wl_list_for_each(ivi_view, &layout->view_list, link) {
-		/*
-		 * If the view is not on the currently rendered scenegraph,
-		 * we do not need to update its properties.
-		 */
-		if (!ivi_view_is_mapped(ivi_view))
+	/*
+	 * If a view is not on the currently rendered scenegraph,
+	 * we do not need to update its properties.
+	 */
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
+		if (!ivilayer->prop.event_mask)
 			continue;
 
-		update_prop(ivi_view);
+		ivilayer->parent.dirty = true;
+
+		wl_list_for_each(ivi_view, &ivilayer->order.view_list,
+				 order_link) {
+			/* views of changed surfaces are updated below */
+			if (!ivi_view_is_mapped(ivi_view) ||
+			    ivi_view->ivisurf->prop.event_mask)
+				continue;
+
+			update_prop_from_layer(ivi_view);
+		}
+	}
+
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
+		wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link) {
+			if (!ivi_view_is_mapped(ivi_view))
+				continue;
+
+			update_prop(ivi_view);
+		}
 	}
 }
 
@@ -634,7 +919,7 @@ commit_surface_list(struct ivi_layout *layout)
 	int32_t dest_height = 0;
 	int32_t configured = 0;
 
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
 		if (ivisurf->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_VIEW_DEFAULT) {
 			dest_x = ivisurf->prop.dest_x;
 			dest_y = ivisurf->prop.dest_y;
@@ -733,7 +1018,7 @@ commit_layer_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_view *next     = NULL;
 
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
 		if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_MOVE) {
 			ivi_layout_transition_move_layer(ivilayer, ivilayer->pending.prop.dest_x, ivilayer->pending.prop.dest_y, ivilayer->pending.prop.transition_duration);
 		} else if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_FADE) {
@@ -755,6 +1040,7 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_init(&ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+			surface_mark_dirty(ivi_view->ivisurf);
 		}
 
 		assert(wl_list_empty(&ivilayer->order.view_list));
@@ -764,9 +1050,11 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_insert(&ivilayer->order.view_list, &ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_ADD;
+			surface_mark_dirty(ivi_view->ivisurf);
 		}
 
 		ivilayer->order.dirty = 0;
+		layout->view_list_dirty = true;
 	}
 }
 
@@ -785,6 +1073,7 @@ commit_screen_list(struct ivi_layout *layout)
 				wl_list_remove(&ivilayer->order.link);
 				wl_list_init(&ivilayer->order.link);
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+				layer_mark_dirty(ivilayer);
 			}
 
 			assert(wl_list_empty(&iviscrn->order.layer_list));
@@ -798,13 +1087,39 @@ commit_screen_list(struct ivi_layout *layout)
 					       &ivilayer->order.link);
 				ivilayer->on_screen = iviscrn;
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_ADD;
+				layer_mark_dirty(ivilayer);
 			}
 
 			iviscrn->order.dirty = 0;
+			layout->view_list_dirty = true;
 		}
 	}
 }
 
+static bool
+view_list_needs_rebuild(struct ivi_layout *layout)
+{
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_surface *ivisurf;
+
+	if (layout->view_list_dirty)
+		return true;
+
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
+		if (ivilayer->prop.event_mask & IVI_NOTIFICATION_VISIBILITY)
+			return true;
+	}
+
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
+		if (ivisurf->prop.event_mask & IVI_NOTIFICATION_VISIBILITY)
+			return true;
+	}
+
+	/* libweston unmapped some views, e.g. on a NULL buffer attach */
+	return wl_list_length(&layout->layout_layer.view_list.link) !=
+	       layout->mapped_view_count;
+}
+
 static void
 build_view_list(struct ivi_layout *layout)
 {
@@ -812,6 +1127,12 @@ build_view_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer;
 	struct ivi_layout_view   *ivi_view;
 
+	if (!view_list_needs_rebuild(layout))
+		return;
+
+	layout->view_list_dirty = false;
+	layout->mapped_view_count = 0;
+
 	/* If ivi_view is not part of the scenegrapgh, we have to unmap
 	 * weston_views
 	 */
@@ -834,6 +1155,7 @@ build_view_list(struct ivi_layout *layout)
 
 				weston_layer_entry_insert(&layout->layout_layer.view_list,
 							  &ivi_view->view->layer_link);
+				layout->mapped_view_count++;
 
 				ivi_view->ivisurf->surface->is_mapped = true;
 				ivi_view->view->is_mapped = true;
@@ -854,7 +1176,7 @@ commit_transition(struct ivi_layout* layout)
 
 	wl_list_init(&layout->pending_transition_list);
 
-	wl_event_source_timer_update(layout->transitions->event_source, 1);
+	ivi_layout_transition_set_schedule(layout->transitions);
 }
 
 static void
@@ -877,17 +1199,46 @@ send_prop(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_surface *ivisurf  = NULL;
 
-	wl_list_for_each_reverse(ivilayer, &layout->layer_list, link) {
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
 		if (ivilayer->prop.event_mask)
 			send_layer_prop(ivilayer);
 	}
 
-	wl_list_for_each_reverse(ivisurf, &layout->surface_list, link) {
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
 		if (ivisurf->prop.event_mask)
 			send_surface_prop(ivisurf);
 	}
 }
 
+/*
+ * What changed stays queued for one more commit, which resets
+ * prop.event_mask from the pending properties.
+ */
+static void
+clear_dirty_lists(struct ivi_layout *layout)
+{
+	struct ivi_layout_layer *ivilayer, *next_layer;
+	struct ivi_layout_surface *ivisurf, *next_surf;
+
+	wl_list_for_each_safe(ivilayer, next_layer,
+			      &layout->dirty_layer_list, dirty_link) {
+		if (ivilayer->prop.event_mask || ivilayer->pending.prop.event_mask)
+			continue;
+
+		wl_list_remove(&ivilayer->dirty_link);
+		wl_list_init(&ivilayer->dirty_link);
+	}
+
+	wl_list_for_each_safe(ivisurf, next_surf,
+			      &layout->dirty_surface_list, dirty_link) {
+		if (ivisurf->prop.event_mask || ivisurf->pending.prop.event_mask)
+			continue;
+
+		wl_list_remove(&ivisurf->dirty_link);
+		wl_list_init(&ivisurf->dirty_link);
+	}
+}
+
 static void
 clear_view_pending_list(struct ivi_layout_layer *ivilayer)
 {
@@ -1011,30 +1362,26 @@ static struct ivi_layout_layer *
 ivi_layout_get_layer_from_id(uint32_t id_layer)
 {
 	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_layer *ivilayer = NULL;
+	struct ivi_layout_id_entry *entry;
 
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
+	entry = id_map_lookup(&layout->layer_ids, id_layer);
+	if (!entry)
+		return NULL;
 
-	return NULL;
+	return container_of(entry, struct ivi_layout_layer, id_entry);
 }
 
 struct ivi_layout_surface *
 ivi_layout_get_surface_from_id(uint32_t id_surface)
 {
 	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_surface *ivisurf = NULL;
+	struct ivi_layout_id_entry *entry;
 
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
+	entry = id_map_lookup(&layout->surface_ids, id_surface);
+	if (!entry)
+		return NULL;
 
-	return NULL;
+	return container_of(entry, struct ivi_layout_surface, id_entry);
 }
 
 static int32_t
@@ -1279,7 +1626,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_layer *ivilayer = NULL;
 
-	ivilayer = get_layer(&layout->layer_list, id_layer);
+	ivilayer = ivi_layout_get_layer_from_id(id_layer);
 	if (ivilayer != NULL) {
 		weston_log("id_layer is already created\n");
 		++ivilayer->ref_count;
@@ -1292,6 +1639,13 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 		return NULL;
 	}
 
+	if (id_map_insert(&layout->layer_ids, &ivilayer->id_entry,
+			  id_layer) < 0) {
+		weston_log("fails to allocate memory\n");
+		free(ivilayer);
+		return NULL;
+	}
+
 	ivilayer->ref_count = 1;
 	wl_signal_init(&ivilayer->property_changed);
 	ivilayer->layout = layout;
@@ -1306,6 +1660,10 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	wl_list_init(&ivilayer->order.view_list);
 	wl_list_init(&ivilayer->order.link);
 
+	weston_matrix_init(&ivilayer->parent.transform.matrix);
+	wl_list_init(&ivilayer->parent.transform.link);
+
+	wl_list_init(&ivilayer->dirty_link);
 	wl_list_insert(&layout->layer_list, &ivilayer->link);
 
 	wl_signal_emit(&layout->layer_notification.created, ivilayer);
@@ -1338,6 +1696,13 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
 	wl_list_remove(&ivilayer->link);
+	wl_list_remove(&ivilayer->dirty_link);
+	id_map_remove(&layout->layer_ids, &ivilayer->id_entry);
+
+	/* destroys the view as well */
+	wl_list_remove(&ivilayer->parent.transform.link);
+	weston_surface_unref(ivilayer->parent.surface);
+	layout->view_list_dirty = true;
 
 	free(ivilayer);
 }
@@ -1361,6 +1726,8 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_VISIBILITY;
 
+	layer_mark_dirty(ivilayer);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1385,6 +1752,8 @@ ivi_layout_layer_set_opacity(struct ivi_layout_layer *ivilayer,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_OPACITY;
 
+	layer_mark_dirty(ivilayer);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1413,6 +1782,8 @@ ivi_layout_layer_set_source_rectangle(struct ivi_layout_layer *ivilayer,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_SOURCE_RECT;
 
+	layer_mark_dirty(ivilayer);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1441,6 +1812,8 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_DEST_RECT;
 
+	layer_mark_dirty(ivilayer);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1471,6 +1844,7 @@ ivi_layout_layer_set_render_order(struct ivi_layout_layer *ivilayer,
 	}
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1494,6 +1868,8 @@ ivi_layout_surface_set_visibility(struct ivi_layout_surface *ivisurf,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_VISIBILITY;
 
+	surface_mark_dirty(ivisurf);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1518,6 +1894,8 @@ ivi_layout_surface_set_opacity(struct ivi_layout_surface *ivisurf,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_OPACITY;
 
+	surface_mark_dirty(ivisurf);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1550,6 +1928,8 @@ ivi_layout_surface_set_destination_rectangle(struct ivi_layout_surface *ivisurf,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_DEST_RECT;
 
+	surface_mark_dirty(ivisurf);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1732,6 +2112,7 @@ ivi_layout_layer_add_surface(struct ivi_layout_layer *ivilayer,
 	wl_list_insert(&ivilayer->pending.view_list, &ivi_view->pending_link);
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1753,6 +2134,7 @@ ivi_layout_layer_remove_surface(struct ivi_layout_layer *ivilayer,
 		wl_list_init(&ivi_view->pending_link);
 
 		ivilayer->order.dirty = 1;
+		layer_mark_dirty(ivilayer);
 	}
 }
 
@@ -1781,6 +2163,8 @@ ivi_layout_surface_set_source_rectangle(struct ivi_layout_surface *ivisurf,
 	else
 		prop->event_mask &= ~IVI_NOTIFICATION_SOURCE_RECT;
 
+	surface_mark_dirty(ivisurf);
+
 	return IVI_SUCCEEDED;
 }
 
@@ -1798,6 +2182,7 @@ ivi_layout_commit_changes(void)
 
 	commit_changes(layout);
 	send_prop(layout);
+	clear_dirty_lists(layout);
 
 	return IVI_SUCCEEDED;
 }
@@ -1814,6 +2199,7 @@ ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 
 	ivilayer->pending.prop.transition_type = type;
 	ivilayer->pending.prop.transition_duration = duration;
+	layer_mark_dirty(ivilayer);
 
 	return 0;
 }
@@ -1831,6 +2217,7 @@ ivi_layout_layer_set_fade_info(struct ivi_layout_layer* ivilayer,
 	ivilayer->pending.prop.is_fade_in = is_fade_in;
 	ivilayer->pending.prop.start_alpha = start_alpha;
 	ivilayer->pending.prop.end_alpha = end_alpha;
+	layer_mark_dirty(ivilayer);
 
 	return 0;
 }
@@ -1848,6 +2235,7 @@ ivi_layout_surface_set_transition_duration(struct ivi_layout_surface *ivisurf,
 
 	prop = &ivisurf->pending.prop;
 	prop->transition_duration = duration*10;
+	surface_mark_dirty(ivisurf);
 	return 0;
 }
 
@@ -1874,12 +2262,23 @@ ivi_layout_surface_set_id(struct ivi_layout_surface *ivisurf,
 		return IVI_FAILED;
 	}
 
-	search_ivisurf = get_surface(&layout->surface_list, id_surface);
+	if (id_surface == IVI_INVALID_ID) {
+		weston_log("%s: invalid surface id\n", __func__);
+		return IVI_FAILED;
+	}
+
+	search_ivisurf = ivi_layout_get_surface_from_id(id_surface);
 	if (search_ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return IVI_FAILED;
 	}
 
+	if (id_map_insert(&layout->surface_ids, &ivisurf->id_entry,
+			  id_surface) < 0) {
+		weston_log("fails to allocate memory\n");
+		return IVI_FAILED;
+	}
+
 	ivisurf->id_surface = id_surface;
 
 	wl_signal_emit(&layout->surface_notification.configure_changed,
@@ -1903,6 +2302,7 @@ ivi_layout_surface_set_transition(struct ivi_layout_surface *ivisurf,
 	prop = &ivisurf->pending.prop;
 	prop->transition_type = type;
 	prop->transition_duration = duration;
+	surface_mark_dirty(ivisurf);
 	return 0;
 }
 
@@ -1946,6 +2346,15 @@ surface_create(struct weston_surface *wl_surface, uint32_t id_surface)
 		return NULL;
 	}
 
+	wl_list_init(&ivisurf->id_entry.link);
+	if (id_surface != IVI_INVALID_ID &&
+	    id_map_insert(&layout->surface_ids, &ivisurf->id_entry,
+			  id_surface) < 0) {
+		weston_log("fails to allocate memory\n");
+		free(ivisurf);
+		return NULL;
+	}
+
 	wl_signal_init(&ivisurf->property_changed);
 	ivisurf->id_surface = id_surface;
 	ivisurf->layout = layout;
@@ -1961,6 +2370,7 @@ surface_create(struct weston_surface *wl_surface, uint32_t id_surface)
 
 	wl_list_init(&ivisurf->view_list);
 
+	wl_list_init(&ivisurf->dirty_link);
 	wl_list_insert(&layout->surface_list, &ivisurf->link);
 
 	return ivisurf;
@@ -1999,6 +2409,18 @@ ivi_layout_surface_configure(struct ivi_layout_surface *ivisurf,
 			     int32_t width, int32_t height)
 {
 	struct ivi_layout *layout = get_instance();
+	struct ivi_layout_view *ivi_view;
+
+	/* Whether the source rectangle crops the surface depends on its
+	 * size, and with it whether the views can inherit the layer
+	 * transformation or need a mask of their own. */
+	wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link) {
+		if (!ivi_view_is_mapped(ivi_view))
+			continue;
+
+		update_view_transform(ivi_view);
+		weston_view_schedule_repaint(ivi_view->view);
+	}
 
 	/* emit callback which is set by ivi-layout api user */
 	wl_signal_emit(&layout->surface_notification.configure_changed,
@@ -2012,7 +2434,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_surface *ivisurf = NULL;
 
-	ivisurf = get_surface(&layout->surface_list, id_surface);
+	ivisurf = ivi_layout_get_surface_from_id(id_surface);
 	if (ivisurf) {
 		weston_log("id_surface(%d) is already created\n", id_surface);
 		return NULL;
@@ -2039,6 +2461,8 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 	wl_list_init(&layout->layer_list);
 	wl_list_init(&layout->screen_list);
 	wl_list_init(&layout->view_list);
+	wl_list_init(&layout->dirty_surface_list);
+	wl_list_init(&layout->dirty_layer_list);
 
 	wl_signal_init(&layout->layer_notification.created);
 	wl_signal_init(&layout->layer_notification.removed);
@@ -2070,6 +2494,12 @@ ivi_layout_fini(void)
 
 	weston_layer_fini(&layout->layout_layer);
 
+	id_map_release(&layout->surface_ids);
+	id_map_release(&layout->layer_ids);
+
+	ivi_layout_transition_set_destroy(layout->transitions);
+	layout->transitions = NULL;
+
 	/* XXX: tear down everything else */
 }
 
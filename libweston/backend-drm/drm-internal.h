@@ -305,6 +305,11 @@ struct drm_backend {
 	bool use_pixman;
 	bool use_pixman_shadow;
 
+	/* Never keep SHM buffers for the cursor plane past the repaint
+	 * which used them, so clients get them back right after the
+	 * renderer upload. */
+	bool early_shm_release;
+
 	struct udev_input input;
 
 	int32_t cursor_width;
@@ -318,6 +323,10 @@ struct drm_backend {
 
 	bool fb_modifiers;
 
+	/* number of atomic TEST_ONLY commits, reported per repaint in the
+	 * drm-backend debug scope */
+	uint64_t atomic_test_count;
+
 	struct weston_log_scope *debug;
 };
 
@@ -528,6 +537,13 @@ struct drm_crtc {
 	struct drm_property_info props_crtc[WDRM_CRTC__COUNT];
 };
 
+/** A view's placement in drm_output::plane_cache */
+struct drm_plane_cache_entry {
+	struct weston_view *ev;
+	struct drm_plane *plane; /**< NULL if composited by the renderer */
+	uint32_t failure_reasons; /**< try_view_on_plane_failure_reasons */
+};
+
 struct drm_output {
 	struct weston_output base;
 	struct drm_backend *backend;
@@ -574,6 +590,20 @@ struct drm_output {
 	bool virtual;
 
 	submit_frame_cb virtual_submit_frame;
+
+	/* Outcome of the last full plane assignment search, re-tested
+	 * first while the scene stays the same; see drm_assign_planes(). */
+	struct {
+		bool valid;
+		uint64_t scene_hash;
+		int mode; /**< enum drm_output_propose_state_mode */
+		struct wl_array entries; /**< struct drm_plane_cache_entry */
+	} plane_cache;
+
+	/* Formats of the dma-buf feedback scanout tranche for views on this
+	 * output's CRTC, owned by the format table; see
+	 * drm_output_get_scanout_formats_indices(). Reset with the CRTC. */
+	struct wl_array *scanout_formats_indices;
 };
 
 static inline struct drm_head *
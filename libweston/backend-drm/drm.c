@@ -167,44 +167,6 @@ drm_output_pageflip_timer_create(struct drm_output *output)
 static void
 drm_output_destroy(struct weston_output *output_base);
 
-/**
- * Returns true if the plane can be used on the given output for its current
- * repaint cycle.
- */
-bool
-drm_plane_is_available(struct drm_plane *plane, struct drm_output *output)
-{
-	assert(plane->state_cur);
-
-	if (output->virtual)
-		return false;
-
-	/* The plane still has a request not yet completed by the kernel. */
-	if (!plane->state_cur->complete)
-		return false;
-
-	/* The plane is still active on another output. */
-	if (plane->state_cur->output && plane->state_cur->output != output)
-		return false;
-
-	/* Check whether the plane can be used with this CRTC; possible_crtcs
-	 * is a bitmask of CRTC indices (pipe), rather than CRTC object ID. */
-	return !!(plane->possible_crtcs & (1 << output->crtc->pipe));
-}
-
-struct drm_crtc *
-drm_crtc_find(struct drm_backend *b, uint32_t crtc_id)
-{
-	struct drm_crtc *crtc;
-
-	wl_list_for_each(crtc, &b->crtc_list, link) {
-		if (crtc->crtc_id == crtc_id)
-			return crtc;
-	}
-
-	return NULL;
-}
-
 struct drm_head *
 drm_head_find_by_connector(struct drm_backend *backend, uint32_t connector_id)
 {
@@ -1842,6 +1804,10 @@ drm_output_detach_crtc(struct drm_output *output)
 	crtc->output = NULL;
 	output->crtc = NULL;
 
+	/* Computed for the planes of this CRTC; the format table keeps the
+	 * array itself, for whichever output gets the same planes next. */
+	output->scanout_formats_indices = NULL;
+
 	/* Force resetting unused CRTCs */
 	b->state_invalid = true;
 }
@@ -1921,6 +1887,7 @@ drm_output_deinit(struct weston_output *base)
 
 	drm_output_deinit_planes(output);
 	drm_output_detach_crtc(output);
+	output->plane_cache.valid = false;
 
 	if (output->hdr_output_metadata_blob_id) {
 		drmModeDestroyPropertyBlob(b->drm.fd,
@@ -1963,6 +1930,7 @@ drm_output_destroy(struct weston_output *base)
 
 	assert(output->hdr_output_metadata_blob_id == 0);
 
+	wl_array_release(&output->plane_cache.entries);
 	free(output);
 }
 
@@ -2325,6 +2293,7 @@ drm_output_create(struct weston_compositor *compositor, const char *name)
 	output->disable_pending = false;
 
 	output->state_cur = drm_output_state_alloc(output, NULL);
+	wl_array_init(&output->plane_cache.entries);
 
 	weston_compositor_add_pending_output(&output->base, b->compositor);
 
@@ -3101,6 +3070,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->use_pixman = config->use_pixman;
 	b->pageflip_timeout = config->pageflip_timeout;
 	b->use_pixman_shadow = config->use_pixman_shadow;
+	b->early_shm_release = !!getenv("WESTON_DRM_EARLY_SHM_RELEASE");
 
 	b->debug = weston_compositor_add_log_scope(compositor, "drm-backend",
 						   "Debug messages from DRM/KMS backend\n",
@@ -507,6 +507,44 @@ fallback:
 	return 0;
 }
 
+/**
+ * Returns true if the plane can be used on the given output for its current
+ * repaint cycle.
+ */
+bool
+drm_plane_is_available(struct drm_plane *plane, struct drm_output *output)
+{
+	assert(plane->state_cur);
+
+	if (output->virtual)
+		return false;
+
+	/* The plane still has a request not yet completed by the kernel. */
+	if (!plane->state_cur->complete)
+		return false;
+
+	/* The plane is still active on another output. */
+	if (plane->state_cur->output && plane->state_cur->output != output)
+		return false;
+
+	/* Check whether the plane can be used with this CRTC; possible_crtcs
+	 * is a bitmask of CRTC indices (pipe), rather than CRTC object ID. */
+	return !!(plane->possible_crtcs & (1 << output->crtc->pipe));
+}
+
+struct drm_crtc *
+drm_crtc_find(struct drm_backend *b, uint32_t crtc_id)
+{
+	struct drm_crtc *crtc;
+
+	wl_list_for_each(crtc, &b->crtc_list, link) {
+		if (crtc->crtc_id == crtc_id)
+			return crtc;
+	}
+
+	return NULL;
+}
+
 void
 drm_output_set_gamma(struct weston_output *output_base,
 		     uint16_t size, uint16_t *r, uint16_t *g, uint16_t *b)
@@ -1226,9 +1264,11 @@ drm_pending_state_test(struct drm_pending_state *pending_state)
 {
 	struct drm_backend *b = pending_state->backend;
 
-	if (b->atomic_modeset)
+	if (b->atomic_modeset) {
+		b->atomic_test_count++;
 		return drm_pending_state_apply_atomic(pending_state,
 						      DRM_STATE_TEST_ONLY);
+	}
 
 	/* We have no way to test state before application on the legacy
 	 * modesetting API, so just claim it succeeded. */
@@ -37,6 +37,7 @@
 #include <libweston/pixel-formats.h>
 
 #include "drm-internal.h"
+#include "shared/hash.h"
 
 #include "color.h"
 #include "linux-dmabuf.h"
@@ -80,7 +81,8 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 			     struct drm_output_state *output_state,
 			     struct weston_view *ev,
 			     enum drm_output_propose_state_mode mode,
-			     struct drm_fb *fb, uint64_t zpos)
+			     struct drm_fb *fb, uint64_t zpos,
+			     bool test_incrementally)
 {
 	struct drm_output *output = output_state->output;
 	struct weston_compositor *ec = output->base.compositor;
@@ -121,8 +123,10 @@ drm_output_try_view_on_plane(struct drm_plane *plane,
 	state->in_fence_fd = ev->surface->acquire_fence_fd;
 
 	/* In planes-only mode, we don't have an incremental state to
-	 * test against, so we just hope it'll work. */
+	 * test against, so we just hope it'll work. When re-using a cached
+	 * assignment, the whole state gets a single test at the end. */
 	if (mode != DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY &&
+	    test_incrementally &&
 	    drm_pending_state_test(output_state->pending_state) != 0) {
 		drm_debug(b, "\t\t\t[view] not placing view %p on plane %lu: "
 		             "atomic test failed\n",
@@ -322,12 +326,65 @@ drm_output_check_zpos_plane_states(struct drm_output_state *state)
 	}
 }
 
+/* The formats the planes of the output's CRTC support, as indices in the
+ * dma-buf feedback format table. The planes of a CRTC never change, so this
+ * is computed once per set of planes and then only handed out. */
+static struct wl_array *
+drm_output_get_scanout_formats_indices(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_dmabuf_feedback_format_table *format_table =
+		b->compositor->dmabuf_feedback_format_table;
+	struct weston_drm_format_array formats;
+	struct wl_array *indices;
+	struct drm_plane *plane;
+	uint64_t plane_mask = 0;
+
+	if (output->scanout_formats_indices)
+		return output->scanout_formats_indices;
+
+	/* As in get_scanout_formats(), cursor planes take no dma-bufs */
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+			continue;
+		if (!(plane->possible_crtcs & (1 << output->crtc->pipe)))
+			continue;
+		plane_mask |= 1ull << plane->plane_idx;
+	}
+
+	indices = weston_dmabuf_feedback_format_table_get_scanout_subset(format_table,
+									 plane_mask);
+	if (indices) {
+		output->scanout_formats_indices = indices;
+		return indices;
+	}
+
+	weston_drm_format_array_init(&formats);
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (!(plane_mask & (1ull << plane->plane_idx)))
+			continue;
+		if (weston_drm_format_array_join(&formats, &plane->formats) < 0)
+			goto out;
+	}
+
+	output->scanout_formats_indices =
+		weston_dmabuf_feedback_format_table_add_scanout_subset(format_table,
+								       plane_mask,
+								       &formats);
+
+out:
+	weston_drm_format_array_fini(&formats);
+	return output->scanout_formats_indices;
+}
+
 static bool
-dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
+dmabuf_feedback_maybe_update(struct drm_output *output, struct weston_view *ev,
 			     uint32_t try_view_on_plane_failure_reasons)
 {
+	struct drm_backend *b = output->backend;
 	struct weston_dmabuf_feedback *dmabuf_feedback = ev->surface->dmabuf_feedback;
 	struct weston_dmabuf_feedback_tranche *scanout_tranche;
+	struct wl_array *scanout_indices;
 	dev_t scanout_dev = b->drm.devnum;
 	uint32_t scanout_flags = ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT;
 	uint32_t action_needed = ACTION_NEEDED_NONE;
@@ -362,10 +419,24 @@ dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
 		scanout_tranche->active = false;
 	}
 
+	/* Only the primary output of the surface decides which planes the
+	 * tranche is about, so that views across outputs do not flip it back
+	 * and forth. Falls back to the planes of all outputs. */
+	scanout_indices = scanout_tranche->formats_indices;
+	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE &&
+	    ev->surface->output == &output->base) {
+		struct wl_array *output_indices =
+			drm_output_get_scanout_formats_indices(output);
+
+		if (output_indices)
+			scanout_indices = output_indices;
+	}
+
 	/* No actions needed, so disarm timer and return */
 	if (action_needed == ACTION_NEEDED_NONE ||
 	    (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE &&
-	     scanout_tranche->active) ||
+	     scanout_tranche->active &&
+	     scanout_tranche->formats_indices == scanout_indices) ||
 	    (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE &&
 	     !scanout_tranche->active)) {
 		dmabuf_feedback->action_needed = ACTION_NEEDED_NONE;
@@ -400,9 +471,10 @@ dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
 	/* If we got here it means that the timer has triggered, so we have
 	 * pending actions with the dma-buf feedback. So we update and resend
 	 * them. */
-	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE)
+	if (action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE) {
+		scanout_tranche->formats_indices = scanout_indices;
 		scanout_tranche->active = true;
-	else if (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE)
+	} else if (action_needed == ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE)
 		scanout_tranche->active = false;
 	else
 		assert(0);
@@ -418,12 +490,34 @@ dmabuf_feedback_maybe_update(struct drm_backend *b, struct weston_view *ev,
 	return true;
 }
 
+/** Whether the cursor plane can show the current content of a SHM view
+ *
+ * With early SHM release the buffer is handed back to the client as soon
+ * as the renderer is done with it, and nobody holds it until the next
+ * commit: the client may already be drawing into it again. Only content
+ * copied into the cursor BO before, with no damage since, can be used.
+ */
+static bool
+drm_output_cursor_content_available(struct drm_output *output,
+				    struct weston_view *ev)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+
+	if (!b->early_shm_release || buffer->busy_count > 0)
+		return true;
+
+	return ev == output->cursor_view &&
+	       !pixman_region32_not_empty(&ev->surface->damage);
+}
+
 static struct drm_plane_state *
 drm_output_find_plane_for_view(struct drm_output_state *state,
 			       struct weston_paint_node *pnode,
 			       enum drm_output_propose_state_mode mode,
 			       struct drm_plane_state *scanout_state,
-			       uint64_t current_lowest_zpos)
+			       uint64_t current_lowest_zpos,
+			       struct drm_plane *only_plane)
 {
 	struct drm_output *output = state->output;
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
@@ -480,6 +574,14 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			return NULL;
 		}
 
+		if (!drm_output_cursor_content_available(output, ev)) {
+			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
+				     "(SHM buffer already released)\n", ev);
+			pnode->try_view_on_plane_failure_reasons |=
+				FAILURE_REASONS_NO_BUFFER;
+			return NULL;
+		}
+
 		possible_plane_mask = (1 << output->cursor_plane->plane_idx);
 	} else {
 		if (mode == DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY) {
@@ -518,6 +620,9 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 
 		possible_plane_mask &= ~(1 << plane->plane_idx);
 
+		if (only_plane && plane != only_plane)
+			continue;
+
 		switch (plane->type) {
 		case WDRM_PLANE_TYPE_CURSOR:
 			assert(buffer->shm_buffer);
@@ -599,7 +704,8 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 			ps = drm_output_prepare_cursor_view(state, ev, zpos);
 		} else {
 			ps = drm_output_try_view_on_plane(plane, state, ev,
-							  mode, fb, zpos);
+							  mode, fb, zpos,
+							  only_plane == NULL);
 		}
 
 		if (ps) {
@@ -625,16 +731,335 @@ drm_output_find_plane_for_view(struct drm_output_state *state,
 	return ps;
 }
 
+static const struct drm_plane_cache_entry *
+drm_output_plane_cache_find(struct drm_output *output, struct weston_view *ev)
+{
+	const struct drm_plane_cache_entry *entry;
+
+	wl_array_for_each(entry, &output->plane_cache.entries) {
+		if (entry->ev == ev)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/** A view competing for the planes left over in mixed mode */
+struct drm_offload_candidate {
+	struct weston_paint_node *pnode;
+	pixman_region32_t clipped_view;
+	uint64_t benefit; /**< composition bytes avoided per second */
+	bool eligible; /**< could go on a plane at all */
+	bool cursor; /**< needs the cursor plane rather than an overlay */
+	bool offload; /**< picked by drm_output_pick_offload_views() */
+};
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *boxes;
+	uint64_t area = 0;
+	int n_boxes, i;
+
+	boxes = pixman_region32_rectangles(region, &n_boxes);
+	for (i = 0; i < n_boxes; i++) {
+		area += (uint64_t) (boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+	}
+
+	return area;
+}
+
+/** Whether nothing but the plane search itself keeps a view off planes
+ *
+ * The quiet counterpart of the force_renderer checks in
+ * drm_output_propose_state(); @param cursor is set for SHM buffers, which
+ * can only ever go on the cursor plane.
+ */
+static bool
+drm_output_view_may_use_plane(struct drm_output *output,
+			      struct weston_paint_node *pnode, bool *cursor)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_view *ev = pnode->view;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+
+	if (ev->output_mask != (1u << output->base.id) || !b->gbm ||
+	    !weston_view_has_valid_buffer(ev) ||
+	    buffer->type == WESTON_BUFFER_SOLID ||
+	    pnode->surf_xform.transform != NULL ||
+	    !pnode->surf_xform.identity_pipeline)
+		return false;
+
+	if (ev->surface->protection_mode == WESTON_SURFACE_PROTECTION_MODE_ENFORCED &&
+	    ev->surface->desired_protection > output->base.current_protection)
+		return false;
+
+	*cursor = (buffer->type == WESTON_BUFFER_SHM);
+	if (*cursor) {
+		return output->cursor_plane && !b->cursors_are_broken &&
+		       buffer->pixel_format->format == DRM_FORMAT_ARGB8888 &&
+		       buffer->width <= b->cursor_width &&
+		       buffer->height <= b->cursor_height &&
+		       drm_output_cursor_content_available(output, ev);
+	}
+
+	return true;
+}
+
+/** Decide which views are worth the planes available in mixed mode
+ *
+ * Walking the views top to bottom and taking planes first come, first
+ * served spends them on whatever happens to be on top, often small
+ * popups, and leaves e.g. a large video below on the renderer. Instead,
+ * estimate how many bytes the renderer would read and write per second to
+ * composite each view, from its visible area and how often and how much
+ * of it changes, and hand out the planes to the views saving most per
+ * plane used.
+ *
+ * A view can only go on a plane if every view above overlapping it does
+ * too, so views are picked together with those; a view which needs a
+ * view that cannot use a plane at all is never picked. The plane search
+ * still has the last word: a picked view the kernel does not accept ends
+ * up on the renderer as before.
+ *
+ * @param candidates Filled with struct drm_offload_candidate, one per
+ * view not entirely occluded on the output, top to bottom.
+ */
+static void
+drm_output_pick_offload_views(struct drm_output *output,
+			      struct drm_plane_state *scanout_state,
+			      struct wl_array *candidates)
+{
+	struct drm_backend *b = output->backend;
+	struct drm_offload_candidate *cand, *c;
+	struct weston_paint_node *pnode;
+	struct drm_plane *plane;
+	pixman_region32_t occluded_region;
+	pixman_region32_t region;
+	struct wl_array needs_array;
+	bool *needs;
+	unsigned int free_overlays = 0;
+	unsigned int free_cursors = 0;
+	uint64_t dst_bpp;
+	size_t n, i, j;
+
+	dst_bpp = scanout_state->fb->format->bpp ?: 32;
+
+	pixman_region32_init(&occluded_region);
+	pixman_region32_init(&region);
+
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_buffer *buffer;
+		uint64_t src_bpp;
+		float redraws;
+
+		if (!(ev->output_mask & (1u << output->base.id)) ||
+		    !pnode->surf_xform_valid)
+			continue;
+
+		/* same occlusion test as drm_output_propose_state() */
+		pixman_region32_intersect(&region, &ev->transform.boundingbox,
+					  &output->base.region);
+		pixman_region32_subtract(&region, &region, &occluded_region);
+		if (!pixman_region32_not_empty(&region))
+			continue;
+
+		cand = wl_array_add(candidates, sizeof *cand);
+		if (!cand)
+			break;
+		cand->pnode = pnode;
+		cand->offload = false;
+		cand->cursor = false;
+		cand->eligible = drm_output_view_may_use_plane(output, pnode,
+							       &cand->cursor);
+
+		/* The renderer reads the visible part of the buffer and
+		 * writes it into its framebuffer. Planar YUV formats have no
+		 * bpp; 16 is close enough for them. */
+		buffer = ev->surface->buffer_ref.buffer;
+		src_bpp = 16;
+		if (buffer && buffer->pixel_format && buffer->pixel_format->bpp)
+			src_bpp = buffer->pixel_format->bpp;
+
+		/* It does so for the damaged part on every update, which
+		 * comes down to this many full redraws a second; count at
+		 * least one, so that idle views still rank by size. */
+		redraws = pnode->update_rate;
+		if (ev->surface->width > 0 && ev->surface->height > 0)
+			redraws *= MIN(pnode->damage_area /
+				       ((float) ev->surface->width *
+					ev->surface->height), 1.0f);
+		if (output->base.current_mode->refresh > 0)
+			redraws = MIN(redraws,
+				      output->base.current_mode->refresh / 1000.0f);
+		redraws = MAX(redraws, 1.0f);
+
+		cand->benefit = region_area(&region) * (src_bpp + dst_bpp) / 8 *
+				redraws;
+
+		pixman_region32_init(&cand->clipped_view);
+		pixman_region32_intersect(&cand->clipped_view,
+					  &ev->transform.boundingbox,
+					  &output->base.region);
+
+		pixman_region32_copy(&region, &cand->clipped_view);
+		if (!weston_view_is_opaque(ev, &region))
+			pixman_region32_intersect(&region, &region,
+						  &ev->transform.opaque);
+		pixman_region32_union(&occluded_region, &occluded_region,
+				      &region);
+	}
+	pixman_region32_fini(&occluded_region);
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY &&
+		    plane->zpos_max > scanout_state->zpos &&
+		    drm_plane_is_available(plane, output))
+			free_overlays++;
+	}
+	if (output->cursor_plane && !b->cursors_are_broken)
+		free_cursors = 1;
+
+	/* needs[i * n + j]: view j must be on a plane for view i to be */
+	cand = candidates->data;
+	n = candidates->size / sizeof *cand;
+	wl_array_init(&needs_array);
+	if (n == 0)
+		goto out;
+	needs = wl_array_add(&needs_array, n * n * sizeof *needs);
+	if (!needs) {
+		/* keep the plain top-down search */
+		for (i = 0; i < n; i++)
+			cand[i].offload = cand[i].eligible;
+		goto out;
+	}
+	memset(needs, 0, n * n * sizeof *needs);
+
+	for (i = 0; i < n; i++) {
+		needs[i * n + i] = true;
+		pixman_region32_copy(&region, &cand[i].clipped_view);
+		for (j = i; j-- > 0; ) {
+			pixman_region32_t overlap;
+			bool overlaps;
+
+			pixman_region32_init(&overlap);
+			pixman_region32_intersect(&overlap, &region,
+						  &cand[j].clipped_view);
+			overlaps = pixman_region32_not_empty(&overlap);
+			pixman_region32_fini(&overlap);
+			if (!overlaps)
+				continue;
+
+			needs[i * n + j] = true;
+			pixman_region32_union(&region, &region,
+					      &cand[j].clipped_view);
+		}
+	}
+
+	/* greedily take the group saving the most bytes per plane */
+	for (;;) {
+		uint64_t best_benefit = 0;
+		unsigned int best_planes = 0;
+		size_t best = n;
+
+		for (i = 0; i < n; i++) {
+			unsigned int overlays = 0, cursors = 0;
+			uint64_t benefit = 0;
+			bool possible = cand[i].eligible && !cand[i].offload;
+
+			for (j = 0; j < n && possible; j++) {
+				if (!needs[i * n + j] || cand[j].offload)
+					continue;
+
+				possible = cand[j].eligible;
+				benefit += cand[j].benefit;
+				if (cand[j].cursor)
+					cursors++;
+				else
+					overlays++;
+			}
+
+			if (!possible || overlays > free_overlays ||
+			    cursors > free_cursors)
+				continue;
+
+			if (best == n ||
+			    benefit * best_planes >
+			    best_benefit * (overlays + cursors)) {
+				best = i;
+				best_benefit = benefit;
+				best_planes = overlays + cursors;
+			}
+		}
+
+		if (best == n)
+			break;
+
+		for (j = 0; j < n; j++) {
+			if (!needs[best * n + j] || cand[j].offload)
+				continue;
+
+			cand[j].offload = true;
+			if (cand[j].cursor)
+				free_cursors--;
+			else
+				free_overlays--;
+		}
+	}
+
+out:
+	wl_array_for_each(c, candidates) {
+		drm_debug(b, "\t\t\t[view] view %p: %"PRIu64" bytes per second "
+			     "to composite at %.1f updates per second, %s\n",
+			  c->pnode->view, c->benefit, c->pnode->update_rate,
+			  c->offload ? "trying planes" :
+			  c->eligible ? "left to the renderer" :
+					"cannot use planes");
+	}
+
+	wl_array_release(&needs_array);
+	pixman_region32_fini(&region);
+}
+
+static bool
+drm_offload_candidates_skip(struct wl_array *candidates,
+			    struct weston_paint_node *pnode)
+{
+	struct drm_offload_candidate *cand;
+
+	wl_array_for_each(cand, candidates) {
+		if (cand->pnode == pnode)
+			return !cand->offload;
+	}
+
+	return false;
+}
+
+static void
+drm_offload_candidates_release(struct wl_array *candidates)
+{
+	struct drm_offload_candidate *cand;
+
+	wl_array_for_each(cand, candidates)
+		pixman_region32_fini(&cand->clipped_view);
+	wl_array_release(candidates);
+}
+
 static struct drm_output_state *
 drm_output_propose_state(struct weston_output *output_base,
 			 struct drm_pending_state *pending_state,
-			 enum drm_output_propose_state_mode mode)
+			 enum drm_output_propose_state_mode mode,
+			 bool use_plane_cache)
 {
 	struct drm_output *output = to_drm_output(output_base);
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
 	struct weston_paint_node *pnode;
 	struct drm_output_state *state;
 	struct drm_plane_state *scanout_state = NULL;
+	struct wl_array candidates;
 
 	pixman_region32_t renderer_region;
 	pixman_region32_t occluded_region;
@@ -707,6 +1132,12 @@ drm_output_propose_state(struct weston_output *output_base,
 	pixman_region32_init(&renderer_region);
 	pixman_region32_init(&occluded_region);
 
+	/* A cached assignment already says which views use planes. */
+	wl_array_init(&candidates);
+	if (mode == DRM_OUTPUT_PROPOSE_STATE_MIXED && !use_plane_cache)
+		drm_output_pick_offload_views(output, scanout_state,
+					      &candidates);
+
 	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
 			 z_order_link) {
 		struct weston_view *ev = pnode->view;
@@ -818,13 +1249,55 @@ drm_output_propose_state(struct weston_output *output_base,
 			force_renderer = true;
 		}
 
-		/* Now try to place it on a plane if we can. */
-		if (!force_renderer) {
+		/* Re-use the placement from the last full search, if
+		 * asked to; a view it does not know means the scene changed. */
+		if (use_plane_cache && !force_renderer) {
+			const struct drm_plane_cache_entry *entry;
+
+			entry = drm_output_plane_cache_find(output, ev);
+			if (!entry) {
+				drm_debug(b, "\t\t[view] failing state generation: "
+					     "view %p not in plane cache\n", ev);
+				pixman_region32_fini(&clipped_view);
+				goto err_region;
+			}
+
+			if (entry->plane) {
+				ps = drm_output_find_plane_for_view(state, pnode,
+								    mode,
+								    scanout_state,
+								    current_lowest_zpos,
+								    entry->plane);
+				/* The plane went away or cannot take the view
+				 * any more: not a reason to fall back to the
+				 * renderer, the full search may still find
+				 * another plane. */
+				if (!ps) {
+					drm_debug(b, "\t\t[view] failing state generation: "
+						     "cached plane %u unusable for view %p\n",
+						  entry->plane->plane_id, ev);
+					pixman_region32_fini(&clipped_view);
+					goto err_region;
+				}
+			} else {
+				pnode->try_view_on_plane_failure_reasons =
+					entry->failure_reasons;
+			}
+		} else if (!force_renderer &&
+			   drm_offload_candidates_skip(&candidates, pnode)) {
+			drm_debug(b, "\t\t\t\t[view] not assigning view %p to plane "
+				     "(planes kept for views saving more composition)\n",
+				  ev);
+			pnode->try_view_on_plane_failure_reasons =
+				FAILURE_REASONS_NO_PLANES_AVAILABLE;
+		} else if (!force_renderer) {
+			/* Now try to place it on a plane if we can. */
 			drm_debug(b, "\t\t\t[plane] started with zpos %"PRIu64"\n",
 				      current_lowest_zpos);
 			ps = drm_output_find_plane_for_view(state, pnode, mode,
 							    scanout_state,
-							    current_lowest_zpos);
+							    current_lowest_zpos,
+							    NULL);
 		} else {
 			/* We are forced to place the view in the renderer, set
 			 * the failure reason accordingly. */
@@ -871,6 +1344,7 @@ drm_output_propose_state(struct weston_output *output_base,
 
 	pixman_region32_fini(&renderer_region);
 	pixman_region32_fini(&occluded_region);
+	drm_offload_candidates_release(&candidates);
 
 	/* In renderer-only mode, we can't test the state as we don't have a
 	 * renderer buffer yet. */
@@ -902,11 +1376,76 @@ drm_output_propose_state(struct weston_output *output_base,
 err_region:
 	pixman_region32_fini(&renderer_region);
 	pixman_region32_fini(&occluded_region);
+	drm_offload_candidates_release(&candidates);
 err:
 	drm_output_state_free(state);
 	return NULL;
 }
 
+/* Updates per second from which a surface is assumed to be playing video
+ * or an animation, rather than just occasionally changing. */
+#define DRM_BUSY_UPDATE_RATE 20.0f
+
+/** Fingerprint everything drm_output_propose_state() bases its decisions on
+ *
+ * Buffer contents and the buffer objects themselves are left out, so that a
+ * client merely updating its content keeps the same fingerprint; their
+ * size, format and modifier are included.
+ */
+static uint64_t
+drm_output_scene_hash(struct drm_output *output)
+{
+	struct drm_backend *b = output->backend;
+	struct weston_paint_node *pnode;
+	uint64_t hash = FNV1A_64_INIT;
+
+	hash = fnv1a_64_value(hash, output->base.current_mode);
+	hash = fnv1a_64_value(hash, output->base.current_protection);
+	hash = fnv1a_64_value(hash, b->cursors_are_broken);
+
+	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
+			 z_order_link) {
+		struct weston_view *ev = pnode->view;
+		struct weston_surface *surface = ev->surface;
+		struct weston_buffer *buffer = surface->buffer_ref.buffer;
+		bool has_fence = surface->acquire_fence_fd >= 0;
+		bool identity = pnode->surf_xform.transform == NULL &&
+				pnode->surf_xform.identity_pipeline;
+		/* rate changes within a class keep the cached assignment */
+		bool busy = pnode->update_rate >= DRM_BUSY_UPDATE_RATE;
+
+		hash = fnv1a_64_value(hash, ev);
+		hash = fnv1a_64_value(hash, ev->output_mask);
+		hash = fnv1a_64_value(hash, ev->alpha);
+		hash = fnv1a_64_value(hash,
+			*pixman_region32_extents(&ev->transform.boundingbox));
+		hash = fnv1a_64_value(hash,
+			*pixman_region32_extents(&ev->transform.opaque));
+		hash = fnv1a_64_value(hash, ev->transform.enabled);
+		if (ev->transform.enabled)
+			hash = fnv1a_64_value(hash, ev->transform.matrix.d);
+		hash = fnv1a_64_value(hash, pnode->surf_xform_valid);
+		hash = fnv1a_64_value(hash, identity);
+		hash = fnv1a_64_value(hash, surface->buffer_viewport.buffer);
+		hash = fnv1a_64_value(hash, surface->buffer_viewport.surface);
+		hash = fnv1a_64_value(hash, has_fence);
+		hash = fnv1a_64_value(hash, busy);
+		hash = fnv1a_64_value(hash, surface->protection_mode);
+		hash = fnv1a_64_value(hash, surface->desired_protection);
+
+		if (!buffer)
+			continue;
+
+		hash = fnv1a_64_value(hash, buffer->type);
+		hash = fnv1a_64_value(hash, buffer->width);
+		hash = fnv1a_64_value(hash, buffer->height);
+		hash = fnv1a_64_value(hash, buffer->pixel_format);
+		hash = fnv1a_64_value(hash, buffer->format_modifier);
+	}
+
+	return hash;
+}
+
 void
 drm_assign_planes(struct weston_output *output_base)
 {
@@ -918,20 +1457,48 @@ drm_assign_planes(struct weston_output *output_base)
 	struct weston_paint_node *pnode;
 	struct weston_plane *primary = &output_base->compositor->primary_plane;
 	enum drm_output_propose_state_mode mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+	uint64_t test_count = b->atomic_test_count;
+	uint64_t scene_hash = 0;
+	bool from_cache = false;
 
 	drm_debug(b, "\t[repaint] preparing state for output %s (%lu)\n",
 		  output_base->name, (unsigned long) output_base->id);
 
 	if (!b->sprites_are_broken && !output->virtual && b->gbm) {
-		drm_debug(b, "\t[repaint] trying planes-only build state\n");
-		state = drm_output_propose_state(output_base, pending_state, mode);
+		scene_hash = drm_output_scene_hash(output);
+
+		/* Nothing but content changed: the last outcome of the full
+		 * search below most likely still works. */
+		if (output->plane_cache.valid && !b->state_invalid &&
+		    output->plane_cache.scene_hash == scene_hash) {
+			mode = output->plane_cache.mode;
+			drm_debug(b, "\t[repaint] scene unchanged, re-testing "
+				     "cached %s\n",
+				  drm_propose_state_mode_to_string(mode));
+			state = drm_output_propose_state(output_base,
+							 pending_state, mode,
+							 true);
+			from_cache = (state != NULL);
+			if (!state) {
+				drm_debug(b, "\t[repaint] cached state "
+					     "rejected, searching again\n");
+				mode = DRM_OUTPUT_PROPOSE_STATE_PLANES_ONLY;
+			}
+		}
+
+		if (!state) {
+			drm_debug(b, "\t[repaint] trying planes-only build state\n");
+			state = drm_output_propose_state(output_base,
+							 pending_state, mode,
+							 false);
+		}
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build planes-only "
 				     "state, trying mixed\n");
 			mode = DRM_OUTPUT_PROPOSE_STATE_MIXED;
 			state = drm_output_propose_state(output_base,
 							 pending_state,
-							 mode);
+							 mode, false);
 		}
 		if (!state) {
 			drm_debug(b, "\t[repaint] could not build mixed-mode "
@@ -944,17 +1511,31 @@ drm_assign_planes(struct weston_output *output_base)
 	if (!state) {
 		mode = DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY;
 		state = drm_output_propose_state(output_base, pending_state,
-						 mode);
+						 mode, false);
 	}
 
 	assert(state);
-	drm_debug(b, "\t[repaint] Using %s composition\n",
-		  drm_propose_state_mode_to_string(mode));
+	drm_debug(b, "\t[repaint] Using %s composition%s, %" PRIu64 " "
+		     "atomic TEST_ONLY commit(s)\n",
+		  drm_propose_state_mode_to_string(mode),
+		  from_cache ? " (cached)" : "",
+		  b->atomic_test_count - test_count);
+
+	/* Remember a successful search; renderer-only needs no tests, so
+	 * there is nothing to save there. */
+	if (!from_cache) {
+		output->plane_cache.valid =
+			(mode != DRM_OUTPUT_PROPOSE_STATE_RENDERER_ONLY);
+		output->plane_cache.scene_hash = scene_hash;
+		output->plane_cache.mode = mode;
+		output->plane_cache.entries.size = 0;
+	}
 
 	wl_list_for_each(pnode, &output->base.paint_node_z_order_list,
 			 z_order_link) {
 		struct weston_view *ev = pnode->view;
 		struct drm_plane *target_plane = NULL;
+		struct drm_plane_cache_entry *cache_entry = NULL;
 
 		/* If this view doesn't touch our output at all, there's no
 		 * reason to do anything with it. */
@@ -962,14 +1543,31 @@ drm_assign_planes(struct weston_output *output_base)
 		if (!(ev->output_mask & (1u << output->base.id)))
 			continue;
 
+		/* Keep the placement and failure reasons for the cache;
+		 * the plane gets filled in below. */
+		if (!from_cache && output->plane_cache.valid) {
+			cache_entry = wl_array_add(&output->plane_cache.entries,
+						   sizeof(*cache_entry));
+			if (cache_entry) {
+				cache_entry->ev = ev;
+				cache_entry->plane = NULL;
+				cache_entry->failure_reasons =
+					pnode->try_view_on_plane_failure_reasons;
+			} else {
+				output->plane_cache.valid = false;
+			}
+		}
+
 		/* Update dmabuf-feedback if needed */
 		if (ev->surface->dmabuf_feedback)
-			dmabuf_feedback_maybe_update(b, ev,
+			dmabuf_feedback_maybe_update(output, ev,
 						     pnode->try_view_on_plane_failure_reasons);
 		pnode->try_view_on_plane_failure_reasons = FAILURE_REASONS_NONE;
 
 		/* Test whether this buffer can ever go into a plane:
-		 * non-shm, or small enough to be a cursor.
+		 * non-shm, or small enough to be a cursor. With early SHM
+		 * release, SHM buffers are never kept; the cursor plane then
+		 * only picks them up while they are still held anyway.
 		 *
 		 * Also, keep a reference when using the pixman renderer.
 		 * That makes it possible to do a seamless switch to the GL
@@ -984,6 +1582,7 @@ drm_assign_planes(struct weston_output *output_base)
 			    buffer->type == WESTON_BUFFER_RENDERER_OPAQUE)
 				ev->surface->keep_buffer = true;
 			else if (buffer->type == WESTON_BUFFER_SHM &&
+				 !b->early_shm_release &&
 				 (ev->surface->width <= b->cursor_width &&
 		       		  ev->surface->height <= b->cursor_height))
 				ev->surface->keep_buffer = true;
@@ -1002,6 +1601,9 @@ drm_assign_planes(struct weston_output *output_base)
 			}
 		}
 
+		if (cache_entry)
+			cache_entry->plane = target_plane;
+
 		if (target_plane) {
 			drm_debug(b, "\t[repaint] view %p on %s plane %lu\n",
 				  ev, plane_type_enums[target_plane->type].name,
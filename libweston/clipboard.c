@@ -25,21 +25,32 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/uio.h>
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+
+/* The most moved per wakeup, from the selection or to a paste */
+#define CLIPBOARD_CHUNK_SIZE (1024 * 1024)
 
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	/* the selection as read so far, kept out of the heap */
+	int contents_fd;
+	off_t contents_size;
+	/* struct clipboard_client::link, caught up and waiting for more */
+	struct wl_list waiting_clients;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -54,6 +65,13 @@ struct clipboard {
 	struct clipboard_source *source;
 };
 
+struct clipboard_client {
+	struct wl_event_source *event_source;
+	struct wl_list link;
+	off_t offset;
+	struct clipboard_source *source;
+};
+
 static void clipboard_client_create(struct clipboard_source *source, int fd);
 
 static void
@@ -74,35 +92,83 @@ clipboard_source_unref(struct clipboard_source *source)
 	s = source->base.mime_types.data;
 	free(*s);
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
+	close(source->contents_fd);
 	free(source);
 }
 
+static int
+clipboard_create_contents_file(void)
+{
+#ifdef HAVE_MEMFD_CREATE
+	return memfd_create("weston-clipboard", MFD_CLOEXEC);
+#else
+	/* The size only preallocates, contents_size says what is valid */
+	return os_create_anonymous_file(CLIPBOARD_CHUNK_SIZE);
+#endif
+}
+
+/** Append what the selection has to offer to the contents file
+ *
+ * Splices straight from the pipe when the file allows it, the data never
+ * enters userspace then.
+ */
+static ssize_t
+clipboard_source_fill(struct clipboard_source *source, int fd)
+{
+	char buffer[4096];
+	loff_t offset = source->contents_size;
+	ssize_t len;
+
+	len = splice(fd, NULL, source->contents_fd, &offset,
+		     CLIPBOARD_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0 && errno == EINVAL) {
+		len = read(fd, buffer, sizeof buffer);
+		if (len > 0 && pwrite(source->contents_fd, buffer, len,
+				      offset) != len)
+			len = -1;
+	}
+
+	if (len > 0)
+		source->contents_size += len;
+
+	return len;
+}
+
+static void
+clipboard_source_wake_clients(struct clipboard_source *source)
+{
+	struct clipboard_client *client, *tmp;
+
+	wl_list_for_each_safe(client, tmp, &source->waiting_clients, link) {
+		wl_list_remove(&client->link);
+		wl_list_init(&client->link);
+		wl_event_source_fd_update(client->event_source,
+					  WL_EVENT_WRITABLE);
+	}
+}
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	ssize_t len;
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
-	}
+	len = clipboard_source_fill(source, fd);
+	if (len < 0 && errno == EAGAIN)
+		return 1;
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
-	if (len == 0) {
+	if (len <= 0) {
 		wl_event_source_remove(source->event_source);
 		close(fd);
 		source->event_source = NULL;
-	} else if (len < 0) {
+	}
+
+	clipboard_source_wake_clients(source);
+
+	if (len < 0) {
 		clipboard_source_unref(source);
 		clipboard->source = NULL;
-	} else {
-		source->contents.size += len;
 	}
 
 	return 1;
@@ -147,7 +213,11 @@ clipboard_source_create(struct clipboard *clipboard,
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	source->contents_fd = clipboard_create_contents_file();
+	if (source->contents_fd < 0)
+		goto err_contents;
+
+	wl_list_init(&source->waiting_clients);
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -178,36 +248,74 @@ clipboard_source_create(struct clipboard *clipboard,
  err_strdup:
 	wl_array_release(&source->base.mime_types);
  err_add:
+	close(source->contents_fd);
+ err_contents:
 	free(source);
 
 	return NULL;
 }
 
-struct clipboard_client {
-	struct wl_event_source *event_source;
-	size_t offset;
-	struct clipboard_source *source;
-};
+/** Pass the next piece of the contents on to a paste
+ *
+ * sendfile() copies inside the kernel, falling back to a bounce buffer
+ * for the file descriptors it can't write to.
+ *
+ * \return The number of bytes written, 0 if the paste can't take any
+ * right now, or -1 on error.
+ */
+static ssize_t
+clipboard_client_send(struct clipboard_client *client, int fd)
+{
+	struct clipboard_source *source = client->source;
+	char buffer[4096];
+	size_t size;
+	ssize_t len;
+
+	size = MIN(source->contents_size - client->offset,
+		   CLIPBOARD_CHUNK_SIZE);
+	len = sendfile(fd, source->contents_fd, &client->offset, size);
+	if (len < 0 && (errno == EINVAL || errno == ENOSYS)) {
+		len = pread(source->contents_fd, buffer,
+			    MIN(size, sizeof buffer), client->offset);
+		if (len > 0)
+			len = write(fd, buffer, len);
+		if (len > 0)
+			client->offset += len;
+	}
+
+	if (len < 0 && errno == EAGAIN)
+		return 0;
+
+	return len;
+}
+
+static void
+clipboard_client_destroy(struct clipboard_client *client, int fd)
+{
+	close(fd);
+	wl_list_remove(&client->link);
+	wl_event_source_remove(client->event_source);
+	clipboard_source_unref(client->source);
+	free(client);
+}
 
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
-	size_t size;
-	int len;
-
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
-	if (len > 0)
-		client->offset += len;
-
-	if (client->offset == size || len <= 0) {
-		close(fd);
-		wl_event_source_remove(client->event_source);
-		clipboard_source_unref(client->source);
-		free(client);
+	struct clipboard_source *source = client->source;
+	ssize_t len = 0;
+
+	if (client->offset < source->contents_size)
+		len = clipboard_client_send(client, fd);
+
+	if (len < 0 || (client->offset == source->contents_size &&
+			source->event_source == NULL)) {
+		clipboard_client_destroy(client, fd);
+	} else if (client->offset == source->contents_size) {
+		/* Caught up while the selection is still being read */
+		wl_event_source_fd_update(client->event_source, 0);
+		wl_list_insert(&source->waiting_clients, &client->link);
 	}
 
 	return 1;
@@ -225,6 +333,10 @@ clipboard_client_create(struct clipboard_source *source, int fd)
 	if (client == NULL)
 		return;
 
+	/* Never block the compositor on a slow paste */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	wl_list_init(&client->link);
 	client->source = source;
 	source->refcount++;
 	client->event_source =
@@ -55,6 +55,7 @@
 #include <drm_fourcc.h>
 
 #include "timeline.h"
+#include "event-capture.h"
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -3038,6 +3039,67 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+/* Weight of the newest sample in the running averages. */
+#define UPDATE_STATS_WEIGHT (1.0f / 8.0f)
+/* Anything slower than this counts as rarely changing, no need to tell
+ * how rarely; it also keeps the average quick to follow a video start. */
+#define UPDATE_STATS_MAX_INTERVAL_MS 1000.0f
+
+static void
+weston_surface_update_stats_record(struct weston_surface *surface,
+				   pixman_region32_t *damage)
+{
+	struct weston_surface_update_stats *stats = &surface->update_stats;
+	pixman_box32_t *boxes;
+	struct timespec now;
+	float interval_ms;
+	float area = 0.0f;
+	int n_boxes, i;
+
+	weston_compositor_read_presentation_clock(surface->compositor, &now);
+
+	boxes = pixman_region32_rectangles(damage, &n_boxes);
+	for (i = 0; i < n_boxes; i++) {
+		area += (float) (boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+	}
+
+	if (stats->updates == 0) {
+		stats->interval_ms = UPDATE_STATS_MAX_INTERVAL_MS;
+		stats->damage_area = area;
+	} else {
+		interval_ms = timespec_sub_to_nsec(&now, &stats->last_update) /
+			      1e6f;
+		interval_ms = MIN(interval_ms, UPDATE_STATS_MAX_INTERVAL_MS);
+		stats->interval_ms += (interval_ms - stats->interval_ms) *
+				      UPDATE_STATS_WEIGHT;
+		stats->damage_area += (area - stats->damage_area) *
+				      UPDATE_STATS_WEIGHT;
+	}
+
+	stats->last_update = now;
+	stats->updates++;
+}
+
+/** Content updates per second a surface currently commits
+ *
+ * The time since the last update bounds the average interval from below,
+ * so that a surface which stopped updating does not keep its old rate.
+ */
+static float
+weston_surface_update_stats_rate(const struct weston_surface_update_stats *stats,
+				 const struct timespec *now)
+{
+	float since_ms;
+
+	if (stats->updates == 0)
+		return 0.0f;
+
+	since_ms = timespec_sub_to_nsec(now, &stats->last_update) / 1e6f;
+
+	return 1000.0f / MAX(MAX(stats->interval_ms, since_ms), 1.0f);
+}
+
 static int
 weston_output_repaint(struct weston_output *output)
 {
@@ -3050,6 +3112,7 @@ weston_output_repaint(struct weston_output *output)
 	int r;
 	uint32_t frame_time_msec;
 	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	struct timespec now;
 
 	if (output->destroying)
 		return 0;
@@ -3059,13 +3122,24 @@ weston_output_repaint(struct weston_output *output)
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec, output);
 
+	output->perf.repaints++;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+
 	/* Find the highest protection desired for an output */
 	wl_list_for_each(pnode, &output->paint_node_z_order_list,
 			 z_order_link) {
+		pnode->update_rate =
+			weston_surface_update_stats_rate(&pnode->surface->update_stats,
+							 &now);
+		pnode->damage_area = pnode->surface->update_stats.damage_area;
+
 		/* TODO: turn this into assert once z_order_list is pruned. */
 		if ((pnode->surface->output_mask & (1u << output->id)) == 0)
 			continue;
 
+		output->perf.paint_nodes++;
+
 		/*
 		 * The desired_protection of the output should be the
 		 * maximum of the desired_protection of the surfaces,
@@ -3129,6 +3203,7 @@ weston_output_repaint(struct weston_output *output)
 	wl_resource_for_each_safe(cb, cnext, &frame_callback_list) {
 		wl_callback_send_done(cb, frame_time_msec);
 		wl_resource_destroy(cb);
+		output->perf.frame_callbacks++;
 	}
 
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
@@ -3362,6 +3437,10 @@ weston_output_finish_frame(struct weston_output *output,
 			  -compositor->repaint_msec);
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
+	/* The frame completed after the repaint deadline of the next one. */
+	if (msec_rel < 0)
+		output->perf.missed_deadlines++;
+
 	if (msec_rel < -1000 || msec_rel > 1000) {
 		static bool warned;
 
@@ -3973,6 +4052,8 @@ weston_surface_commit_state(struct weston_surface *surface,
 {
 	struct weston_view *view;
 	pixman_region32_t opaque;
+	pixman_region32_t damage;
+	bool content_update;
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
@@ -4005,25 +4086,40 @@ weston_surface_commit_state(struct weston_surface *surface,
 			surface->committed(surface, state->sx, state->sy);
 	}
 
-	state->sx = 0;
-	state->sy = 0;
-	state->newly_attached = 0;
-	state->buffer_viewport.changed = 0;
+	/* a new buffer, or new content in the old one */
+	content_update = (state->newly_attached && surface->buffer_ref.buffer) ||
+			 pixman_region32_not_empty(&state->damage_surface) ||
+			 pixman_region32_not_empty(&state->damage_buffer);
 
 	/* wl_surface.damage and wl_surface.damage_buffer */
 	if (pixman_region32_not_empty(&state->damage_surface) ||
 	     pixman_region32_not_empty(&state->damage_buffer))
 		TL_POINT(surface->compositor, "core_commit_damage", TLP_SURFACE(surface), TLP_END);
 
-	pixman_region32_union(&surface->damage, &surface->damage,
-			      &state->damage_surface);
-
-	apply_damage_buffer(&surface->damage, surface, state);
-
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &state->damage_surface);
+	apply_damage_buffer(&damage, surface, state);
+	pixman_region32_intersect_rect(&damage, &damage,
+				       0, 0, surface->width, surface->height);
+	pixman_region32_union(&surface->damage, &surface->damage, &damage);
 	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
 				       0, 0, surface->width, surface->height);
 	pixman_region32_clear(&state->damage_surface);
 
+	/* the damage of this commit alone */
+	if (content_update)
+		weston_surface_update_stats_record(surface, &damage);
+	if (surface->compositor->event_capture)
+		weston_event_capture_surface_commit(surface,
+						    state->newly_attached,
+						    &damage);
+	pixman_region32_fini(&damage);
+
+	state->sx = 0;
+	state->sy = 0;
+	state->newly_attached = 0;
+	state->buffer_viewport.changed = 0;
+
 	/* wl_surface.set_opaque_region */
 	pixman_region32_init(&opaque);
 	pixman_region32_intersect_rect(&opaque, &state->opaque,
@@ -7777,6 +7873,18 @@ debug_scene_view_print(FILE *fp, struct weston_view *view, int view_idx)
 	if (view->alpha < 1.0)
 		fprintf(fp, "\t\talpha: %f\n", view->alpha);
 
+	if (view->surface->update_stats.updates > 0) {
+		const struct weston_surface_update_stats *stats =
+			&view->surface->update_stats;
+		struct timespec now;
+
+		weston_compositor_read_presentation_clock(ec, &now);
+		fprintf(fp, "\t\tupdates: %u, %.1f per second, "
+			"%.0f px damaged per update\n", stats->updates,
+			weston_surface_update_stats_rate(stats, &now),
+			stats->damage_area);
+	}
+
 	if (view->output_mask != 0) {
 		bool first_output = true;
 		fprintf(fp, "\t\toutputs: ");
@@ -7931,6 +8039,72 @@ debug_scene_graph_cb(struct weston_log_subscription *sub, void *data)
 	weston_log_subscription_complete(sub);
 }
 
+static void
+debug_perf_counters_print(struct weston_log_subscription *sub,
+			  struct weston_compositor *ec)
+{
+	struct weston_output *output;
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	weston_log_subscription_printf(sub,
+				       "Weston perf counters at %ld.%09ld:\n",
+				       now.tv_sec, now.tv_nsec);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		const struct weston_perf_counters *perf = &output->perf;
+
+		weston_log_subscription_printf(sub,
+			"Output %d (%s):\n"
+			"\trepaints: %" PRIu64 "\n"
+			"\tpaint nodes: %" PRIu64 "\n"
+			"\tregion rectangles: %" PRIu64 "\n"
+			"\tupload bytes: %" PRIu64 "\n"
+			"\tshm uploads: %" PRIu64 "\n"
+			"\tread_pixels bytes: %" PRIu64 "\n"
+			"\tmissed deadlines: %" PRIu64 "\n"
+			"\tframe callbacks: %" PRIu64 "\n",
+			output->id, output->name,
+			perf->repaints, perf->paint_nodes, perf->region_rects,
+			perf->upload_bytes, perf->shm_uploads,
+			perf->read_pixels_bytes, perf->missed_deadlines,
+			perf->frame_callbacks);
+	}
+}
+
+/**
+ * Called when the 'perf-counters' debug scope is bound by a client. This
+ * one-shot weston-debug scope prints a snapshot of the per-output counters,
+ * and then terminates the stream.
+ */
+static void
+debug_perf_counters_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+
+	debug_perf_counters_print(sub, ec);
+	weston_log_subscription_complete(sub);
+}
+
+/**
+ * Called when the 'perf-counters-reset' debug scope is bound by a client.
+ * Like 'perf-counters', but all counters are zeroed after the snapshot has
+ * been printed, starting a new measurement interval.
+ */
+static void
+debug_perf_counters_reset_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+
+	debug_perf_counters_print(sub, ec);
+
+	wl_list_for_each(output, &ec->output_list, link)
+		memset(&output->perf, 0, sizeof output->perf);
+
+	weston_log_subscription_complete(sub);
+}
+
 /** Retrieve testsuite data from compositor
  *
  * The testsuite data can be defined by the test suite of projects that uses
@@ -8088,6 +8262,16 @@ weston_compositor_create(struct wl_display *display,
 		weston_compositor_add_log_scope(ec, "libseat-debug",
 						"libseat debug messages\n",
 						NULL, NULL, NULL);
+	ec->perf_counters =
+		weston_compositor_add_log_scope(ec, "perf-counters",
+						"Per-output performance counters\n",
+						debug_perf_counters_cb, NULL,
+						ec);
+	ec->perf_counters_reset =
+		weston_compositor_add_log_scope(ec, "perf-counters-reset",
+						"Print and reset the performance counters\n",
+						debug_perf_counters_reset_cb, NULL,
+						ec);
 	return ec;
 
 fail:
@@ -8283,6 +8467,40 @@ weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 	return renderer->import_dmabuf(compositor, buffer);
 }
 
+/** Start importing a dmabuf buffer into the current renderer
+ *
+ * \param compositor
+ * \param buffer the dmabuf buffer to import
+ * \param done called from the event loop once the import has finished
+ * \return true if the import was started, false otherwise
+ *
+ * Like weston_compositor_import_dmabuf(), but lets the renderer do the
+ * expensive part of the import without blocking the compositor. The
+ * buffer must be kept alive until \c done has been called. \c done is
+ * never called from within this function.
+ *
+ * Returns false if the renderer cannot import asynchronously, or decides
+ * the buffer is better imported synchronously. The caller should use
+ * weston_compositor_import_dmabuf() then.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT bool
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      void (*done)(struct linux_dmabuf_buffer *buffer,
+						   bool success))
+{
+	struct weston_renderer *renderer;
+
+	renderer = compositor->renderer;
+
+	if (renderer->import_dmabuf_async == NULL)
+		return false;
+
+	return renderer->import_dmabuf_async(compositor, buffer, done);
+}
+
 WL_EXPORT bool
 weston_compositor_dmabuf_can_scanout(struct weston_compositor *compositor,
 		struct linux_dmabuf_buffer *buffer)
@@ -8451,6 +8669,9 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	/* prevent further rendering while shutting down */
 	compositor->state = WESTON_COMPOSITOR_OFFSCREEN;
 
+	weston_compositor_stop_event_capture(compositor);
+	weston_event_replay_destroy(compositor);
+
 	weston_signal_emit_mutable(&compositor->destroy_signal, compositor);
 
 	weston_compositor_xkb_destroy(compositor);
@@ -8475,6 +8696,12 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->libseat_debug);
 	compositor->libseat_debug = NULL;
 
+	weston_log_scope_destroy(compositor->perf_counters);
+	compositor->perf_counters = NULL;
+
+	weston_log_scope_destroy(compositor->perf_counters_reset);
+	compositor->perf_counters_reset = NULL;
+
 	if (compositor->default_dmabuf_feedback) {
 		weston_dmabuf_feedback_destroy(compositor->default_dmabuf_feedback);
 		weston_dmabuf_feedback_format_table_destroy(compositor->dmabuf_feedback_format_table);
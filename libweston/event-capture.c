@@ -0,0 +1,898 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include "backend.h"
+#include "libweston-internal.h"
+#include "event-capture.h"
+#include "pixel-formats.h"
+#include "shared/helpers.h"
+#include "shared/hash.h"
+#include "shared/timespec-util.h"
+
+/** Event capture writer
+ *
+ * Records what the compositor acts on into a file, see event-capture.h for
+ * the format. Surfaces get small sequential ids on first sight, like the
+ * timeline does for its objects.
+ *
+ * @ingroup internal-log
+ */
+struct weston_event_capture {
+	struct weston_compositor *compositor;
+	FILE *fp;
+	struct timespec start;
+	uint32_t next_surface_id;
+	struct wl_list surfaces; /**< weston_event_capture_surface::link */
+	struct wl_listener output_created_listener;
+	struct wl_listener output_moved_listener;
+	struct wl_listener output_resized_listener;
+};
+
+struct weston_event_capture_surface {
+	struct weston_event_capture *capture;
+	struct weston_surface *surface;
+	uint32_t id;
+	struct wl_list link;
+	struct wl_listener destroy_listener;
+};
+
+/** Event replay state
+ *
+ * Re-executes a capture: surfaces become solid colour views in a private
+ * layer, with the captured size, position and damage, and the colour derived
+ * from the buffer hash. Input goes through a private seat.
+ *
+ * @ingroup internal-log
+ */
+struct weston_event_replay {
+	struct weston_compositor *compositor;
+	char *data;
+	size_t size;
+	size_t pos;
+	uint32_t n_records;
+	struct timespec start;
+	struct wl_event_source *timer;
+	struct weston_layer layer;
+	struct weston_seat seat;
+	struct wl_list surfaces; /**< weston_event_replay_surface::link */
+	uint64_t repaints_start;
+	uint64_t missed_deadlines_start;
+	weston_event_replay_done_func_t done;
+	void *done_data;
+};
+
+struct weston_event_replay_surface {
+	uint32_t id;
+	struct weston_view *view;
+	struct weston_buffer_reference *buffer_ref;
+	uint64_t buffer_hash;
+	bool opaque;
+	struct wl_list link;
+};
+
+static uint64_t
+event_capture_hash_buffer(struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm;
+	const uint8_t *data;
+	uint64_t hash = FNV1A_64_INIT;
+	int32_t stride;
+	size_t row_len;
+	int y;
+
+	if (!buffer || buffer->type != WESTON_BUFFER_SHM ||
+	    !buffer->pixel_format)
+		return 0;
+
+	shm = buffer->shm_buffer;
+	stride = wl_shm_buffer_get_stride(shm);
+	row_len = (size_t) buffer->width * buffer->pixel_format->bpp / 8;
+
+	wl_shm_buffer_begin_access(shm);
+	data = wl_shm_buffer_get_data(shm);
+	for (y = 0; y < buffer->height; y++)
+		hash = fnv1a_64(hash, data + y * stride, row_len);
+	wl_shm_buffer_end_access(shm);
+
+	return hash;
+}
+
+static void
+event_capture_write(struct weston_event_capture *capture,
+		    enum weston_capture_record_type type,
+		    const void *payload, size_t payload_size,
+		    const void *extra, size_t extra_size)
+{
+	struct weston_capture_record record;
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(capture->compositor, &now);
+
+	record.type = type;
+	record.size = sizeof(record) + payload_size + extra_size;
+	record.time_nsec = timespec_sub_to_nsec(&now, &capture->start);
+
+	fwrite(&record, sizeof(record), 1, capture->fp);
+	fwrite(payload, payload_size, 1, capture->fp);
+	if (extra_size > 0)
+		fwrite(extra, extra_size, 1, capture->fp);
+}
+
+static void
+event_capture_surface_destroy(struct weston_event_capture_surface *cs)
+{
+	wl_list_remove(&cs->link);
+	wl_list_remove(&cs->destroy_listener.link);
+	free(cs);
+}
+
+static void
+event_capture_surface_destroy_handler(struct wl_listener *listener,
+				      void *data)
+{
+	struct weston_event_capture_surface *cs =
+		container_of(listener, struct weston_event_capture_surface,
+			     destroy_listener);
+	struct weston_capture_surface_destroy payload = {
+		.surface_id = cs->id,
+	};
+
+	event_capture_write(cs->capture, WESTON_CAPTURE_SURFACE_DESTROY,
+			    &payload, sizeof(payload), NULL, 0);
+	event_capture_surface_destroy(cs);
+}
+
+static struct weston_event_capture_surface *
+event_capture_get_surface(struct weston_event_capture *capture,
+			  struct weston_surface *surface)
+{
+	struct weston_event_capture_surface *cs;
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&surface->destroy_signal,
+				 event_capture_surface_destroy_handler);
+	if (listener)
+		return container_of(listener,
+				    struct weston_event_capture_surface,
+				    destroy_listener);
+
+	cs = zalloc(sizeof(*cs));
+	if (!cs)
+		return NULL;
+
+	cs->capture = capture;
+	cs->surface = surface;
+	cs->id = ++capture->next_surface_id;
+	cs->destroy_listener.notify = event_capture_surface_destroy_handler;
+	wl_signal_add(&surface->destroy_signal, &cs->destroy_listener);
+	wl_list_insert(&capture->surfaces, &cs->link);
+
+	return cs;
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_surface_commit(struct weston_surface *surface,
+				    bool newly_attached,
+				    pixman_region32_t *damage)
+{
+	struct weston_event_capture *capture =
+		surface->compositor->event_capture;
+	struct weston_event_capture_surface *cs;
+	struct weston_capture_surface_commit payload = { 0 };
+	struct weston_capture_rect *rects;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct weston_view *view;
+	pixman_box32_t *boxes;
+	float x, y;
+	int n, i;
+
+	cs = event_capture_get_surface(capture, surface);
+	if (!cs)
+		return;
+
+	payload.surface_id = cs->id;
+	payload.width = surface->width;
+	payload.height = surface->height;
+
+	if (buffer && buffer->pixel_format) {
+		payload.format = buffer->pixel_format->format;
+		if (pixel_format_is_opaque(buffer->pixel_format))
+			payload.flags |= WESTON_CAPTURE_COMMIT_OPAQUE;
+	}
+
+	if (newly_attached) {
+		payload.flags |= WESTON_CAPTURE_COMMIT_ATTACH;
+		payload.buffer_hash = event_capture_hash_buffer(buffer);
+	}
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (!weston_view_is_mapped(view))
+			continue;
+
+		weston_view_to_global_float(view, 0, 0, &x, &y);
+		payload.x = x;
+		payload.y = y;
+		payload.flags |= WESTON_CAPTURE_COMMIT_MAPPED;
+		break;
+	}
+
+	boxes = pixman_region32_rectangles(damage, &n);
+	rects = n > 0 ? calloc(n, sizeof(*rects)) : NULL;
+	if (n > 0 && !rects)
+		return;
+	for (i = 0; i < n; i++) {
+		rects[i].x1 = boxes[i].x1;
+		rects[i].y1 = boxes[i].y1;
+		rects[i].x2 = boxes[i].x2;
+		rects[i].y2 = boxes[i].y2;
+	}
+	payload.n_rects = n;
+
+	event_capture_write(capture, WESTON_CAPTURE_SURFACE_COMMIT,
+			    &payload, sizeof(payload),
+			    rects, n * sizeof(*rects));
+	free(rects);
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_output(struct weston_output *output)
+{
+	struct weston_event_capture *capture =
+		output->compositor->event_capture;
+	struct weston_capture_output payload = {
+		.id = output->id,
+		.x = output->x,
+		.y = output->y,
+		.width = output->current_mode ? output->current_mode->width : 0,
+		.height = output->current_mode ? output->current_mode->height : 0,
+		.scale = output->current_scale,
+		.transform = output->transform,
+		.refresh = output->current_mode ? output->current_mode->refresh : 0,
+	};
+
+	event_capture_write(capture, WESTON_CAPTURE_OUTPUT,
+			    &payload, sizeof(payload), NULL, 0);
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_motion(struct weston_compositor *compositor,
+			    const struct weston_pointer_motion_event *event)
+{
+	struct weston_capture_motion payload = {
+		.mask = event->mask,
+		.x = event->x,
+		.y = event->y,
+		.dx = event->dx,
+		.dy = event->dy,
+		.dx_unaccel = event->dx_unaccel,
+		.dy_unaccel = event->dy_unaccel,
+	};
+
+	event_capture_write(compositor->event_capture, WESTON_CAPTURE_MOTION,
+			    &payload, sizeof(payload), NULL, 0);
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_button(struct weston_compositor *compositor,
+			    uint32_t button, uint32_t state)
+{
+	struct weston_capture_button payload = {
+		.button = button,
+		.state = state,
+	};
+
+	event_capture_write(compositor->event_capture, WESTON_CAPTURE_BUTTON,
+			    &payload, sizeof(payload), NULL, 0);
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_key(struct weston_compositor *compositor,
+			 uint32_t key, uint32_t state)
+{
+	struct weston_capture_key payload = {
+		.key = key,
+		.state = state,
+	};
+
+	event_capture_write(compositor->event_capture, WESTON_CAPTURE_KEY,
+			    &payload, sizeof(payload), NULL, 0);
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_capture_axis(struct weston_compositor *compositor,
+			  const struct weston_pointer_axis_event *event)
+{
+	struct weston_capture_axis payload = {
+		.axis = event->axis,
+		.has_discrete = event->has_discrete,
+		.discrete = event->discrete,
+		.value = event->value,
+	};
+
+	event_capture_write(compositor->event_capture, WESTON_CAPTURE_AXIS,
+			    &payload, sizeof(payload), NULL, 0);
+}
+
+static void
+event_capture_output_changed(struct wl_listener *listener, void *data)
+{
+	weston_event_capture_output(data);
+}
+
+/** Start recording compositor input into a file
+ *
+ * \param compositor The compositor.
+ * \param path The file to write, truncated if it exists.
+ * \return 0 on success, -1 on failure.
+ *
+ * Records surface commits (size, position, damage and a hash of SHM buffer
+ * contents), pointer and keyboard events as they reach notify_motion(),
+ * notify_button(), notify_axis() and notify_key(), and the configuration of
+ * every enabled output. The result can be fed to
+ * weston_compositor_replay_events().
+ *
+ * Hashing reads every attached SHM buffer in full, so capturing has a cost
+ * of its own.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT int
+weston_compositor_start_event_capture(struct weston_compositor *compositor,
+				      const char *path)
+{
+	struct weston_event_capture *capture;
+	struct weston_capture_file_header header = { 0 };
+	struct weston_output *output;
+
+	if (compositor->event_capture)
+		return -1;
+
+	capture = zalloc(sizeof(*capture));
+	if (!capture)
+		return -1;
+
+	capture->fp = fopen(path, "we");
+	if (!capture->fp) {
+		weston_log("event capture: cannot open '%s': %s\n",
+			   path, strerror(errno));
+		free(capture);
+		return -1;
+	}
+
+	memcpy(header.magic, WESTON_CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = WESTON_CAPTURE_VERSION;
+	fwrite(&header, sizeof(header), 1, capture->fp);
+
+	capture->compositor = compositor;
+	wl_list_init(&capture->surfaces);
+	weston_compositor_read_presentation_clock(compositor, &capture->start);
+	compositor->event_capture = capture;
+
+	capture->output_created_listener.notify = event_capture_output_changed;
+	wl_signal_add(&compositor->output_created_signal,
+		      &capture->output_created_listener);
+	capture->output_moved_listener.notify = event_capture_output_changed;
+	wl_signal_add(&compositor->output_moved_signal,
+		      &capture->output_moved_listener);
+	capture->output_resized_listener.notify = event_capture_output_changed;
+	wl_signal_add(&compositor->output_resized_signal,
+		      &capture->output_resized_listener);
+	wl_list_for_each(output, &compositor->output_list, link)
+		weston_event_capture_output(output);
+
+	weston_log("event capture: recording to '%s'\n", path);
+
+	return 0;
+}
+
+/** Stop recording started by weston_compositor_start_event_capture()
+ *
+ * \param compositor The compositor.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT void
+weston_compositor_stop_event_capture(struct weston_compositor *compositor)
+{
+	struct weston_event_capture *capture = compositor->event_capture;
+	struct weston_event_capture_surface *cs, *tmp;
+
+	if (!capture)
+		return;
+
+	wl_list_for_each_safe(cs, tmp, &capture->surfaces, link)
+		event_capture_surface_destroy(cs);
+
+	wl_list_remove(&capture->output_created_listener.link);
+	wl_list_remove(&capture->output_moved_listener.link);
+	wl_list_remove(&capture->output_resized_listener.link);
+	fclose(capture->fp);
+	free(capture);
+	compositor->event_capture = NULL;
+}
+
+static struct weston_event_replay_surface *
+event_replay_get_surface(struct weston_event_replay *replay, uint32_t id)
+{
+	struct weston_event_replay_surface *rs;
+	struct weston_surface *surface;
+
+	wl_list_for_each(rs, &replay->surfaces, link) {
+		if (rs->id == id)
+			return rs;
+	}
+
+	rs = zalloc(sizeof(*rs));
+	if (!rs)
+		return NULL;
+
+	surface = weston_surface_create(replay->compositor);
+	if (!surface)
+		goto err_free;
+
+	rs->view = weston_view_create(surface);
+	if (!rs->view)
+		goto err_surface;
+
+	pixman_region32_fini(&surface->input);
+	pixman_region32_init(&surface->input);
+
+	rs->id = id;
+	wl_list_insert(&replay->surfaces, &rs->link);
+
+	return rs;
+
+err_surface:
+	weston_surface_unref(surface);
+err_free:
+	free(rs);
+	return NULL;
+}
+
+static void
+event_replay_surface_destroy(struct weston_event_replay_surface *rs)
+{
+	struct weston_surface *surface = rs->view->surface;
+
+	weston_view_destroy(rs->view);
+	weston_surface_unref(surface);
+	if (rs->buffer_ref)
+		weston_buffer_destroy_solid(rs->buffer_ref);
+	wl_list_remove(&rs->link);
+	free(rs);
+}
+
+static void
+event_replay_commit(struct weston_event_replay *replay,
+		    const struct weston_capture_surface_commit *commit,
+		    const struct weston_capture_rect *rects)
+{
+	struct weston_event_replay_surface *rs;
+	struct weston_surface *surface;
+	uint64_t hash = commit->buffer_hash;
+	bool opaque = commit->flags & WESTON_CAPTURE_COMMIT_OPAQUE;
+	uint32_t i;
+
+	rs = event_replay_get_surface(replay, commit->surface_id);
+	if (!rs)
+		return;
+	surface = rs->view->surface;
+
+	if (commit->width <= 0 || commit->height <= 0) {
+		weston_view_unmap(rs->view);
+		return;
+	}
+
+	/* Stand-in for the client's buffer: the colour changes whenever the
+	 * captured contents did. */
+	if ((commit->flags & WESTON_CAPTURE_COMMIT_ATTACH) &&
+	    (!rs->buffer_ref || hash != rs->buffer_hash ||
+	     opaque != rs->opaque)) {
+		if (rs->buffer_ref)
+			weston_buffer_destroy_solid(rs->buffer_ref);
+		rs->buffer_ref =
+			weston_buffer_create_solid_rgba(replay->compositor,
+							((hash >> 16) & 0xff) / 255.0f,
+							((hash >> 8) & 0xff) / 255.0f,
+							(hash & 0xff) / 255.0f,
+							opaque ? 1.0f : 0.75f);
+		rs->buffer_hash = hash;
+		rs->opaque = opaque;
+		if (!rs->buffer_ref)
+			return;
+	}
+
+	if (!rs->buffer_ref)
+		return;
+
+	if (surface->buffer_ref.buffer != rs->buffer_ref->buffer ||
+	    surface->width != commit->width ||
+	    surface->height != commit->height)
+		weston_surface_attach_solid(surface, rs->buffer_ref,
+					    commit->width, commit->height);
+
+	if (commit->flags & WESTON_CAPTURE_COMMIT_MAPPED) {
+		weston_view_set_position(rs->view, commit->x, commit->y);
+		if (!weston_view_is_mapped(rs->view)) {
+			weston_layer_entry_insert(&replay->layer.view_list,
+						  &rs->view->layer_link);
+			surface->is_mapped = true;
+			rs->view->is_mapped = true;
+		}
+	}
+
+	for (i = 0; i < commit->n_rects; i++) {
+		pixman_region32_union_rect(&surface->damage, &surface->damage,
+					   rects[i].x1, rects[i].y1,
+					   rects[i].x2 - rects[i].x1,
+					   rects[i].y2 - rects[i].y1);
+	}
+
+	weston_surface_schedule_repaint(surface);
+}
+
+static void
+event_replay_output(struct weston_event_replay *replay,
+		    const struct weston_capture_output *co)
+{
+	struct weston_output *output;
+
+	wl_list_for_each(output, &replay->compositor->output_list, link) {
+		if (output->x == co->x && output->y == co->y &&
+		    output->current_mode &&
+		    output->current_mode->width == co->width &&
+		    output->current_mode->height == co->height &&
+		    output->current_scale == co->scale &&
+		    output->transform == co->transform)
+			return;
+	}
+
+	weston_log("event replay: no output matches captured output %u, "
+		   "%dx%d@%d at %d,%d scale %d, replay may diverge\n",
+		   co->id, co->width, co->height, co->refresh, co->x, co->y,
+		   co->scale);
+}
+
+static void
+event_replay_dispatch(struct weston_event_replay *replay,
+		      const struct weston_capture_record *record)
+{
+	const void *payload = record + 1;
+	size_t payload_size = record->size - sizeof(*record);
+	const struct weston_capture_surface_commit *commit;
+	const struct weston_capture_surface_destroy *destroy;
+	const struct weston_capture_motion *motion;
+	const struct weston_capture_button *button;
+	const struct weston_capture_key *key;
+	const struct weston_capture_axis *axis;
+	struct weston_event_replay_surface *rs;
+	struct weston_pointer_motion_event motion_event;
+	struct weston_pointer_axis_event axis_event;
+	struct timespec time;
+
+	weston_compositor_get_time(&time);
+
+	switch (record->type) {
+	case WESTON_CAPTURE_OUTPUT:
+		if (payload_size < sizeof(struct weston_capture_output))
+			break;
+		event_replay_output(replay, payload);
+		break;
+	case WESTON_CAPTURE_SURFACE_COMMIT:
+		commit = payload;
+		if (payload_size < sizeof(*commit) ||
+		    (payload_size - sizeof(*commit)) /
+		    sizeof(struct weston_capture_rect) < commit->n_rects)
+			break;
+		event_replay_commit(replay, commit,
+				    (const void *) (commit + 1));
+		break;
+	case WESTON_CAPTURE_SURFACE_DESTROY:
+		destroy = payload;
+		if (payload_size < sizeof(*destroy))
+			break;
+		wl_list_for_each(rs, &replay->surfaces, link) {
+			if (rs->id == destroy->surface_id) {
+				event_replay_surface_destroy(rs);
+				break;
+			}
+		}
+		break;
+	case WESTON_CAPTURE_MOTION:
+		motion = payload;
+		if (payload_size < sizeof(*motion))
+			break;
+		motion_event = (struct weston_pointer_motion_event) {
+			.mask = motion->mask,
+			.time = time,
+			.x = motion->x,
+			.y = motion->y,
+			.dx = motion->dx,
+			.dy = motion->dy,
+			.dx_unaccel = motion->dx_unaccel,
+			.dy_unaccel = motion->dy_unaccel,
+		};
+		notify_motion(&replay->seat, &time, &motion_event);
+		break;
+	case WESTON_CAPTURE_BUTTON:
+		button = payload;
+		if (payload_size < sizeof(*button))
+			break;
+		notify_button(&replay->seat, &time, button->button,
+			      button->state);
+		break;
+	case WESTON_CAPTURE_KEY:
+		key = payload;
+		if (payload_size < sizeof(*key))
+			break;
+		notify_key(&replay->seat, &time, key->key, key->state,
+			   STATE_UPDATE_AUTOMATIC);
+		break;
+	case WESTON_CAPTURE_AXIS:
+		axis = payload;
+		if (payload_size < sizeof(*axis))
+			break;
+		axis_event = (struct weston_pointer_axis_event) {
+			.axis = axis->axis,
+			.value = axis->value,
+			.has_discrete = axis->has_discrete,
+			.discrete = axis->discrete,
+		};
+		notify_axis(&replay->seat, &time, &axis_event);
+		break;
+	default:
+		/* unknown records are skipped */
+		break;
+	}
+
+	replay->n_records++;
+}
+
+static void
+event_replay_perf_totals(struct weston_compositor *compositor,
+			 uint64_t *repaints, uint64_t *missed_deadlines)
+{
+	struct weston_output *output;
+
+	*repaints = 0;
+	*missed_deadlines = 0;
+	wl_list_for_each(output, &compositor->output_list, link) {
+		*repaints += output->perf.repaints;
+		*missed_deadlines += output->perf.missed_deadlines;
+	}
+}
+
+static char *
+event_replay_read_file(const char *path, size_t *size)
+{
+	FILE *fp;
+	char *data;
+	long len;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return NULL;
+
+	if (fseek(fp, 0, SEEK_END) < 0 || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) < 0)
+		goto err_close;
+
+	data = malloc(len > 0 ? len : 1);
+	if (!data)
+		goto err_close;
+
+	if (fread(data, 1, len, fp) != (size_t) len) {
+		free(data);
+		goto err_close;
+	}
+
+	fclose(fp);
+	*size = len;
+
+	return data;
+
+err_close:
+	fclose(fp);
+	return NULL;
+}
+
+static const struct weston_capture_record *
+event_replay_peek(struct weston_event_replay *replay)
+{
+	const struct weston_capture_record *record;
+
+	if (replay->size - replay->pos < sizeof(*record))
+		return NULL;
+
+	record = (const void *) (replay->data + replay->pos);
+	if (record->size < sizeof(*record) ||
+	    record->size > replay->size - replay->pos ||
+	    record->size % 8 != 0)
+		return NULL;
+
+	return record;
+}
+
+static int
+event_replay_timer_handler(void *data)
+{
+	struct weston_event_replay *replay = data;
+	struct weston_compositor *compositor = replay->compositor;
+	const struct weston_capture_record *record;
+	struct timespec now;
+	uint64_t repaints, missed;
+	int64_t elapsed;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	elapsed = timespec_sub_to_nsec(&now, &replay->start);
+
+	while ((record = event_replay_peek(replay))) {
+		if ((int64_t) record->time_nsec > elapsed) {
+			wl_event_source_timer_update(replay->timer,
+				MAX(1, (record->time_nsec - elapsed) / 1000000));
+			return 0;
+		}
+
+		replay->pos += record->size;
+		event_replay_dispatch(replay, record);
+	}
+
+	if (replay->pos != replay->size)
+		weston_log("event replay: trailing garbage at offset %zu\n",
+			   replay->pos);
+
+	event_replay_perf_totals(compositor, &repaints, &missed);
+	weston_log("event replay: %u records in %.1f ms, "
+		   "%" PRIu64 " repaints, %" PRIu64 " missed deadlines\n",
+		   replay->n_records, elapsed / 1e6,
+		   repaints - replay->repaints_start,
+		   missed - replay->missed_deadlines_start);
+
+	if (replay->done)
+		replay->done(compositor, replay->done_data);
+
+	return 0;
+}
+
+/** Replay a file written by weston_compositor_start_event_capture()
+ *
+ * \param compositor The compositor.
+ * \param path The capture file.
+ * \param done Called once all records have been executed, may be NULL.
+ * \param data User data for \c done.
+ * \return 0 on success, -1 on failure.
+ *
+ * Records are executed at their captured times relative to this call.
+ * Captured surfaces are stood in for by solid colour surfaces in a layer
+ * of their own, matching the captured size, position and damage; input
+ * events are sent through a seat named "replay". Output records are only
+ * compared against the current outputs, so the replay is meant to run on
+ * the headless backend configured like the captured system. A summary of
+ * the repaint counters is logged at the end.
+ *
+ * \ingroup compositor
+ */
+WL_EXPORT int
+weston_compositor_replay_events(struct weston_compositor *compositor,
+				const char *path,
+				weston_event_replay_done_func_t done,
+				void *data)
+{
+	struct weston_event_replay *replay;
+	const struct weston_capture_file_header *header;
+	struct wl_event_loop *loop;
+
+	if (compositor->event_replay)
+		return -1;
+
+	replay = zalloc(sizeof(*replay));
+	if (!replay)
+		return -1;
+
+	replay->data = event_replay_read_file(path, &replay->size);
+	if (!replay->data) {
+		weston_log("event replay: cannot read '%s': %s\n",
+			   path, strerror(errno));
+		goto err_free;
+	}
+
+	header = (const void *) replay->data;
+	if (replay->size < sizeof(*header) ||
+	    memcmp(header->magic, WESTON_CAPTURE_MAGIC,
+		   sizeof(header->magic)) != 0 ||
+	    header->version != WESTON_CAPTURE_VERSION) {
+		weston_log("event replay: '%s' is not a supported capture\n",
+			   path);
+		goto err_data;
+	}
+	replay->pos = sizeof(*header);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop,
+						event_replay_timer_handler,
+						replay);
+	if (!replay->timer)
+		goto err_data;
+
+	weston_seat_init(&replay->seat, compositor, "replay");
+	weston_seat_init_pointer(&replay->seat);
+	if (weston_seat_init_keyboard(&replay->seat, NULL) < 0)
+		goto err_seat;
+
+	replay->compositor = compositor;
+	replay->done = done;
+	replay->done_data = data;
+	wl_list_init(&replay->surfaces);
+	weston_layer_init(&replay->layer, compositor);
+	weston_layer_set_position(&replay->layer, WESTON_LAYER_POSITION_NORMAL);
+
+	event_replay_perf_totals(compositor, &replay->repaints_start,
+				 &replay->missed_deadlines_start);
+	weston_compositor_read_presentation_clock(compositor, &replay->start);
+	wl_event_source_timer_update(replay->timer, 1);
+	compositor->event_replay = replay;
+
+	weston_log("event replay: replaying '%s'\n", path);
+
+	return 0;
+
+err_seat:
+	weston_seat_release(&replay->seat);
+	wl_event_source_remove(replay->timer);
+err_data:
+	free(replay->data);
+err_free:
+	free(replay);
+	return -1;
+}
+
+WESTON_EXPORT_FOR_TESTS void
+weston_event_replay_destroy(struct weston_compositor *compositor)
+{
+	struct weston_event_replay *replay = compositor->event_replay;
+	struct weston_event_replay_surface *rs, *tmp;
+
+	if (!replay)
+		return;
+
+	wl_event_source_remove(replay->timer);
+	wl_list_for_each_safe(rs, tmp, &replay->surfaces, link)
+		event_replay_surface_destroy(rs);
+	weston_layer_fini(&replay->layer);
+	weston_seat_release(&replay->seat);
+	free(replay->data);
+	free(replay);
+	compositor->event_replay = NULL;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_EVENT_CAPTURE_H
+#define WESTON_EVENT_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libweston/libweston.h>
+
+/* The capture file is a weston_capture_file_header followed by records.
+ * Every record starts with a weston_capture_record, whose size covers the
+ * record header and the payload, so unknown records can be skipped. All
+ * values are in host byte order.
+ */
+
+#define WESTON_CAPTURE_MAGIC	"WSTNCAPT"
+#define WESTON_CAPTURE_VERSION	1
+
+struct weston_capture_file_header {
+	char magic[8];		/**< WESTON_CAPTURE_MAGIC, not terminated */
+	uint32_t version;	/**< WESTON_CAPTURE_VERSION */
+	uint32_t padding;
+};
+
+enum weston_capture_record_type {
+	WESTON_CAPTURE_OUTPUT = 1,
+	WESTON_CAPTURE_SURFACE_COMMIT,
+	WESTON_CAPTURE_SURFACE_DESTROY,
+	WESTON_CAPTURE_MOTION,
+	WESTON_CAPTURE_BUTTON,
+	WESTON_CAPTURE_KEY,
+	WESTON_CAPTURE_AXIS,
+};
+
+struct weston_capture_record {
+	uint32_t type;		/**< enum weston_capture_record_type */
+	uint32_t size;		/**< bytes, including this header */
+	uint64_t time_nsec;	/**< since the start of the capture */
+};
+
+struct weston_capture_output {
+	uint32_t id;
+	int32_t x, y;
+	int32_t width, height;	/**< current mode */
+	int32_t scale;
+	uint32_t transform;
+	int32_t refresh;	/**< mHz */
+};
+
+enum weston_capture_commit_flags {
+	WESTON_CAPTURE_COMMIT_ATTACH = 1 << 0,	/**< new buffer attached */
+	WESTON_CAPTURE_COMMIT_MAPPED = 1 << 1,	/**< x, y are valid */
+	WESTON_CAPTURE_COMMIT_OPAQUE = 1 << 2,	/**< buffer has no alpha */
+};
+
+struct weston_capture_rect {
+	int32_t x1, y1, x2, y2;
+};
+
+struct weston_capture_surface_commit {
+	uint32_t surface_id;
+	uint32_t flags;		/**< enum weston_capture_commit_flags */
+	int32_t x, y;		/**< global position of the first view */
+	int32_t width, height;	/**< surface size */
+	uint32_t format;	/**< DRM fourcc, 0 without buffer */
+	uint32_t n_rects;	/**< damage rectangles following the struct */
+	uint64_t buffer_hash;	/**< FNV-1a of SHM contents, 0 if unknown */
+};
+
+struct weston_capture_surface_destroy {
+	uint32_t surface_id;
+	uint32_t padding;
+};
+
+struct weston_capture_motion {
+	uint32_t mask;		/**< WESTON_POINTER_MOTION_* */
+	uint32_t padding;
+	double x, y;
+	double dx, dy;
+	double dx_unaccel, dy_unaccel;
+};
+
+struct weston_capture_button {
+	uint32_t button;
+	uint32_t state;
+};
+
+struct weston_capture_key {
+	uint32_t key;
+	uint32_t state;
+};
+
+struct weston_capture_axis {
+	uint32_t axis;
+	uint32_t has_discrete;
+	int32_t discrete;
+	uint32_t padding;
+	double value;
+};
+
+void
+weston_event_capture_surface_commit(struct weston_surface *surface,
+				    bool newly_attached,
+				    pixman_region32_t *damage);
+
+void
+weston_event_capture_output(struct weston_output *output);
+
+void
+weston_event_capture_motion(struct weston_compositor *compositor,
+			    const struct weston_pointer_motion_event *event);
+
+void
+weston_event_capture_button(struct weston_compositor *compositor,
+			    uint32_t button, uint32_t state);
+
+void
+weston_event_capture_key(struct weston_compositor *compositor,
+			 uint32_t key, uint32_t state);
+
+void
+weston_event_capture_axis(struct weston_compositor *compositor,
+			  const struct weston_pointer_axis_event *event);
+
+void
+weston_event_replay_destroy(struct weston_compositor *compositor);
+
+#endif /* WESTON_EVENT_CAPTURE_H */
@@ -38,13 +38,22 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "shared/helpers.h"
+#include "shared/hash.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
 #include <libweston/libweston.h>
 #include "backend.h"
 #include "libweston-internal.h"
+#include "event-capture.h"
 #include "relative-pointer-unstable-v1-server-protocol.h"
 #include "pointer-constraints-unstable-v1-server-protocol.h"
 #include "input-timestamps-unstable-v1-server-protocol.h"
@@ -1790,6 +1799,9 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	if (ec->event_capture)
+		weston_event_capture_motion(ec, event);
+
 	weston_compositor_wake(ec);
 	pointer->grab->interface->motion(pointer->grab, time, event);
 }
@@ -1846,6 +1858,9 @@ notify_motion_absolute(struct weston_seat *seat, const struct timespec *time,
 		.y = y,
 	};
 
+	if (ec->event_capture)
+		weston_event_capture_motion(ec, &event);
+
 	pointer->grab->interface->motion(pointer->grab, time, &event);
 }
 
@@ -1885,6 +1900,9 @@ notify_button(struct weston_seat *seat, const struct timespec *time,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	if (compositor->event_capture)
+		weston_event_capture_button(compositor, button, state);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1916,6 +1934,9 @@ notify_axis(struct weston_seat *seat, const struct timespec *time,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	if (compositor->event_capture)
+		weston_event_capture_axis(compositor, event);
+
 	weston_compositor_wake(compositor);
 
 	if (weston_compositor_run_axis_binding(compositor, pointer,
@@ -2197,6 +2218,9 @@ notify_key(struct weston_seat *seat, const struct timespec *time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	if (compositor->event_capture)
+		weston_event_capture_key(compositor, key, state);
+
 	end = keyboard->keys.data + keyboard->keys.size;
 	for (k = keyboard->keys.data; k < end; k++) {
 		if (*k == key) {
@@ -3126,6 +3150,34 @@ weston_compositor_set_xkb_rule_names(struct weston_compositor *ec,
 	return 0;
 }
 
+/** Cache keymaps compiled from the XKB rule names on disk
+ *
+ * \param ec The compositor.
+ * \param dir Directory to keep the cached keymaps in, created as needed,
+ * or NULL to compile the keymap at every start.
+ * \return 0 on success, -1 on failure.
+ *
+ * Loading a cached keymap only needs to parse a single text file, which
+ * is much cheaper than resolving the rule names.
+ */
+WL_EXPORT int
+weston_compositor_set_xkb_keymap_cache_dir(struct weston_compositor *ec,
+					   const char *dir)
+{
+	char *copy = NULL;
+
+	if (dir) {
+		copy = strdup(dir);
+		if (!copy)
+			return -1;
+	}
+
+	free(ec->xkb_keymap_cache_dir);
+	ec->xkb_keymap_cache_dir = copy;
+
+	return 0;
+}
+
 static void
 weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 {
@@ -3138,14 +3190,22 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	free(xkb_info);
 }
 
+static void
+weston_xkb_keymap_job_destroy(struct weston_xkb_keymap_job *job);
+
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
+	/* Stops the worker */
+	if (ec->xkb_keymap_job)
+		weston_xkb_keymap_job_destroy(ec->xkb_keymap_job);
+
 	free((char *) ec->xkb_names.rules);
 	free((char *) ec->xkb_names.model);
 	free((char *) ec->xkb_names.layout);
 	free((char *) ec->xkb_names.variant);
 	free((char *) ec->xkb_names.options);
+	free(ec->xkb_keymap_cache_dir);
 
 	if (ec->xkb_info)
 		weston_xkb_info_destroy(ec->xkb_info);
@@ -3153,9 +3213,9 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_create_with_string(struct xkb_keymap *keymap,
+				   const char *keymap_string)
 {
-	char *keymap_string;
 	size_t keymap_size;
 	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
 	if (xkb_info == NULL)
@@ -3188,18 +3248,10 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 	xkb_info->scroll_led = xkb_keymap_led_get_index(xkb_info->keymap,
 							XKB_LED_NAME_SCROLL);
 
-	keymap_string = xkb_keymap_get_as_string(xkb_info->keymap,
-							   XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (keymap_string == NULL) {
-		weston_log("failed to get string version of keymap\n");
-		goto err_keymap;
-	}
 	keymap_size = strlen(keymap_string) + 1;
 
 	xkb_info->keymap_rofile = os_ro_anonymous_file_create(keymap_size,
 							      keymap_string);
-	free(keymap_string);
-
 	if (!xkb_info->keymap_rofile) {
 		weston_log("failed to create anonymous file for keymap\n");
 		goto err_keymap;
@@ -3213,33 +3265,479 @@ err_keymap:
 	return NULL;
 }
 
+static struct weston_xkb_info *
+weston_xkb_info_create(struct xkb_keymap *keymap)
+{
+	struct weston_xkb_info *xkb_info;
+	char *keymap_string;
+
+	keymap_string = xkb_keymap_get_as_string(keymap,
+						 XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (keymap_string == NULL) {
+		weston_log("failed to get string version of keymap\n");
+		return NULL;
+	}
+
+	xkb_info = weston_xkb_info_create_with_string(keymap, keymap_string);
+	free(keymap_string);
+
+	return xkb_info;
+}
+
+/* Deep enough for the vendor subdirectories of symbols/ */
+#define XKB_CACHE_MAX_DEPTH 4
+
+/* Folds the name, size and modification time of everything below a
+ * directory into the hash. Takes ownership of dirfd. */
+static uint64_t
+weston_xkb_cache_hash_dir(uint64_t hash, int dirfd, int depth)
+{
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	dir = fdopendir(dirfd);
+	if (!dir) {
+		close(dirfd);
+		return hash;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (fstatat(dirfd, ent->d_name, &st, 0) < 0)
+			continue;
+
+		hash = fnv1a_64(hash, ent->d_name, strlen(ent->d_name) + 1);
+		hash = fnv1a_64(hash, &st.st_size, sizeof st.st_size);
+		hash = fnv1a_64(hash, &st.st_mtim.tv_sec,
+				sizeof st.st_mtim.tv_sec);
+		hash = fnv1a_64(hash, &st.st_mtim.tv_nsec,
+				sizeof st.st_mtim.tv_nsec);
+
+		if (!S_ISDIR(st.st_mode) || depth >= XKB_CACHE_MAX_DEPTH)
+			continue;
+
+		fd = openat(dirfd, ent->d_name,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0)
+			hash = weston_xkb_cache_hash_dir(hash, fd, depth + 1);
+	}
+
+	closedir(dir);
+
+	return hash;
+}
+
+/** The key a keymap compiled from rule names is cached under
+ *
+ * A cached keymap is valid for the same rule names, the same xkbcommon
+ * and the same XKB data. xkbcommon cannot tell which files the rules
+ * resolve to without compiling, so the data is every rules, keycodes,
+ * types, compat and symbols file in every include path of the context,
+ * the user's own included, down to their size and modification time.
+ *
+ * The key is stored at the start of the cache file and compared in full,
+ * its hash only names the file.
+ */
+WESTON_EXPORT_FOR_TESTS char *
+weston_xkb_cache_key(struct xkb_context *context,
+		     const struct xkb_rule_names *names)
+{
+	static const char * const components[] = {
+		"rules", "keycodes", "types", "compat", "symbols",
+	};
+	uint64_t hash = FNV1A_64_INIT;
+	const char *include_path;
+	unsigned int i, j;
+	char *key;
+	int dirfd, fd;
+	int ret;
+
+	for (i = 0; i < xkb_context_num_include_paths(context); i++) {
+		include_path = xkb_context_include_path_get(context, i);
+		hash = fnv1a_64(hash, include_path, strlen(include_path) + 1);
+
+		dirfd = open(include_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd < 0)
+			continue;
+
+		for (j = 0; j < ARRAY_LENGTH(components); j++) {
+			fd = openat(dirfd, components[j],
+				    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+
+			hash = fnv1a_64(hash, components[j],
+					strlen(components[j]) + 1);
+			hash = weston_xkb_cache_hash_dir(hash, fd, 0);
+		}
+
+		close(dirfd);
+	}
+
+	ret = asprintf(&key, "xkbcommon %s\ndata %016" PRIx64 "\n"
+		       "rules %s\nmodel %s\nlayout %s\nvariant %s\n"
+		       "options %s\n\n",
+		       XKBCOMMON_VERSION, hash, names->rules,
+		       names->model, names->layout,
+		       names->variant ?: "", names->options ?: "");
+	if (ret < 0)
+		return NULL;
+
+	return key;
+}
+
+static char *
+weston_xkb_cache_path(const char *dir, const char *key)
+{
+	uint64_t hash;
+	char *path;
+
+	hash = fnv1a_64(FNV1A_64_INIT, key, strlen(key));
+	if (asprintf(&path, "%s/keymap-%016" PRIx64 ".xkb", dir, hash) < 0)
+		return NULL;
+
+	return path;
+}
+
+/* Returns the keymap and its text, the text points into *contents */
+static struct xkb_keymap *
+weston_xkb_cache_load(struct xkb_context *context, const char *key,
+		      const char *path, char **contents)
+{
+	struct xkb_keymap *keymap = NULL;
+	size_t key_size = strlen(key);
+	struct stat st;
+	FILE *fp;
+
+	*contents = NULL;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) < 0 || (size_t) st.st_size <= key_size)
+		goto out;
+
+	*contents = malloc(st.st_size + 1);
+	if (!*contents)
+		goto out;
+
+	if (fread(*contents, 1, st.st_size, fp) != (size_t) st.st_size ||
+	    memcmp(*contents, key, key_size) != 0)
+		goto out;
+	(*contents)[st.st_size] = '\0';
+
+	/* An invalid cache file gets recompiled and replaced */
+	keymap = xkb_keymap_new_from_string(context, *contents + key_size,
+					    XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+
+out:
+	if (!keymap) {
+		free(*contents);
+		*contents = NULL;
+	}
+	fclose(fp);
+
+	return keymap;
+}
+
 static int
-weston_compositor_build_global_keymap(struct weston_compositor *ec)
+mkdir_parents(char *path)
 {
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	return 0;
+}
+
+/* Written to a temporary file first, so that a concurrent start never
+ * sees a partial keymap. */
+static void
+weston_xkb_cache_store(const char *key, const char *path,
+		       const char *keymap_string)
+{
+	char *tmp;
+	FILE *fp;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		return;
+
+	if (mkdir_parents(tmp) < 0)
+		goto err;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto err;
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto err_unlink;
+	}
+
+	if (fputs(key, fp) < 0 || fputs(keymap_string, fp) < 0) {
+		fclose(fp);
+		goto err_unlink;
+	}
+
+	if (fclose(fp) != 0 || rename(tmp, path) < 0)
+		goto err_unlink;
+
+	free(tmp);
+	return;
+
+err_unlink:
+	unlink(tmp);
+err:
+	weston_log("failed to cache keymap in %s: %s\n", path, strerror(errno));
+	free(tmp);
+}
+
+/** Getting the global keymap, from the cache or by compiling it
+ *
+ * Only touches its own members and XKB context, so that it can run on a
+ * worker thread; everything else happens in
+ * weston_compositor_build_global_keymap().
+ */
+struct weston_xkb_keymap_job {
+	struct xkb_context *context;
+	/* copies, the compositor's may change while the worker runs */
+	struct xkb_rule_names names;
+	char *cache_dir;
+
+	pthread_t thread;
+	bool threaded;
+
+	char *key;
+	char *path;
 	struct xkb_keymap *keymap;
+	/* keymap text, at keymap_string + key_size when from the cache */
+	char *keymap_string;
+	size_t key_size;
+	bool from_cache;
+	int64_t nsec;
+};
+
+static void
+weston_xkb_keymap_job_run(struct weston_xkb_keymap_job *job)
+{
+	struct timespec begin, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	if (job->cache_dir) {
+		job->key = weston_xkb_cache_key(job->context, &job->names);
+		if (job->key)
+			job->path = weston_xkb_cache_path(job->cache_dir,
+							  job->key);
+		if (job->path)
+			job->keymap = weston_xkb_cache_load(job->context,
+							    job->key,
+							    job->path,
+							    &job->keymap_string);
+		if (job->keymap) {
+			job->key_size = strlen(job->key);
+			job->from_cache = true;
+		}
+	}
+
+	if (!job->keymap) {
+		job->keymap = xkb_keymap_new_from_names(job->context,
+							&job->names, 0);
+		if (job->keymap)
+			job->keymap_string =
+				xkb_keymap_get_as_string(job->keymap,
+							 XKB_KEYMAP_FORMAT_TEXT_V1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->nsec = timespec_sub_to_nsec(&end, &begin);
+}
+
+static void *
+weston_xkb_keymap_job_thread(void *data)
+{
+	weston_xkb_keymap_job_run(data);
+
+	return NULL;
+}
+
+static void
+weston_xkb_keymap_job_destroy(struct weston_xkb_keymap_job *job)
+{
+	if (job->threaded)
+		pthread_join(job->thread, NULL);
+
+	xkb_keymap_unref(job->keymap);
+	free(job->keymap_string);
+	free(job->key);
+	free(job->path);
+	free((char *) job->names.rules);
+	free((char *) job->names.model);
+	free((char *) job->names.layout);
+	free((char *) job->names.variant);
+	free((char *) job->names.options);
+	free(job->cache_dir);
+	xkb_context_unref(job->context);
+	free(job);
+}
+
+static bool
+weston_xkb_copy_string(const char **dst, const char *src)
+{
+	*dst = src ? strdup(src) : NULL;
+
+	return !src || *dst;
+}
+
+/* Takes ownership of the context */
+static struct weston_xkb_keymap_job *
+weston_xkb_keymap_job_create(struct weston_compositor *ec,
+			     struct xkb_context *context)
+{
+	const struct xkb_rule_names *names = &ec->xkb_names;
+	struct weston_xkb_keymap_job *job;
+
+	if (!context)
+		return NULL;
+
+	job = zalloc(sizeof *job);
+	if (!job) {
+		xkb_context_unref(context);
+		return NULL;
+	}
+	job->context = context;
+
+	if (!weston_xkb_copy_string(&job->names.rules, names->rules) ||
+	    !weston_xkb_copy_string(&job->names.model, names->model) ||
+	    !weston_xkb_copy_string(&job->names.layout, names->layout) ||
+	    !weston_xkb_copy_string(&job->names.variant, names->variant) ||
+	    !weston_xkb_copy_string(&job->names.options, names->options))
+		goto err;
+
+	if (ec->xkb_keymap_cache_dir) {
+		job->cache_dir = strdup(ec->xkb_keymap_cache_dir);
+		if (!job->cache_dir)
+			goto err;
+	}
+
+	return job;
+
+err:
+	weston_xkb_keymap_job_destroy(job);
+	return NULL;
+}
+
+/** Start getting the global keymap on a worker thread
+ *
+ * \param ec The compositor.
+ * \return 0 on success, -1 on failure.
+ *
+ * The rule names and cache directory must be set already. The keymap is
+ * picked up when the first keyboard without a keymap of its own needs
+ * it, so the compositor can carry on with backend and renderer setup in
+ * the meantime. If this fails, the keymap is simply compiled then.
+ */
+WL_EXPORT int
+weston_compositor_build_xkb_keymap_async(struct weston_compositor *ec)
+{
+	struct weston_xkb_keymap_job *job;
+	sigset_t mask, old_mask;
+	int ret;
+
+	if (ec->xkb_info || ec->xkb_keymap_job)
+		return 0;
+
+	/* XKB contexts are not thread-safe, the worker gets its own */
+	job = weston_xkb_keymap_job_create(ec,
+					   xkb_context_new(XKB_CONTEXT_NO_FLAGS));
+	if (!job)
+		return -1;
+
+	/* Signals are for the main thread to handle */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	ret = pthread_create(&job->thread, NULL,
+			     weston_xkb_keymap_job_thread, job);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (ret != 0) {
+		weston_xkb_keymap_job_destroy(job);
+		return -1;
+	}
+
+	job->threaded = true;
+	ec->xkb_keymap_job = job;
+
+	return 0;
+}
+
+static int
+weston_compositor_build_global_keymap(struct weston_compositor *ec)
+{
+	struct weston_xkb_keymap_job *job;
+	const char *keymap_string;
 
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
-	if (keymap == NULL) {
+	if (ec->xkb_keymap_job) {
+		job = ec->xkb_keymap_job;
+		ec->xkb_keymap_job = NULL;
+		pthread_join(job->thread, NULL);
+		job->threaded = false;
+	} else {
+		job = weston_xkb_keymap_job_create(ec,
+						   xkb_context_ref(ec->xkb_context));
+		if (!job)
+			return -1;
+		weston_xkb_keymap_job_run(job);
+	}
+
+	if (job->keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
 			"options %s\n",
 			ec->xkb_names.rules, ec->xkb_names.model,
 			ec->xkb_names.layout, ec->xkb_names.variant,
 			ec->xkb_names.options);
-		return -1;
+		goto out;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
-	xkb_keymap_unref(keymap);
-	if (ec->xkb_info == NULL)
-		return -1;
+	if (job->keymap_string == NULL) {
+		weston_log("failed to get string version of keymap\n");
+		goto out;
+	}
 
-	return 0;
+	keymap_string = job->keymap_string + job->key_size;
+	ec->xkb_info = weston_xkb_info_create_with_string(job->keymap,
+							  keymap_string);
+
+	if (job->from_cache) {
+		weston_log("Loaded XKB keymap from %s in %.1f ms\n",
+			   job->path, job->nsec / 1e6);
+	} else {
+		weston_log("Compiled XKB keymap in %.1f ms\n", job->nsec / 1e6);
+		if (ec->xkb_info && job->path)
+			weston_xkb_cache_store(job->key, job->path,
+					       keymap_string);
+	}
+
+out:
+	weston_xkb_keymap_job_destroy(job);
+
+	return ec->xkb_info ? 0 : -1;
 }
 
 WL_EXPORT void
@@ -67,6 +67,12 @@ struct weston_renderer {
 	bool (*import_dmabuf)(struct weston_compositor *ec,
 			      struct linux_dmabuf_buffer *buffer);
 
+	/** See weston_compositor_import_dmabuf_async() */
+	bool (*import_dmabuf_async)(struct weston_compositor *ec,
+				    struct linux_dmabuf_buffer *buffer,
+				    void (*done)(struct linux_dmabuf_buffer *buffer,
+						 bool success));
+
 	const struct weston_drm_format_array *
 			(*get_supported_formats)(struct weston_compositor *ec);
 
@@ -114,6 +120,11 @@ bool
 weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 				struct linux_dmabuf_buffer *buffer);
 bool
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      void (*done)(struct linux_dmabuf_buffer *buffer,
+						   bool success));
+bool
 weston_compositor_dmabuf_can_scanout(struct weston_compositor *compositor,
 					struct linux_dmabuf_buffer *buffer);
 void
@@ -182,6 +193,10 @@ weston_compositor_shutdown(struct weston_compositor *ec);
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec);
 
+char *
+weston_xkb_cache_key(struct xkb_context *context,
+		     const struct xkb_rule_names *names);
+
 int
 weston_input_init(struct weston_compositor *compositor);
 
@@ -452,6 +467,10 @@ struct weston_paint_node {
 	bool surf_xform_valid;
 
 	uint32_t try_view_on_plane_failure_reasons;
+
+	/* Snapshot of weston_surface::update_stats, taken each repaint */
+	float update_rate; /**< content updates per second, decays when idle */
+	float damage_area; /**< average damaged surface area per update */
 };
 
 struct weston_paint_node *
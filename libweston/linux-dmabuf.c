@@ -63,6 +63,12 @@ destroy_params(struct wl_resource *params_resource)
 	if (!buffer)
 		return;
 
+	if (buffer->import_pending) {
+		/* freed by params_import_done() */
+		buffer->params_resource = NULL;
+		return;
+	}
+
 	linux_dmabuf_buffer_destroy(buffer);
 }
 
@@ -85,7 +91,7 @@ params_add(struct wl_client *client,
 	struct linux_dmabuf_buffer *buffer;
 
 	buffer = wl_resource_get_user_data(params_resource);
-	if (!buffer) {
+	if (!buffer || buffer->import_pending) {
 		wl_resource_post_error(params_resource,
 			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
 			"params was already used to create a wl_buffer");
@@ -152,6 +158,68 @@ destroy_linux_dmabuf_wl_buffer(struct wl_resource *resource)
 	linux_dmabuf_buffer_destroy(buffer);
 }
 
+static bool
+params_create_wl_buffer(struct wl_client *client,
+			struct wl_resource *params_resource,
+			struct linux_dmabuf_buffer *buffer,
+			uint32_t buffer_id)
+{
+	buffer->buffer_resource = wl_resource_create(client,
+						     &wl_buffer_interface,
+						     1, buffer_id);
+	if (!buffer->buffer_resource) {
+		wl_resource_post_no_memory(params_resource);
+		return false;
+	}
+
+	wl_resource_set_implementation(buffer->buffer_resource,
+				       &linux_dmabuf_buffer_implementation,
+				       buffer, destroy_linux_dmabuf_wl_buffer);
+
+	/* send 'created' event when the request is not for an immediate
+	 * import, ie buffer_id is zero */
+	if (buffer_id == 0)
+		zwp_linux_buffer_params_v1_send_created(params_resource,
+						buffer->buffer_resource);
+
+	return true;
+}
+
+static void
+params_import_done(struct linux_dmabuf_buffer *buffer, bool success)
+{
+	struct wl_resource *params_resource = buffer->params_resource;
+
+	assert(buffer->import_pending);
+	buffer->import_pending = false;
+
+	/* The client destroyed the params before the import finished */
+	if (!params_resource)
+		goto err_buffer;
+
+	wl_resource_set_user_data(params_resource, NULL);
+	buffer->params_resource = NULL;
+
+	if (!success) {
+		zwp_linux_buffer_params_v1_send_failed(params_resource);
+		goto err_buffer;
+	}
+
+	if (!params_create_wl_buffer(wl_resource_get_client(params_resource),
+				     params_resource, buffer, 0)) {
+		zwp_linux_buffer_params_v1_send_failed(params_resource);
+		goto err_buffer;
+	}
+
+	return;
+
+err_buffer:
+	if (buffer->user_data_destroy_func)
+		buffer->user_data_destroy_func(buffer);
+
+	linux_dmabuf_buffer_destroy(buffer);
+}
+
 static void
 params_create_common(struct wl_client *client,
 		     struct wl_resource *params_resource,
@@ -166,7 +234,7 @@ params_create_common(struct wl_client *client,
 
 	buffer = wl_resource_get_user_data(params_resource);
 
-	if (!buffer) {
+	if (!buffer || buffer->import_pending) {
 		wl_resource_post_error(params_resource,
 			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
 			"params was already used to create a wl_buffer");
@@ -271,27 +339,28 @@ params_create_common(struct wl_client *client,
 		goto avoid_gpu_import;
 	}
 
+	/* 'create' lets us answer later, so the renderer may do the import
+	 * without holding up the compositor; params_import_done() finishes
+	 * the job. */
+	if (buffer_id == 0) {
+		buffer->params_resource = params_resource;
+		buffer->import_pending = true;
+		if (weston_compositor_import_dmabuf_async(buffer->compositor,
+							  buffer,
+							  params_import_done)) {
+			wl_resource_set_user_data(params_resource, buffer);
+			return;
+		}
+		buffer->params_resource = NULL;
+		buffer->import_pending = false;
+	}
+
 	if (!weston_compositor_import_dmabuf(buffer->compositor, buffer))
 		goto err_failed;
 
 avoid_gpu_import:
-	buffer->buffer_resource = wl_resource_create(client,
-						     &wl_buffer_interface,
-						     1, buffer_id);
-	if (!buffer->buffer_resource) {
-		wl_resource_post_no_memory(params_resource);
+	if (!params_create_wl_buffer(client, params_resource, buffer, buffer_id))
 		goto err_buffer;
-	}
-
-	wl_resource_set_implementation(buffer->buffer_resource,
-				       &linux_dmabuf_buffer_implementation,
-				       buffer, destroy_linux_dmabuf_wl_buffer);
-
-	/* send 'created' event when the request is not for an immediate
-	 * import, ie buffer_id is zero */
-	if (buffer_id == 0)
-		zwp_linux_buffer_params_v1_send_created(params_resource,
-						buffer->buffer_resource);
 
 	return;
 
@@ -431,17 +500,9 @@ weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feed
 
 	/* Get the formats indices array */
 	if (flags == 0) {
-		if (wl_array_copy(&tranche->formats_indices,
-				  &format_table->renderer_formats_indices) < 0) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err;
-		}
+		tranche->formats_indices = &format_table->renderer_formats_indices;
 	} else if (flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT) {
-		if (wl_array_copy(&tranche->formats_indices,
-				  &format_table->scanout_formats_indices) < 0) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err;
-		}
+		tranche->formats_indices = &format_table->scanout_formats_indices;
 	} else {
 		weston_log("error: for now we just have renderer and scanout "
 			   "tranches, can't create other type of tranche\n");
@@ -468,7 +529,6 @@ err:
 static void
 weston_dmabuf_feedback_tranche_destroy(struct weston_dmabuf_feedback_tranche *tranche)
 {
-	wl_array_release(&tranche->formats_indices);
 	wl_list_remove(&tranche->link);
 	free(tranche);
 }
@@ -527,6 +587,7 @@ weston_dmabuf_feedback_format_table_create(const struct weston_drm_format_array
 	}
 	wl_array_init(&format_table->renderer_formats_indices);
 	wl_array_init(&format_table->scanout_formats_indices);
+	wl_list_init(&format_table->scanout_subsets);
 
 	/* Creates formats file table and mmap it */
 	format_table->size = weston_drm_format_array_count_pairs(renderer_formats) *
@@ -562,6 +623,20 @@ err_fd:
 	return NULL;
 }
 
+struct format_table_subset {
+	struct wl_list link; /* weston_dmabuf_feedback_format_table::scanout_subsets */
+	uint64_t key;
+	struct wl_array indices;
+};
+
+static void
+format_table_subset_destroy(struct format_table_subset *subset)
+{
+	wl_array_release(&subset->indices);
+	wl_list_remove(&subset->link);
+	free(subset);
+}
+
 /** Destroys dma-buf feedback formats table
  *
  * @param format_table The dma-buf feedback format table to destroy
@@ -569,6 +644,11 @@ err_fd:
 WL_EXPORT void
 weston_dmabuf_feedback_format_table_destroy(struct weston_dmabuf_feedback_format_table *format_table)
 {
+	struct format_table_subset *subset, *tmp;
+
+	wl_list_for_each_safe(subset, tmp, &format_table->scanout_subsets, link)
+		format_table_subset_destroy(subset);
+
 	wl_array_release(&format_table->renderer_formats_indices);
 	wl_array_release(&format_table->scanout_formats_indices);
 
@@ -583,7 +663,8 @@ format_table_get_format_index(struct weston_dmabuf_feedback_format_table *format
 			      uint32_t format, uint64_t modifier, uint16_t *index_out)
 {
 	uint16_t index;
-	unsigned int num_elements = format_table->size / sizeof(index);
+	unsigned int num_elements = format_table->size /
+				    sizeof(*format_table->data);
 
 	for (index = 0; index < num_elements; index++) {
 		if (format_table->data[index].format == format &&
@@ -645,6 +726,88 @@ err:
 	return -1;
 }
 
+/** Find the scanout formats indices of a subset of the KMS planes
+ *
+ * @param format_table The dma-buf feedback format table
+ * @param key The key the subset was added with
+ * @return The indices, or NULL if no subset was added with this key
+ */
+WL_EXPORT struct wl_array *
+weston_dmabuf_feedback_format_table_get_scanout_subset(struct weston_dmabuf_feedback_format_table *format_table,
+						       uint64_t key)
+{
+	struct format_table_subset *subset;
+
+	wl_list_for_each(subset, &format_table->scanout_subsets, link)
+		if (subset->key == key)
+			return &subset->indices;
+
+	return NULL;
+}
+
+/** Add the scanout formats indices of a subset of the KMS planes
+ *
+ * A scanout tranche is best restricted to the formats of the planes that
+ * can actually be used for the surface, e.g. those of the CRTC driving
+ * its output. This computes the indices of such a set of formats once, so
+ * that tranches can then switch between them without touching the table.
+ * Formats that are not in the table, i.e. not supported by the renderer,
+ * are left out.
+ *
+ * The backend chooses the key, e.g. a mask of the planes in the subset.
+ *
+ * @param format_table The dma-buf feedback format table
+ * @param key The key to find the indices again with
+ * @param scanout_formats The formats supported by the planes of the subset
+ * @return The indices, owned by the table, or NULL on failure
+ */
+WL_EXPORT struct wl_array *
+weston_dmabuf_feedback_format_table_add_scanout_subset(struct weston_dmabuf_feedback_format_table *format_table,
+						       uint64_t key,
+						       const struct weston_drm_format_array *scanout_formats)
+{
+	struct format_table_subset *subset;
+	struct weston_drm_format *fmt;
+	unsigned int num_modifiers;
+	const uint64_t *modifiers;
+	uint16_t index, *index_ptr;
+	unsigned int i;
+
+	assert(!weston_dmabuf_feedback_format_table_get_scanout_subset(format_table,
+								       key));
+
+	subset = zalloc(sizeof(*subset));
+	if (!subset) {
+		weston_log("%s: out of memory\n", __func__);
+		return NULL;
+	}
+	subset->key = key;
+	wl_array_init(&subset->indices);
+	wl_list_insert(&format_table->scanout_subsets, &subset->link);
+
+	wl_array_for_each(fmt, &scanout_formats->arr) {
+		modifiers = weston_drm_format_get_modifiers(fmt, &num_modifiers);
+		for (i = 0; i < num_modifiers; i++) {
+			if (format_table_get_format_index(format_table,
+							  fmt->format,
+							  modifiers[i],
+							  &index) < 0)
+				continue;
+
+			index_ptr = wl_array_add(&subset->indices,
+						 sizeof(index));
+			if (!index_ptr) {
+				weston_log("%s: out of memory\n", __func__);
+				format_table_subset_destroy(subset);
+				return NULL;
+			}
+			*index_ptr = index;
+		}
+	}
+
+	return &subset->indices;
+}
+
 /** Creates dma-buf feedback object
  *
  * @param main_device The main device of the dma-buf feedback
@@ -759,7 +922,7 @@ weston_dmabuf_feedback_send(struct weston_dmabuf_feedback *dmabuf_feedback,
 		zwp_linux_dmabuf_feedback_v1_send_tranche_flags(res, tranche->flags);
 
 		/* tranche_formats event */
-		zwp_linux_dmabuf_feedback_v1_send_tranche_formats(res, &tranche->formats_indices);
+		zwp_linux_dmabuf_feedback_v1_send_tranche_formats(res, tranche->formats_indices);
 
 		/* tranche_done_event */
 		zwp_linux_dmabuf_feedback_v1_send_tranche_done(res);
@@ -73,6 +73,9 @@ struct linux_dmabuf_buffer {
 
 	/**< marked as scan-out capable, avoids any composition */
 	bool direct_display;
+
+	/**< the renderer is importing it for a 'create' request */
+	bool import_pending;
 };
 
 enum weston_dmabuf_feedback_tranche_preference {
@@ -102,6 +105,11 @@ struct weston_dmabuf_feedback_format_table {
 	/* Indices of the scanout formats (union of KMS plane's supported
          * formats intersected with the renderer formats). */
 	struct wl_array scanout_formats_indices;
+
+	/* Indices of the scanout formats of subsets of the KMS planes, each
+	 * computed once. See
+	 * weston_dmabuf_feedback_format_table_add_scanout_subset(). */
+	struct wl_list scanout_subsets;
 };
 
 struct weston_dmabuf_feedback {
@@ -142,7 +150,10 @@ struct weston_dmabuf_feedback_tranche {
 	uint32_t flags;
 	enum weston_dmabuf_feedback_tranche_preference preference;
 
-	struct wl_array formats_indices;
+	/* One of the index arrays of the format table, which outlives every
+	 * tranche. Changing the formats a tranche advertises is only a matter
+	 * of pointing it somewhere else. */
+	struct wl_array *formats_indices;
 };
 
 int
@@ -190,6 +201,15 @@ int
 weston_dmabuf_feedback_format_table_set_scanout_indices(struct weston_dmabuf_feedback_format_table *format_table,
 							const struct weston_drm_format_array *scanout_formats);
 
+struct wl_array *
+weston_dmabuf_feedback_format_table_get_scanout_subset(struct weston_dmabuf_feedback_format_table *format_table,
+						       uint64_t key);
+
+struct wl_array *
+weston_dmabuf_feedback_format_table_add_scanout_subset(struct weston_dmabuf_feedback_format_table *format_table,
+						       uint64_t key,
+						       const struct weston_drm_format_array *scanout_formats);
+
 struct weston_dmabuf_feedback_tranche *
 weston_dmabuf_feedback_tranche_create(struct weston_dmabuf_feedback *dmabuf_feedback,
 				      struct weston_dmabuf_feedback_format_table *format_table,
@@ -125,6 +125,9 @@ pixman_renderer_read_pixels(struct weston_output *output,
 
 	pixman_image_unref(out_buf);
 
+	output->perf.read_pixels_bytes +=
+		(uint64_t) (PIXMAN_FORMAT_BPP(format) / 8) * width * height;
+
 	return 0;
 }
 
@@ -343,6 +346,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 
  	/* Clip rendering to the damaged output region */
 	pixman_image_set_clip_region32(target_image, repaint_output);
+	output->perf.region_rects += pixman_region32_n_rects(repaint_output);
 
 	pixman_renderer_compute_transform(&transform, ev, output);
 
@@ -29,6 +29,7 @@
 #ifndef GL_RENDERER_INTERNAL_H
 #define GL_RENDERER_INTERNAL_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <time.h>
 
@@ -112,6 +113,27 @@ struct gl_shader_config {
 	} color_mapping;
 };
 
+/** Worker for linux-dmabuf 'create' requests
+ *
+ * eglCreateImageKHR() on a dma-buf can take milliseconds on some drivers.
+ * The protocol lets us answer a non-immediate 'create' later, so the EGLImage
+ * is created on this thread and the rest of the import is finished on the
+ * compositor thread once the event loop sees the eventfd.
+ */
+struct gl_dmabuf_importer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool running;
+	bool exit;
+
+	struct wl_list queue; /* gl_dmabuf_import_job::link, to the worker */
+	struct wl_list done; /* gl_dmabuf_import_job::link, from the worker */
+
+	int eventfd;
+	struct wl_event_source *source;
+};
+
 struct gl_renderer {
 	struct weston_renderer base;
 	struct weston_compositor *compositor;
@@ -133,6 +155,8 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	/* pixman_box32_t, see gl_renderer_plan_shm_upload() */
+	struct wl_array upload_boxes;
 
 	EGLDeviceEXT egl_device;
 	const char *drm_device;
@@ -166,7 +190,10 @@ struct gl_renderer {
 	bool has_surfaceless_context;
 
 	bool has_dmabuf_import;
+	/** Recently imported dma-bufs, see struct gl_dmabuf_image */
 	struct wl_list dmabuf_images;
+	int n_idle_dmabuf_images;
+	struct gl_dmabuf_importer dmabuf_importer;
 	struct wl_list dmabuf_formats;
 
 	bool has_texture_type_2_10_10_10_rev;
@@ -196,6 +223,12 @@ struct gl_renderer {
 
 	bool gl_supports_color_transforms;
 
+	/** Composite stable bottom layers once, see struct gl_layer_cache */
+	bool use_layer_cache;
+
+	/** SHM upload staging with GLES 3, see struct gl_upload_ring */
+	struct gl_upload_ring *upload_ring;
+
 	/** Shader program cache in most recently used order
 	 *
 	 * Uses struct gl_shader::link.
@@ -33,6 +33,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -40,6 +41,8 @@
 #include <float.h>
 #include <assert.h>
 #include <linux/input.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "linux-sync-file.h"
@@ -53,8 +56,10 @@
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "linux-explicit-synchronization.h"
 #include "pixel-formats.h"
+#include "shm-upload-plan.h"
 
 #include "shared/fd-util.h"
+#include "shared/hash.h"
 #include "shared/helpers.h"
 #include "shared/platform.h"
 #include "shared/string-helpers.h"
@@ -88,6 +93,21 @@ struct gl_fbo_texture {
 	int32_t height;
 };
 
+/** Composited result of the stable bottom of an output's scene
+ *
+ * The longest run of paint nodes from the bottom which rarely change, like
+ * the desktop background, panels and idle windows, is composited into a
+ * texture. Frames where only views above those change then draw that
+ * texture and the changed views, instead of every view in the damage.
+ */
+struct gl_layer_cache {
+	struct gl_fbo_texture fbotex;
+	uint64_t fingerprint;
+	unsigned int n_nodes; /**< paint nodes composited into fbotex */
+	struct wl_array updates; /**< uint32_t, their update counts */
+	pixman_region32_t stale; /**< global coordinates, needs redrawing */
+};
+
 struct gl_output_state {
 	EGLSurface egl_surface;
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
@@ -105,6 +125,8 @@ struct gl_output_state {
 	struct wl_list timeline_render_point_list;
 
 	struct gl_fbo_texture shadow;
+
+	struct gl_layer_cache layer_cache;
 };
 
 struct gl_renderer;
@@ -153,11 +175,18 @@ struct gl_buffer_state {
 	GLenum gl_pixel_type;
 	GLenum gl_format[3];
 	int offset[3]; /* per-plane pitch in bytes */
+	int texel_size[3]; /* per-texture bytes per texel */
 
 	EGLImageKHR images[3];
 	int num_images;
 	enum gl_shader_texture_variant shader_variant;
 
+	/* Last method SHM damage was uploaded with, for debugging */
+	enum shm_upload_method upload_method;
+
+	/* Owner of images[0] when the dma-buf import is shared */
+	struct gl_dmabuf_image *dmabuf_image;
+
 	GLuint textures[3];
 	int num_textures;
 
@@ -765,6 +794,7 @@ repaint_region(struct gl_renderer *gr,
 	 * it has a non-zero area (at least 3 vertices, actually).
 	 */
 	nfans = texture_region(ev, region, surf_region);
+	output->perf.region_rects += pixman_region32_n_rects(region);
 
 	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
@@ -996,7 +1026,8 @@ gl_shader_config_init_for_paint_node(struct gl_shader_config *sconf,
 
 static void
 draw_paint_node(struct weston_paint_node *pnode,
-		pixman_region32_t *damage /* in global coordinates */)
+		pixman_region32_t *damage, /* in global coordinates */
+		pixman_region32_t *clip /* occluded, in global coordinates */)
 {
 	struct gl_renderer *gr = get_renderer(pnode->surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(pnode->surface);
@@ -1021,7 +1052,7 @@ draw_paint_node(struct weston_paint_node *pnode,
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &pnode->view->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &pnode->view->clip);
+	pixman_region32_subtract(&repaint, &repaint, clip);
 
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
@@ -1096,16 +1127,354 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+/** Draw a texture of the output's size over a region of the output
+ *
+ * \param region The region to draw, in global coordinates.
+ * \param ctransf Color transformation to apply, or NULL.
+ */
+static void
+draw_fbo_texture(struct weston_output *output,
+		 const struct gl_fbo_texture *fbotex,
+		 pixman_region32_t *region,
+		 struct weston_color_transform *ctransf)
+{
+	struct gl_shader_config sconf = {
+		.req = {
+			.variant = SHADER_VARIANT_RGBA,
+			.input_is_premult = true,
+		},
+		.projection = {
+			.d = { /* transpose */
+				 2.0f,  0.0f, 0.0f, 0.0f,
+				 0.0f,  2.0f, 0.0f, 0.0f,
+				 0.0f,  0.0f, 1.0f, 0.0f,
+				-1.0f, -1.0f, 0.0f, 1.0f
+			},
+			.type = WESTON_MATRIX_TRANSFORM_SCALE |
+				WESTON_MATRIX_TRANSFORM_TRANSLATE,
+		},
+		.view_alpha = 1.0f,
+		.input_tex_filter = GL_NEAREST,
+		.input_tex[0] = fbotex->tex,
+	};
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	double width = output->current_mode->width;
+	double height = output->current_mode->height;
+	pixman_box32_t *rects;
+	int n_rects;
+	int i;
+	pixman_region32_t translated_damage;
+	GLfloat verts[4 * 2];
+
+	if (!gl_shader_config_set_color_transform(&sconf, ctransf)) {
+		weston_log("GL-renderer: %s failed to generate a color transformation.\n", __func__);
+		return;
+	}
+
+	pixman_region32_init(&translated_damage);
+
+	gl_renderer_use_program(gr, &sconf);
+	glDisable(GL_BLEND);
+
+	/* region is in global coordinates */
+	pixman_region32_intersect(&translated_damage, region,
+				  &output->region);
+	/* Convert to output pixel coordinates in-place */
+	weston_output_region_from_global(output, &translated_damage);
+
+	rects = pixman_region32_rectangles(&translated_damage, &n_rects);
+	for (i = 0; i < n_rects; i++) {
+
+		verts[0] = rects[i].x1 / width;
+		verts[1] = (height - rects[i].y1) / height;
+		verts[2] = rects[i].x2 / width;
+		verts[3] = (height - rects[i].y1) / height;
+
+		verts[4] = rects[i].x2 / width;
+		verts[5] = (height - rects[i].y2) / height;
+		verts[6] = rects[i].x1 / width;
+		verts[7] = (height - rects[i].y2) / height;
+
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+		glEnableVertexAttribArray(0);
+
+		/* texcoord: */
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+		glEnableVertexAttribArray(1);
+
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pixman_region32_fini(&translated_damage);
+}
+
+/* Paint nodes updating at most this often per second may be cached. */
+#define GL_LAYER_CACHE_MAX_RATE 2.0f
+
+/** Collect the stable paint nodes at the bottom of the renderer's scene
+ *
+ * \param nodes Filled with struct weston_paint_node pointers, bottom to
+ * top.
+ * \return Fingerprint of everything but their content which decides how
+ * they are drawn.
+ */
+static uint64_t
+gl_layer_cache_collect(struct weston_output *output, struct wl_array *nodes)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_paint_node *pnode, **p;
+	uint64_t hash = FNV1A_64_INIT;
+
+	hash = fnv1a_64_value(hash, output->current_mode->width);
+	hash = fnv1a_64_value(hash, output->current_mode->height);
+	hash = fnv1a_64_value(hash, output->matrix.d);
+	hash = fnv1a_64_value(hash, output->current_protection);
+	hash = fnv1a_64_value(hash, output->color_outcome);
+
+	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
+				 z_order_link) {
+		struct weston_view *view = pnode->view;
+		struct weston_surface *surface = pnode->surface;
+
+		if (view->plane != &compositor->primary_plane)
+			continue;
+		if (pnode->update_rate > GL_LAYER_CACHE_MAX_RATE)
+			break;
+
+		p = wl_array_add(nodes, sizeof *p);
+		if (!p)
+			break;
+		*p = pnode;
+
+		hash = fnv1a_64_value(hash, pnode);
+		hash = fnv1a_64_value(hash, view->alpha);
+		hash = fnv1a_64_value(hash,
+			*pixman_region32_extents(&view->transform.boundingbox));
+		hash = fnv1a_64_value(hash,
+			*pixman_region32_extents(&view->transform.opaque));
+		hash = fnv1a_64_value(hash, view->transform.enabled);
+		if (view->transform.enabled)
+			hash = fnv1a_64_value(hash, view->transform.matrix.d);
+		hash = fnv1a_64_value(hash, view->geometry.scissor_enabled);
+		if (view->geometry.scissor_enabled)
+			hash = fnv1a_64_value(hash,
+				*pixman_region32_extents(&view->geometry.scissor));
+		hash = fnv1a_64_value(hash,
+			*pixman_region32_extents(&surface->opaque));
+		hash = fnv1a_64_value(hash, surface->width);
+		hash = fnv1a_64_value(hash, surface->height);
+		hash = fnv1a_64_value(hash, surface->buffer_viewport);
+		hash = fnv1a_64_value(hash, surface->desired_protection);
+		hash = fnv1a_64_value(hash, pnode->surf_xform.transform);
+	}
+
+	return hash;
+}
+
+/** Bring the layer cache up to date within damage and draw it
+ *
+ * \param damage The region being repainted, in global coordinates.
+ * \return The number of paint nodes from the bottom, on the primary
+ * plane, the cache has drawn; 0 if it is not used this time.
+ */
+static unsigned int
+gl_layer_cache_draw(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_layer_cache *cache = &go->layer_cache;
+	struct weston_paint_node **nodes;
+	pixman_region32_t *clips;
+	pixman_region32_t redraw;
+	struct wl_array node_array;
+	struct wl_array clip_array;
+	uint32_t *updates;
+	uint64_t fingerprint;
+	GLint target_fbo;
+	GLint viewport[4];
+	unsigned int n, i;
+	bool ok;
+
+	if (!gr->use_layer_cache || gr->fan_debug)
+		return 0;
+
+	wl_array_init(&node_array);
+	fingerprint = gl_layer_cache_collect(output, &node_array);
+	nodes = node_array.data;
+	n = node_array.size / sizeof *nodes;
+
+	/* a single node is as quick to draw as the cache */
+	if (n < 2) {
+		wl_array_release(&node_array);
+		return 0;
+	}
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target_fbo);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	if (cache->fbotex.fbo != 0 &&
+	    (cache->fbotex.width != output->current_mode->width ||
+	     cache->fbotex.height != output->current_mode->height)) {
+		gl_fbo_texture_fini(&cache->fbotex);
+	}
+
+	if (cache->fbotex.fbo == 0) {
+		/* keep the precision of what it stands in for */
+		if (shadow_exists(go))
+			ok = gl_fbo_texture_init(&cache->fbotex,
+						 output->current_mode->width,
+						 output->current_mode->height,
+						 GL_RGBA16F, GL_RGBA,
+						 GL_HALF_FLOAT);
+		else
+			ok = gl_fbo_texture_init(&cache->fbotex,
+						 output->current_mode->width,
+						 output->current_mode->height,
+						 GL_RGBA, GL_RGBA,
+						 GL_UNSIGNED_BYTE);
+		if (!ok) {
+			weston_log("Output %s failed to create layer cache, "
+				   "disabling it.\n", output->name);
+			gr->use_layer_cache = false;
+			glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+			wl_array_release(&node_array);
+			return 0;
+		}
+		cache->n_nodes = 0;
+	}
+
+	if (fingerprint != cache->fingerprint || n != cache->n_nodes) {
+		cache->fingerprint = fingerprint;
+		cache->n_nodes = n;
+		cache->updates.size = 0;
+		updates = wl_array_add(&cache->updates, n * sizeof *updates);
+		if (!updates) {
+			cache->n_nodes = 0;
+			glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+			wl_array_release(&node_array);
+			return 0;
+		}
+		for (i = 0; i < n; i++)
+			updates[i] = nodes[i]->surface->update_stats.updates;
+		pixman_region32_copy(&cache->stale, &output->region);
+	} else {
+		/* new content only invalidates where it is */
+		updates = cache->updates.data;
+		for (i = 0; i < n; i++) {
+			struct weston_paint_node *pnode = nodes[i];
+
+			if (updates[i] == pnode->surface->update_stats.updates)
+				continue;
+
+			updates[i] = pnode->surface->update_stats.updates;
+			pixman_region32_union(&cache->stale, &cache->stale,
+					      &pnode->view->transform.boundingbox);
+		}
+	}
+
+	pixman_region32_init(&redraw);
+	pixman_region32_intersect(&redraw, &cache->stale, damage);
+
+	if (pixman_region32_not_empty(&redraw)) {
+		pixman_region32_t clear;
+		pixman_box32_t *rects;
+		int n_rects, r;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, cache->fbotex.fbo);
+		glViewport(0, 0, cache->fbotex.width, cache->fbotex.height);
+
+		/* what no view covers stays black */
+		pixman_region32_init(&clear);
+		pixman_region32_intersect(&clear, &redraw, &output->region);
+		weston_output_region_from_global(output, &clear);
+		rects = pixman_region32_rectangles(&clear, &n_rects);
+		glEnable(GL_SCISSOR_TEST);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		for (r = 0; r < n_rects; r++) {
+			glScissor(rects[r].x1,
+				  cache->fbotex.height - rects[r].y2,
+				  rects[r].x2 - rects[r].x1,
+				  rects[r].y2 - rects[r].y1);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		glDisable(GL_SCISSOR_TEST);
+		pixman_region32_fini(&clear);
+
+		/* Views above these have no say in the cache; only
+		 * occlusion among the cached ones counts. */
+		wl_array_init(&clip_array);
+		clips = wl_array_add(&clip_array, n * sizeof *clips);
+		if (clips) {
+			pixman_region32_init(&clips[n - 1]);
+			for (i = n - 1; i > 0; i--) {
+				pixman_region32_init(&clips[i - 1]);
+				pixman_region32_union(&clips[i - 1], &clips[i],
+						      &nodes[i]->view->transform.opaque);
+			}
+
+			for (i = 0; i < n; i++)
+				draw_paint_node(nodes[i], &redraw, &clips[i]);
+
+			for (i = 0; i < n; i++)
+				pixman_region32_fini(&clips[i]);
+
+			pixman_region32_subtract(&cache->stale, &cache->stale,
+						 &redraw);
+		}
+		wl_array_release(&clip_array);
+	}
+	pixman_region32_fini(&redraw);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	/* what could not be brought up to date is drawn as usual */
+	pixman_region32_init(&redraw);
+	pixman_region32_intersect(&redraw, &cache->stale, damage);
+	if (pixman_region32_not_empty(&redraw)) {
+		pixman_region32_fini(&redraw);
+		wl_array_release(&node_array);
+		return 0;
+	}
+	pixman_region32_fini(&redraw);
+
+	draw_fbo_texture(output, &cache->fbotex, damage, NULL);
+
+	wl_array_release(&node_array);
+
+	return n;
+}
+
+static void
+gl_layer_cache_fini(struct gl_layer_cache *cache)
+{
+	if (cache->fbotex.fbo != 0)
+		gl_fbo_texture_fini(&cache->fbotex);
+	wl_array_release(&cache->updates);
+	pixman_region32_fini(&cache->stale);
+}
+
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_paint_node *pnode;
+	unsigned int cached;
+
+	cached = gl_layer_cache_draw(output, damage);
 
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
-		if (pnode->view->plane == &compositor->primary_plane)
-			draw_paint_node(pnode, damage);
+		if (pnode->view->plane != &compositor->primary_plane)
+			continue;
+
+		if (cached > 0) {
+			cached--;
+			continue;
+		}
+
+		draw_paint_node(pnode, damage, &pnode->view->clip);
 	}
 }
 
@@ -1493,77 +1862,9 @@ blit_shadow_to_output(struct weston_output *output,
 		      pixman_region32_t *output_damage)
 {
 	struct gl_output_state *go = get_output_state(output);
-	struct gl_shader_config sconf = {
-		.req = {
-			.variant = SHADER_VARIANT_RGBA,
-			.input_is_premult = true,
-		},
-		.projection = {
-			.d = { /* transpose */
-				 2.0f,  0.0f, 0.0f, 0.0f,
-				 0.0f,  2.0f, 0.0f, 0.0f,
-				 0.0f,  0.0f, 1.0f, 0.0f,
-				-1.0f, -1.0f, 0.0f, 1.0f
-			},
-			.type = WESTON_MATRIX_TRANSFORM_SCALE |
-				WESTON_MATRIX_TRANSFORM_TRANSLATE,
-		},
-		.view_alpha = 1.0f,
-		.input_tex_filter = GL_NEAREST,
-		.input_tex[0] = go->shadow.tex,
-	};
-	struct gl_renderer *gr = get_renderer(output->compositor);
-	double width = output->current_mode->width;
-	double height = output->current_mode->height;
-	struct weston_color_transform *ctransf;
-	pixman_box32_t *rects;
-	int n_rects;
-	int i;
-	pixman_region32_t translated_damage;
-	GLfloat verts[4 * 2];
-
-	ctransf = output->color_outcome->from_blend_to_output;
-	if (!gl_shader_config_set_color_transform(&sconf, ctransf)) {
-		weston_log("GL-renderer: %s failed to generate a color transformation.\n", __func__);
-		return;
-	}
-
-	pixman_region32_init(&translated_damage);
 
-	gl_renderer_use_program(gr, &sconf);
-	glDisable(GL_BLEND);
-
-	/* output_damage is in global coordinates */
-	pixman_region32_intersect(&translated_damage, output_damage,
-				  &output->region);
-	/* Convert to output pixel coordinates in-place */
-	weston_output_region_from_global(output, &translated_damage);
-
-	rects = pixman_region32_rectangles(&translated_damage, &n_rects);
-	for (i = 0; i < n_rects; i++) {
-
-		verts[0] = rects[i].x1 / width;
-		verts[1] = (height - rects[i].y1) / height;
-		verts[2] = rects[i].x2 / width;
-		verts[3] = (height - rects[i].y1) / height;
-
-		verts[4] = rects[i].x2 / width;
-		verts[5] = (height - rects[i].y2) / height;
-		verts[6] = rects[i].x1 / width;
-		verts[7] = (height - rects[i].y2) / height;
-
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glEnableVertexAttribArray(0);
-
-		/* texcoord: */
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glEnableVertexAttribArray(1);
-
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-	}
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	pixman_region32_fini(&translated_damage);
+	draw_fbo_texture(output, &go->shadow, output_damage,
+			 output->color_outcome->from_blend_to_output);
 }
 
 /* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
@@ -1779,6 +2080,8 @@ gl_renderer_read_pixels(struct weston_output *output,
 	glReadPixels(x, y, width, height, gl_format,
 		     GL_UNSIGNED_BYTE, pixels);
 
+	output->perf.read_pixels_bytes += (uint64_t) width * height * 4;
+
 	return 0;
 }
 
@@ -1799,6 +2102,347 @@ gl_format_from_internal(GLenum internal_format)
 	}
 }
 
+/** Number of pixel unpack buffers SHM uploads rotate through */
+#define GL_UPLOAD_RING_SLOTS 4
+#define GL_UPLOAD_SLOT_MIN_SIZE (4 * 1024 * 1024)
+#define GL_UPLOAD_SLOT_MAX_SIZE (64 * 1024 * 1024)
+
+struct gl_upload_slot {
+	GLuint pbo;
+	GLsizeiptr size;
+	GLsizeiptr used;
+	/* After the latest upload from this slot */
+	GLsync fence;
+};
+
+/** Staging memory for SHM texture uploads
+ *
+ * Uploading straight from the wl_shm pool makes the driver either copy the
+ * client memory or wait for the GPU before glTexSubImage2D() returns. With
+ * GLES 3, the damage is instead copied once into a pixel unpack buffer, and
+ * the texture upload reads from there whenever the GPU gets to it.
+ *
+ * The buffers form a ring. Uploads are sub-allocated from the current slot
+ * until it is full, and a slot is only reused once the fence after its
+ * latest upload has signalled. Rather than stalling on a busy slot, the
+ * upload then goes the direct way.
+ */
+struct gl_upload_ring {
+	struct gl_upload_slot slots[GL_UPLOAD_RING_SLOTS];
+	int current;
+
+	/* Totals reported in the gl-renderer scope */
+	uint64_t staged_bytes;
+	uint64_t direct_bytes;
+	uint64_t upload_nsec;
+	unsigned int stalls;
+};
+
+static void
+gl_upload_ring_init(struct gl_renderer *gr)
+{
+	struct gl_upload_ring *ring;
+	GLuint pbos[GL_UPLOAD_RING_SLOTS];
+	int i;
+
+	if (gr->gl_version < gr_gl_version(3, 0))
+		return;
+
+	ring = zalloc(sizeof *ring);
+	if (!ring)
+		return;
+
+	glGenBuffers(ARRAY_LENGTH(pbos), pbos);
+	for (i = 0; i < GL_UPLOAD_RING_SLOTS; i++)
+		ring->slots[i].pbo = pbos[i];
+
+	gr->upload_ring = ring;
+}
+
+static void
+gl_upload_ring_fini(struct gl_renderer *gr)
+{
+	struct gl_upload_ring *ring = gr->upload_ring;
+	int i;
+
+	if (!ring)
+		return;
+
+	for (i = 0; i < GL_UPLOAD_RING_SLOTS; i++) {
+		if (ring->slots[i].fence)
+			glDeleteSync(ring->slots[i].fence);
+		glDeleteBuffers(1, &ring->slots[i].pbo);
+	}
+	free(ring);
+	gr->upload_ring = NULL;
+}
+
+/** Find room for size bytes of staging memory
+ *
+ * On success, the PBO of the current slot is left bound to
+ * GL_PIXEL_UNPACK_BUFFER.
+ *
+ * \return The offset of the room in the PBO, or -1 if the upload should
+ * go the direct way.
+ */
+static GLintptr
+gl_upload_ring_reserve(struct gl_upload_ring *ring, GLsizeiptr size)
+{
+	struct gl_upload_slot *slot = &ring->slots[ring->current];
+	GLintptr offset;
+
+	if (size > GL_UPLOAD_SLOT_MAX_SIZE)
+		return -1;
+
+	if (slot->used + size > slot->size) {
+		slot = &ring->slots[(ring->current + 1) % GL_UPLOAD_RING_SLOTS];
+		if (slot->fence) {
+			if (glClientWaitSync(slot->fence, 0, 0) ==
+			    GL_TIMEOUT_EXPIRED) {
+				ring->stalls++;
+				return -1;
+			}
+			glDeleteSync(slot->fence);
+			slot->fence = NULL;
+		}
+		ring->current = slot - ring->slots;
+		slot->used = 0;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+	if (slot->size < size) {
+		slot->size = MAX(size, GL_UPLOAD_SLOT_MIN_SIZE);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slot->size, NULL,
+			     GL_STREAM_DRAW);
+	}
+
+	offset = slot->used;
+	slot->used += size;
+
+	return offset;
+}
+
+/* Row stride of pixel data as GL reads it with the default
+ * GL_UNPACK_ALIGNMENT of 4 */
+static int
+gl_unpack_stride(int width, int texel_size)
+{
+	return (width * texel_size + 3) & ~3;
+}
+
+/* Staging chunks start at 16 bytes, a multiple of any texel size */
+static GLsizeiptr
+staged_chunk_size(int stride, int height)
+{
+	return ((GLsizeiptr) stride * height + 15) & ~15;
+}
+
+/** Upload boxes of a SHM buffer through the staging ring
+ *
+ * Must be called within wl_shm_buffer_begin_access().
+ *
+ * \return false if nothing was uploaded, the boxes then need to be
+ * uploaded directly.
+ */
+static bool
+gl_renderer_upload_shm_staged(struct gl_renderer *gr,
+			      struct gl_buffer_state *gb,
+			      struct weston_buffer *buffer,
+			      const pixman_box32_t *boxes, int n,
+			      uint64_t *upload_bytes, unsigned int *uploads)
+{
+	struct gl_upload_ring *ring = gr->upload_ring;
+	struct gl_upload_slot *slot;
+	const uint8_t *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	GLsizeiptr size = 0;
+	GLintptr offset, pos;
+	uint8_t *map;
+	int i, j, row;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+			int w = (boxes[i].x2 - boxes[i].x1) / hsub;
+			int h = (boxes[i].y2 - boxes[i].y1) / vsub;
+
+			if (w > 0 && h > 0)
+				size += staged_chunk_size(
+					gl_unpack_stride(w, gb->texel_size[j]), h);
+		}
+	}
+	if (size == 0)
+		return true;
+
+	offset = gl_upload_ring_reserve(ring, size);
+	if (offset < 0)
+		return false;
+
+	map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+			       GL_MAP_WRITE_BIT |
+			       GL_MAP_INVALIDATE_RANGE_BIT |
+			       GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	pos = 0;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+			int texel_size = gb->texel_size[j];
+			int w = (boxes[i].x2 - boxes[i].x1) / hsub;
+			int h = (boxes[i].y2 - boxes[i].y1) / vsub;
+			int src_stride = gl_unpack_stride(gb->pitch / hsub,
+							  texel_size);
+			int dst_stride = gl_unpack_stride(w, texel_size);
+			const uint8_t *src;
+
+			if (w <= 0 || h <= 0)
+				continue;
+
+			src = data + gb->offset[j] +
+			      (boxes[i].y1 / vsub) * src_stride +
+			      (boxes[i].x1 / hsub) * texel_size;
+			for (row = 0; row < h; row++)
+				memcpy(map + pos + row * dst_stride,
+				       src + row * src_stride, w * texel_size);
+
+			pos += staged_chunk_size(dst_stride, h);
+		}
+	}
+
+	if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+		/* The staged data got lost, e.g. on a mode switch */
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+
+	pos = offset;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+			int w = (boxes[i].x2 - boxes[i].x1) / hsub;
+			int h = (boxes[i].y2 - boxes[i].y1) / vsub;
+
+			if (w <= 0 || h <= 0)
+				continue;
+
+			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					boxes[i].x1 / hsub,
+					boxes[i].y1 / vsub,
+					w, h,
+					gl_format_from_internal(gb->gl_format[j]),
+					gb->gl_pixel_type,
+					(const void *) (uintptr_t) pos);
+			pos += staged_chunk_size(
+				gl_unpack_stride(w, gb->texel_size[j]), h);
+			*upload_bytes += (uint64_t) gb->texel_size[j] * w * h;
+			(*uploads)++;
+		}
+	}
+
+	slot = &ring->slots[ring->current];
+	if (slot->fence)
+		glDeleteSync(slot->fence);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return true;
+}
+
+/** Decide how to upload the damage of a SHM buffer, see
+ * shm_upload_plan_choose()
+ *
+ * \return The plan->n_boxes boxes to upload, in buffer coordinates, or
+ * NULL on allocation failure.
+ */
+static pixman_box32_t *
+gl_renderer_plan_shm_upload(struct gl_renderer *gr,
+			    struct weston_surface *surface,
+			    struct weston_buffer *buffer,
+			    struct shm_upload_plan *plan)
+{
+	struct gl_buffer_state *gb = get_surface_state(surface)->buffer;
+	pixman_box32_t *rectangles, *rects;
+	int i, n;
+
+	rectangles = pixman_region32_rectangles(&gb->texture_damage, &n);
+
+	gr->upload_boxes.size = 0;
+	rects = wl_array_add(&gr->upload_boxes,
+			     (n + MAX(n, 1)) * sizeof *rects);
+	if (!rects)
+		return NULL;
+
+	for (i = 0; i < n; i++)
+		rects[i] = weston_surface_to_buffer_rect(surface, rectangles[i]);
+
+	/* Sub-sampled planes are accounted for in the call cost only */
+	shm_upload_plan_choose(plan, rects, n, buffer->width, buffer->height,
+			       gb->texel_size[0], gb->num_textures, rects + n);
+
+	if (plan->method != gb->upload_method) {
+		weston_log_scope_printf(gr->renderer_scope,
+			"SHM uploads for surface %p switch from %s to %s, "
+			"estimated cost %" PRIu64 " (rects) %" PRIu64
+			" (bands) %" PRIu64 " (full)\n",
+			surface, shm_upload_method_name(gb->upload_method),
+			shm_upload_method_name(plan->method),
+			plan->cost[SHM_UPLOAD_RECTS],
+			plan->cost[SHM_UPLOAD_BANDS],
+			plan->cost[SHM_UPLOAD_FULL]);
+		gb->upload_method = plan->method;
+	}
+
+	return rects + n;
+}
+
+static void
+gl_renderer_log_shm_upload(struct gl_renderer *gr,
+			   struct weston_surface *surface,
+			   int damage_rects, enum shm_upload_method method,
+			   unsigned int uploads, uint64_t upload_bytes,
+			   bool staged, const struct timespec *start)
+{
+	struct gl_upload_ring *ring = gr->upload_ring;
+	struct timespec end;
+	int64_t nsec;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	nsec = timespec_sub_to_nsec(&end, start);
+
+	if (ring) {
+		if (staged)
+			ring->staged_bytes += upload_bytes;
+		else
+			ring->direct_bytes += upload_bytes;
+		ring->upload_nsec += nsec;
+	}
+
+	weston_log_scope_printf(gr->renderer_scope,
+		"SHM upload for surface %p: %d damage rects as %s in %u "
+		"uploads, %" PRIu64 " bytes %s in %" PRId64 " us\n",
+		surface, damage_rects, shm_upload_method_name(method),
+		uploads, upload_bytes, staged ? "staged" : "direct",
+		nsec / 1000);
+	if (ring)
+		weston_log_scope_printf(gr->renderer_scope,
+			"\ttotal %" PRIu64 " bytes staged, %" PRIu64
+			" bytes direct in %" PRIu64 " us, %u ring stalls\n",
+			ring->staged_bytes, ring->direct_bytes,
+			ring->upload_nsec / 1000, ring->stalls);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface,
 			 struct weston_buffer *buffer)
@@ -1807,11 +2451,18 @@ gl_renderer_flush_damage(struct weston_surface *surface,
 		&surface->compositor->test_data.test_quirks;
 	struct gl_surface_state *gs = get_surface_state(surface);
 	struct gl_buffer_state *gb = gs->buffer;
+	struct gl_renderer *gr = gb->gr;
 	struct weston_view *view;
 	bool texture_used;
-	pixman_box32_t *rectangles;
+	struct shm_upload_plan plan = { .method = SHM_UPLOAD_FULL };
+	pixman_box32_t *boxes = NULL;
 	uint8_t *data;
-	int i, j, n;
+	uint64_t upload_bytes = 0;
+	unsigned int uploads = 0;
+	bool staged = false;
+	bool timed;
+	struct timespec start;
+	int i, j;
 
 	assert(buffer && gb);
 
@@ -1845,9 +2496,16 @@ gl_renderer_flush_damage(struct weston_surface *surface,
 
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
+	timed = weston_log_scope_is_enabled(gr->renderer_scope);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
 	glActiveTexture(GL_TEXTURE0);
 
-	if (gb->needs_full_upload || quirks->gl_force_full_upload) {
+	if (!gb->needs_full_upload && !quirks->gl_force_full_upload)
+		boxes = gl_renderer_plan_shm_upload(gr, surface, buffer, &plan);
+
+	if (!boxes) {
 		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
@@ -1867,17 +2525,26 @@ gl_renderer_flush_damage(struct weston_surface *surface,
 				     gl_format_from_internal(gb->gl_format[j]),
 				     gb->gl_pixel_type,
 				     data + gb->offset[j]);
+			upload_bytes += (uint64_t) gb->texel_size[j] *
+					(buffer->width / hsub) *
+					(buffer->height / vsub);
+			uploads++;
 		}
 		wl_shm_buffer_end_access(buffer->shm_buffer);
-		goto done;
+		goto account;
 	}
 
-	rectangles = pixman_region32_rectangles(&gb->texture_damage, &n);
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
-	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
-
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+	if (gr->upload_ring &&
+	    gl_renderer_upload_shm_staged(gr, gb, buffer,
+					  boxes, plan.n_boxes,
+					  &upload_bytes, &uploads)) {
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		staged = true;
+		goto account;
+	}
+	for (i = 0; i < plan.n_boxes; i++) {
+		pixman_box32_t r = boxes[i];
 
 		for (j = 0; j < gb->num_textures; j++) {
 			int hsub = pixel_format_hsub(buffer->pixel_format, j);
@@ -1896,10 +2563,24 @@ gl_renderer_flush_damage(struct weston_surface *surface,
 					gl_format_from_internal(gb->gl_format[j]),
 					gb->gl_pixel_type,
 					data + gb->offset[j]);
+			upload_bytes += (uint64_t) gb->texel_size[j] *
+					((r.x2 - r.x1) / hsub) *
+					((r.y2 - r.y1) / vsub);
+			uploads++;
 		}
 	}
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 
+account:
+	if (surface->output) {
+		surface->output->perf.shm_uploads += uploads;
+		surface->output->perf.upload_bytes += upload_bytes;
+	}
+	if (timed)
+		gl_renderer_log_shm_upload(gr, surface,
+			pixman_region32_n_rects(&gb->texture_damage),
+			plan.method, uploads, upload_bytes, staged, &start);
+
 done:
 	pixman_region32_fini(&gb->texture_damage);
 	pixman_region32_init(&gb->texture_damage);
@@ -1910,6 +2591,154 @@ done:
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 }
 
+/** Identity of a client dma-buf import
+ *
+ * The fds themselves differ on every import, so the dma-bufs are told apart
+ * by the device and inode behind them. Those stay unique for as long as an
+ * EGLImage holds a reference to the dma-buf.
+ */
+struct gl_dmabuf_image_key {
+	int32_t width;
+	int32_t height;
+	uint32_t format;
+	uint32_t flags;
+	int n_planes;
+	uint32_t offset[MAX_DMABUF_PLANES];
+	uint32_t stride[MAX_DMABUF_PLANES];
+	uint64_t modifier[MAX_DMABUF_PLANES];
+	dev_t dev[MAX_DMABUF_PLANES];
+	ino_t ino[MAX_DMABUF_PLANES];
+};
+
+/** An EGLImage shared by every import of the same dma-buf
+ *
+ * Clients recycling buffer pools, or recreating wl_buffers for the same
+ * dma-bufs, would otherwise pay for eglCreateImageKHR() on every import.
+ * Images no longer used by any buffer are kept for a while too, up to
+ * GL_DMABUF_IMAGE_IDLE_MAX of them, least recently used dropped first.
+ */
+struct gl_dmabuf_image {
+	struct wl_list link; /* gl_renderer::dmabuf_images, most recent first */
+	struct gl_dmabuf_image_key key;
+	EGLImageKHR image;
+	GLenum target;
+	int refcount;
+	bool detached; /* renderer destroyed while still in use */
+};
+
+#define GL_DMABUF_IMAGE_IDLE_MAX 8
+
+static bool
+gl_dmabuf_image_key_init(struct gl_dmabuf_image_key *key,
+			 const struct dmabuf_attributes *attributes)
+{
+	struct stat st;
+	int i;
+
+	/* Compared with memcmp(), so clear the padding too */
+	memset(key, 0, sizeof *key);
+	key->width = attributes->width;
+	key->height = attributes->height;
+	key->format = attributes->format;
+	key->flags = attributes->flags;
+	key->n_planes = attributes->n_planes;
+
+	for (i = 0; i < attributes->n_planes; i++) {
+		if (fstat(attributes->fd[i], &st) < 0)
+			return false;
+
+		key->offset[i] = attributes->offset[i];
+		key->stride[i] = attributes->stride[i];
+		key->modifier[i] = attributes->modifier[i];
+		key->dev[i] = st.st_dev;
+		key->ino[i] = st.st_ino;
+	}
+
+	return true;
+}
+
+static struct gl_dmabuf_image *
+gl_dmabuf_image_lookup(struct gl_renderer *gr,
+		       const struct gl_dmabuf_image_key *key)
+{
+	struct gl_dmabuf_image *img;
+
+	wl_list_for_each(img, &gr->dmabuf_images, link) {
+		if (memcmp(&img->key, key, sizeof *key) == 0)
+			return img;
+	}
+
+	return NULL;
+}
+
+static struct gl_dmabuf_image *
+gl_dmabuf_image_create(struct gl_renderer *gr,
+		       const struct gl_dmabuf_image_key *key,
+		       EGLImageKHR image, GLenum target)
+{
+	struct gl_dmabuf_image *img;
+
+	img = zalloc(sizeof *img);
+	if (!img)
+		return NULL;
+
+	img->key = *key;
+	img->image = image;
+	img->target = target;
+	img->refcount = 1;
+	wl_list_insert(&gr->dmabuf_images, &img->link);
+
+	return img;
+}
+
+static void
+gl_dmabuf_image_destroy(struct gl_renderer *gr, struct gl_dmabuf_image *img)
+{
+	gr->destroy_image(gr->egl_display, img->image);
+	wl_list_remove(&img->link);
+	free(img);
+}
+
+static struct gl_dmabuf_image *
+gl_dmabuf_image_ref(struct gl_renderer *gr, struct gl_dmabuf_image *img)
+{
+	if (img->refcount++ == 0)
+		gr->n_idle_dmabuf_images--;
+
+	wl_list_remove(&img->link);
+	wl_list_insert(&gr->dmabuf_images, &img->link);
+
+	return img;
+}
+
+static void
+gl_dmabuf_image_unref(struct gl_renderer *gr, struct gl_dmabuf_image *img)
+{
+	struct gl_dmabuf_image *oldest, *tmp;
+
+	assert(img->refcount > 0);
+	if (--img->refcount > 0)
+		return;
+
+	/* The renderer, and the EGLImage with it, are already gone. */
+	if (img->detached) {
+		free(img);
+		return;
+	}
+
+	gr->n_idle_dmabuf_images++;
+
+	wl_list_for_each_reverse_safe(oldest, tmp, &gr->dmabuf_images, link) {
+		if (gr->n_idle_dmabuf_images <= GL_DMABUF_IMAGE_IDLE_MAX)
+			break;
+		if (oldest->refcount > 0)
+			continue;
+
+		gl_dmabuf_image_destroy(gr, oldest);
+		gr->n_idle_dmabuf_images--;
+	}
+}
+
 static void
 destroy_buffer_state(struct gl_buffer_state *gb)
 {
@@ -1917,8 +2746,13 @@ destroy_buffer_state(struct gl_buffer_state *gb)
 
 	glDeleteTextures(gb->num_textures, gb->textures);
 
-	for (i = 0; i < gb->num_images; i++)
-		gb->gr->destroy_image(gb->gr->egl_display, gb->images[i]);
+	if (gb->dmabuf_image) {
+		gl_dmabuf_image_unref(gb->gr, gb->dmabuf_image);
+	} else {
+		for (i = 0; i < gb->num_images; i++)
+			gb->gr->destroy_image(gb->gr->egl_display,
+					      gb->images[i]);
+	}
 
 	pixman_region32_fini(&gb->texture_damage);
 	wl_list_remove(&gb->destroy_listener.link);
@@ -1972,6 +2806,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	enum gl_shader_texture_variant shader_variant;
 	int pitch;
 	int offset[3] = { 0, 0, 0 };
+	int texel_size[3] = { 0, 0, 0 };
 	unsigned int num_planes;
 	unsigned int i;
 	bool using_glesv2 = gr->gl_version < gr_gl_version(3, 0);
@@ -2031,6 +2866,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 			gl_format[out] = sub_info->gl_format;
 			offset[out] = shm_offset[yuv->plane[out].plane_index];
+			texel_size[out] = sub_info->bpp / 8;
 		}
 	} else {
 		int bpp = buffer->pixel_format->bpp;
@@ -2048,6 +2884,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 		gl_format[0] = buffer->pixel_format->gl_format;
 		gl_pixel_type = buffer->pixel_format->gl_type;
+		texel_size[0] = bpp / 8;
 	}
 
 	for (i = 0; i < ARRAY_LENGTH(gb->gl_format); i++) {
@@ -2105,6 +2942,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gb->shader_variant = shader_variant;
 	ARRAY_COPY(gb->offset, offset);
 	ARRAY_COPY(gb->gl_format, gl_format);
+	ARRAY_COPY(gb->texel_size, texel_size);
 	gb->gl_pixel_type = gl_pixel_type;
 	gb->needs_full_upload = true;
 
@@ -2544,14 +3382,9 @@ choose_texture_target(struct gl_renderer *gr,
 }
 
 static struct gl_buffer_state *
-import_dmabuf(struct gl_renderer *gr,
-	      struct linux_dmabuf_buffer *dmabuf)
+buffer_state_create_dmabuf(struct gl_renderer *gr)
 {
-	EGLImageKHR egl_image;
-	struct gl_buffer_state *gb = zalloc(sizeof(*gb));
-
-	if (!pixel_format_get_info(dmabuf->attributes.format))
-		return NULL;
+	struct gl_buffer_state *gb;
 
 	gb = zalloc(sizeof(*gb));
 	if (!gb)
@@ -2561,22 +3394,68 @@ import_dmabuf(struct gl_renderer *gr,
 	pixman_region32_init(&gb->texture_damage);
 	wl_list_init(&gb->destroy_listener.link);
 
-	egl_image = import_simple_dmabuf(gr, &dmabuf->attributes);
-	if (egl_image != EGL_NO_IMAGE_KHR) {
-		GLenum target = choose_texture_target(gr, &dmabuf->attributes);
+	return gb;
+}
 
-		gb->num_images = 1;
-		gb->images[0] = egl_image;
+static void
+buffer_state_set_dmabuf_image(struct gl_buffer_state *gb,
+			      EGLImageKHR egl_image, GLenum target)
+{
+	gb->num_images = 1;
+	gb->images[0] = egl_image;
 
-		switch (target) {
-		case GL_TEXTURE_2D:
-			gb->shader_variant = SHADER_VARIANT_RGBA;
-			break;
-		default:
-			gb->shader_variant = SHADER_VARIANT_EXTERNAL;
-		}
+	switch (target) {
+	case GL_TEXTURE_2D:
+		gb->shader_variant = SHADER_VARIANT_RGBA;
+		break;
+	default:
+		gb->shader_variant = SHADER_VARIANT_EXTERNAL;
+	}
+
+	ensure_textures(gb, target, gb->num_images);
+}
+
+static struct gl_buffer_state *
+import_dmabuf_cached(struct gl_renderer *gr, struct gl_dmabuf_image *img)
+{
+	struct gl_buffer_state *gb;
+
+	gb = buffer_state_create_dmabuf(gr);
+	if (!gb)
+		return NULL;
+
+	gb->dmabuf_image = gl_dmabuf_image_ref(gr, img);
+	buffer_state_set_dmabuf_image(gb, img->image, img->target);
+
+	return gb;
+}
+
+/* Finishes an import once import_simple_dmabuf() has been tried, falling
+ * back to importing the planes separately if that failed. Takes ownership
+ * of egl_image. The result is shared if key is not NULL. */
+static struct gl_buffer_state *
+import_dmabuf_finish(struct gl_renderer *gr,
+		     struct linux_dmabuf_buffer *dmabuf,
+		     const struct gl_dmabuf_image_key *key,
+		     EGLImageKHR egl_image)
+{
+	struct gl_buffer_state *gb;
+
+	gb = buffer_state_create_dmabuf(gr);
+	if (!gb) {
+		if (egl_image != EGL_NO_IMAGE_KHR)
+			gr->destroy_image(gr->egl_display, egl_image);
+		return NULL;
+	}
 
-		ensure_textures(gb, target, gb->num_images);
+	if (egl_image != EGL_NO_IMAGE_KHR) {
+		GLenum target = choose_texture_target(gr, &dmabuf->attributes);
+
+		if (key)
+			gb->dmabuf_image = gl_dmabuf_image_create(gr, key,
+								  egl_image,
+								  target);
+		buffer_state_set_dmabuf_image(gb, egl_image, target);
 
 		return gb;
 	}
@@ -2589,6 +3468,29 @@ import_dmabuf(struct gl_renderer *gr,
 	return gb;
 }
 
+static struct gl_buffer_state *
+import_dmabuf(struct gl_renderer *gr,
+	      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_dmabuf_image_key key;
+	struct gl_dmabuf_image *img;
+	bool shareable;
+
+	if (!pixel_format_get_info(dmabuf->attributes.format))
+		return NULL;
+
+	shareable = gl_dmabuf_image_key_init(&key, &dmabuf->attributes);
+	if (shareable) {
+		img = gl_dmabuf_image_lookup(gr, &key);
+		if (img)
+			return import_dmabuf_cached(gr, img);
+	}
+
+	return import_dmabuf_finish(gr, dmabuf, shareable ? &key : NULL,
+				    import_simple_dmabuf(gr,
+							 &dmabuf->attributes));
+}
+
 static void
 gl_renderer_query_dmabuf_formats(struct weston_compositor *wc,
 				int **formats, int *num_formats)
@@ -2691,11 +3593,9 @@ gl_renderer_query_dmabuf_modifiers(struct weston_compositor *wc, int format,
 }
 
 static bool
-gl_renderer_import_dmabuf(struct weston_compositor *ec,
-			  struct linux_dmabuf_buffer *dmabuf)
+dmabuf_is_importable(struct gl_renderer *gr,
+		     struct linux_dmabuf_buffer *dmabuf)
 {
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_buffer_state *gb;
 	int i;
 
 	assert(gr->has_dmabuf_import);
@@ -2716,6 +3616,19 @@ gl_renderer_import_dmabuf(struct weston_compositor *ec,
 	if (dmabuf->attributes.flags & ~ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT)
 		return false;
 
+	return true;
+}
+
+static bool
+gl_renderer_import_dmabuf(struct weston_compositor *ec,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_buffer_state *gb;
+
+	if (!dmabuf_is_importable(gr, dmabuf))
+		return false;
+
 	gb = import_dmabuf(gr, dmabuf);
 	if (!gb)
 		return false;
@@ -2726,6 +3639,224 @@ gl_renderer_import_dmabuf(struct weston_compositor *ec,
 	return true;
 }
 
+struct gl_dmabuf_import_job {
+	struct wl_list link; /* gl_dmabuf_importer::queue or ::done */
+	struct linux_dmabuf_buffer *dmabuf;
+	void (*done)(struct linux_dmabuf_buffer *dmabuf, bool success);
+	struct gl_dmabuf_image_key key;
+
+	/* Written by the worker thread */
+	EGLImageKHR image;
+};
+
+static void *
+dmabuf_importer_thread(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_dmabuf_importer *imp = &gr->dmabuf_importer;
+	struct gl_dmabuf_import_job *job;
+
+	pthread_mutex_lock(&imp->mutex);
+
+	for (;;) {
+		while (!imp->exit && wl_list_empty(&imp->queue))
+			pthread_cond_wait(&imp->cond, &imp->mutex);
+
+		if (imp->exit)
+			break;
+
+		job = container_of(imp->queue.next,
+				   struct gl_dmabuf_import_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&imp->mutex);
+
+		/* EGL is thread-safe, and creating an EGLImage from a dma-buf
+		 * does not need a context. The dma-buf stays alive until the
+		 * compositor thread has seen the job back. */
+		job->image = import_simple_dmabuf(gr, &job->dmabuf->attributes);
+
+		pthread_mutex_lock(&imp->mutex);
+		wl_list_insert(imp->done.prev, &job->link);
+		eventfd_write(imp->eventfd, 1);
+	}
+
+	pthread_mutex_unlock(&imp->mutex);
+	eglReleaseThread();
+
+	return NULL;
+}
+
+static void
+dmabuf_import_job_finish(struct gl_renderer *gr,
+			 struct gl_dmabuf_import_job *job)
+{
+	struct linux_dmabuf_buffer *dmabuf = job->dmabuf;
+	void (*done)(struct linux_dmabuf_buffer *, bool) = job->done;
+	struct gl_dmabuf_image *img;
+	struct gl_buffer_state *gb;
+
+	/* Another import of the same dma-buf may have finished first */
+	img = gl_dmabuf_image_lookup(gr, &job->key);
+	if (img) {
+		if (job->image != EGL_NO_IMAGE_KHR)
+			gr->destroy_image(gr->egl_display, job->image);
+		gb = import_dmabuf_cached(gr, img);
+	} else {
+		gb = import_dmabuf_finish(gr, dmabuf, &job->key, job->image);
+	}
+
+	if (gb)
+		linux_dmabuf_buffer_set_user_data(dmabuf, gb,
+						  gl_renderer_destroy_dmabuf);
+
+	wl_list_remove(&job->link);
+	free(job);
+
+	done(dmabuf, gb != NULL);
+}
+
+static int
+dmabuf_importer_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_dmabuf_importer *imp = &gr->dmabuf_importer;
+	struct gl_dmabuf_import_job *job, *tmp;
+	struct wl_list done;
+	eventfd_t count;
+
+	eventfd_read(fd, &count);
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&imp->mutex);
+	wl_list_insert_list(&done, &imp->done);
+	wl_list_init(&imp->done);
+	pthread_mutex_unlock(&imp->mutex);
+
+	wl_list_for_each_safe(job, tmp, &done, link)
+		dmabuf_import_job_finish(gr, job);
+
+	return 0;
+}
+
+static void
+gl_dmabuf_importer_init(struct gl_dmabuf_importer *imp)
+{
+	pthread_mutex_init(&imp->mutex, NULL);
+	pthread_cond_init(&imp->cond, NULL);
+	wl_list_init(&imp->queue);
+	wl_list_init(&imp->done);
+	imp->eventfd = -1;
+}
+
+/* The worker is only started by the first client using 'create' */
+static bool
+gl_dmabuf_importer_start(struct gl_renderer *gr)
+{
+	struct gl_dmabuf_importer *imp = &gr->dmabuf_importer;
+	struct wl_event_loop *loop;
+
+	if (imp->running)
+		return true;
+
+	imp->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (imp->eventfd < 0)
+		return false;
+
+	loop = wl_display_get_event_loop(gr->compositor->wl_display);
+	imp->source = wl_event_loop_add_fd(loop, imp->eventfd,
+					   WL_EVENT_READABLE,
+					   dmabuf_importer_dispatch, gr);
+	if (!imp->source)
+		goto err_fd;
+
+	if (pthread_create(&imp->thread, NULL, dmabuf_importer_thread, gr) != 0)
+		goto err_source;
+
+	imp->running = true;
+	return true;
+
+err_source:
+	wl_event_source_remove(imp->source);
+	imp->source = NULL;
+err_fd:
+	close(imp->eventfd);
+	imp->eventfd = -1;
+	weston_log("Failed to start the dma-buf import thread, "
+		   "importing synchronously.\n");
+	return false;
+}
+
+static void
+gl_dmabuf_importer_fini(struct gl_renderer *gr)
+{
+	struct gl_dmabuf_importer *imp = &gr->dmabuf_importer;
+	struct gl_dmabuf_import_job *job, *tmp;
+
+	if (imp->running) {
+		pthread_mutex_lock(&imp->mutex);
+		imp->exit = true;
+		pthread_cond_signal(&imp->cond);
+		pthread_mutex_unlock(&imp->mutex);
+
+		pthread_join(imp->thread, NULL);
+
+		wl_event_source_remove(imp->source);
+		close(imp->eventfd);
+	}
+
+	/* Whatever is left never gets a wl_buffer */
+	wl_list_insert_list(&imp->done, &imp->queue);
+	wl_list_for_each_safe(job, tmp, &imp->done, link) {
+		if (job->image != EGL_NO_IMAGE_KHR)
+			gr->destroy_image(gr->egl_display, job->image);
+		wl_list_remove(&job->link);
+		job->done(job->dmabuf, false);
+		free(job);
+	}
+
+	pthread_mutex_destroy(&imp->mutex);
+	pthread_cond_destroy(&imp->cond);
+}
+
+static bool
+gl_renderer_import_dmabuf_async(struct weston_compositor *ec,
+				struct linux_dmabuf_buffer *dmabuf,
+				void (*done)(struct linux_dmabuf_buffer *dmabuf,
+					     bool success))
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_dmabuf_importer *imp = &gr->dmabuf_importer;
+	struct gl_dmabuf_import_job *job;
+	struct gl_dmabuf_image_key key;
+
+	/* Rejections and re-imports are quick, leave them to
+	 * gl_renderer_import_dmabuf() */
+	if (!dmabuf_is_importable(gr, dmabuf) ||
+	    !pixel_format_get_info(dmabuf->attributes.format) ||
+	    !gl_dmabuf_image_key_init(&key, &dmabuf->attributes) ||
+	    gl_dmabuf_image_lookup(gr, &key))
+		return false;
+
+	if (!gl_dmabuf_importer_start(gr))
+		return false;
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return false;
+
+	job->dmabuf = dmabuf;
+	job->done = done;
+	job->key = key;
+	job->image = EGL_NO_IMAGE_KHR;
+
+	pthread_mutex_lock(&imp->mutex);
+	wl_list_insert(imp->queue.prev, &job->link);
+	pthread_cond_signal(&imp->cond);
+	pthread_mutex_unlock(&imp->mutex);
+
+	return true;
+}
+
 static bool
 gl_renderer_attach_dmabuf(struct weston_surface *surface,
 			  struct weston_buffer *buffer)
@@ -3322,6 +4453,9 @@ gl_renderer_output_create(struct weston_output *output,
 		}
 	}
 
+	wl_array_init(&go->layer_cache.updates);
+	pixman_region32_init(&go->layer_cache.stale);
+
 	output->renderer_state = go;
 
 	return 0;
@@ -3421,6 +4555,8 @@ gl_renderer_output_destroy(struct weston_output *output)
 	if (shadow_exists(go))
 		gl_fbo_texture_fini(&go->shadow);
 
+	gl_layer_cache_fini(&go->layer_cache);
+
 	eglMakeCurrent(gr->egl_display,
 		       gr->dummy_surface, gr->dummy_surface, gr->egl_context);
 
@@ -3463,12 +4599,17 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_format *format, *next_format;
+	struct gl_dmabuf_image *img, *next_img;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	gl_dmabuf_importer_fini(gr);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	gl_upload_ring_fini(gr);
+
 	gl_renderer_shader_list_destroy(gr);
 	if (gr->fallback_shader)
 		gl_shader_destroy(gr, gr->fallback_shader);
@@ -3481,6 +4622,21 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(format, next_format, &gr->dmabuf_formats, link)
 		dmabuf_format_destroy(format);
 
+	/* Buffers still holding an image drop their reference after this,
+	 * so only let go of the EGLImage and leave the rest to them. */
+	wl_list_for_each_safe(img, next_img, &gr->dmabuf_images, link) {
+		if (img->refcount == 0) {
+			gl_dmabuf_image_destroy(gr, img);
+			continue;
+		}
+
+		gr->destroy_image(gr->egl_display, img->image);
+		img->image = EGL_NO_IMAGE_KHR;
+		wl_list_remove(&img->link);
+		wl_list_init(&img->link);
+		img->detached = true;
+	}
+
 	weston_drm_format_array_fini(&gr->supported_formats);
 
 	if (gr->dummy_surface != EGL_NO_SURFACE)
@@ -3492,6 +4648,7 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->upload_boxes);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
@@ -3581,6 +4738,8 @@ gl_renderer_display_create(struct weston_compositor *ec,
 	gr->compositor = ec;
 	wl_list_init(&gr->shader_list);
 	gr->platform = options->egl_platform;
+	gr->use_layer_cache = getenv("WESTON_GL_LAYER_CACHE") ||
+		ec->test_data.test_quirks.gl_layer_cache;
 
 	gr->renderer_scope = weston_compositor_add_log_scope(ec, "gl-renderer",
 		"GL-renderer verbose messages\n", NULL, NULL, gr);
@@ -3639,6 +4798,7 @@ gl_renderer_display_create(struct weston_compositor *ec,
 
 	if (gr->has_dmabuf_import) {
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
+		gr->base.import_dmabuf_async = gl_renderer_import_dmabuf_async;
 		gr->base.get_supported_formats = gl_renderer_get_supported_formats;
 		ret = populate_supported_formats(ec, &gr->supported_formats);
 		if (ret < 0)
@@ -3656,6 +4816,8 @@ gl_renderer_display_create(struct weston_compositor *ec,
 		}
 	}
 	wl_list_init(&gr->dmabuf_formats);
+	wl_list_init(&gr->dmabuf_images);
+	gl_dmabuf_importer_init(&gr->dmabuf_importer);
 
 	if (gr->has_surfaceless_context) {
 		gr->dummy_surface = EGL_NO_SURFACE;
@@ -3888,6 +5050,8 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 
 	glActiveTexture(GL_TEXTURE0);
 
+	gl_upload_ring_init(gr);
+
 	gr->fallback_shader = gl_renderer_create_fallback_shader(gr);
 	if (!gr->fallback_shader) {
 		weston_log("Error: compiling fallback shader failed.\n");
@@ -3918,6 +5082,8 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 			    yesno(gr->has_gl_texture_rg));
 	weston_log_continue(STAMP_SPACE "OES_EGL_image_external: %s\n",
 			    yesno(gr->has_egl_image_external));
+	weston_log_continue(STAMP_SPACE "wl_shm staged uploads: %s\n",
+			    yesno(gr->upload_ring != NULL));
 
 	return 0;
 }
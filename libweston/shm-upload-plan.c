@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "shared/helpers.h"
+#include "shm-upload-plan.h"
+
+static uint64_t
+box_area(const pixman_box32_t *box)
+{
+	return (uint64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+const char *
+shm_upload_method_name(enum shm_upload_method method)
+{
+	switch (method) {
+	case SHM_UPLOAD_RECTS:
+		return "rects";
+	case SHM_UPLOAD_BANDS:
+		return "bands";
+	case SHM_UPLOAD_FULL:
+		return "full";
+	case SHM_UPLOAD_METHOD_COUNT:
+		break;
+	}
+	return "???";
+}
+
+/** Merge damage rectangles into bands
+ *
+ * Rectangles sharing the same rows, as pixman splits a region into, become
+ * a single box across all of them. Touching bands are merged in turn as
+ * long as their bounding box is at most a quarter larger than the area
+ * they cover, which joins e.g. consecutive lines of text.
+ *
+ * \return The number of boxes written.
+ */
+static int
+merge_bands(const pixman_box32_t *rects, int n_rects, pixman_box32_t *boxes)
+{
+	uint64_t covered;
+	int n_bands = 0;
+	int i, out;
+
+	for (i = 0; i < n_rects; i++) {
+		pixman_box32_t *prev = n_bands ? &boxes[n_bands - 1] : NULL;
+
+		if (prev && prev->y1 == rects[i].y1 &&
+		    prev->y2 == rects[i].y2) {
+			prev->x1 = MIN(prev->x1, rects[i].x1);
+			prev->x2 = MAX(prev->x2, rects[i].x2);
+		} else {
+			boxes[n_bands++] = rects[i];
+		}
+	}
+
+	out = 0;
+	covered = box_area(&boxes[0]);
+	for (i = 1; i < n_bands; i++) {
+		pixman_box32_t merged = {
+			.x1 = MIN(boxes[out].x1, boxes[i].x1),
+			.y1 = boxes[out].y1,
+			.x2 = MAX(boxes[out].x2, boxes[i].x2),
+			.y2 = boxes[i].y2,
+		};
+		uint64_t area = box_area(&boxes[i]);
+
+		if (boxes[out].y2 == boxes[i].y1 &&
+		    box_area(&merged) * 4 <= (covered + area) * 5) {
+			boxes[out] = merged;
+			covered += area;
+		} else {
+			boxes[++out] = boxes[i];
+			covered = area;
+		}
+	}
+
+	return out + 1;
+}
+
+/** Choose how to upload the damage of a SHM buffer
+ *
+ * Uploading each damage rectangle on its own is pathological for clients
+ * damaging hundreds of small rectangles, while near-full damage is
+ * uploaded cheaper in one go. The cost of each method is estimated from
+ * the bytes it uploads and the number of upload calls it takes, see
+ * SHM_UPLOAD_CALL_COST, and the cheapest one wins; on a tie, the one
+ * uploading fewer bytes.
+ *
+ * \param plan Filled with the chosen method and all the estimates.
+ * \param rects The damage in buffer coordinates, ideally banded as from
+ * pixman_region32_rectangles().
+ * \param n_rects The number of damage rectangles.
+ * \param width The buffer width.
+ * \param height The buffer height.
+ * \param bytes_per_pixel Bytes per pixel of the first plane; the other,
+ * sub-sampled planes only add to the call cost.
+ * \param planes The number of textures each upload goes to.
+ * \param boxes Filled with the plan->n_boxes boxes to upload, in buffer
+ * coordinates. Needs room for MAX(n_rects, 1) boxes.
+ */
+void
+shm_upload_plan_choose(struct shm_upload_plan *plan,
+		       const pixman_box32_t *rects, int n_rects,
+		       int32_t width, int32_t height,
+		       int bytes_per_pixel, int planes,
+		       pixman_box32_t *boxes)
+{
+	const uint64_t call_cost = (uint64_t) SHM_UPLOAD_CALL_COST * planes;
+	uint64_t area = 0;
+	int n_bands;
+	int i;
+
+	assert(n_rects >= 0);
+
+	if (n_rects == 0) {
+		*plan = (struct shm_upload_plan) {
+			.method = SHM_UPLOAD_RECTS,
+		};
+		return;
+	}
+
+	for (i = 0; i < n_rects; i++)
+		area += box_area(&rects[i]);
+	plan->cost[SHM_UPLOAD_RECTS] =
+		area * bytes_per_pixel + n_rects * call_cost;
+
+	n_bands = merge_bands(rects, n_rects, boxes);
+	area = 0;
+	for (i = 0; i < n_bands; i++)
+		area += box_area(&boxes[i]);
+	plan->cost[SHM_UPLOAD_BANDS] =
+		area * bytes_per_pixel + n_bands * call_cost;
+
+	plan->cost[SHM_UPLOAD_FULL] =
+		(uint64_t) width * height * bytes_per_pixel + call_cost;
+
+	plan->method = SHM_UPLOAD_RECTS;
+	for (i = SHM_UPLOAD_BANDS; i < SHM_UPLOAD_METHOD_COUNT; i++) {
+		if (plan->cost[i] < plan->cost[plan->method])
+			plan->method = i;
+	}
+
+	switch (plan->method) {
+	case SHM_UPLOAD_RECTS:
+		for (i = 0; i < n_rects; i++)
+			boxes[i] = rects[i];
+		plan->n_boxes = n_rects;
+		break;
+	case SHM_UPLOAD_BANDS:
+		plan->n_boxes = n_bands;
+		break;
+	case SHM_UPLOAD_FULL:
+		boxes[0] = (pixman_box32_t) { 0, 0, width, height };
+		plan->n_boxes = 1;
+		break;
+	case SHM_UPLOAD_METHOD_COUNT:
+		assert(0);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SHM_UPLOAD_PLAN_H
+#define WESTON_SHM_UPLOAD_PLAN_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+/** How to get the damage of a SHM buffer into a texture */
+enum shm_upload_method {
+	SHM_UPLOAD_RECTS = 0,	/**< one upload per damage rectangle */
+	SHM_UPLOAD_BANDS,	/**< one upload per merged band of damage */
+	SHM_UPLOAD_FULL,	/**< the whole buffer in one upload */
+	SHM_UPLOAD_METHOD_COUNT
+};
+
+/** One texture upload call costs about as much as uploading this many
+ * bytes: the driver validates state and, without a staging buffer,
+ * synchronises with the GPU every time. */
+#define SHM_UPLOAD_CALL_COST (64 * 1024)
+
+struct shm_upload_plan {
+	enum shm_upload_method method;
+	/** Estimated cost of each method, in bytes */
+	uint64_t cost[SHM_UPLOAD_METHOD_COUNT];
+	/** Number of boxes to upload */
+	int n_boxes;
+};
+
+const char *
+shm_upload_method_name(enum shm_upload_method method);
+
+void
+shm_upload_plan_choose(struct shm_upload_plan *plan,
+		       const pixman_box32_t *rects, int n_rects,
+		       int32_t width, int32_t height,
+		       int bytes_per_pixel, int planes,
+		       pixman_box32_t *boxes);
+
+#endif
@@ -36,14 +36,19 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
+#include "shared/flight-rec-format.h"
+
 struct weston_ring_buffer {
 	uint32_t append_pos;	/**< where in the buffer we are */
 	uint32_t size;		/**< max length of the ring buffer */
 	char *buf;		/**< the buffer itself */
 	FILE *file;		/**< where to write in case we need to dump the buf */
 	bool overlap;		/**< in case buff overlaps, hint from where to print buf contents */
+	struct weston_flight_rec_file_header *header; /**< file-backed only */
 };
 
 /** allows easy access to the ring buffer in case of a core dump
@@ -56,6 +61,7 @@ WL_EXPORT struct weston_ring_buffer *weston_primary_flight_recorder_ring_buffer
 struct weston_debug_log_flight_recorder {
 	struct weston_log_subscriber base;
 	struct weston_ring_buffer rb;
+	size_t map_size;	/**< length of the file mapping, if any */
 };
 
 static void
@@ -66,6 +72,7 @@ weston_ring_buffer_init(struct weston_ring_buffer *rb, size_t size, char *buf)
 	rb->buf = buf;
 	rb->overlap = false;
 	rb->file = stderr;
+	rb->header = NULL;
 }
 
 static struct weston_debug_log_flight_recorder *
@@ -175,6 +182,12 @@ weston_log_flight_recorder_write(struct weston_log_subscriber *sub,
 		}
 	}
 
+	/* publish the new position for weston-flight-rec; a plain store,
+	 * the kernel keeps the shared mapping even if we crash */
+	if (rb->header) {
+		rb->header->append_pos = rb->append_pos;
+		rb->header->overlap = rb->overlap;
+	}
 }
 
 static void
@@ -229,17 +242,44 @@ weston_log_subscriber_destroy_flight_rec(struct weston_log_subscriber *sub)
 		weston_primary_flight_recorder_ring_buffer = NULL;
 
 	weston_log_subscriber_release(sub);
-	free(flight_rec->rb.buf);
+
+	if (flight_rec->rb.header) {
+		flight_rec->rb.header->flags |= WESTON_FLIGHT_REC_FLAG_CLOSED;
+		munmap(flight_rec->rb.header, flight_rec->map_size);
+	} else {
+		free(flight_rec->rb.buf);
+	}
 	free(flight_rec);
 }
 
+static struct weston_debug_log_flight_recorder *
+weston_log_flight_recorder_alloc(void)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+
+	assert("Can't create more than one flight recorder." &&
+			!weston_primary_flight_recorder_ring_buffer);
+
+	flight_rec = zalloc(sizeof(*flight_rec));
+	if (!flight_rec)
+		return NULL;
+
+	flight_rec->base.write = weston_log_flight_recorder_write;
+	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
+	flight_rec->base.destroy_subscription = NULL;
+	flight_rec->base.complete = NULL;
+	wl_list_init(&flight_rec->base.subscription_list);
+
+	return flight_rec;
+}
+
 /** Create a flight recorder type of subscriber
  *
  * Allocates both the flight recorder and the underlying ring buffer. Use
  * weston_log_subscriber_destroy() to clean-up.
  *
  * @param size specify the maximum size (in bytes) of the backing storage
- * for the flight recorder
+ * for the flight recorder, at least 2
  * @returns a weston_log_subscriber object or NULL in case of failure
  */
 WL_EXPORT struct weston_log_subscriber *
@@ -248,19 +288,14 @@ weston_log_subscriber_create_flight_rec(size_t size)
 	struct weston_debug_log_flight_recorder *flight_rec;
 	char *weston_rb;
 
-	assert("Can't create more than one flight recorder." &&
-			!weston_primary_flight_recorder_ring_buffer);
+	/* one byte of the buffer is kept free, see weston_ring_buffer_init() */
+	if (size < 2)
+		return NULL;
 
-	flight_rec = zalloc(sizeof(*flight_rec));
+	flight_rec = weston_log_flight_recorder_alloc();
 	if (!flight_rec)
 		return NULL;
 
-	flight_rec->base.write = weston_log_flight_recorder_write;
-	flight_rec->base.destroy = weston_log_subscriber_destroy_flight_rec;
-	flight_rec->base.destroy_subscription = NULL;
-	flight_rec->base.complete = NULL;
-	wl_list_init(&flight_rec->base.subscription_list);
-
 	weston_rb = zalloc(sizeof(char) * size);
 	if (!weston_rb) {
 		free(flight_rec);
@@ -276,6 +311,92 @@ weston_log_subscriber_create_flight_rec(size_t size)
 	return &flight_rec->base;
 }
 
+/** Create a flight recorder type of subscriber backed by a file
+ *
+ * Same as weston_log_subscriber_create_flight_rec(), but the ring buffer
+ * lives in a shared memory mapping of \c path, preceded by a
+ * struct weston_flight_rec_file_header. The contents therefore survive the
+ * compositor process and can be recovered with the weston-flight-rec tool
+ * after a crash. Writing to the ring remains a memcpy().
+ *
+ * The file is created if needed and truncated to the new size; it is left
+ * in place when the subscriber is destroyed.
+ *
+ * @param path the file to store the ring buffer in
+ * @param size specify the maximum size (in bytes) of the ring buffer
+ * @returns a weston_log_subscriber object or NULL in case of failure
+ */
+WL_EXPORT struct weston_log_subscriber *
+weston_log_subscriber_create_flight_rec_file(const char *path, size_t size)
+{
+	struct weston_debug_log_flight_recorder *flight_rec;
+	struct weston_flight_rec_file_header *header;
+	size_t header_size = sizeof(*header);
+	size_t map_size;
+	void *map;
+	int fd;
+	int ret;
+
+	if (size < 2 || size > UINT32_MAX - header_size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	flight_rec = weston_log_flight_recorder_alloc();
+	if (!flight_rec)
+		return NULL;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto err_free;
+
+	/* Reserve the blocks now, running out of disk space while writing to
+	 * the mapping would raise SIGBUS. */
+	map_size = header_size + size;
+	ret = posix_fallocate(fd, 0, map_size);
+	if (ret != 0) {
+		errno = ret;
+		goto err_close;
+	}
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err_close;
+
+	/* the mapping keeps the file referenced */
+	close(fd);
+
+	header = map;
+	weston_ring_buffer_init(&flight_rec->rb, size,
+				(char *) map + header_size);
+	flight_rec->rb.header = header;
+	flight_rec->map_size = map_size;
+
+	memcpy(header->magic, WESTON_FLIGHT_REC_MAGIC, sizeof(header->magic));
+	header->version = WESTON_FLIGHT_REC_VERSION;
+	header->header_size = header_size;
+	header->size = flight_rec->rb.size;
+	header->append_pos = 0;
+	header->overlap = 0;
+	header->flags = 0;
+	header->pid = getpid();
+
+	weston_primary_flight_recorder_ring_buffer = &flight_rec->rb;
+
+	/* fault in every page up-front, like the anonymous variant */
+	weston_log_flight_recorder_map_memory(flight_rec);
+
+	return &flight_rec->base;
+
+err_close:
+	ret = errno;
+	close(fd);
+	errno = ret;
+err_free:
+	free(flight_rec);
+	return NULL;
+}
+
 /** Retrieve flight recorder ring buffer contents, could be useful when
  * implementing an assert()-like wrapper.
  *
@@ -35,10 +35,19 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
+/* Bounds of the per-stream queue of data waiting for the reader */
+#define STREAM_QUEUE_MIN_SIZE (64 * 1024)
+#define STREAM_QUEUE_MAX_SIZE (4 * 1024 * 1024)
+
 /** A debug stream created by a client
  *
  * A client provides a file descriptor for the server to write debug messages
@@ -49,11 +58,33 @@
  * The following is specific to weston-debug protocol.
  * Subscription/unsubscription takes place in the stream_create(), respectively
  * in stream_destroy().
+ *
+ * Unless the fd refers to a regular file, writes never block the compositor:
+ * whatever the reader does not accept immediately is kept in a bounded queue
+ * that is drained when the fd becomes writable again. When the queue is full,
+ * new messages are dropped whole, and a notice with the amount of dropped
+ * bytes is inserted into the stream once the reader catches up. The rest of
+ * a message the reader took only part of is always queued, so that no
+ * message gets cut short.
  */
 struct weston_log_debug_wayland {
 	struct weston_log_subscriber base;
 	int fd;				/**< client provided fd */
 	struct wl_resource *resource;	/**< weston_debug_stream_v1 object */
+
+	bool nonblocking;		/**< writes to fd never block */
+	bool is_socket;			/**< fd is a socket, use send() */
+	struct wl_event_loop *loop;
+	struct wl_event_source *fd_source; /**< armed while queue is not empty */
+
+	char *queue;			/**< pending data, starts at queue_start */
+	size_t queue_start;
+	size_t queue_len;
+	size_t queue_alloc;
+
+	uint64_t dropped_bytes;		/**< total bytes dropped */
+	uint64_t dropped_pending;	/**< dropped bytes not yet reported */
+	bool complete_pending;		/**< complete once the queue is empty */
 };
 
 static struct weston_log_debug_wayland *
@@ -65,6 +96,17 @@ to_weston_log_debug_wayland(struct weston_log_subscriber *sub)
 static void
 stream_close_unlink(struct weston_log_debug_wayland *stream)
 {
+	if (stream->fd_source)
+		wl_event_source_remove(stream->fd_source);
+	stream->fd_source = NULL;
+
+	free(stream->queue);
+	stream->queue = NULL;
+	stream->queue_start = 0;
+	stream->queue_len = 0;
+	stream->queue_alloc = 0;
+	stream->complete_pending = false;
+
 	if (stream->fd != -1)
 		close(stream->fd);
 	stream->fd = -1;
@@ -93,6 +135,244 @@ stream_close_on_failure(struct weston_log_debug_wayland *stream,
 	}
 }
 
+static void
+stream_send_complete(struct weston_log_debug_wayland *stream)
+{
+	stream_close_unlink(stream);
+	weston_debug_stream_v1_send_complete(stream->resource);
+}
+
+/** Set up the fd so that writing to it cannot block
+ *
+ * Setting O_NONBLOCK on the fd the client gave us would also affect the
+ * client's own copy (e.g. its terminal), so pipes and character devices are
+ * re-opened as a new, non-blocking, open file description instead. Sockets
+ * are written with MSG_DONTWAIT. Regular files, and anything that can not be
+ * re-opened, keep being written synchronously.
+ */
+static void
+stream_setup_fd(struct weston_log_debug_wayland *stream)
+{
+	struct stat st;
+	char path[64];
+	int fd;
+
+	if (fstat(stream->fd, &st) < 0)
+		return;
+
+	if (S_ISSOCK(st.st_mode)) {
+		stream->is_socket = true;
+		stream->nonblocking = true;
+		return;
+	}
+
+	if (!S_ISFIFO(st.st_mode) && !S_ISCHR(st.st_mode))
+		return;
+
+	snprintf(path, sizeof path, "/proc/self/fd/%d", stream->fd);
+	fd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	close(stream->fd);
+	stream->fd = fd;
+	stream->nonblocking = true;
+}
+
+static ssize_t
+stream_write_nonblock(struct weston_log_debug_wayland *stream,
+		      const char *data, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		if (stream->is_socket)
+			ret = send(stream->fd, data, len,
+				   MSG_DONTWAIT | MSG_NOSIGNAL);
+		else
+			ret = write(stream->fd, data, len);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/** Append data to the queue
+ *
+ * \param bounded Fail rather than grow the queue past STREAM_QUEUE_MAX_SIZE.
+ */
+static bool
+stream_queue_append(struct weston_log_debug_wayland *stream,
+		    const char *data, size_t len, bool bounded)
+{
+	size_t needed = stream->queue_len + len;
+	size_t alloc;
+	char *queue;
+
+	if (bounded && needed > STREAM_QUEUE_MAX_SIZE)
+		return false;
+
+	if (stream->queue_start + needed > stream->queue_alloc &&
+	    stream->queue_start > 0) {
+		memmove(stream->queue, stream->queue + stream->queue_start,
+			stream->queue_len);
+		stream->queue_start = 0;
+	}
+
+	if (needed > stream->queue_alloc) {
+		alloc = MAX(stream->queue_alloc, STREAM_QUEUE_MIN_SIZE);
+		while (alloc < needed)
+			alloc *= 2;
+		alloc = MIN(alloc, MAX(needed, STREAM_QUEUE_MAX_SIZE));
+
+		queue = realloc(stream->queue, alloc);
+		if (!queue)
+			return false;
+
+		stream->queue = queue;
+		stream->queue_alloc = alloc;
+	}
+
+	memcpy(stream->queue + stream->queue_start + stream->queue_len,
+	       data, len);
+	stream->queue_len += len;
+
+	return true;
+}
+
+static int
+stream_handle_fd(int fd, uint32_t mask, void *data);
+
+static void
+stream_arm(struct weston_log_debug_wayland *stream, bool writable)
+{
+	uint32_t mask = writable ? WL_EVENT_WRITABLE : 0;
+
+	if (stream->fd_source) {
+		wl_event_source_fd_update(stream->fd_source, mask);
+		return;
+	}
+
+	if (!writable)
+		return;
+
+	stream->fd_source = wl_event_loop_add_fd(stream->loop, stream->fd,
+						 mask, stream_handle_fd,
+						 stream);
+	if (!stream->fd_source)
+		stream_close_on_failure(stream,
+					"Error watching the debug stream fd");
+}
+
+/** Write out as much queued data as the reader accepts
+ *
+ * Once the queue is empty, a notice about dropped data is queued if needed,
+ * and a pending complete is carried out.
+ */
+static void
+stream_flush(struct weston_log_debug_wayland *stream)
+{
+	char notice[128];
+	ssize_t ret;
+	int len;
+	int e;
+
+	for (;;) {
+		if (stream->queue_len == 0) {
+			stream->queue_start = 0;
+			if (stream->dropped_pending == 0)
+				break;
+
+			len = snprintf(notice, sizeof notice,
+				       "\n[weston-debug: reader too slow, "
+				       "dropped %" PRIu64 " bytes, "
+				       "%" PRIu64 " in total]\n",
+				       stream->dropped_pending,
+				       stream->dropped_bytes);
+			stream->dropped_pending = 0;
+			if (!stream_queue_append(stream, notice, len, true))
+				break;
+		}
+
+		ret = stream_write_nonblock(stream,
+					    stream->queue + stream->queue_start,
+					    stream->queue_len);
+		e = errno;
+		if (ret < 0) {
+			if (e == EAGAIN || e == EWOULDBLOCK) {
+				stream_arm(stream, true);
+				return;
+			}
+
+			stream_close_on_failure(stream,
+					"Error writing %zu bytes: %s (%d)",
+					stream->queue_len, strerror(e), e);
+			return;
+		}
+
+		stream->queue_start += ret;
+		stream->queue_len -= ret;
+	}
+
+	stream_arm(stream, false);
+
+	if (stream->complete_pending)
+		stream_send_complete(stream);
+}
+
+static int
+stream_handle_fd(int fd, uint32_t mask, void *data)
+{
+	struct weston_log_debug_wayland *stream = data;
+
+	stream_flush(stream);
+
+	return 0;
+}
+
+static void
+weston_log_debug_wayland_write_nonblock(struct weston_log_debug_wayland *stream,
+					const char *data, size_t len)
+{
+	ssize_t ret;
+	int e;
+
+	/* Data already waiting goes out first, to keep the order. */
+	if (stream->queue_len == 0 && stream->dropped_pending == 0) {
+		ret = stream_write_nonblock(stream, data, len);
+		e = errno;
+		if (ret < 0 && e != EAGAIN && e != EWOULDBLOCK) {
+			stream_close_on_failure(stream,
+					"Error writing %zu bytes: %s (%d)",
+					len, strerror(e), e);
+			return;
+		}
+
+		if (ret > 0) {
+			data += ret;
+			len -= ret;
+			if (len == 0)
+				return;
+
+			/* finish the message the reader has already started */
+			if (!stream_queue_append(stream, data, len, false)) {
+				stream_close_on_failure(stream,
+						"Error queueing %zu bytes", len);
+				return;
+			}
+
+			stream_arm(stream, true);
+			return;
+		}
+	}
+
+	if (!stream_queue_append(stream, data, len, true)) {
+		stream->dropped_bytes += len;
+		stream->dropped_pending += len;
+	}
+
+	stream_arm(stream, true);
+}
+
 /** Write data into a specific debug stream
  *
  * \param sub The subscriber's stream to write into; must not be NULL.
@@ -102,9 +382,14 @@ stream_close_on_failure(struct weston_log_debug_wayland *stream,
  * Writes the given data (binary verbatim) into the debug stream.
  * If \c len is zero or negative, the write is silently dropped.
  *
- * Writing is continued until all data has been written or
+ * For streams that can be written without blocking, whatever the reader
+ * does not accept right away is queued and written from the event loop
+ * once the fd becomes writable, see weston_log_debug_wayland.
+ *
+ * Otherwise writing is continued until all data has been written or
  * a write fails. If the write fails due to a signal, it is re-tried.
- * Otherwise on failure, the stream is closed and
+ *
+ * On failure, the stream is closed and
  * \c weston_debug_stream_v1.failure event is sent to the client.
  *
  * \memberof weston_log_debug_wayland
@@ -118,9 +403,14 @@ weston_log_debug_wayland_write(struct weston_log_subscriber *sub,
 	int e;
 	struct weston_log_debug_wayland *stream = to_weston_log_debug_wayland(sub);
 
-	if (stream->fd == -1)
+	if (stream->fd == -1 || stream->complete_pending)
 		return;
 
+	if (stream->nonblocking) {
+		weston_log_debug_wayland_write_nonblock(stream, data, len);
+		return;
+	}
+
 	while (len_ > 0) {
 		ret = write(stream->fd, data, len_);
 		e = errno;
@@ -145,7 +435,8 @@ weston_log_debug_wayland_write(struct weston_log_subscriber *sub,
  *
  * Closes the debug stream and sends \c weston_debug_stream_v1.complete
  * event to the client. This tells the client the debug information dump
- * is complete.
+ * is complete. If data is still queued for the reader, this is deferred
+ * until the queue has been written out.
  *
  * \memberof weston_log_debug_wayland
  */
@@ -154,8 +445,12 @@ weston_log_debug_wayland_complete(struct weston_log_subscriber *sub)
 {
 	struct weston_log_debug_wayland *stream = to_weston_log_debug_wayland(sub);
 
-	stream_close_unlink(stream);
-	weston_debug_stream_v1_send_complete(stream->resource);
+	if (stream->queue_len > 0 || stream->dropped_pending > 0) {
+		stream->complete_pending = true;
+		return;
+	}
+
+	stream_send_complete(stream);
 }
 
 static void
@@ -173,6 +468,7 @@ stream_create(struct weston_log_context *log_ctx, const char *name,
 {
 	struct weston_log_debug_wayland *stream;
 	struct weston_log_scope *scope;
+	struct wl_client *client = wl_resource_get_client(stream_resource);
 
 	stream = zalloc(sizeof *stream);
 	if (!stream)
@@ -180,6 +476,8 @@ stream_create(struct weston_log_context *log_ctx, const char *name,
 
 	stream->fd = streamfd;
 	stream->resource = stream_resource;
+	stream->loop = wl_display_get_event_loop(wl_client_get_display(client));
+	stream_setup_fd(stream);
 
 	stream->base.write = weston_log_debug_wayland_write;
 	stream->base.destroy = NULL;
@@ -39,6 +39,10 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <time.h>
+
+/* Messages longer than this are formatted on the heap instead */
+#define WESTON_LOG_SCOPE_FORMAT_SIZE 1024
 
 /**
  * @defgroup log Public Logging/Debugging API
@@ -87,6 +91,14 @@ struct weston_log_scope {
 	void *user_data;
 	struct wl_list compositor_link;
 	struct wl_list subscription_list;  /**< weston_log_subscription::source_link */
+
+	/** Reusable buffer for formatting messages without allocating */
+	char format_buf[WESTON_LOG_SCOPE_FORMAT_SIZE];
+	bool format_buf_busy;		/**< format_buf in use, e.g. re-entry */
+
+	/** weston_log_scope_timestamp() date and time, for timestamp_sec */
+	time_t timestamp_sec;
+	char timestamp_str[32];
 };
 
 /** Ties a subscriber to a scope
@@ -187,6 +199,60 @@ weston_log_subscription_write(struct weston_log_subscription *sub,
 		sub->owner->write(sub->owner, data, len);
 }
 
+/** Format a message for a scope
+ *
+ * @param scope the scope whose formatting buffer to use
+ * @param[out] str the formatted string, to be released with
+ * weston_log_scope_format_release()
+ * @param fmt Printf-style format string.
+ * @param ap Formatting arguments.
+ * @returns the length of the formatted string, or -1 on failure
+ *
+ * Formats into the scope's reusable buffer, so that the common case does
+ * not allocate. Only messages not fitting in the buffer, or nested
+ * formatting for the same scope, fall back to the heap.
+ *
+ * @memberof weston_log_scope
+ */
+static int
+weston_log_scope_format(struct weston_log_scope *scope, char **str,
+			const char *fmt, va_list ap)
+{
+	va_list aq;
+	int len;
+
+	if (!scope->format_buf_busy) {
+		va_copy(aq, ap);
+		len = vsnprintf(scope->format_buf, sizeof scope->format_buf,
+				fmt, aq);
+		va_end(aq);
+
+		if (len < 0)
+			return -1;
+
+		if ((size_t) len < sizeof scope->format_buf) {
+			scope->format_buf_busy = true;
+			*str = scope->format_buf;
+			return len;
+		}
+	}
+
+	return vasprintf(str, fmt, ap);
+}
+
+/** Release a string from weston_log_scope_format()
+ *
+ * @memberof weston_log_scope
+ */
+static void
+weston_log_scope_format_release(struct weston_log_scope *scope, char *str)
+{
+	if (str == scope->format_buf)
+		scope->format_buf_busy = false;
+	else
+		free(str);
+}
+
 /** Write a formatted string to the stream's subscription
  *
  * @memberof weston_log_subscription
@@ -202,10 +268,10 @@ weston_log_subscription_vprintf(struct weston_log_subscription *sub,
 	if (!weston_log_scope_is_enabled(sub->source))
 		return;
 
-	len = vasprintf(&str, fmt, ap);
+	len = weston_log_scope_format(sub->source, &str, fmt, ap);
 	if (len >= 0) {
 		weston_log_subscription_write(sub, str, len);
-		free(str);
+		weston_log_scope_format_release(sub->source, str);
 	} else {
 		weston_log_subscription_write(sub, oom, sizeof oom - 1);
 	}
@@ -477,8 +543,10 @@ compositor_destroy_listener(struct wl_listener *listener, void *data)
  * This enables the weston_debug_v1 Wayland protocol extension which any client
  * can use to get debug messages from the compositor.
  *
- * WARNING: This feature should not be used in production. If a client
- * provides a file descriptor that blocks writes, it will block the whole
+ * WARNING: This feature should not be used in production. Writes to pipes,
+ * sockets and terminals are queued and never block the compositor, dropping
+ * messages when a reader falls too far behind, but if a client provides any
+ * other file descriptor that blocks writes, it will block the whole
  * compositor indefinitely.
  *
  * There is no control on which client is allowed to subscribe to debug
@@ -800,6 +868,9 @@ weston_log_scope_write(struct weston_log_scope *scope,
  * The behavioral details for each stream are the same as for
  * weston_debug_stream_write().
  *
+ * Messages are formatted into a buffer owned by the scope, only messages
+ * longer than WESTON_LOG_SCOPE_FORMAT_SIZE are allocated from the heap.
+ *
  * \memberof weston_log_scope
  */
 WL_EXPORT int
@@ -813,10 +884,10 @@ weston_log_scope_vprintf(struct weston_log_scope *scope,
 	if (!weston_log_scope_is_enabled(scope))
 		return len;
 
-	len = vasprintf(&str, fmt, ap);
+	len = weston_log_scope_format(scope, &str, fmt, ap);
 	if (len >= 0) {
 		weston_log_scope_write(scope, str, len);
-		free(str);
+		weston_log_scope_format_release(scope, str);
 	} else {
 		weston_log_scope_write(scope, oom, sizeof oom - 1);
 	}
@@ -883,6 +954,8 @@ weston_log_subscription_printf(struct weston_log_subscription *sub,
  * and append the debug scope name to it, if a scope is available.
  * The string is NUL-terminated, even if truncated.
  *
+ * The date and time part is formatted at most once per second for a scope.
+ *
  * @memberof weston_log_scope
  */
 WL_EXPORT char *
@@ -896,11 +969,23 @@ weston_log_scope_timestamp(struct weston_log_scope *scope,
 
 	gettimeofday(&tv, NULL);
 
+	if (scope && scope->timestamp_str[0] &&
+	    scope->timestamp_sec == tv.tv_sec) {
+		snprintf(buf, len, "[%s.%03ld][%s]", scope->timestamp_str,
+			 tv.tv_usec / 1000, scope->name);
+		return buf;
+	}
+
 	bdt = localtime(&tv.tv_sec);
 	if (bdt)
 		ret = strftime(string, sizeof string,
 			       "%Y-%m-%d %H:%M:%S", bdt);
 
+	if (scope && ret > 0 && ret < sizeof scope->timestamp_str) {
+		memcpy(scope->timestamp_str, string, ret + 1);
+		scope->timestamp_sec = tv.tv_sec;
+	}
+
 	if (ret > 0) {
 		snprintf(buf, len, "[%s.%03ld][%s]", string,
 			 tv.tv_usec / 1000,
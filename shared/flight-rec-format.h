@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FLIGHT_REC_FORMAT_H
+#define WESTON_FLIGHT_REC_FORMAT_H
+
+#include <stdint.h>
+
+/* On-disk layout of a file-backed flight recorder, shared between
+ * libweston (writer) and weston-flight-rec (reader). The file is the header
+ * followed by the ring buffer contents, starting at header_size.
+ */
+
+#define WESTON_FLIGHT_REC_MAGIC		"WSTNFREC"
+#define WESTON_FLIGHT_REC_VERSION	1
+
+/* set when the compositor destroyed the flight recorder properly */
+#define WESTON_FLIGHT_REC_FLAG_CLOSED	(1 << 0)
+
+struct weston_flight_rec_file_header {
+	char magic[8];		/**< WESTON_FLIGHT_REC_MAGIC, not terminated */
+	uint32_t version;	/**< WESTON_FLIGHT_REC_VERSION */
+	uint32_t header_size;	/**< offset of the ring buffer in the file */
+	uint32_t size;		/**< usable length of the ring buffer */
+	uint32_t append_pos;	/**< where the next write goes */
+	uint32_t overlap;	/**< non-zero once the ring has wrapped */
+	uint32_t flags;		/**< WESTON_FLIGHT_REC_FLAG_* */
+	uint32_t pid;		/**< process id of the writer */
+	uint32_t padding;
+};
+
+#endif /* WESTON_FLIGHT_REC_FORMAT_H */
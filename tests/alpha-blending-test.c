@@ -36,6 +36,7 @@ struct setup_args {
 	struct fixture_metadata meta;
 	enum renderer_type renderer;
 	bool color_management;
+	bool gl_layer_cache;
 };
 
 static const int ALPHA_STEPS = 256;
@@ -57,6 +58,12 @@ static const struct setup_args my_setup_args[] = {
 		.color_management = true,
 		.meta.name = "GL sRGB EOTF"
 	},
+	{
+		.renderer = RENDERER_GL,
+		.color_management = false,
+		.gl_layer_cache = true,
+		.meta.name = "GL layer cache"
+	},
 };
 
 static enum test_result_code
@@ -70,6 +77,9 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 	setup.height = 16;
 	setup.shell = SHELL_TEST_DESKTOP;
 
+	/* both surfaces are static, so they are drawn through the cache */
+	setup.test_quirks.gl_layer_cache = arg->gl_layer_cache;
+
 	if (arg->color_management) {
 		weston_ini_setup(&setup,
 				 cfgln("[core]"),
@@ -0,0 +1,290 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+#define MIME_TYPE "text/plain;charset=utf-8"
+
+struct selection {
+	size_t size;
+	struct wl_data_offer *offer;
+	struct timespec sent;
+};
+
+static char
+selection_byte(size_t offset)
+{
+	return 'a' + offset % 26;
+}
+
+static void
+data_source_target(void *data, struct wl_data_source *source,
+		   const char *mime_type)
+{
+}
+
+/* The clipboard manager asks for its copy, the client thread may block
+ * while the compositor reads it. */
+static void
+data_source_send(void *data, struct wl_data_source *source,
+		 const char *mime_type, int32_t fd)
+{
+	struct selection *selection = data;
+	char buffer[64 * 1024 + 26];
+	size_t offset = 0, len;
+	ssize_t ret;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(buffer); i++)
+		buffer[i] = selection_byte(i);
+
+	while (offset < selection->size) {
+		len = MIN(selection->size - offset, 64 * 1024);
+		ret = write(fd, buffer + offset % 26, len);
+		assert(ret > 0);
+		offset += ret;
+	}
+	close(fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &selection->sent);
+}
+
+static void
+data_source_cancelled(void *data, struct wl_data_source *source)
+{
+}
+
+static const struct wl_data_source_listener data_source_listener = {
+	data_source_target,
+	data_source_send,
+	data_source_cancelled,
+};
+
+static void
+data_device_data_offer(void *data, struct wl_data_device *device,
+		       struct wl_data_offer *offer)
+{
+}
+
+static void
+data_device_enter(void *data, struct wl_data_device *device,
+		  uint32_t serial, struct wl_surface *surface,
+		  wl_fixed_t x, wl_fixed_t y, struct wl_data_offer *offer)
+{
+}
+
+static void
+data_device_leave(void *data, struct wl_data_device *device)
+{
+}
+
+static void
+data_device_motion(void *data, struct wl_data_device *device,
+		   uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+}
+
+static void
+data_device_drop(void *data, struct wl_data_device *device)
+{
+}
+
+static void
+data_device_selection(void *data, struct wl_data_device *device,
+		      struct wl_data_offer *offer)
+{
+	struct selection *selection = data;
+
+	if (selection->offer)
+		wl_data_offer_destroy(selection->offer);
+	selection->offer = offer;
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+	data_device_data_offer,
+	data_device_enter,
+	data_device_leave,
+	data_device_motion,
+	data_device_drop,
+	data_device_selection,
+};
+
+/* In kB, for the whole process, compositor included */
+static long
+read_status_kb(const char *field)
+{
+	char line[128];
+	long value = -1;
+	size_t len = strlen(field);
+	FILE *fp;
+
+	fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (strncmp(line, field, len) == 0 && line[len] == ':') {
+			value = strtol(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(fp);
+
+	return value;
+}
+
+/* Returns the time until the first byte arrived */
+static int64_t
+paste(struct client *client, struct selection *selection)
+{
+	char buffer[64 * 1024];
+	struct timespec begin, first;
+	size_t offset = 0, i;
+	ssize_t len;
+	int p[2];
+
+	assert(pipe2(p, O_CLOEXEC) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	wl_data_offer_receive(selection->offer, MIME_TYPE, p[1]);
+	close(p[1]);
+	wl_display_flush(client->wl_display);
+
+	while ((len = read(p[0], buffer, sizeof buffer)) > 0) {
+		if (offset == 0)
+			clock_gettime(CLOCK_MONOTONIC, &first);
+		for (i = 0; i < (size_t) len; i++)
+			assert(buffer[i] == selection_byte(offset + i));
+		offset += len;
+	}
+	assert(len == 0);
+	close(p[0]);
+
+	assert(offset == selection->size);
+
+	return offset ? timespec_sub_to_nsec(&first, &begin) : 0;
+}
+
+static const size_t selection_sizes[] = {
+	4 * 1024,
+	1024 * 1024,
+	64 * 1024 * 1024,
+};
+
+/* Not a pass/fail criterion on timing or memory: the clipboard manager
+ * takes over a selection of the given size once its client lets go, and
+ * serves a few pastes from it. */
+TEST_P(clipboard_persistence, selection_sizes)
+{
+	const size_t *size = data;
+	struct selection selection = { .size = *size };
+	struct client *client;
+	struct wl_data_device_manager *manager;
+	struct wl_data_device *device;
+	struct wl_data_source *source;
+	struct timespec begin, end;
+	long anon, shmem;
+	int64_t latency;
+	int i;
+
+	client = create_client_and_test_surface(10, 10, 1, 1);
+	weston_test_activate_surface(client->test->weston_test,
+				     client->surface->wl_surface);
+
+	manager = bind_to_singleton_global(client,
+					   &wl_data_device_manager_interface, 1);
+	device = wl_data_device_manager_get_data_device(manager,
+							client->input->wl_seat);
+	wl_data_device_add_listener(device, &data_device_listener, &selection);
+	client_roundtrip(client);
+
+	anon = read_status_kb("RssAnon");
+	shmem = read_status_kb("RssShmem");
+
+	/* Copy: the clipboard manager reads the whole selection */
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	source = wl_data_device_manager_create_data_source(manager);
+	wl_data_source_add_listener(source, &data_source_listener,
+				    &selection);
+	wl_data_source_offer(source, MIME_TYPE);
+	wl_data_device_set_selection(device, source, 0);
+	client_roundtrip(client);
+	assert(selection.sent.tv_sec != 0 || selection.sent.tv_nsec != 0);
+
+	/* The clipboard manager's copy replaces the selection */
+	wl_data_source_destroy(source);
+	if (selection.offer) {
+		wl_data_offer_destroy(selection.offer);
+		selection.offer = NULL;
+	}
+	while (!selection.offer)
+		client_roundtrip(client);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	testlog("%zu bytes: copy %.2f ms, process grew by %ld kB anonymous, "
+		"%ld kB shared memory\n", selection.size,
+		timespec_sub_to_nsec(&end, &begin) / 1e6,
+		read_status_kb("RssAnon") - anon,
+		read_status_kb("RssShmem") - shmem);
+
+	for (i = 0; i < 3; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		latency = paste(client, &selection);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		testlog("%zu bytes: paste %d first byte after %.3f ms, "
+			"done in %.2f ms\n", selection.size, i,
+			latency / 1e6, timespec_sub_to_nsec(&end, &begin) / 1e6);
+	}
+
+	wl_data_offer_destroy(selection.offer);
+	wl_data_device_destroy(device);
+	wl_data_device_manager_destroy(manager);
+	client_destroy(client);
+}
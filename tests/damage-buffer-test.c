@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum renderer_type renderer;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{
+		.renderer = RENDERER_PIXMAN,
+		.meta.name = "pixman"
+	},
+	{
+		.renderer = RENDERER_GL,
+		.meta.name = "GL"
+	},
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+static uint32_t
+get_pixel(struct buffer *buf, int x, int y)
+{
+	uint8_t *pixels = (uint8_t *) pixman_image_get_data(buf->image);
+	int stride = pixman_image_get_stride(buf->image);
+
+	return ((uint32_t *) (pixels + y * stride))[x] & 0xffffff;
+}
+
+/*
+ * Only the damage a client posts gets uploaded by the GL renderer, so new
+ * content in a re-attached buffer shows up only if wl_surface.damage_buffer
+ * made it into the surface damage.
+ */
+TEST(damage_buffer_updates_content)
+{
+	struct client *client;
+	struct surface *surface;
+	struct buffer *shot;
+	pixman_color_t red;
+	pixman_color_t blue;
+	pixman_rectangle16_t left = { 0, 0, 50, 80 };
+	int done;
+
+	color_rgb888(&red, 255, 0, 0);
+	color_rgb888(&blue, 0, 0, 255);
+
+	client = create_client_and_test_surface(40, 40, 100, 80);
+	surface = client->surface;
+
+	fill_image_with_color(surface->buffer->image, &red);
+	move_client(client, 40, 40);
+
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, surface->buffer->image,
+				     &blue, 1, &left);
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage_buffer(surface->wl_surface, 0, 0, 50, 80);
+	frame_callback_set(surface->wl_surface, &done);
+	wl_surface_commit(surface->wl_surface);
+	frame_callback_wait(client, &done);
+
+	shot = capture_screenshot_of_output(client);
+	assert(shot);
+	assert(get_pixel(shot, 40 + 25, 40 + 40) == 0x0000ff);
+	assert(get_pixel(shot, 40 + 75, 40 + 40) == 0xff0000);
+
+	buffer_destroy(shot);
+	client_destroy(client);
+}
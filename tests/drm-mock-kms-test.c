@@ -0,0 +1,1105 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "backend.h"
+#include "color.h"
+#include "libweston-internal.h"
+#include "linux-dmabuf.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+#include "pixel-formats.h"
+#include "presentation-time-server-protocol.h"
+#include "backend-drm/drm-internal.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-runner.h"
+#include "drm-mock-kms.h"
+
+/*
+ * These tests run the atomic KMS code of the DRM backend (kms.c, fb.c,
+ * state-helpers.c and state-propose.c) against the mock KMS device in a
+ * compositor without a renderer. What drm.c would do at start-up and
+ * during repaint is done by the harness below, reduced to what the
+ * plane assignment needs.
+ */
+
+#define MOCK_WIDTH 1920
+#define MOCK_HEIGHT 1080
+#define MOCK_REFRESH 60
+
+static const uint32_t mock_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+};
+
+static const uint64_t mock_modifiers[] = {
+	DRM_FORMAT_MOD_LINEAR,
+};
+
+struct mock_drm {
+	struct wl_display *display;
+	struct weston_log_context *log_ctx;
+	struct weston_compositor *compositor;
+	struct mock_kms *kms;
+	struct drm_backend *b;
+	struct drm_head *head;
+	struct drm_output *output;
+	struct drm_mode mode;
+	struct weston_layer layer;
+	uint32_t overlay_ids[8];
+	unsigned int n_overlays;
+};
+
+struct mock_dmabuf_buffer {
+	struct weston_buffer base; /* freed by the last buffer reference */
+	struct linux_dmabuf_buffer dmabuf;
+};
+
+/* The parts of drm.c the KMS code calls back into. */
+
+void
+drm_output_update_complete(struct drm_output *output, uint32_t flags,
+			   unsigned int sec, unsigned int usec)
+{
+	struct drm_plane_state *ps;
+	struct timespec ts;
+
+	wl_list_for_each(ps, &output->state_cur->plane_list, link)
+		ps->complete = true;
+
+	drm_output_state_free(output->state_last);
+	output->state_last = NULL;
+
+	ts.tv_sec = sec;
+	ts.tv_nsec = usec * 1000;
+	weston_output_finish_frame(&output->base, &ts, flags);
+}
+
+/* Only reached on legacy KMS, which the mock does not offer. */
+int
+drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
+{
+	assert(!"not reached");
+	return -1;
+}
+
+void
+drm_output_fini_egl(struct drm_output *output)
+{
+	assert(!"not reached");
+}
+
+static void
+mock_drm_repaint_begin(struct weston_compositor *compositor)
+{
+	struct drm_backend *b = to_drm_backend(compositor);
+
+	b->repaint_data = drm_pending_state_alloc(b);
+}
+
+static int
+mock_drm_repaint_flush(struct weston_compositor *compositor)
+{
+	struct drm_backend *b = to_drm_backend(compositor);
+	int ret;
+
+	ret = drm_pending_state_apply(b->repaint_data);
+	b->repaint_data = NULL;
+
+	return (ret == -EACCES) ? -1 : 0;
+}
+
+static void
+mock_drm_repaint_cancel(struct weston_compositor *compositor)
+{
+	struct drm_backend *b = to_drm_backend(compositor);
+
+	drm_pending_state_free(b->repaint_data);
+	b->repaint_data = NULL;
+}
+
+static void
+mock_drm_destroy(struct weston_compositor *compositor)
+{
+	struct drm_backend *b = to_drm_backend(compositor);
+	struct drm_plane *plane, *plane_tmp;
+	struct drm_crtc *crtc, *crtc_tmp;
+	struct weston_head *base, *next;
+
+	weston_compositor_shutdown(compositor);
+
+	wl_list_for_each_safe(plane, plane_tmp, &b->plane_list, link) {
+		drm_plane_state_free(plane->state_cur, true);
+		drm_property_info_free(plane->props, WDRM_PLANE__COUNT);
+		weston_plane_release(&plane->base);
+		weston_drm_format_array_fini(&plane->formats);
+		wl_list_remove(&plane->link);
+		free(plane);
+	}
+
+	wl_list_for_each_safe(crtc, crtc_tmp, &b->crtc_list, link) {
+		drm_property_info_free(crtc->props_crtc, WDRM_CRTC__COUNT);
+		wl_list_remove(&crtc->link);
+		free(crtc);
+	}
+
+	wl_list_for_each_safe(base, next, &compositor->head_list,
+			      compositor_link) {
+		struct drm_head *head = to_drm_head(base);
+
+		weston_head_release(&head->base);
+		drm_property_info_free(head->connector.props,
+				       WDRM_CONNECTOR__COUNT);
+		drmModeFreeObjectProperties(head->connector.props_drm);
+		drmModeFreeConnector(head->connector.conn);
+		free(head);
+	}
+
+	free(b);
+}
+
+static int
+mock_output_enable(struct weston_output *base)
+{
+	return 0;
+}
+
+static void
+mock_output_destroy(struct weston_output *base)
+{
+	struct drm_output *output = to_drm_output(base);
+
+	weston_output_release(&output->base);
+
+	assert(!output->state_last);
+	drm_output_state_free(output->state_cur);
+	drm_fb_unref(output->dumb[0]);
+
+	wl_array_release(&output->plane_cache.entries);
+	free(output);
+}
+
+/* As drm_output_start_repaint_loop() when there is no vblank to query. */
+static int
+mock_output_start_repaint_loop(struct weston_output *base)
+{
+	weston_output_finish_frame(base, NULL,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
+
+	return 0;
+}
+
+/* As drm_output_repaint(), with a dumb buffer standing in for the
+ * renderer's output. */
+static int
+mock_output_repaint(struct weston_output *base, pixman_region32_t *damage)
+{
+	struct drm_output *output = to_drm_output(base);
+	struct drm_pending_state *pending_state = output->backend->repaint_data;
+	struct drm_output_state *state;
+	struct drm_plane_state *scanout_state;
+
+	assert(!output->state_last);
+
+	state = drm_pending_state_get_output(pending_state, output);
+	if (!state)
+		state = drm_output_state_duplicate(output->state_cur,
+						   pending_state,
+						   DRM_OUTPUT_STATE_CLEAR_PLANES);
+	state->dpms = WESTON_DPMS_ON;
+
+	scanout_state = drm_output_state_get_plane(state,
+						   output->scanout_plane);
+	if (scanout_state->fb)
+		return 0;
+
+	scanout_state->fb = drm_fb_ref(output->dumb[0]);
+	scanout_state->output = output;
+	scanout_state->src_x = 0;
+	scanout_state->src_y = 0;
+	scanout_state->src_w = MOCK_WIDTH << 16;
+	scanout_state->src_h = MOCK_HEIGHT << 16;
+	scanout_state->dest_x = 0;
+	scanout_state->dest_y = 0;
+	scanout_state->dest_w = MOCK_WIDTH;
+	scanout_state->dest_h = MOCK_HEIGHT;
+
+	return 0;
+}
+
+/* As drm_plane_create(). */
+static struct drm_plane *
+mock_drm_plane_create(struct drm_backend *b, const drmModePlane *kplane,
+		      uint32_t plane_idx)
+{
+	struct drm_plane *plane, *tmp;
+	drmModeObjectProperties *props;
+	uint64_t *zpos_range_values;
+
+	plane = xzalloc(sizeof(*plane));
+	plane->backend = b;
+	plane->state_cur = drm_plane_state_alloc(NULL, plane);
+	plane->state_cur->complete = true;
+	plane->possible_crtcs = kplane->possible_crtcs;
+	plane->plane_id = kplane->plane_id;
+	plane->plane_idx = plane_idx;
+	weston_drm_format_array_init(&plane->formats);
+
+	props = drmModeObjectGetProperties(b->drm.fd, kplane->plane_id,
+					   DRM_MODE_OBJECT_PLANE);
+	assert(props);
+	drm_property_info_populate(b, plane_props, plane->props,
+				   WDRM_PLANE__COUNT, props);
+	plane->type = drm_property_get_value(&plane->props[WDRM_PLANE_TYPE],
+					     props, WDRM_PLANE_TYPE__COUNT);
+	zpos_range_values =
+		drm_property_get_range_values(&plane->props[WDRM_PLANE_ZPOS],
+					      props);
+	assert(zpos_range_values);
+	plane->zpos_min = zpos_range_values[0];
+	plane->zpos_max = zpos_range_values[1];
+	assert(drm_plane_populate_formats(plane, kplane, props,
+					  b->fb_modifiers) == 0);
+	drmModeFreeObjectProperties(props);
+
+	weston_plane_init(&plane->base, b->compositor, 0, 0);
+
+	wl_list_for_each(tmp, &b->plane_list, link) {
+		if (tmp->zpos_max > plane->zpos_max) {
+			wl_list_insert(tmp->link.prev, &plane->link);
+			break;
+		}
+	}
+	if (plane->link.next == NULL)
+		wl_list_insert(b->plane_list.prev, &plane->link);
+
+	return plane;
+}
+
+static void
+mock_drm_create_kms_objects(struct mock_drm *m)
+{
+	struct drm_backend *b = m->b;
+	drmModeObjectProperties *props;
+	drmModePlaneRes *plane_res;
+	drmModeRes *res;
+	struct drm_crtc *crtc;
+	struct drm_head *head;
+	uint32_t i;
+
+	res = drmModeGetResources(b->drm.fd);
+	assert(res && res->count_crtcs == 1 && res->count_connectors == 1);
+	b->min_width = res->min_width;
+	b->max_width = res->max_width;
+	b->min_height = res->min_height;
+	b->max_height = res->max_height;
+
+	crtc = xzalloc(sizeof(*crtc));
+	props = drmModeObjectGetProperties(b->drm.fd, res->crtcs[0],
+					   DRM_MODE_OBJECT_CRTC);
+	assert(props);
+	drm_property_info_populate(b, crtc_props, crtc->props_crtc,
+				   WDRM_CRTC__COUNT, props);
+	drmModeFreeObjectProperties(props);
+	crtc->backend = b;
+	crtc->crtc_id = res->crtcs[0];
+	crtc->pipe = 0;
+	wl_list_insert(&b->crtc_list, &crtc->link);
+
+	plane_res = drmModeGetPlaneResources(b->drm.fd);
+	assert(plane_res);
+	for (i = 0; i < plane_res->count_planes; i++) {
+		drmModePlane *kplane;
+		struct drm_plane *plane;
+
+		kplane = drmModeGetPlane(b->drm.fd, plane_res->planes[i]);
+		assert(kplane);
+		plane = mock_drm_plane_create(b, kplane, i);
+		drmModeFreePlane(kplane);
+
+		if (plane->type == WDRM_PLANE_TYPE_OVERLAY)
+			weston_compositor_stack_plane(b->compositor,
+						      &plane->base,
+						      &b->compositor->primary_plane);
+	}
+	drmModeFreePlaneResources(plane_res);
+
+	head = xzalloc(sizeof(*head));
+	head->backend = b;
+	head->connector.backend = b;
+	head->connector.connector_id = res->connectors[0];
+	head->connector.conn = drmModeGetConnector(b->drm.fd,
+						   res->connectors[0]);
+	head->connector.props_drm =
+		drmModeObjectGetProperties(b->drm.fd, res->connectors[0],
+					   DRM_MODE_OBJECT_CONNECTOR);
+	assert(head->connector.conn && head->connector.props_drm);
+	drm_property_info_populate(b, connector_props, head->connector.props,
+				   WDRM_CONNECTOR__COUNT,
+				   head->connector.props_drm);
+	weston_head_init(&head->base, "Virtual-1");
+	weston_head_set_monitor_strings(&head->base, "mock", "kms", NULL);
+	weston_head_set_connection_status(&head->base, true);
+	weston_compositor_add_head(b->compositor, &head->base);
+	m->head = head;
+
+	m->mode.mode_info = head->connector.conn->modes[0];
+	m->mode.base.flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+	m->mode.base.width = MOCK_WIDTH;
+	m->mode.base.height = MOCK_HEIGHT;
+	m->mode.base.refresh = MOCK_REFRESH * 1000;
+
+	drmModeFreeResources(res);
+}
+
+static void
+mock_drm_create_output(struct mock_drm *m)
+{
+	struct drm_backend *b = m->b;
+	struct drm_output *output;
+	struct drm_plane *plane;
+
+	output = xzalloc(sizeof(*output));
+	output->backend = b;
+	output->crtc = container_of(b->crtc_list.next, struct drm_crtc, link);
+	output->crtc->output = output;
+
+	weston_output_init(&output->base, b->compositor, "Virtual-1");
+	output->base.enable = mock_output_enable;
+	output->base.destroy = mock_output_destroy;
+	output->base.start_repaint_loop = mock_output_start_repaint_loop;
+	output->base.repaint = mock_output_repaint;
+	output->base.assign_planes = drm_assign_planes;
+	output->state_cur = drm_output_state_alloc(output, NULL);
+	wl_array_init(&output->plane_cache.entries);
+	weston_compositor_add_pending_output(&output->base, b->compositor);
+
+	wl_list_for_each(plane, &b->plane_list, link) {
+		if (plane->type == WDRM_PLANE_TYPE_PRIMARY)
+			output->scanout_plane = plane;
+		else if (plane->type == WDRM_PLANE_TYPE_CURSOR)
+			output->cursor_plane = plane;
+	}
+	assert(output->scanout_plane && output->cursor_plane);
+	weston_compositor_stack_plane(b->compositor,
+				      &output->cursor_plane->base, NULL);
+
+	output->dumb[0] = drm_fb_create_dumb(b, MOCK_WIDTH, MOCK_HEIGHT,
+					     DRM_FORMAT_XRGB8888);
+	assert(output->dumb[0]);
+
+	wl_list_insert(&output->base.mode_list, &m->mode.base.link);
+	output->base.current_mode = &m->mode.base;
+	weston_output_set_scale(&output->base, 1);
+	weston_output_set_transform(&output->base, WL_OUTPUT_TRANSFORM_NORMAL);
+	assert(weston_output_attach_head(&output->base, &m->head->base) == 0);
+	assert(weston_output_enable(&output->base) == 0);
+
+	m->output = output;
+}
+
+/** Repaint the output once and wait for the page flip to complete */
+static void
+mock_drm_repaint(struct mock_drm *m)
+{
+	struct weston_output *output = &m->output->base;
+	struct wl_event_loop *loop = wl_display_get_event_loop(m->display);
+	int i;
+
+	weston_output_schedule_repaint(output);
+
+	for (i = 0; i < 1000; i++) {
+		if (mock_kms_count_pending_flips(m->kms) > 0)
+			on_drm_input(m->b->drm.fd, WL_EVENT_READABLE, m->b);
+		else if (output->repaint_status == REPAINT_NOT_SCHEDULED &&
+			 !output->repaint_needed)
+			return;
+
+		wl_event_loop_dispatch(loop, 1);
+	}
+
+	assert(!"repaint did not complete");
+}
+
+static void
+mock_drm_init(struct mock_drm *m, unsigned int n_overlays)
+{
+	struct weston_color_manager *cm;
+	struct drm_backend *b;
+	uint32_t crtc_id;
+	unsigned int i;
+
+	memset(m, 0, sizeof(*m));
+
+	m->kms = mock_kms_create();
+	crtc_id = mock_kms_add_crtc(m->kms);
+	assert(crtc_id);
+	mock_kms_add_plane(m->kms, MOCK_KMS_PLANE_PRIMARY, 1, 0, 0,
+			   mock_formats, ARRAY_LENGTH(mock_formats),
+			   mock_modifiers, ARRAY_LENGTH(mock_modifiers));
+	assert(n_overlays <= ARRAY_LENGTH(m->overlay_ids));
+	for (i = 0; i < n_overlays; i++) {
+		m->overlay_ids[i] =
+			mock_kms_add_plane(m->kms, MOCK_KMS_PLANE_OVERLAY, 1,
+					   i + 1, i + 1, mock_formats,
+					   ARRAY_LENGTH(mock_formats),
+					   mock_modifiers,
+					   ARRAY_LENGTH(mock_modifiers));
+	}
+	m->n_overlays = n_overlays;
+	mock_kms_add_plane(m->kms, MOCK_KMS_PLANE_CURSOR, 1,
+			   n_overlays + 1, n_overlays + 1,
+			   &mock_formats[1], 1, NULL, 0);
+	mock_kms_add_connector(m->kms, 1, MOCK_WIDTH, MOCK_HEIGHT,
+			       MOCK_REFRESH);
+
+	m->display = wl_display_create();
+	assert(m->display);
+	m->log_ctx = weston_log_ctx_create();
+	assert(m->log_ctx);
+	m->compositor = weston_compositor_create(m->display, m->log_ctx,
+						 NULL, NULL);
+	assert(m->compositor);
+	assert(weston_compositor_set_presentation_clock(m->compositor,
+							CLOCK_MONOTONIC) == 0);
+
+	b = xzalloc(sizeof(*b));
+	b->compositor = m->compositor;
+	b->drm.fd = mock_kms_get_fd(m->kms);
+	/* never dereferenced, the mock replaces the GBM import */
+	b->gbm = (struct gbm_device *) m;
+	b->atomic_modeset = true;
+	b->fb_modifiers = true;
+	b->state_invalid = true;
+	b->cursor_width = 64;
+	b->cursor_height = 64;
+	wl_list_init(&b->plane_list);
+	wl_list_init(&b->crtc_list);
+	wl_list_init(&b->writeback_connector_list);
+	b->base.destroy = mock_drm_destroy;
+	b->base.repaint_begin = mock_drm_repaint_begin;
+	b->base.repaint_flush = mock_drm_repaint_flush;
+	b->base.repaint_cancel = mock_drm_repaint_cancel;
+	m->compositor->backend = &b->base;
+	m->b = b;
+
+	assert(noop_renderer_init(m->compositor) == 0);
+	cm = weston_color_manager_noop_create(m->compositor);
+	assert(cm && cm->init(cm));
+	m->compositor->color_manager = cm;
+
+	mock_drm_create_kms_objects(m);
+	mock_drm_create_output(m);
+
+	weston_layer_init(&m->layer, m->compositor);
+	weston_layer_set_position(&m->layer, WESTON_LAYER_POSITION_NORMAL);
+
+	/* The first frame is the modeset; it also puts a renderer buffer
+	 * on screen, which mixed-mode plane assignment needs. */
+	mock_drm_repaint(m);
+	assert(!b->state_invalid);
+}
+
+static void
+mock_drm_fini(struct mock_drm *m)
+{
+	struct weston_view *view, *tmp;
+
+	wl_list_for_each_safe(view, tmp, &m->layer.view_list.link,
+			      layer_link.link) {
+		struct weston_surface *surface = view->surface;
+
+		weston_view_destroy(view);
+		weston_surface_unref(surface);
+	}
+	weston_layer_fini(&m->layer);
+
+	weston_compositor_destroy(m->compositor);
+	weston_log_ctx_destroy(m->log_ctx);
+	wl_display_destroy(m->display);
+	mock_kms_destroy(m->kms);
+}
+
+/** Map a surface showing a linear dma-buf, as a client could */
+static struct weston_view *
+mock_drm_add_view_format(struct mock_drm *m, int x, int y, int width,
+			 int height, int scale, uint32_t format)
+{
+	struct mock_dmabuf_buffer *mbuf;
+	struct dmabuf_attributes *attr;
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	mbuf = xzalloc(sizeof(*mbuf));
+	attr = &mbuf->dmabuf.attributes;
+	attr->width = width * scale;
+	attr->height = height * scale;
+	attr->format = format;
+	attr->n_planes = 1;
+	attr->fd[0] = -1;
+	attr->stride[0] = attr->width * 4;
+	attr->modifier[0] = DRM_FORMAT_MOD_LINEAR;
+	mbuf->dmabuf.compositor = m->compositor;
+
+	mbuf->base.type = WESTON_BUFFER_DMABUF;
+	mbuf->base.dmabuf = &mbuf->dmabuf;
+	mbuf->base.width = attr->width;
+	mbuf->base.height = attr->height;
+	mbuf->base.pixel_format = pixel_format_get_info(attr->format);
+	mbuf->base.format_modifier = attr->modifier[0];
+	mbuf->base.buffer_origin = ORIGIN_TOP_LEFT;
+	wl_signal_init(&mbuf->base.destroy_signal);
+
+	surface = weston_surface_create(m->compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+
+	weston_buffer_reference(&surface->buffer_ref, &mbuf->base,
+				BUFFER_MAY_BE_ACCESSED);
+	surface->buffer_viewport.buffer.scale = scale;
+	weston_surface_set_size(surface, width, height);
+	surface->is_opaque = true;
+	pixman_region32_fini(&surface->opaque);
+	pixman_region32_init_rect(&surface->opaque, 0, 0, width, height);
+
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&m->layer.view_list, &view->layer_link);
+	surface->is_mapped = true;
+	view->is_mapped = true;
+
+	return view;
+}
+
+static struct weston_view *
+mock_drm_add_view(struct mock_drm *m, int x, int y, int width, int height,
+		  int scale)
+{
+	return mock_drm_add_view_format(m, x, y, width, height, scale,
+					DRM_FORMAT_XRGB8888);
+}
+
+static struct drm_plane *
+mock_drm_view_plane(struct mock_drm *m, struct weston_view *view)
+{
+	struct drm_plane *plane;
+
+	wl_list_for_each(plane, &m->b->plane_list, link) {
+		if (view->plane == &plane->base)
+			return plane;
+	}
+
+	return NULL;
+}
+
+static unsigned int
+mock_drm_count_enabled_overlays(struct mock_drm *m)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < m->n_overlays; i++) {
+		uint64_t fb_id = 0;
+
+		assert(mock_kms_get_property(m->kms, m->overlay_ids[i],
+					     "FB_ID", &fb_id));
+		if (fb_id != 0)
+			count++;
+	}
+
+	return count;
+}
+
+TEST(mock_kms_modeset_and_flip)
+{
+	struct mock_drm m;
+	const struct mock_kms_stats *stats;
+	uint64_t value;
+	uint32_t crtc_id;
+
+	mock_drm_init(&m, 2);
+	stats = mock_kms_get_stats(m.kms);
+	crtc_id = m.output->crtc->crtc_id;
+
+	assert(stats->commits == 1 && stats->rejects == 0);
+	assert(stats->flip_events == 1);
+	assert(mock_kms_get_property(m.kms, crtc_id, "ACTIVE", &value));
+	assert(value == 1);
+	assert(mock_kms_get_property(m.kms, m.head->connector.connector_id,
+				     "CRTC_ID", &value));
+	assert(value == crtc_id);
+	assert(mock_kms_get_property(m.kms, m.output->scanout_plane->plane_id,
+				     "FB_ID", &value));
+	assert(value == m.output->dumb[0]->fb_id);
+	assert(!m.output->state_last);
+
+	/* a later frame needs no modeset and completes as well */
+	mock_drm_repaint(&m);
+	assert(stats->commits == 2 && stats->flip_events == 2);
+	assert(!m.output->state_last);
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_overlays_within_plane_limit)
+{
+	struct mock_drm m;
+	struct mock_kms_rules rules = {
+		/* primary and two overlays */
+		.max_active_planes = 3,
+	};
+	struct weston_view *views[4];
+	unsigned int i, on_overlay = 0;
+
+	mock_drm_init(&m, 3);
+	mock_kms_set_rules(m.kms, &rules);
+
+	for (i = 0; i < ARRAY_LENGTH(views); i++)
+		views[i] = mock_drm_add_view(&m, 50 + 300 * i, 100, 200, 200, 1);
+
+	mock_drm_repaint(&m);
+
+	for (i = 0; i < ARRAY_LENGTH(views); i++) {
+		struct drm_plane *plane = mock_drm_view_plane(&m, views[i]);
+
+		if (plane) {
+			assert(plane->type == WDRM_PLANE_TYPE_OVERLAY);
+			on_overlay++;
+		} else {
+			assert(views[i]->plane == &m.compositor->primary_plane);
+		}
+	}
+	assert(on_overlay == 2);
+	assert(mock_drm_count_enabled_overlays(&m) == 2);
+	assert(mock_kms_get_stats(m.kms)->test_rejects > 0);
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_rejected_scaling_falls_back_to_renderer)
+{
+	struct mock_drm m;
+	struct mock_kms_rules rules = {
+		.reject_scaling = true,
+	};
+	struct weston_view *scaled, *unscaled;
+
+	mock_drm_init(&m, 2);
+	mock_kms_set_rules(m.kms, &rules);
+
+	scaled = mock_drm_add_view(&m, 100, 100, 200, 200, 2);
+	unscaled = mock_drm_add_view(&m, 600, 100, 200, 200, 1);
+
+	mock_drm_repaint(&m);
+
+	assert(scaled->plane == &m.compositor->primary_plane);
+	assert(mock_drm_view_plane(&m, unscaled) != NULL);
+	assert(mock_drm_count_enabled_overlays(&m) == 1);
+	assert(mock_kms_get_stats(m.kms)->rejects == 0);
+
+	/* without the restriction, both fit */
+	memset(&rules, 0, sizeof(rules));
+	mock_kms_set_rules(m.kms, &rules);
+	m.output->plane_cache.valid = false;
+	mock_drm_repaint(&m);
+
+	assert(mock_drm_view_plane(&m, scaled) != NULL);
+	assert(mock_drm_count_enabled_overlays(&m) == 2);
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_overlay_goes_to_largest_view)
+{
+	struct mock_drm m;
+	struct weston_view *video, *small, *popup;
+	struct drm_plane *plane;
+
+	mock_drm_init(&m, 1);
+
+	/* bottom to top */
+	video = mock_drm_add_view(&m, 0, 0, 1280, 720, 1);
+	small = mock_drm_add_view(&m, 1500, 900, 64, 64, 1);
+
+	mock_drm_repaint(&m);
+
+	plane = mock_drm_view_plane(&m, video);
+	assert(plane && plane->type == WDRM_PLANE_TYPE_OVERLAY);
+	assert(small->plane == &m.compositor->primary_plane);
+
+	/* the video would need the popup on a plane as well */
+	popup = mock_drm_add_view(&m, 100, 100, 64, 64, 1);
+
+	mock_drm_repaint(&m);
+
+	assert(video->plane == &m.compositor->primary_plane);
+	assert(mock_drm_count_enabled_overlays(&m) == 1);
+	assert(mock_drm_view_plane(&m, popup) ||
+	       mock_drm_view_plane(&m, small));
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_overlay_goes_to_busy_view)
+{
+	struct mock_drm m;
+	struct weston_surface_update_stats *stats;
+	struct weston_view *video, *still;
+	struct drm_plane *plane;
+
+	mock_drm_init(&m, 1);
+
+	/* bottom to top, same size */
+	video = mock_drm_add_view(&m, 0, 0, 400, 400, 1);
+	still = mock_drm_add_view(&m, 800, 0, 400, 400, 1);
+
+	/* as if it had been committing full frames at 60 Hz */
+	stats = &video->surface->update_stats;
+	weston_compositor_read_presentation_clock(m.compositor,
+						  &stats->last_update);
+	stats->interval_ms = 1000.0f / 60.0f;
+	stats->damage_area = 400 * 400;
+	stats->updates = 100;
+
+	mock_drm_repaint(&m);
+
+	plane = mock_drm_view_plane(&m, video);
+	assert(plane && plane->type == WDRM_PLANE_TYPE_OVERLAY);
+	assert(still->plane == &m.compositor->primary_plane);
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_plane_cache_retests_once)
+{
+	struct mock_drm m;
+	struct weston_view *views[2];
+	struct drm_plane *planes[2];
+	uint64_t tests;
+	unsigned int i;
+
+	mock_drm_init(&m, 2);
+
+	for (i = 0; i < ARRAY_LENGTH(views); i++)
+		views[i] = mock_drm_add_view(&m, 50 + 400 * i, 100, 300, 300, 1);
+
+	/* full search */
+	tests = m.b->atomic_test_count;
+	mock_drm_repaint(&m);
+	assert(m.output->plane_cache.valid);
+	assert(m.b->atomic_test_count - tests > 1);
+	for (i = 0; i < ARRAY_LENGTH(views); i++) {
+		planes[i] = mock_drm_view_plane(&m, views[i]);
+		assert(planes[i]);
+	}
+
+	/* unchanged scene: the cached assignment is tested once */
+	tests = m.b->atomic_test_count;
+	mock_drm_repaint(&m);
+	assert(m.b->atomic_test_count - tests == 1);
+	for (i = 0; i < ARRAY_LENGTH(views); i++)
+		assert(mock_drm_view_plane(&m, views[i]) == planes[i]);
+
+	/* the device refusing the cached assignment triggers a new search */
+	mock_kms_set_rules(m.kms, &(struct mock_kms_rules) {
+		.reject_plane_id = planes[0]->plane_id,
+	});
+	tests = m.b->atomic_test_count;
+	mock_drm_repaint(&m);
+	assert(m.b->atomic_test_count - tests > 1);
+	assert(mock_drm_view_plane(&m, views[0]) != planes[0]);
+	assert(mock_kms_get_stats(m.kms)->rejects == 0);
+
+	/* a moved view changes the scene */
+	mock_kms_set_rules(m.kms, &(struct mock_kms_rules) { 0 });
+	weston_view_set_position(views[1], 900, 500);
+	tests = m.b->atomic_test_count;
+	mock_drm_repaint(&m);
+	assert(m.b->atomic_test_count - tests > 1);
+
+	mock_drm_fini(&m);
+}
+
+TEST(mock_kms_plane_cache_unusable_plane_searches_again)
+{
+	struct mock_drm m;
+	struct mock_kms_rules rules = {
+		.reject_scaling = true,
+	};
+	struct weston_view *scaled, *unscaled;
+	struct drm_plane *cached, *plane;
+	uint32_t possible_crtcs;
+
+	mock_drm_init(&m, 2);
+	mock_kms_set_rules(m.kms, &rules);
+
+	/* the scaled view keeps the renderer, and so the cache, in use */
+	scaled = mock_drm_add_view(&m, 100, 100, 200, 200, 2);
+	unscaled = mock_drm_add_view(&m, 600, 100, 200, 200, 1);
+
+	mock_drm_repaint(&m);
+	assert(m.output->plane_cache.valid);
+	assert(scaled->plane == &m.compositor->primary_plane);
+	cached = mock_drm_view_plane(&m, unscaled);
+	assert(cached);
+
+	/* the cached plane can no longer be used on this CRTC, but the other
+	 * overlay is free: the view must not end up in the renderer */
+	possible_crtcs = cached->possible_crtcs;
+	cached->possible_crtcs = 0;
+	mock_drm_repaint(&m);
+
+	plane = mock_drm_view_plane(&m, unscaled);
+	assert(plane && plane != cached);
+	assert(plane->type == WDRM_PLANE_TYPE_OVERLAY);
+	assert(scaled->plane == &m.compositor->primary_plane);
+
+	cached->possible_crtcs = possible_crtcs;
+	mock_drm_fini(&m);
+}
+
+/* The formats a renderer could offer: more than the planes can take. */
+static const uint32_t mock_renderer_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_ABGR8888,
+};
+
+/** A client subscribed to the dma-buf feedback of a surface */
+struct mock_feedback {
+	int fds[2];
+	struct wl_client *client;
+	struct weston_dmabuf_feedback *feedback;
+};
+
+static void
+mock_feedback_init(struct mock_feedback *mf, struct mock_drm *m,
+		   struct weston_surface *surface)
+{
+	struct weston_drm_format_array formats;
+	struct weston_drm_format *fmt;
+	struct wl_resource *resource;
+	unsigned int i;
+
+	weston_drm_format_array_init(&formats);
+	for (i = 0; i < ARRAY_LENGTH(mock_renderer_formats); i++) {
+		fmt = weston_drm_format_array_add_format(&formats,
+							 mock_renderer_formats[i]);
+		assert(fmt);
+		assert(weston_drm_format_add_modifier(fmt,
+						      DRM_FORMAT_MOD_LINEAR) == 0);
+	}
+	m->compositor->dmabuf_feedback_format_table =
+		weston_dmabuf_feedback_format_table_create(&formats);
+	assert(m->compositor->dmabuf_feedback_format_table);
+	weston_drm_format_array_fini(&formats);
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+			  mf->fds) == 0);
+	mf->client = wl_client_create(m->display, mf->fds[0]);
+	assert(mf->client);
+
+	mf->feedback = weston_dmabuf_feedback_create(0);
+	assert(mf->feedback);
+	assert(weston_dmabuf_feedback_tranche_create(mf->feedback,
+			m->compositor->dmabuf_feedback_format_table,
+			0, 0, RENDERER_PREF));
+	resource = wl_resource_create(mf->client,
+				      &zwp_linux_dmabuf_feedback_v1_interface,
+				      4, 0);
+	assert(resource);
+	wl_list_insert(&mf->feedback->resource_list,
+		       wl_resource_get_link(resource));
+	surface->dmabuf_feedback = mf->feedback;
+}
+
+static void
+mock_feedback_fini(struct mock_feedback *mf, struct mock_drm *m,
+		   struct weston_surface *surface)
+{
+	surface->dmabuf_feedback = NULL;
+	weston_dmabuf_feedback_destroy(mf->feedback);
+	wl_client_destroy(mf->client);
+	close(mf->fds[1]);
+
+	weston_dmabuf_feedback_format_table_destroy(m->compositor->dmabuf_feedback_format_table);
+	m->compositor->dmabuf_feedback_format_table = NULL;
+}
+
+static struct weston_dmabuf_feedback_tranche *
+mock_feedback_scanout_tranche(struct mock_feedback *mf, struct mock_drm *m)
+{
+	return weston_dmabuf_feedback_find_tranche(mf->feedback,
+			m->b->drm.devnum,
+			ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT,
+			SCANOUT_PREF);
+}
+
+/* As if the feedback had been waiting for the scene to settle long enough */
+static void
+mock_feedback_expire_timer(struct mock_feedback *mf)
+{
+	mf->feedback->timer.tv_sec -= 10;
+}
+
+TEST(mock_kms_dmabuf_feedback_flapping)
+{
+	struct mock_drm m;
+	struct mock_feedback mf;
+	struct weston_dmabuf_feedback_format_table *format_table;
+	struct weston_dmabuf_feedback_tranche *tranche;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct wl_array *indices;
+	uint16_t *index;
+	unsigned int i;
+
+	mock_drm_init(&m, 1);
+
+	/* a format the renderer takes but none of the planes */
+	view = mock_drm_add_view_format(&m, 0, 0, 640, 480, 1,
+					DRM_FORMAT_ABGR8888);
+	surface = view->surface;
+	mock_feedback_init(&mf, &m, surface);
+	format_table = m.compositor->dmabuf_feedback_format_table;
+
+	/* the scanout tranche is only sent once the scene is stable */
+	mock_drm_repaint(&m);
+	tranche = mock_feedback_scanout_tranche(&mf, &m);
+	assert(tranche && !tranche->active);
+	assert(mf.feedback->action_needed == ACTION_NEEDED_ADD_SCANOUT_TRANCHE);
+
+	mock_feedback_expire_timer(&mf);
+	mock_drm_repaint(&m);
+	assert(tranche->active);
+	assert(mf.feedback->action_needed == ACTION_NEEDED_NONE);
+
+	/* it lists what the planes of this output can take */
+	indices = tranche->formats_indices;
+	assert(indices == m.output->scanout_formats_indices);
+	assert(indices->size == 2 * sizeof(*index));
+	wl_array_for_each(index, indices)
+		assert(format_table->data[*index].format != DRM_FORMAT_ABGR8888);
+
+	/* flapping between having to be composited and being a candidate
+	 * for scanout does not resend anything */
+	surface->protection_mode = WESTON_SURFACE_PROTECTION_MODE_ENFORCED;
+	for (i = 0; i < 10; i++) {
+		surface->desired_protection = (i % 2) ?
+			WESTON_HDCP_DISABLE : WESTON_HDCP_ENABLE_TYPE_0;
+		mock_drm_repaint(&m);
+		assert(tranche->active);
+		assert(tranche->formats_indices == indices);
+	}
+
+	/* composited for long enough: the tranche goes away */
+	surface->desired_protection = WESTON_HDCP_ENABLE_TYPE_0;
+	mock_drm_repaint(&m);
+	assert(mf.feedback->action_needed ==
+	       ACTION_NEEDED_REMOVE_SCANOUT_TRANCHE);
+	mock_feedback_expire_timer(&mf);
+	mock_drm_repaint(&m);
+	assert(!tranche->active);
+
+	/* and comes back with the very same indices */
+	surface->desired_protection = WESTON_HDCP_DISABLE;
+	mock_drm_repaint(&m);
+	mock_feedback_expire_timer(&mf);
+	mock_drm_repaint(&m);
+	assert(tranche->active);
+	assert(tranche->formats_indices == indices);
+
+	mock_feedback_fini(&mf, &m, surface);
+	mock_drm_fini(&m);
+}
+
+static double
+mock_drm_time_assign_planes(struct mock_drm *m, int iterations,
+			    bool use_cache, uint64_t *tests)
+{
+	struct drm_backend *b = m->b;
+	struct timespec begin, end;
+	uint64_t test_count = b->atomic_test_count;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < iterations; i++) {
+		if (!use_cache)
+			m->output->plane_cache.valid = false;
+
+		b->repaint_data = drm_pending_state_alloc(b);
+		drm_assign_planes(&m->output->base);
+		drm_pending_state_free(b->repaint_data);
+		b->repaint_data = NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*tests = (b->atomic_test_count - test_count) / iterations;
+
+	return (double) timespec_sub_to_nsec(&end, &begin) / iterations;
+}
+
+/* Not a pass/fail criterion, reports the cost of plane assignment for a
+ * scene with many candidate views in the test log. */
+TEST(mock_kms_assign_planes_benchmark)
+{
+	struct mock_drm m;
+	const int iterations = 50;
+	uint64_t tests;
+	double ns;
+	int i;
+
+	mock_drm_init(&m, 3);
+
+	/* 64 views in a grid, each a plane candidate */
+	for (i = 0; i < 64; i++)
+		mock_drm_add_view(&m, (i % 8) * 240, (i / 8) * 135, 200, 120, 1);
+
+	mock_drm_repaint(&m);
+	assert(mock_drm_count_enabled_overlays(&m) == 3);
+
+	ns = mock_drm_time_assign_planes(&m, iterations, false, &tests);
+	testlog("64 views, 3 overlays: full search %.0f ns, "
+		"%" PRIu64 " TEST_ONLY commits per repaint\n", ns, tests);
+
+	ns = mock_drm_time_assign_planes(&m, iterations, true, &tests);
+	testlog("64 views, 3 overlays: cached %.0f ns, "
+		"%" PRIu64 " TEST_ONLY commits per repaint\n", ns, tests);
+	assert(tests == 1);
+
+	mock_drm_fini(&m);
+}
@@ -0,0 +1,1748 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <gbm.h>
+#include <wayland-util.h>
+#include <libweston/zalloc.h>
+
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/weston-drm-fourcc.h"
+#include "drm-mock-kms.h"
+
+#define MOCK_KMS_MAX_CRTCS 8
+#define MOCK_KMS_MAX_PLANES 32
+#define MOCK_KMS_MAX_CONNECTORS 8
+#define MOCK_KMS_MAX_OBJECT_PROPS 16
+#define MOCK_KMS_MAX_PROPS 64
+#define MOCK_KMS_MAX_FORMATS 64
+#define MOCK_KMS_MAX_MODIFIERS 16
+#define MOCK_KMS_CURSOR_SIZE 64
+
+enum mock_kms_prop {
+	MOCK_PROP_TYPE = 0,
+	MOCK_PROP_SRC_X,
+	MOCK_PROP_SRC_Y,
+	MOCK_PROP_SRC_W,
+	MOCK_PROP_SRC_H,
+	MOCK_PROP_CRTC_X,
+	MOCK_PROP_CRTC_Y,
+	MOCK_PROP_CRTC_W,
+	MOCK_PROP_CRTC_H,
+	MOCK_PROP_FB_ID,
+	MOCK_PROP_CRTC_ID,
+	MOCK_PROP_IN_FORMATS,
+	MOCK_PROP_IN_FENCE_FD,
+	MOCK_PROP_MODE_ID,
+	MOCK_PROP_ACTIVE,
+	MOCK_PROP__SHARED_COUNT,
+};
+
+struct mock_property {
+	uint32_t id;
+	const char *name;
+	uint32_t flags;
+	uint64_t range[2];
+};
+
+struct mock_object {
+	uint32_t id;
+	uint32_t type; /**< DRM_MODE_OBJECT_* */
+	unsigned int count_props;
+	uint32_t prop_ids[MOCK_KMS_MAX_OBJECT_PROPS];
+	uint64_t values[MOCK_KMS_MAX_OBJECT_PROPS];
+	/* values of the atomic commit being checked */
+	uint64_t staged[MOCK_KMS_MAX_OBJECT_PROPS];
+};
+
+struct mock_crtc {
+	struct mock_object obj;
+	int pipe;
+	unsigned int sequence;
+	bool flip_pending;
+};
+
+struct mock_plane {
+	struct mock_object obj;
+	enum mock_kms_plane_type type;
+	uint32_t possible_crtcs;
+	uint32_t formats[MOCK_KMS_MAX_FORMATS];
+	unsigned int count_formats;
+	uint64_t modifiers[MOCK_KMS_MAX_MODIFIERS];
+	unsigned int count_modifiers;
+};
+
+struct mock_connector {
+	struct mock_object obj;
+	uint32_t encoder_id;
+	uint32_t possible_crtcs;
+	drmModeModeInfo mode;
+};
+
+struct mock_fb {
+	uint32_t id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint64_t modifier;
+};
+
+struct mock_blob {
+	uint32_t id;
+	uint32_t size;
+	void *data;
+};
+
+struct mock_dumb {
+	uint32_t handle;
+	uint64_t size;
+	uint64_t offset;
+};
+
+struct mock_flip {
+	uint32_t crtc_id;
+	void *user_data;
+};
+
+struct mock_kms {
+	int fd;
+	uint32_t next_id;
+	uint32_t next_handle;
+	uint64_t dumb_end;
+
+	struct mock_property props[MOCK_KMS_MAX_PROPS];
+	unsigned int count_props;
+
+	struct mock_crtc crtcs[MOCK_KMS_MAX_CRTCS];
+	unsigned int count_crtcs;
+	struct mock_plane planes[MOCK_KMS_MAX_PLANES];
+	unsigned int count_planes;
+	struct mock_connector connectors[MOCK_KMS_MAX_CONNECTORS];
+	unsigned int count_connectors;
+
+	struct wl_array fbs; /**< struct mock_fb */
+	struct wl_array blobs; /**< struct mock_blob */
+	struct wl_array dumbs; /**< struct mock_dumb */
+	struct wl_array flips; /**< struct mock_flip */
+
+	struct mock_kms_rules rules;
+	struct mock_kms_stats stats;
+	bool checking;
+};
+
+struct _drmModeAtomicReq {
+	struct wl_array items; /**< struct mock_atomic_item */
+};
+
+struct mock_atomic_item {
+	uint32_t obj_id;
+	uint32_t prop_id;
+	uint64_t value;
+};
+
+struct gbm_bo {
+	struct gbm_device *gbm;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint64_t modifier;
+	int num_planes;
+	uint32_t handles[4];
+	uint32_t strides[4];
+	uint32_t offsets[4];
+	void *user_data;
+	void (*destroy_user_data)(struct gbm_bo *, void *);
+};
+
+/* libdrm calls only carry a file descriptor, so there is one device. */
+static struct mock_kms *mock_kms_device;
+
+static const char * const shared_prop_names[] = {
+	[MOCK_PROP_TYPE] = "type",
+	[MOCK_PROP_SRC_X] = "SRC_X",
+	[MOCK_PROP_SRC_Y] = "SRC_Y",
+	[MOCK_PROP_SRC_W] = "SRC_W",
+	[MOCK_PROP_SRC_H] = "SRC_H",
+	[MOCK_PROP_CRTC_X] = "CRTC_X",
+	[MOCK_PROP_CRTC_Y] = "CRTC_Y",
+	[MOCK_PROP_CRTC_W] = "CRTC_W",
+	[MOCK_PROP_CRTC_H] = "CRTC_H",
+	[MOCK_PROP_FB_ID] = "FB_ID",
+	[MOCK_PROP_CRTC_ID] = "CRTC_ID",
+	[MOCK_PROP_IN_FORMATS] = "IN_FORMATS",
+	[MOCK_PROP_IN_FENCE_FD] = "IN_FENCE_FD",
+	[MOCK_PROP_MODE_ID] = "MODE_ID",
+	[MOCK_PROP_ACTIVE] = "ACTIVE",
+};
+
+static const struct drm_mode_property_enum plane_type_enums[] = {
+	{ .value = MOCK_KMS_PLANE_OVERLAY, .name = "Overlay" },
+	{ .value = MOCK_KMS_PLANE_PRIMARY, .name = "Primary" },
+	{ .value = MOCK_KMS_PLANE_CURSOR, .name = "Cursor" },
+};
+
+static struct mock_kms *
+mock_kms_from_fd(int fd)
+{
+	assert(mock_kms_device);
+	assert(fd == mock_kms_device->fd);
+
+	return mock_kms_device;
+}
+
+static int
+mock_kms_fail(int err)
+{
+	errno = err;
+	return -err;
+}
+
+static struct mock_property *
+mock_kms_add_property(struct mock_kms *kms, const char *name, uint32_t flags,
+		      uint64_t min, uint64_t max)
+{
+	struct mock_property *prop;
+
+	assert(kms->count_props < ARRAY_LENGTH(kms->props));
+	prop = &kms->props[kms->count_props++];
+	prop->id = kms->next_id++;
+	prop->name = name;
+	prop->flags = flags;
+	prop->range[0] = min;
+	prop->range[1] = max;
+
+	return prop;
+}
+
+static struct mock_property *
+mock_kms_find_property(struct mock_kms *kms, uint32_t prop_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < kms->count_props; i++) {
+		if (kms->props[i].id == prop_id)
+			return &kms->props[i];
+	}
+
+	return NULL;
+}
+
+static void
+mock_object_attach_property(struct mock_object *obj, uint32_t prop_id,
+			    uint64_t value)
+{
+	assert(obj->count_props < ARRAY_LENGTH(obj->prop_ids));
+	obj->prop_ids[obj->count_props] = prop_id;
+	obj->values[obj->count_props] = value;
+	obj->count_props++;
+}
+
+static int
+mock_object_find_property(const struct mock_object *obj, uint32_t prop_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < obj->count_props; i++) {
+		if (obj->prop_ids[i] == prop_id)
+			return i;
+	}
+
+	return -1;
+}
+
+static bool
+mock_object_get_named(struct mock_kms *kms, const struct mock_object *obj,
+		      const char *name, bool staged, uint64_t *value)
+{
+	unsigned int i;
+
+	for (i = 0; i < obj->count_props; i++) {
+		struct mock_property *prop;
+
+		prop = mock_kms_find_property(kms, obj->prop_ids[i]);
+		if (strcmp(prop->name, name) != 0)
+			continue;
+
+		*value = staged ? obj->staged[i] : obj->values[i];
+		return true;
+	}
+
+	return false;
+}
+
+static uint64_t
+mock_object_staged(struct mock_kms *kms, const struct mock_object *obj,
+		   enum mock_kms_prop p)
+{
+	uint64_t value = 0;
+
+	mock_object_get_named(kms, obj, shared_prop_names[p], true, &value);
+
+	return value;
+}
+
+static struct mock_object *
+mock_kms_find_object(struct mock_kms *kms, uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < kms->count_crtcs; i++) {
+		if (kms->crtcs[i].obj.id == id)
+			return &kms->crtcs[i].obj;
+	}
+	for (i = 0; i < kms->count_planes; i++) {
+		if (kms->planes[i].obj.id == id)
+			return &kms->planes[i].obj;
+	}
+	for (i = 0; i < kms->count_connectors; i++) {
+		if (kms->connectors[i].obj.id == id)
+			return &kms->connectors[i].obj;
+	}
+
+	return NULL;
+}
+
+static struct mock_crtc *
+mock_kms_find_crtc(struct mock_kms *kms, uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < kms->count_crtcs; i++) {
+		if (kms->crtcs[i].obj.id == id)
+			return &kms->crtcs[i];
+	}
+
+	return NULL;
+}
+
+static struct mock_fb *
+mock_kms_find_fb(struct mock_kms *kms, uint32_t id)
+{
+	struct mock_fb *fb;
+
+	wl_array_for_each(fb, &kms->fbs) {
+		if (fb->id == id)
+			return fb;
+	}
+
+	return NULL;
+}
+
+static struct mock_blob *
+mock_kms_find_blob(struct mock_kms *kms, uint32_t id)
+{
+	struct mock_blob *blob;
+
+	wl_array_for_each(blob, &kms->blobs) {
+		if (blob->id == id)
+			return blob;
+	}
+
+	return NULL;
+}
+
+static uint32_t
+mock_kms_create_blob(struct mock_kms *kms, const void *data, size_t size)
+{
+	struct mock_blob *blob;
+
+	blob = wl_array_add(&kms->blobs, sizeof(*blob));
+	assert(blob);
+	blob->id = kms->next_id++;
+	blob->size = size;
+	blob->data = malloc(size);
+	assert(blob->data);
+	memcpy(blob->data, data, size);
+
+	return blob->id;
+}
+
+struct mock_kms *
+mock_kms_create(void)
+{
+	struct mock_kms *kms;
+	unsigned int i;
+
+	assert(!mock_kms_device);
+
+	kms = zalloc(sizeof(*kms));
+	assert(kms);
+
+	/* A real file, so dumb buffers can be mapped from it. */
+	kms->fd = os_create_anonymous_file(0);
+	assert(kms->fd >= 0);
+
+	kms->next_id = 1;
+	kms->next_handle = 1;
+	wl_array_init(&kms->fbs);
+	wl_array_init(&kms->blobs);
+	wl_array_init(&kms->dumbs);
+	wl_array_init(&kms->flips);
+
+	for (i = 0; i < MOCK_PROP__SHARED_COUNT; i++) {
+		uint32_t flags = DRM_MODE_PROP_RANGE;
+		uint64_t max = UINT32_MAX;
+
+		switch (i) {
+		case MOCK_PROP_TYPE:
+			flags = DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE;
+			break;
+		case MOCK_PROP_IN_FORMATS:
+			flags = DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE;
+			break;
+		case MOCK_PROP_MODE_ID:
+			flags = DRM_MODE_PROP_BLOB;
+			break;
+		case MOCK_PROP_FB_ID:
+		case MOCK_PROP_CRTC_ID:
+			flags = DRM_MODE_PROP_OBJECT;
+			break;
+		case MOCK_PROP_IN_FENCE_FD:
+			flags = DRM_MODE_PROP_SIGNED_RANGE;
+			break;
+		case MOCK_PROP_ACTIVE:
+			max = 1;
+			break;
+		}
+
+		mock_kms_add_property(kms, shared_prop_names[i], flags, 0, max);
+	}
+
+	mock_kms_device = kms;
+
+	return kms;
+}
+
+void
+mock_kms_destroy(struct mock_kms *kms)
+{
+	struct mock_blob *blob;
+
+	assert(kms == mock_kms_device);
+
+	wl_array_for_each(blob, &kms->blobs)
+		free(blob->data);
+	wl_array_release(&kms->blobs);
+	wl_array_release(&kms->fbs);
+	wl_array_release(&kms->dumbs);
+	wl_array_release(&kms->flips);
+	close(kms->fd);
+	free(kms);
+
+	mock_kms_device = NULL;
+}
+
+int
+mock_kms_get_fd(struct mock_kms *kms)
+{
+	return kms->fd;
+}
+
+uint32_t
+mock_kms_add_crtc(struct mock_kms *kms)
+{
+	struct mock_crtc *crtc;
+
+	assert(kms->count_crtcs < ARRAY_LENGTH(kms->crtcs));
+	crtc = &kms->crtcs[kms->count_crtcs];
+	crtc->pipe = kms->count_crtcs++;
+	crtc->obj.id = kms->next_id++;
+	crtc->obj.type = DRM_MODE_OBJECT_CRTC;
+
+	mock_object_attach_property(&crtc->obj,
+				    kms->props[MOCK_PROP_MODE_ID].id, 0);
+	mock_object_attach_property(&crtc->obj,
+				    kms->props[MOCK_PROP_ACTIVE].id, 0);
+
+	return crtc->obj.id;
+}
+
+/* The IN_FORMATS blob pairs every modifier with all formats. */
+static uint32_t
+mock_kms_create_in_formats(struct mock_kms *kms, struct mock_plane *plane)
+{
+	struct drm_format_modifier_blob *header;
+	struct drm_format_modifier *mods;
+	uint32_t id;
+	size_t size;
+	unsigned int i;
+	char *data;
+
+	size = sizeof(*header) +
+	       plane->count_formats * sizeof(uint32_t) +
+	       plane->count_modifiers * sizeof(*mods);
+	size = (size + 7) & ~(size_t) 7;
+	data = zalloc(size + 8);
+	assert(data);
+
+	header = (struct drm_format_modifier_blob *) data;
+	header->version = FORMAT_BLOB_CURRENT;
+	header->count_formats = plane->count_formats;
+	header->formats_offset = sizeof(*header);
+	header->count_modifiers = plane->count_modifiers;
+	header->modifiers_offset =
+		(header->formats_offset +
+		 plane->count_formats * sizeof(uint32_t) + 7) & ~7u;
+	memcpy(data + header->formats_offset, plane->formats,
+	       plane->count_formats * sizeof(uint32_t));
+
+	mods = (struct drm_format_modifier *) (data + header->modifiers_offset);
+	for (i = 0; i < plane->count_modifiers; i++) {
+		mods[i].formats = plane->count_formats >= 64 ? UINT64_MAX :
+				  (1ull << plane->count_formats) - 1;
+		mods[i].offset = 0;
+		mods[i].modifier = plane->modifiers[i];
+	}
+
+	id = mock_kms_create_blob(kms, data, header->modifiers_offset +
+				  plane->count_modifiers * sizeof(*mods));
+	free(data);
+
+	return id;
+}
+
+uint32_t
+mock_kms_add_plane(struct mock_kms *kms, enum mock_kms_plane_type type,
+		   uint32_t possible_crtcs, uint64_t zpos_min, uint64_t zpos_max,
+		   const uint32_t *formats, unsigned int count_formats,
+		   const uint64_t *modifiers, unsigned int count_modifiers)
+{
+	struct mock_plane *plane;
+	struct mock_property *zpos;
+	unsigned int i;
+
+	assert(kms->count_planes < ARRAY_LENGTH(kms->planes));
+	assert(count_formats <= MOCK_KMS_MAX_FORMATS);
+	assert(count_modifiers <= MOCK_KMS_MAX_MODIFIERS);
+
+	plane = &kms->planes[kms->count_planes++];
+	plane->obj.id = kms->next_id++;
+	plane->obj.type = DRM_MODE_OBJECT_PLANE;
+	plane->type = type;
+	plane->possible_crtcs = possible_crtcs;
+	memcpy(plane->formats, formats, count_formats * sizeof(*formats));
+	plane->count_formats = count_formats;
+	memcpy(plane->modifiers, modifiers,
+	       count_modifiers * sizeof(*modifiers));
+	plane->count_modifiers = count_modifiers;
+
+	mock_object_attach_property(&plane->obj,
+				    kms->props[MOCK_PROP_TYPE].id, type);
+	for (i = MOCK_PROP_SRC_X; i <= MOCK_PROP_CRTC_ID; i++)
+		mock_object_attach_property(&plane->obj, kms->props[i].id, 0);
+	mock_object_attach_property(&plane->obj,
+				    kms->props[MOCK_PROP_IN_FENCE_FD].id,
+				    (uint64_t) -1);
+	if (count_modifiers > 0) {
+		mock_object_attach_property(&plane->obj,
+					    kms->props[MOCK_PROP_IN_FORMATS].id,
+					    mock_kms_create_in_formats(kms, plane));
+	}
+
+	/* Like the kernel, every plane has its own zpos property. */
+	zpos = mock_kms_add_property(kms, "zpos", DRM_MODE_PROP_RANGE,
+				     zpos_min, zpos_max);
+	if (zpos_min == zpos_max)
+		zpos->flags |= DRM_MODE_PROP_IMMUTABLE;
+	mock_object_attach_property(&plane->obj, zpos->id, zpos_min);
+
+	return plane->obj.id;
+}
+
+uint32_t
+mock_kms_add_connector(struct mock_kms *kms, uint32_t possible_crtcs,
+		       int width, int height, int refresh_hz)
+{
+	struct mock_connector *connector;
+	drmModeModeInfo *mode;
+
+	assert(kms->count_connectors < ARRAY_LENGTH(kms->connectors));
+	connector = &kms->connectors[kms->count_connectors++];
+	connector->obj.id = kms->next_id++;
+	connector->obj.type = DRM_MODE_OBJECT_CONNECTOR;
+	connector->encoder_id = kms->next_id++;
+	connector->possible_crtcs = possible_crtcs;
+
+	mode = &connector->mode;
+	mode->hdisplay = width;
+	mode->hsync_start = width + 48;
+	mode->hsync_end = width + 80;
+	mode->htotal = width + 160;
+	mode->vdisplay = height;
+	mode->vsync_start = height + 3;
+	mode->vsync_end = height + 8;
+	mode->vtotal = height + 30;
+	mode->vrefresh = refresh_hz;
+	mode->clock = (uint64_t) mode->htotal * mode->vtotal * refresh_hz / 1000;
+	mode->type = DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+	snprintf(mode->name, sizeof(mode->name), "%dx%d", width, height);
+
+	mock_object_attach_property(&connector->obj,
+				    kms->props[MOCK_PROP_CRTC_ID].id, 0);
+
+	return connector->obj.id;
+}
+
+void
+mock_kms_set_rules(struct mock_kms *kms, const struct mock_kms_rules *rules)
+{
+	kms->rules = *rules;
+}
+
+const struct mock_kms_stats *
+mock_kms_get_stats(struct mock_kms *kms)
+{
+	return &kms->stats;
+}
+
+void
+mock_kms_reset_stats(struct mock_kms *kms)
+{
+	memset(&kms->stats, 0, sizeof(kms->stats));
+}
+
+bool
+mock_kms_get_property(struct mock_kms *kms, uint32_t obj_id,
+		      const char *name, uint64_t *value)
+{
+	struct mock_object *obj = mock_kms_find_object(kms, obj_id);
+
+	return obj && mock_object_get_named(kms, obj, name, false, value);
+}
+
+bool
+mock_kms_get_pending_property(struct mock_kms *kms, uint32_t obj_id,
+			      const char *name, uint64_t *value)
+{
+	struct mock_object *obj = mock_kms_find_object(kms, obj_id);
+
+	assert(kms->checking);
+
+	return obj && mock_object_get_named(kms, obj, name, true, value);
+}
+
+unsigned int
+mock_kms_count_pending_flips(struct mock_kms *kms)
+{
+	return kms->flips.size / sizeof(struct mock_flip);
+}
+
+static bool
+mock_plane_supports(const struct mock_plane *plane, const struct mock_fb *fb)
+{
+	unsigned int i;
+	bool found = false;
+
+	for (i = 0; i < plane->count_formats; i++) {
+		if (plane->formats[i] == fb->format)
+			found = true;
+	}
+	if (!found)
+		return false;
+
+	/* Without IN_FORMATS, only implicit modifiers work. */
+	if (plane->count_modifiers == 0)
+		return fb->modifier == DRM_FORMAT_MOD_INVALID;
+
+	if (fb->modifier == DRM_FORMAT_MOD_INVALID)
+		return true;
+
+	for (i = 0; i < plane->count_modifiers; i++) {
+		if (plane->modifiers[i] == fb->modifier)
+			return true;
+	}
+
+	return false;
+}
+
+struct mock_rect {
+	int64_t x1, y1, x2, y2;
+};
+
+static bool
+mock_rect_overlap(const struct mock_rect *a, const struct mock_rect *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/** Check the staged state of one CRTC and the planes on it */
+static int
+mock_kms_check_crtc(struct mock_kms *kms, struct mock_crtc *crtc)
+{
+	const struct mock_kms_rules *rules = &kms->rules;
+	struct mock_rect overlays[MOCK_KMS_MAX_PLANES];
+	uint64_t zpos[MOCK_KMS_MAX_PLANES];
+	unsigned int n_overlays = 0;
+	unsigned int n_active = 0;
+	bool active;
+	bool primary_on = false;
+	unsigned int i, j;
+
+	active = mock_object_staged(kms, &crtc->obj, MOCK_PROP_ACTIVE);
+	if (active &&
+	    !mock_kms_find_blob(kms, mock_object_staged(kms, &crtc->obj,
+							MOCK_PROP_MODE_ID)))
+		return -EINVAL;
+
+	for (i = 0; i < kms->count_planes; i++) {
+		struct mock_plane *plane = &kms->planes[i];
+		struct mock_fb *fb;
+		struct mock_rect dst;
+		uint64_t src_w, src_h;
+
+		if (mock_object_staged(kms, &plane->obj, MOCK_PROP_CRTC_ID) !=
+		    crtc->obj.id)
+			continue;
+
+		if (!active)
+			return -EINVAL;
+		if (!(plane->possible_crtcs & (1u << crtc->pipe)))
+			return -EINVAL;
+
+		fb = mock_kms_find_fb(kms, mock_object_staged(kms, &plane->obj,
+							      MOCK_PROP_FB_ID));
+		if (!fb || !mock_plane_supports(plane, fb))
+			return -EINVAL;
+
+		src_w = mock_object_staged(kms, &plane->obj, MOCK_PROP_SRC_W);
+		src_h = mock_object_staged(kms, &plane->obj, MOCK_PROP_SRC_H);
+		if (mock_object_staged(kms, &plane->obj, MOCK_PROP_SRC_X) +
+		    src_w > (uint64_t) fb->width << 16 ||
+		    mock_object_staged(kms, &plane->obj, MOCK_PROP_SRC_Y) +
+		    src_h > (uint64_t) fb->height << 16)
+			return -ENOSPC;
+
+		dst.x1 = (int32_t) mock_object_staged(kms, &plane->obj,
+						      MOCK_PROP_CRTC_X);
+		dst.y1 = (int32_t) mock_object_staged(kms, &plane->obj,
+						      MOCK_PROP_CRTC_Y);
+		dst.x2 = dst.x1 + mock_object_staged(kms, &plane->obj,
+						     MOCK_PROP_CRTC_W);
+		dst.y2 = dst.y1 + mock_object_staged(kms, &plane->obj,
+						     MOCK_PROP_CRTC_H);
+
+		if (plane->type == MOCK_KMS_PLANE_CURSOR &&
+		    (dst.x2 - dst.x1 > MOCK_KMS_CURSOR_SIZE ||
+		     dst.y2 - dst.y1 > MOCK_KMS_CURSOR_SIZE))
+			return -EINVAL;
+
+		if (rules->reject_plane_id == plane->obj.id)
+			return -EINVAL;
+
+		if (rules->reject_scaling &&
+		    ((src_w >> 16) != (uint64_t) (dst.x2 - dst.x1) ||
+		     (src_h >> 16) != (uint64_t) (dst.y2 - dst.y1)))
+			return -ERANGE;
+
+		if (plane->type == MOCK_KMS_PLANE_PRIMARY)
+			primary_on = true;
+
+		if (plane->type == MOCK_KMS_PLANE_OVERLAY) {
+			if (rules->reject_overlay_overlap) {
+				for (j = 0; j < n_overlays; j++) {
+					if (mock_rect_overlap(&overlays[j],
+							      &dst))
+						return -EINVAL;
+				}
+			}
+			overlays[n_overlays++] = dst;
+		}
+
+		if (rules->reject_duplicate_zpos) {
+			uint64_t z = 0;
+
+			mock_object_get_named(kms, &plane->obj, "zpos", true,
+					      &z);
+			for (j = 0; j < n_active; j++) {
+				if (zpos[j] == z)
+					return -EINVAL;
+			}
+			zpos[n_active] = z;
+		}
+
+		n_active++;
+		if (rules->max_active_planes > 0 &&
+		    n_active > rules->max_active_planes)
+			return -ENOSPC;
+	}
+
+	/* Most drivers cannot light up a CRTC without its primary plane. */
+	if (active && !primary_on)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int
+mock_kms_check_state(struct mock_kms *kms, uint32_t flags)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < kms->count_planes; i++) {
+		struct mock_object *obj = &kms->planes[i].obj;
+
+		/* FB_ID and CRTC_ID go together. */
+		if (!mock_object_staged(kms, obj, MOCK_PROP_FB_ID) !=
+		    !mock_object_staged(kms, obj, MOCK_PROP_CRTC_ID))
+			return -EINVAL;
+	}
+
+	for (i = 0; i < kms->count_connectors; i++) {
+		uint64_t crtc_id;
+
+		crtc_id = mock_object_staged(kms, &kms->connectors[i].obj,
+					     MOCK_PROP_CRTC_ID);
+		if (crtc_id && !mock_kms_find_crtc(kms, crtc_id))
+			return -EINVAL;
+	}
+
+	for (i = 0; i < kms->count_crtcs; i++) {
+		ret = mock_kms_check_crtc(kms, &kms->crtcs[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (kms->rules.check &&
+	    !kms->rules.check(kms, flags, kms->rules.check_data))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void
+mock_kms_for_each_object(struct mock_kms *kms,
+			 void (*func)(struct mock_object *obj))
+{
+	unsigned int i;
+
+	for (i = 0; i < kms->count_crtcs; i++)
+		func(&kms->crtcs[i].obj);
+	for (i = 0; i < kms->count_planes; i++)
+		func(&kms->planes[i].obj);
+	for (i = 0; i < kms->count_connectors; i++)
+		func(&kms->connectors[i].obj);
+}
+
+static void
+mock_object_stage(struct mock_object *obj)
+{
+	memcpy(obj->staged, obj->values, sizeof(obj->values));
+}
+
+static void
+mock_object_apply(struct mock_object *obj)
+{
+	memcpy(obj->values, obj->staged, sizeof(obj->values));
+}
+
+static bool
+mock_kms_is_modeset_prop(struct mock_kms *kms, uint32_t prop_id,
+			 const struct mock_object *obj)
+{
+	return prop_id == kms->props[MOCK_PROP_MODE_ID].id ||
+	       prop_id == kms->props[MOCK_PROP_ACTIVE].id ||
+	       (obj->type == DRM_MODE_OBJECT_CONNECTOR &&
+		prop_id == kms->props[MOCK_PROP_CRTC_ID].id);
+}
+
+/** Whether the request touches the CRTC or anything routed to it */
+static bool
+mock_kms_req_touches_crtc(struct mock_kms *kms, drmModeAtomicReqPtr req,
+			  struct mock_crtc *crtc)
+{
+	struct mock_atomic_item *item;
+
+	wl_array_for_each(item, &req->items) {
+		struct mock_object *obj;
+
+		if (item->obj_id == crtc->obj.id)
+			return true;
+
+		obj = mock_kms_find_object(kms, item->obj_id);
+		if (obj->type != DRM_MODE_OBJECT_CRTC &&
+		    mock_object_staged(kms, obj, MOCK_PROP_CRTC_ID) ==
+		    crtc->obj.id)
+			return true;
+	}
+
+	return false;
+}
+
+/* libdrm */
+
+int
+drmGetCap(int fd, uint64_t capability, uint64_t *value)
+{
+	mock_kms_from_fd(fd);
+
+	switch (capability) {
+	case DRM_CAP_CURSOR_WIDTH:
+	case DRM_CAP_CURSOR_HEIGHT:
+		*value = MOCK_KMS_CURSOR_SIZE;
+		return 0;
+	case DRM_CAP_TIMESTAMP_MONOTONIC:
+	case DRM_CAP_ADDFB2_MODIFIERS:
+	case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+		*value = 1;
+		return 0;
+	default:
+		return mock_kms_fail(EINVAL);
+	}
+}
+
+int
+drmSetClientCap(int fd, uint64_t capability, uint64_t value)
+{
+	mock_kms_from_fd(fd);
+
+	switch (capability) {
+	case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+	case DRM_CLIENT_CAP_ATOMIC:
+	case DRM_CLIENT_CAP_ASPECT_RATIO:
+		return 0;
+	default:
+		return mock_kms_fail(EINVAL);
+	}
+}
+
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_dumb *dumb;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_CREATE_DUMB: {
+		struct drm_mode_create_dumb *create = arg;
+		long page = sysconf(_SC_PAGESIZE);
+
+		dumb = wl_array_add(&kms->dumbs, sizeof(*dumb));
+		if (!dumb)
+			return mock_kms_fail(ENOMEM);
+		create->pitch = ((create->width * create->bpp / 8) + 63) & ~63u;
+		create->size = (uint64_t) create->pitch * create->height;
+		create->handle = kms->next_handle++;
+		dumb->handle = create->handle;
+		dumb->size = (create->size + page - 1) & ~(uint64_t) (page - 1);
+		dumb->offset = kms->dumb_end;
+		kms->dumb_end += dumb->size;
+		if (ftruncate(kms->fd, kms->dumb_end) < 0)
+			return -1;
+		return 0;
+	}
+	case DRM_IOCTL_MODE_MAP_DUMB: {
+		struct drm_mode_map_dumb *map = arg;
+
+		wl_array_for_each(dumb, &kms->dumbs) {
+			if (dumb->handle == map->handle) {
+				map->offset = dumb->offset;
+				return 0;
+			}
+		}
+		return mock_kms_fail(ENOENT);
+	}
+	case DRM_IOCTL_MODE_DESTROY_DUMB:
+	case DRM_IOCTL_GEM_CLOSE:
+		/* The backing storage is only released with the device. */
+		return 0;
+	default:
+		return mock_kms_fail(ENOTTY);
+	}
+}
+
+int
+drmHandleEvent(int fd, drmEventContextPtr evctx)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct wl_array flips;
+	struct mock_flip *flip;
+	struct timespec now;
+
+	/* Handlers may commit again, which queues new events. */
+	flips = kms->flips;
+	wl_array_init(&kms->flips);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	wl_array_for_each(flip, &flips) {
+		struct mock_crtc *crtc = mock_kms_find_crtc(kms, flip->crtc_id);
+
+		crtc->flip_pending = false;
+		crtc->sequence++;
+		kms->stats.flip_events++;
+		evctx->page_flip_handler2(fd, crtc->sequence, now.tv_sec,
+					  now.tv_nsec / 1000, flip->crtc_id,
+					  flip->user_data);
+	}
+	wl_array_release(&flips);
+
+	return 0;
+}
+
+drmModeResPtr
+drmModeGetResources(int fd)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	drmModeResPtr res;
+	unsigned int i;
+
+	res = zalloc(sizeof(*res));
+	res->count_crtcs = kms->count_crtcs;
+	res->crtcs = calloc(kms->count_crtcs + 1, sizeof(uint32_t));
+	for (i = 0; i < kms->count_crtcs; i++)
+		res->crtcs[i] = kms->crtcs[i].obj.id;
+
+	res->count_connectors = kms->count_connectors;
+	res->connectors = calloc(kms->count_connectors + 1, sizeof(uint32_t));
+	res->count_encoders = kms->count_connectors;
+	res->encoders = calloc(kms->count_connectors + 1, sizeof(uint32_t));
+	for (i = 0; i < kms->count_connectors; i++) {
+		res->connectors[i] = kms->connectors[i].obj.id;
+		res->encoders[i] = kms->connectors[i].encoder_id;
+	}
+
+	res->min_width = 1;
+	res->min_height = 1;
+	res->max_width = 16384;
+	res->max_height = 16384;
+
+	return res;
+}
+
+void
+drmModeFreeResources(drmModeResPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->crtcs);
+	free(ptr->connectors);
+	free(ptr->encoders);
+	free(ptr);
+}
+
+drmModePlaneResPtr
+drmModeGetPlaneResources(int fd)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	drmModePlaneResPtr res;
+	unsigned int i;
+
+	res = zalloc(sizeof(*res));
+	res->count_planes = kms->count_planes;
+	res->planes = calloc(kms->count_planes + 1, sizeof(uint32_t));
+	for (i = 0; i < kms->count_planes; i++)
+		res->planes[i] = kms->planes[i].obj.id;
+
+	return res;
+}
+
+void
+drmModeFreePlaneResources(drmModePlaneResPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->planes);
+	free(ptr);
+}
+
+drmModePlanePtr
+drmModeGetPlane(int fd, uint32_t plane_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_plane *plane = NULL;
+	drmModePlanePtr kplane;
+	unsigned int i;
+
+	for (i = 0; i < kms->count_planes; i++) {
+		if (kms->planes[i].obj.id == plane_id)
+			plane = &kms->planes[i];
+	}
+	if (!plane) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	kplane = zalloc(sizeof(*kplane));
+	kplane->plane_id = plane_id;
+	kplane->possible_crtcs = plane->possible_crtcs;
+	kplane->crtc_id = plane->obj.values[mock_object_find_property(
+		&plane->obj, kms->props[MOCK_PROP_CRTC_ID].id)];
+	kplane->fb_id = plane->obj.values[mock_object_find_property(
+		&plane->obj, kms->props[MOCK_PROP_FB_ID].id)];
+	kplane->count_formats = plane->count_formats;
+	kplane->formats = calloc(plane->count_formats + 1, sizeof(uint32_t));
+	memcpy(kplane->formats, plane->formats,
+	       plane->count_formats * sizeof(uint32_t));
+
+	return kplane;
+}
+
+void
+drmModeFreePlane(drmModePlanePtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->formats);
+	free(ptr);
+}
+
+drmModeConnectorPtr
+drmModeGetConnector(int fd, uint32_t connector_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_connector *connector = NULL;
+	drmModeConnectorPtr kconn;
+	unsigned int i;
+
+	for (i = 0; i < kms->count_connectors; i++) {
+		if (kms->connectors[i].obj.id == connector_id)
+			connector = &kms->connectors[i];
+	}
+	if (!connector) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	kconn = zalloc(sizeof(*kconn));
+	kconn->connector_id = connector_id;
+	kconn->connector_type = DRM_MODE_CONNECTOR_VIRTUAL;
+	kconn->connector_type_id = i;
+	kconn->connection = DRM_MODE_CONNECTED;
+	kconn->mmWidth = connector->mode.hdisplay / 4;
+	kconn->mmHeight = connector->mode.vdisplay / 4;
+	kconn->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+	kconn->count_modes = 1;
+	kconn->modes = zalloc(sizeof(*kconn->modes));
+	kconn->modes[0] = connector->mode;
+	kconn->encoder_id = connector->encoder_id;
+	kconn->count_encoders = 1;
+	kconn->encoders = zalloc(sizeof(uint32_t));
+	kconn->encoders[0] = connector->encoder_id;
+	kconn->count_props = connector->obj.count_props;
+	kconn->props = calloc(connector->obj.count_props, sizeof(uint32_t));
+	kconn->prop_values = calloc(connector->obj.count_props,
+				    sizeof(uint64_t));
+	memcpy(kconn->props, connector->obj.prop_ids,
+	       connector->obj.count_props * sizeof(uint32_t));
+	memcpy(kconn->prop_values, connector->obj.values,
+	       connector->obj.count_props * sizeof(uint64_t));
+
+	return kconn;
+}
+
+void
+drmModeFreeConnector(drmModeConnectorPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->modes);
+	free(ptr->encoders);
+	free(ptr->props);
+	free(ptr->prop_values);
+	free(ptr);
+}
+
+drmModeEncoderPtr
+drmModeGetEncoder(int fd, uint32_t encoder_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	drmModeEncoderPtr encoder;
+	unsigned int i;
+
+	for (i = 0; i < kms->count_connectors; i++) {
+		if (kms->connectors[i].encoder_id != encoder_id)
+			continue;
+
+		encoder = zalloc(sizeof(*encoder));
+		encoder->encoder_id = encoder_id;
+		encoder->possible_crtcs = kms->connectors[i].possible_crtcs;
+		return encoder;
+	}
+
+	errno = ENOENT;
+	return NULL;
+}
+
+void
+drmModeFreeEncoder(drmModeEncoderPtr ptr)
+{
+	free(ptr);
+}
+
+drmModeObjectPropertiesPtr
+drmModeObjectGetProperties(int fd, uint32_t object_id, uint32_t object_type)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_object *obj = mock_kms_find_object(kms, object_id);
+	drmModeObjectPropertiesPtr props;
+
+	if (!obj || obj->type != object_type) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	props = zalloc(sizeof(*props));
+	props->count_props = obj->count_props;
+	props->props = calloc(obj->count_props, sizeof(uint32_t));
+	props->prop_values = calloc(obj->count_props, sizeof(uint64_t));
+	memcpy(props->props, obj->prop_ids,
+	       obj->count_props * sizeof(uint32_t));
+	memcpy(props->prop_values, obj->values,
+	       obj->count_props * sizeof(uint64_t));
+
+	return props;
+}
+
+void
+drmModeFreeObjectProperties(drmModeObjectPropertiesPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->props);
+	free(ptr->prop_values);
+	free(ptr);
+}
+
+drmModePropertyPtr
+drmModeGetProperty(int fd, uint32_t property_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_property *prop = mock_kms_find_property(kms, property_id);
+	drmModePropertyPtr kprop;
+
+	if (!prop) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	kprop = zalloc(sizeof(*kprop));
+	kprop->prop_id = prop->id;
+	kprop->flags = prop->flags;
+	snprintf(kprop->name, sizeof(kprop->name), "%s", prop->name);
+
+	if (prop->flags & (DRM_MODE_PROP_RANGE | DRM_MODE_PROP_SIGNED_RANGE)) {
+		kprop->count_values = 2;
+		kprop->values = calloc(2, sizeof(uint64_t));
+		kprop->values[0] = prop->range[0];
+		kprop->values[1] = prop->range[1];
+	}
+
+	if (prop->flags & DRM_MODE_PROP_ENUM) {
+		kprop->count_enums = ARRAY_LENGTH(plane_type_enums);
+		kprop->enums = calloc(kprop->count_enums,
+				      sizeof(*kprop->enums));
+		memcpy(kprop->enums, plane_type_enums,
+		       sizeof(plane_type_enums));
+	}
+
+	return kprop;
+}
+
+void
+drmModeFreeProperty(drmModePropertyPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->values);
+	free(ptr->enums);
+	free(ptr);
+}
+
+drmModePropertyBlobPtr
+drmModeGetPropertyBlob(int fd, uint32_t blob_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_blob *blob = mock_kms_find_blob(kms, blob_id);
+	drmModePropertyBlobPtr kblob;
+
+	if (!blob) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	kblob = zalloc(sizeof(*kblob));
+	kblob->id = blob->id;
+	kblob->length = blob->size;
+	kblob->data = malloc(blob->size);
+	memcpy(kblob->data, blob->data, blob->size);
+
+	return kblob;
+}
+
+void
+drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->data);
+	free(ptr);
+}
+
+int
+drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
+			  uint32_t *id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+
+	*id = mock_kms_create_blob(kms, data, size);
+
+	return 0;
+}
+
+int
+drmModeDestroyPropertyBlob(int fd, uint32_t id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_blob *blob = mock_kms_find_blob(kms, id);
+	struct mock_blob *last;
+
+	if (!blob)
+		return mock_kms_fail(ENOENT);
+
+	free(blob->data);
+	last = (struct mock_blob *) ((char *) kms->blobs.data +
+				     kms->blobs.size) - 1;
+	*blob = *last;
+	kms->blobs.size -= sizeof(*blob);
+
+	return 0;
+}
+
+static int
+mock_kms_add_fb(struct mock_kms *kms, uint32_t width, uint32_t height,
+		uint32_t format, uint64_t modifier, uint32_t *fb_id)
+{
+	struct mock_fb *fb;
+
+	if (width == 0 || height == 0 || width > 16384 || height > 16384)
+		return mock_kms_fail(EINVAL);
+
+	fb = wl_array_add(&kms->fbs, sizeof(*fb));
+	if (!fb)
+		return mock_kms_fail(ENOMEM);
+
+	fb->id = kms->next_id++;
+	fb->width = width;
+	fb->height = height;
+	fb->format = format;
+	fb->modifier = modifier;
+	*fb_id = fb->id;
+	kms->stats.fbs_created++;
+
+	return 0;
+}
+
+int
+drmModeAddFB(int fd, uint32_t width, uint32_t height, uint8_t depth,
+	     uint8_t bpp, uint32_t pitch, uint32_t bo_handle, uint32_t *buf_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	uint32_t format;
+
+	if (depth == 24 && bpp == 32)
+		format = DRM_FORMAT_XRGB8888;
+	else if (depth == 32 && bpp == 32)
+		format = DRM_FORMAT_ARGB8888;
+	else if (depth == 16 && bpp == 16)
+		format = DRM_FORMAT_RGB565;
+	else
+		return mock_kms_fail(EINVAL);
+
+	return mock_kms_add_fb(kms, width, height, format,
+			       DRM_FORMAT_MOD_INVALID, buf_id);
+}
+
+int
+drmModeAddFB2(int fd, uint32_t width, uint32_t height, uint32_t pixel_format,
+	      const uint32_t bo_handles[4], const uint32_t pitches[4],
+	      const uint32_t offsets[4], uint32_t *buf_id, uint32_t flags)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+
+	return mock_kms_add_fb(kms, width, height, pixel_format,
+			       DRM_FORMAT_MOD_INVALID, buf_id);
+}
+
+int
+drmModeAddFB2WithModifiers(int fd, uint32_t width, uint32_t height,
+			   uint32_t pixel_format, const uint32_t bo_handles[4],
+			   const uint32_t pitches[4], const uint32_t offsets[4],
+			   const uint64_t modifier[4], uint32_t *buf_id,
+			   uint32_t flags)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+
+	if (!(flags & DRM_MODE_FB_MODIFIERS))
+		return mock_kms_fail(EINVAL);
+
+	return mock_kms_add_fb(kms, width, height, pixel_format,
+			       modifier[0], buf_id);
+}
+
+int
+drmModeRmFB(int fd, uint32_t buffer_id)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	struct mock_fb *fb = mock_kms_find_fb(kms, buffer_id);
+	struct mock_fb *last;
+
+	if (!fb)
+		return mock_kms_fail(ENOENT);
+
+	last = (struct mock_fb *) ((char *) kms->fbs.data +
+				   kms->fbs.size) - 1;
+	*fb = *last;
+	kms->fbs.size -= sizeof(*fb);
+
+	return 0;
+}
+
+drmModeAtomicReqPtr
+drmModeAtomicAlloc(void)
+{
+	drmModeAtomicReqPtr req = zalloc(sizeof(*req));
+
+	if (req)
+		wl_array_init(&req->items);
+
+	return req;
+}
+
+void
+drmModeAtomicFree(drmModeAtomicReqPtr req)
+{
+	if (!req)
+		return;
+
+	wl_array_release(&req->items);
+	free(req);
+}
+
+int
+drmModeAtomicAddProperty(drmModeAtomicReqPtr req, uint32_t object_id,
+			 uint32_t property_id, uint64_t value)
+{
+	struct mock_atomic_item *item;
+
+	item = wl_array_add(&req->items, sizeof(*item));
+	if (!item)
+		return -ENOMEM;
+
+	item->obj_id = object_id;
+	item->prop_id = property_id;
+	item->value = value;
+
+	return req->items.size / sizeof(*item);
+}
+
+int
+drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req, uint32_t flags,
+		    void *user_data)
+{
+	struct mock_kms *kms = mock_kms_from_fd(fd);
+	bool test_only = flags & DRM_MODE_ATOMIC_TEST_ONLY;
+	struct mock_atomic_item *item;
+	unsigned int i;
+	int ret = 0;
+
+	if (test_only)
+		kms->stats.test_commits++;
+	else
+		kms->stats.commits++;
+
+	mock_kms_for_each_object(kms, mock_object_stage);
+
+	wl_array_for_each(item, &req->items) {
+		struct mock_object *obj = mock_kms_find_object(kms,
+							       item->obj_id);
+		struct mock_property *prop;
+		int idx;
+
+		if (!obj) {
+			ret = -ENOENT;
+			break;
+		}
+
+		idx = mock_object_find_property(obj, item->prop_id);
+		prop = mock_kms_find_property(kms, item->prop_id);
+		if (idx < 0 || (prop->flags & DRM_MODE_PROP_IMMUTABLE)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (obj->staged[idx] != item->value &&
+		    mock_kms_is_modeset_prop(kms, item->prop_id, obj) &&
+		    !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		obj->staged[idx] = item->value;
+	}
+
+	if (ret == 0) {
+		kms->checking = true;
+		ret = mock_kms_check_state(kms, flags);
+		kms->checking = false;
+	}
+
+	/* A CRTC accepts no new commit until its last one completed. */
+	for (i = 0; ret == 0 && !test_only && i < kms->count_crtcs; i++) {
+		if (kms->crtcs[i].flip_pending &&
+		    mock_kms_req_touches_crtc(kms, req, &kms->crtcs[i]))
+			ret = -EBUSY;
+	}
+
+	if (ret != 0) {
+		if (test_only)
+			kms->stats.test_rejects++;
+		else
+			kms->stats.rejects++;
+		return mock_kms_fail(-ret);
+	}
+
+	if (test_only)
+		return 0;
+
+	for (i = 0; i < kms->count_crtcs; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		struct mock_flip *flip;
+
+		if (!(flags & DRM_MODE_PAGE_FLIP_EVENT) ||
+		    !mock_object_staged(kms, &crtc->obj, MOCK_PROP_ACTIVE) ||
+		    !mock_kms_req_touches_crtc(kms, req, crtc))
+			continue;
+
+		flip = wl_array_add(&kms->flips, sizeof(*flip));
+		assert(flip);
+		flip->crtc_id = crtc->obj.id;
+		flip->user_data = user_data;
+		crtc->flip_pending = true;
+	}
+
+	mock_kms_for_each_object(kms, mock_object_apply);
+
+	return 0;
+}
+
+/* Legacy KMS is not modelled; the backend only uses it without atomic. */
+
+int
+drmModeSetCrtc(int fd, uint32_t crtc_id, uint32_t buffer_id, uint32_t x,
+	       uint32_t y, uint32_t *connectors, int count,
+	       drmModeModeInfoPtr mode)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+int
+drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags,
+		void *user_data)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+int
+drmModeSetCursor(int fd, uint32_t crtc_id, uint32_t bo_handle,
+		 uint32_t width, uint32_t height)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+int
+drmModeMoveCursor(int fd, uint32_t crtc_id, int x, int y)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+int
+drmModeCrtcSetGamma(int fd, uint32_t crtc_id, uint32_t size,
+		    uint16_t *red, uint16_t *green, uint16_t *blue)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+int
+drmModeConnectorSetProperty(int fd, uint32_t connector_id,
+			    uint32_t property_id, uint64_t value)
+{
+	return mock_kms_fail(EOPNOTSUPP);
+}
+
+/* GBM buffer import */
+
+struct gbm_bo *
+gbm_bo_import(struct gbm_device *gbm, uint32_t type, void *buffer,
+	      uint32_t usage)
+{
+	struct gbm_import_fd_modifier_data *data = buffer;
+	struct gbm_bo *bo;
+	unsigned int i;
+
+	assert(mock_kms_device);
+
+	if (type != GBM_BO_IMPORT_FD_MODIFIER) {
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	bo = zalloc(sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	bo->gbm = gbm;
+	bo->width = data->width;
+	bo->height = data->height;
+	bo->format = data->format;
+	bo->modifier = data->modifier;
+	bo->num_planes = data->num_fds;
+	for (i = 0; i < data->num_fds && i < ARRAY_LENGTH(bo->handles); i++) {
+		bo->handles[i] = mock_kms_device->next_handle++;
+		bo->strides[i] = data->strides[i];
+		bo->offsets[i] = data->offsets[i];
+	}
+
+	return bo;
+}
+
+void
+gbm_bo_destroy(struct gbm_bo *bo)
+{
+	if (bo->destroy_user_data)
+		bo->destroy_user_data(bo, bo->user_data);
+	free(bo);
+}
+
+uint32_t
+gbm_bo_get_width(struct gbm_bo *bo)
+{
+	return bo->width;
+}
+
+uint32_t
+gbm_bo_get_height(struct gbm_bo *bo)
+{
+	return bo->height;
+}
+
+uint32_t
+gbm_bo_get_format(struct gbm_bo *bo)
+{
+	return bo->format;
+}
+
+uint64_t
+gbm_bo_get_modifier(struct gbm_bo *bo)
+{
+	return bo->modifier;
+}
+
+int
+gbm_bo_get_plane_count(struct gbm_bo *bo)
+{
+	return bo->num_planes;
+}
+
+uint32_t
+gbm_bo_get_stride(struct gbm_bo *bo)
+{
+	return bo->strides[0];
+}
+
+uint32_t
+gbm_bo_get_stride_for_plane(struct gbm_bo *bo, int plane)
+{
+	return bo->strides[plane];
+}
+
+uint32_t
+gbm_bo_get_offset(struct gbm_bo *bo, int plane)
+{
+	return bo->offsets[plane];
+}
+
+union gbm_bo_handle
+gbm_bo_get_handle(struct gbm_bo *bo)
+{
+	union gbm_bo_handle handle = { .u32 = bo->handles[0] };
+
+	return handle;
+}
+
+union gbm_bo_handle
+gbm_bo_get_handle_for_plane(struct gbm_bo *bo, int plane)
+{
+	union gbm_bo_handle handle = { .u32 = bo->handles[plane] };
+
+	return handle;
+}
+
+void
+gbm_bo_set_user_data(struct gbm_bo *bo, void *data,
+		     void (*destroy_user_data)(struct gbm_bo *, void *))
+{
+	bo->user_data = data;
+	bo->destroy_user_data = destroy_user_data;
+}
+
+void *
+gbm_bo_get_user_data(struct gbm_bo *bo)
+{
+	return bo->user_data;
+}
+
+int
+gbm_bo_write(struct gbm_bo *bo, const void *buf, size_t count)
+{
+	return 0;
+}
+
+void
+gbm_surface_release_buffer(struct gbm_surface *surface, struct gbm_bo *bo)
+{
+	assert(!"GBM surfaces are not modelled by the mock KMS device");
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_TEST_DRM_MOCK_KMS_H
+#define WESTON_TEST_DRM_MOCK_KMS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** An in-process stand-in for a KMS device
+ *
+ * Linking drm-mock-kms.c into a test replaces the libdrm KMS entry points
+ * and the GBM buffer import functions used by the DRM backend, so that
+ * kms.c, fb.c and state-propose.c run against fake CRTCs, planes and
+ * connectors instead of a kernel driver.
+ *
+ * Atomic commits are checked against the object model and a set of
+ * configurable rejection rules. Committed property values are kept, and
+ * non-blocking commits queue a page flip event per active CRTC which
+ * drmHandleEvent() delivers.
+ *
+ * Only one device can exist at a time; its file descriptor is a memfd so
+ * that dumb buffers can be mapped.
+ */
+struct mock_kms;
+
+enum mock_kms_plane_type {
+	MOCK_KMS_PLANE_OVERLAY = 0,
+	MOCK_KMS_PLANE_PRIMARY,
+	MOCK_KMS_PLANE_CURSOR,
+};
+
+/** Reasons for the mock device to refuse an atomic commit
+ *
+ * A zero-initialized struct accepts every state the object model allows.
+ */
+struct mock_kms_rules {
+	/** Maximum number of enabled planes per CRTC, 0 for no limit */
+	unsigned int max_active_planes;
+
+	/** Refuse planes whose source and destination sizes differ */
+	bool reject_scaling;
+
+	/** Refuse overlay planes overlapping each other on the same CRTC */
+	bool reject_overlay_overlap;
+
+	/** Refuse planes sharing a zpos value on the same CRTC */
+	bool reject_duplicate_zpos;
+
+	/** Refuse any state enabling this plane, 0 for none */
+	uint32_t reject_plane_id;
+
+	/** Called last for every commit that passed the rules above;
+	 * return false to refuse it */
+	bool (*check)(struct mock_kms *kms, uint32_t flags, void *data);
+	void *check_data;
+};
+
+struct mock_kms_stats {
+	uint64_t test_commits;
+	uint64_t test_rejects;
+	uint64_t commits;
+	uint64_t rejects;
+	uint64_t flip_events;
+	uint64_t fbs_created;
+};
+
+struct mock_kms *
+mock_kms_create(void);
+
+void
+mock_kms_destroy(struct mock_kms *kms);
+
+int
+mock_kms_get_fd(struct mock_kms *kms);
+
+uint32_t
+mock_kms_add_crtc(struct mock_kms *kms);
+
+uint32_t
+mock_kms_add_plane(struct mock_kms *kms, enum mock_kms_plane_type type,
+		   uint32_t possible_crtcs, uint64_t zpos_min, uint64_t zpos_max,
+		   const uint32_t *formats, unsigned int count_formats,
+		   const uint64_t *modifiers, unsigned int count_modifiers);
+
+uint32_t
+mock_kms_add_connector(struct mock_kms *kms, uint32_t possible_crtcs,
+		       int width, int height, int refresh_hz);
+
+void
+mock_kms_set_rules(struct mock_kms *kms, const struct mock_kms_rules *rules);
+
+const struct mock_kms_stats *
+mock_kms_get_stats(struct mock_kms *kms);
+
+void
+mock_kms_reset_stats(struct mock_kms *kms);
+
+bool
+mock_kms_get_property(struct mock_kms *kms, uint32_t obj_id,
+		      const char *name, uint64_t *value);
+
+/** Value of a property in the atomic commit being checked; only valid from
+ * within mock_kms_rules::check */
+bool
+mock_kms_get_pending_property(struct mock_kms *kms, uint32_t obj_id,
+			      const char *name, uint64_t *value);
+
+unsigned int
+mock_kms_count_pending_flips(struct mock_kms *kms);
+
+#endif /* WESTON_TEST_DRM_MOCK_KMS_H */
@@ -0,0 +1,325 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <linux/input.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "event-capture.h"
+#include "shared/helpers.h"
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+PLUGIN_TEST(event_capture_records_outputs)
+{
+	/* struct weston_compositor *compositor; */
+	char path[] = "/tmp/weston-event-capture-test-XXXXXX";
+	struct weston_capture_file_header header;
+	struct weston_capture_record record;
+	struct weston_capture_output co;
+	struct weston_output *output;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	assert(weston_compositor_start_event_capture(compositor, path) == 0);
+	/* only one capture at a time */
+	assert(weston_compositor_start_event_capture(compositor, path) < 0);
+	weston_compositor_stop_event_capture(compositor);
+	assert(!compositor->event_capture);
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+
+	fp = fopen(path, "r");
+	assert(fp);
+	assert(fread(&header, sizeof header, 1, fp) == 1);
+	assert(memcmp(header.magic, WESTON_CAPTURE_MAGIC,
+		      sizeof header.magic) == 0);
+	assert(header.version == WESTON_CAPTURE_VERSION);
+
+	assert(fread(&record, sizeof record, 1, fp) == 1);
+	assert(record.type == WESTON_CAPTURE_OUTPUT);
+	assert(record.size == sizeof record + sizeof co);
+	assert(fread(&co, sizeof co, 1, fp) == 1);
+	assert(co.id == output->id);
+	assert(co.x == output->x && co.y == output->y);
+	assert(co.width == output->current_mode->width);
+	assert(co.height == output->current_mode->height);
+	assert(co.scale == output->current_scale);
+
+	fclose(fp);
+
+	/* a capture file is accepted for replay, which reads it up-front */
+	assert(weston_compositor_replay_events(compositor, path,
+					       NULL, NULL) == 0);
+	assert(compositor->event_replay);
+	assert(weston_compositor_replay_events(compositor, path,
+					       NULL, NULL) < 0);
+	weston_event_replay_destroy(compositor);
+
+	unlink(path);
+}
+
+PLUGIN_TEST(event_replay_rejects_garbage)
+{
+	/* struct weston_compositor *compositor; */
+	char path[] = "/tmp/weston-event-capture-test-XXXXXX";
+	static const char garbage[] = "definitely not a capture file";
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	assert(write(fd, garbage, sizeof garbage) == sizeof garbage);
+	close(fd);
+
+	assert(weston_compositor_replay_events(compositor, path,
+					       NULL, NULL) < 0);
+	assert(!compositor->event_replay);
+
+	unlink(path);
+
+	assert(weston_compositor_replay_events(compositor, path,
+					       NULL, NULL) < 0);
+}
+
+static bool
+is_input_record(uint32_t type)
+{
+	return type == WESTON_CAPTURE_MOTION ||
+	       type == WESTON_CAPTURE_BUTTON ||
+	       type == WESTON_CAPTURE_KEY ||
+	       type == WESTON_CAPTURE_AXIS;
+}
+
+/* Reads the next input record of a capture file, skipping everything else */
+static bool
+read_input_record(FILE *fp, struct weston_capture_record *record,
+		  void *payload, size_t payload_size)
+{
+	size_t len;
+
+	while (fread(record, sizeof *record, 1, fp) == 1) {
+		assert(record->size >= sizeof *record);
+		len = record->size - sizeof *record;
+		if (!is_input_record(record->type)) {
+			assert(fseek(fp, len, SEEK_CUR) == 0);
+			continue;
+		}
+
+		assert(len <= payload_size);
+		assert(fread(payload, 1, len, fp) == len);
+		return true;
+	}
+
+	return false;
+}
+
+static void
+replay_done(struct weston_compositor *compositor, void *data)
+{
+	bool *done = data;
+
+	*done = true;
+}
+
+static struct weston_view *
+find_view_by_size(struct weston_compositor *compositor, int width, int height)
+{
+	struct weston_layer *layer;
+	struct weston_view *view;
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		wl_list_for_each(view, &layer->view_list.link,
+				 layer_link.link) {
+			if (view->surface->width == width &&
+			    view->surface->height == height)
+				return view;
+		}
+	}
+
+	return NULL;
+}
+
+PLUGIN_TEST(event_capture_replay_round_trip)
+{
+	/* struct weston_compositor *compositor; */
+	char path[] = "/tmp/weston-event-capture-test-XXXXXX";
+	char replay_path[] = "/tmp/weston-event-capture-test-XXXXXX";
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+	struct weston_pointer_motion_event motion = {
+		.mask = WESTON_POINTER_MOTION_ABS,
+		.x = 30.0,
+		.y = 40.0,
+	};
+	struct weston_pointer_axis_event axis = {
+		.axis = WL_POINTER_AXIS_VERTICAL_SCROLL,
+		.value = 10.0,
+		.has_discrete = true,
+		.discrete = 1,
+	};
+	struct weston_capture_record record, replayed_record;
+	uint8_t payload[64], replayed_payload[64];
+	struct weston_buffer_reference *buffer_ref;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct weston_layer layer;
+	pixman_region32_t damage;
+	FILE *fp, *replayed_fp;
+	bool done = false;
+	int n_input = 0;
+	float x, y;
+	int fd, i;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	fd = mkstemp(replay_path);
+	assert(fd >= 0);
+	close(fd);
+
+	weston_layer_init(&layer, compositor);
+	weston_layer_set_position(&layer, WESTON_LAYER_POSITION_NORMAL);
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	buffer_ref = weston_buffer_create_solid_rgba(compositor,
+						     1.0f, 0.0f, 0.0f, 1.0f);
+	assert(buffer_ref);
+	weston_surface_attach_solid(surface, buffer_ref, 40, 30);
+	weston_view_set_position(view, 11, 22);
+	weston_layer_entry_insert(&layer.view_list, &view->layer_link);
+	surface->is_mapped = true;
+	view->is_mapped = true;
+	weston_view_update_transform(view);
+
+	/* Commit the surface, grow it, then send some input, the way
+	 * weston_surface_commit_state() and the notify_*() functions would. */
+	assert(weston_compositor_start_event_capture(compositor, path) == 0);
+
+	pixman_region32_init_rect(&damage, 0, 0, 40, 30);
+	weston_event_capture_surface_commit(surface, true, &damage);
+	pixman_region32_fini(&damage);
+
+	weston_surface_attach_solid(surface, buffer_ref, 57, 33);
+	pixman_region32_init_rect(&damage, 40, 0, 17, 33);
+	weston_event_capture_surface_commit(surface, false, &damage);
+	pixman_region32_fini(&damage);
+
+	weston_event_capture_motion(compositor, &motion);
+	weston_event_capture_button(compositor, BTN_LEFT,
+				    WL_POINTER_BUTTON_STATE_PRESSED);
+	weston_event_capture_button(compositor, BTN_LEFT,
+				    WL_POINTER_BUTTON_STATE_RELEASED);
+	weston_event_capture_key(compositor, KEY_A,
+				 WL_KEYBOARD_KEY_STATE_PRESSED);
+	weston_event_capture_key(compositor, KEY_A,
+				 WL_KEYBOARD_KEY_STATE_RELEASED);
+	weston_event_capture_axis(compositor, &axis);
+
+	weston_compositor_stop_event_capture(compositor);
+
+	weston_view_destroy(view);
+	weston_surface_unref(surface);
+	weston_buffer_destroy_solid(buffer_ref);
+	weston_layer_fini(&layer);
+	assert(!find_view_by_size(compositor, 57, 33));
+
+	/* Replay while capturing again: the replayed input goes through the
+	 * notify_*() functions, so it ends up in the second capture. */
+	assert(weston_compositor_start_event_capture(compositor,
+						     replay_path) == 0);
+	assert(weston_compositor_replay_events(compositor, path,
+					       replay_done, &done) == 0);
+	for (i = 0; i < 1000 && !done; i++)
+		wl_event_loop_dispatch(loop, 10);
+	assert(done);
+	weston_compositor_stop_event_capture(compositor);
+
+	/* The replayed surface has the last committed size and position */
+	view = find_view_by_size(compositor, 57, 33);
+	assert(view);
+	assert(weston_view_is_mapped(view));
+	assert(view->surface->buffer_ref.buffer);
+	weston_view_update_transform(view);
+	weston_view_to_global_float(view, 0, 0, &x, &y);
+	assert(x == 11 && y == 22);
+
+	/* The same input, in the same order */
+	fp = fopen(path, "r");
+	assert(fp);
+	replayed_fp = fopen(replay_path, "r");
+	assert(replayed_fp);
+	assert(fseek(fp, sizeof(struct weston_capture_file_header),
+		     SEEK_SET) == 0);
+	assert(fseek(replayed_fp, sizeof(struct weston_capture_file_header),
+		     SEEK_SET) == 0);
+
+	while (read_input_record(fp, &record, payload, sizeof payload)) {
+		assert(read_input_record(replayed_fp, &replayed_record,
+					 replayed_payload,
+					 sizeof replayed_payload));
+		assert(replayed_record.type == record.type);
+		assert(replayed_record.size == record.size);
+		assert(memcmp(replayed_payload, payload,
+			      record.size - sizeof record) == 0);
+		n_input++;
+	}
+	assert(!read_input_record(replayed_fp, &replayed_record,
+				  replayed_payload, sizeof replayed_payload));
+	assert(n_input == 6);
+
+	fclose(replayed_fp);
+	fclose(fp);
+
+	weston_event_replay_destroy(compositor);
+	assert(!find_view_by_size(compositor, 57, 33));
+
+	unlink(replay_path);
+	unlink(path);
+}
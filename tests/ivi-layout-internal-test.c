@@ -31,6 +31,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include <libweston/libweston.h>
 #include "compositor/weston.h"
@@ -38,6 +40,7 @@
 #include "ivi-shell/ivi-layout-private.h"
 #include "ivi-test.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "weston-test-runner.h"
 #include "weston-test-fixture-compositor.h"
 
@@ -505,6 +508,167 @@ test_get_layer_after_destory_layer(struct test_context *ctx)
 	iassert(ivilayer == NULL);
 }
 
+/*
+ * Controllers look a layer up by ID for every property they set, so with
+ * hundreds of layers the lookup must not depend on how many there are.
+ * Looks every layer up and sets a property on it, many times over.
+ * Not a pass/fail criterion, the result goes to the log.
+ */
+#define BENCHMARK_LAYER_COUNT 1000
+#define BENCHMARK_ROUNDS 100
+
+static void
+test_layer_lookup_benchmark(struct test_context *ctx)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct ivi_layout_layer **ivilayers;
+	struct timespec begin, end;
+	int64_t elapsed_ns;
+	bool found = true;
+	uint32_t i, round;
+
+	ivilayers = calloc(BENCHMARK_LAYER_COUNT, sizeof *ivilayers);
+	if (!iassert(ivilayers != NULL))
+		return;
+
+	for (i = 0; i < BENCHMARK_LAYER_COUNT; i++) {
+		ivilayers[i] = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(i),
+								200, 300);
+		iassert(ivilayers[i] != NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+		for (i = 0; i < BENCHMARK_LAYER_COUNT; i++) {
+			struct ivi_layout_layer *ivilayer;
+
+			ivilayer = lyt->get_layer_from_id(IVI_TEST_LAYER_ID(i));
+			found = found && ivilayer == ivilayers[i];
+			lyt->layer_set_opacity(ivilayer,
+					       wl_fixed_from_double((round % 2) * 0.5));
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	iassert(found);
+
+	elapsed_ns = timespec_sub_to_nsec(&end, &begin);
+	weston_log("%s: %d lookups among %d layers in %.3f ms, %.1f ns each\n",
+		   __func__, BENCHMARK_LAYER_COUNT * BENCHMARK_ROUNDS,
+		   BENCHMARK_LAYER_COUNT, elapsed_ns / 1e6,
+		   (double)elapsed_ns / (BENCHMARK_LAYER_COUNT * BENCHMARK_ROUNDS));
+
+	iassert(lyt->commit_changes() == IVI_SUCCEEDED);
+
+	for (i = 0; i < BENCHMARK_LAYER_COUNT; i++) {
+		lyt->layer_destroy(ivilayers[i]);
+		iassert(lyt->get_layer_from_id(IVI_TEST_LAYER_ID(i)) == NULL);
+	}
+
+	free(ivilayers);
+}
+
+struct repaint_counter {
+	struct weston_animation animation;
+	int frames;
+};
+
+static void
+repaint_counter_frame(struct weston_animation *animation,
+		      struct weston_output *output,
+		      const struct timespec *time)
+{
+	struct repaint_counter *counter =
+		container_of(animation, struct repaint_counter, animation);
+
+	counter->frames++;
+}
+
+/*
+ * Dispatches the compositor event loop until done() holds or timeout_msec
+ * have passed, and returns whether done() held.
+ */
+static bool
+dispatch_until(struct test_context *ctx,
+	       bool (*done)(struct test_context *ctx, void *data), void *data,
+	       int timeout_msec)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(ctx->compositor->wl_display);
+	struct timespec begin, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	while (!done(ctx, data)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_sub_to_msec(&now, &begin) > timeout_msec)
+			return false;
+
+		wl_event_loop_dispatch(loop, 10);
+	}
+
+	return true;
+}
+
+static bool
+output_is_idle(struct test_context *ctx, void *data)
+{
+	struct weston_output *output = data;
+
+	return output->repaint_status == REPAINT_NOT_SCHEDULED;
+}
+
+static bool
+layer_is_opaque(struct test_context *ctx, void *data)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	const struct ivi_layout_layer_properties *prop;
+
+	prop = lyt->get_properties_of_layer(data);
+
+	return prop->opacity == wl_fixed_from_double(1.0);
+}
+
+/*
+ * A transition that damages no output must run on the timer: an idle
+ * output would stall it, and repainting one just for it is wasted work.
+ */
+static void
+test_layer_fade_transition_paced_without_output(struct test_context *ctx)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct repaint_counter counter = {
+		.animation.frame = repaint_counter_frame,
+	};
+	struct weston_output *output;
+	struct ivi_layout_layer *ivilayer;
+
+	if (!iassert(!wl_list_empty(&ctx->compositor->output_list)))
+		return;
+
+	output = container_of(ctx->compositor->output_list.next,
+			      struct weston_output, link);
+	if (!iassert(dispatch_until(ctx, output_is_idle, output, 1000)))
+		return;
+
+	wl_list_insert(&output->animation_list, &counter.animation.link);
+
+	/* the layer is on no screen */
+	ivilayer = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(0), 200, 300);
+	iassert(ivilayer != NULL);
+	iassert(lyt->layer_set_opacity(ivilayer, wl_fixed_from_double(0.0)) == IVI_SUCCEEDED);
+	iassert(lyt->layer_set_fade_info(ivilayer, 1, 0.0, 1.0) == 0);
+	iassert(lyt->layer_set_transition(ivilayer,
+					  IVI_LAYOUT_TRANSITION_LAYER_FADE,
+					  100) == 0);
+	iassert(lyt->commit_changes() == IVI_SUCCEEDED);
+
+	iassert(dispatch_until(ctx, layer_is_opaque, ivilayer, 2000));
+	iassert(counter.frames == 0);
+
+	wl_list_remove(&counter.animation.link);
+	lyt->layer_destroy(ivilayer);
+	lyt->commit_changes();
+}
+
 static void
 test_screen_render_order(struct test_context *ctx)
 {
@@ -982,6 +1146,8 @@ run_internal_tests(struct test_context *ctx)
 	test_commit_changes_after_destination_rectangle_set_layer_destroy(ctx);
 	test_layer_create_duplicate(ctx);
 	test_get_layer_after_destory_layer(ctx);
+	test_layer_lookup_benchmark(ctx);
+	test_layer_fade_transition_paced_without_output(ctx);
 
 	test_screen_render_order(ctx);
 	test_screen_bad_render_order(ctx);
@@ -477,6 +477,43 @@ TEST(ivi_layout_surface_configure_notification)
 	client_destroy(client);
 }
 
+TEST(ivi_layout_surface_resize_clip)
+{
+	struct client *client;
+	struct runner *runner;
+	struct ivi_application *iviapp;
+	struct ivi_window *wind;
+	struct buffer *buffers[2];
+
+	client = create_client();
+	runner = client_create_runner(client);
+	iviapp = get_ivi_application(client);
+
+	wind = client_create_ivi_window(client, iviapp, IVI_TEST_SURFACE_ID(0));
+
+	buffers[0] = create_shm_buffer_a8r8g8b8(client, 100, 80);
+	wl_surface_attach(wind->wl_surface, buffers[0]->proxy, 0, 0);
+	wl_surface_damage(wind->wl_surface, 0, 0, 100, 80);
+	wl_surface_commit(wind->wl_surface);
+
+	runner_run(runner, "surface_resize_clip_p1");
+
+	/* grow the surface, leaving its ivi-layout properties alone */
+	buffers[1] = create_shm_buffer_a8r8g8b8(client, 150, 120);
+	wl_surface_attach(wind->wl_surface, buffers[1]->proxy, 0, 0);
+	wl_surface_damage(wind->wl_surface, 0, 0, 150, 120);
+	wl_surface_commit(wind->wl_surface);
+
+	runner_run(runner, "surface_resize_clip_p2");
+
+	buffer_destroy(buffers[1]);
+	buffer_destroy(buffers[0]);
+	ivi_window_destroy(wind);
+	runner_destroy(runner);
+	ivi_application_destroy(iviapp);
+	client_destroy(client);
+}
+
 TEST(ivi_layout_surface_create_notification)
 {
 	struct client *client;
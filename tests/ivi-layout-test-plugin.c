@@ -1037,3 +1037,85 @@ RUNNER_TEST(surface_bad_properties_changed_notification)
 	runner_assert(lyt->surface_add_listener(
 		      ivisurf, NULL) == IVI_FAILED);
 }
+
+static struct weston_view *
+get_test_surface_view(const struct ivi_layout_interface *lyt,
+		      struct ivi_layout_surface *ivisurf)
+{
+	struct weston_surface *surface = lyt->surface_get_weston_surface(ivisurf);
+
+	if (wl_list_empty(&surface->views))
+		return NULL;
+
+	return container_of(surface->views.next, struct weston_view,
+			    surface_link);
+}
+
+RUNNER_TEST(surface_resize_clip_p1)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct ivi_layout_surface *ivisurf;
+	struct ivi_layout_layer *ivilayer;
+	struct weston_surface *surface;
+	struct weston_output *output;
+	struct weston_view *view;
+
+	ivisurf = lyt->get_surface_from_id(IVI_TEST_SURFACE_ID(0));
+	runner_assert(ivisurf != NULL);
+	surface = lyt->surface_get_weston_surface(ivisurf);
+	runner_assert(surface->width == 100 && surface->height == 80);
+
+	runner_assert(!wl_list_empty(&surface->compositor->output_list));
+	output = wl_container_of(surface->compositor->output_list.next,
+				 output, link);
+
+	ivilayer = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(0),
+						    100, 80);
+	runner_assert(ivilayer != NULL);
+	runner_assert(lyt->screen_add_layer(output, ivilayer) == IVI_SUCCEEDED);
+	runner_assert(lyt->layer_set_visibility(ivilayer, true) == IVI_SUCCEEDED);
+	runner_assert(lyt->layer_add_surface(ivilayer, ivisurf) == IVI_SUCCEEDED);
+	runner_assert(lyt->surface_set_source_rectangle(
+		      ivisurf, 0, 0, 100, 80) == IVI_SUCCEEDED);
+	runner_assert(lyt->surface_set_destination_rectangle(
+		      ivisurf, 0, 0, 100, 80) == IVI_SUCCEEDED);
+	runner_assert(lyt->surface_set_visibility(ivisurf, true) == IVI_SUCCEEDED);
+	lyt->commit_changes();
+
+	/* the whole surface is shown, so it inherits the layer transform */
+	view = get_test_surface_view(lyt, ivisurf);
+	runner_assert(view != NULL);
+	runner_assert(view->geometry.parent != NULL);
+}
+
+RUNNER_TEST(surface_resize_clip_p2)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct ivi_layout_surface *ivisurf;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	pixman_box32_t *box;
+
+	ivisurf = lyt->get_surface_from_id(IVI_TEST_SURFACE_ID(0));
+	runner_assert(ivisurf != NULL);
+	surface = lyt->surface_get_weston_surface(ivisurf);
+	runner_assert(surface->width == 150 && surface->height == 120);
+
+	/* The client grew the surface past its source rectangle without
+	 * any property change: the view must now be clipped to the source
+	 * rectangle, which takes a mask of its own. */
+	view = get_test_surface_view(lyt, ivisurf);
+	runner_assert(view != NULL);
+	runner_assert(view->geometry.parent == NULL);
+
+	/* masks need a renderer that can clip */
+	if (surface->compositor->capabilities & WESTON_CAP_VIEW_CLIP_MASK) {
+		runner_assert(view->geometry.scissor_enabled);
+		box = pixman_region32_extents(&view->geometry.scissor);
+		runner_assert(box->x1 == 0 && box->y1 == 0 &&
+			      box->x2 == 100 && box->y2 == 80);
+	}
+
+	lyt->layer_destroy(lyt->get_layer_from_id(IVI_TEST_LAYER_ID(0)));
+	lyt->commit_changes();
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <libweston/libweston.h>
+#include <libweston-internal.h>
+
+#include "shared/helpers.h"
+#include "shared/string-helpers.h"
+#include "weston-test-runner.h"
+
+/* A stand-in for the XKB data, one file in each component directory; the
+ * key only looks at the files, it never parses them. */
+static const char * const xkb_components[] = {
+	"rules", "keycodes", "types", "compat", "symbols",
+};
+
+static char *
+xkb_path(const char *root, const char *component, const char *name)
+{
+	char *path;
+
+	if (name)
+		str_printf(&path, "%s/%s/%s", root, component, name);
+	else
+		str_printf(&path, "%s/%s", root, component);
+	assert(path);
+
+	return path;
+}
+
+static void
+write_file(const char *root, const char *component, const char *name,
+	   const char *contents)
+{
+	char *path = xkb_path(root, component, name);
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	assert(fp);
+	assert(fputs(contents, fp) >= 0);
+	assert(fclose(fp) == 0);
+	free(path);
+}
+
+static void
+remove_file(const char *root, const char *component, const char *name)
+{
+	char *path = xkb_path(root, component, name);
+
+	assert(remove(path) == 0);
+	free(path);
+}
+
+static char *
+make_xkb_root(void)
+{
+	char *root = strdup("/tmp/weston-keymap-cache-test-XXXXXX");
+	char *dir;
+	unsigned int i;
+
+	assert(root);
+	assert(mkdtemp(root));
+
+	for (i = 0; i < ARRAY_LENGTH(xkb_components); i++) {
+		dir = xkb_path(root, xkb_components[i], NULL);
+		assert(mkdir(dir, 0700) == 0);
+		free(dir);
+		write_file(root, xkb_components[i], "test", "default");
+	}
+
+	return root;
+}
+
+static void
+remove_xkb_root(char *root)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(xkb_components); i++) {
+		remove_file(root, xkb_components[i], "test");
+		remove_file(root, xkb_components[i], NULL);
+	}
+	assert(rmdir(root) == 0);
+	free(root);
+}
+
+TEST(keymap_cache_key_follows_xkb_data)
+{
+	struct xkb_rule_names names = {
+		.rules = "evdev",
+		.model = "pc105",
+		.layout = "us",
+	};
+	struct xkb_context *context;
+	char *root = make_xkb_root();
+	char *key, *again;
+
+	context = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+	assert(context);
+	assert(xkb_context_include_path_append(context, root));
+
+	key = weston_xkb_cache_key(context, &names);
+	assert(key);
+
+	/* nothing changed: a cache hit */
+	again = weston_xkb_cache_key(context, &names);
+	assert(again && strcmp(again, key) == 0);
+	free(again);
+
+	/* a layout edited in place, with the rules file untouched */
+	write_file(root, "symbols", "test", "edited in place");
+	again = weston_xkb_cache_key(context, &names);
+	assert(again && strcmp(again, key) != 0);
+	free(key);
+	key = again;
+
+	/* a keycodes file added next to the others */
+	write_file(root, "keycodes", "aliases", "new");
+	again = weston_xkb_cache_key(context, &names);
+	assert(again && strcmp(again, key) != 0);
+	free(again);
+	remove_file(root, "keycodes", "aliases");
+
+	/* other rule names */
+	names.layout = "de";
+	again = weston_xkb_cache_key(context, &names);
+	assert(again && strcmp(again, key) != 0);
+	free(again);
+
+	free(key);
+	xkb_context_unref(context);
+	remove_xkb_root(root);
+}
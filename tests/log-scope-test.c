@@ -0,0 +1,239 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "shared/flight-rec-format.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+#include "weston-test-client-helper.h"
+
+struct log_fixture {
+	struct weston_log_context *log_ctx;
+	struct weston_log_scope *scope;
+	struct weston_log_subscriber *subscriber;
+	FILE *fp;
+	char *data;
+	size_t size;
+};
+
+static void
+log_fixture_init(struct log_fixture *f, FILE *fp)
+{
+	f->log_ctx = weston_log_ctx_create();
+	assert(f->log_ctx);
+
+	f->scope = weston_log_ctx_add_log_scope(f->log_ctx, "test",
+						"test scope\n", NULL, NULL,
+						NULL);
+	assert(f->scope);
+
+	if (fp) {
+		f->fp = fp;
+	} else {
+		f->fp = open_memstream(&f->data, &f->size);
+		assert(f->fp);
+	}
+
+	f->subscriber = weston_log_subscriber_create_log(f->fp);
+	assert(f->subscriber);
+	weston_log_subscribe(f->log_ctx, f->subscriber, "test");
+	assert(weston_log_scope_is_enabled(f->scope));
+}
+
+static void
+log_fixture_fini(struct log_fixture *f)
+{
+	weston_log_subscriber_destroy(f->subscriber);
+	weston_log_scope_destroy(f->scope);
+	weston_log_ctx_destroy(f->log_ctx);
+	fclose(f->fp);
+	free(f->data);
+}
+
+TEST(log_scope_printf_short_and_long)
+{
+	struct log_fixture f = {};
+	char *long_str;
+	size_t long_len = 10000;
+	int len;
+
+	long_str = xzalloc(long_len + 1);
+	memset(long_str, 'x', long_len);
+
+	log_fixture_init(&f, NULL);
+
+	len = weston_log_scope_printf(f.scope, "%s %d\n", "short", 42);
+	assert(len == 9);
+
+	/* does not fit the scope's formatting buffer */
+	len = weston_log_scope_printf(f.scope, "%s\n", long_str);
+	assert(len == (int) long_len + 1);
+
+	len = weston_log_scope_printf(f.scope, "%s %d\n", "again", 7);
+	assert(len == 8);
+
+	fflush(f.fp);
+	assert(f.size == 9 + long_len + 1 + 8);
+	assert(strncmp(f.data, "short 42\n", 9) == 0);
+	assert(f.data[9] == 'x');
+	assert(f.data[9 + long_len - 1] == 'x');
+	assert(strcmp(f.data + 9 + long_len, "\nagain 7\n") == 0);
+
+	log_fixture_fini(&f);
+	free(long_str);
+}
+
+TEST(log_scope_timestamp)
+{
+	struct log_fixture f = {};
+	char buf[128];
+	char buf2[128];
+
+	log_fixture_init(&f, NULL);
+
+	weston_log_scope_timestamp(f.scope, buf, sizeof buf);
+	assert(buf[0] == '[');
+	assert(strstr(buf, "][test]") != NULL);
+
+	/* The cached date and time must produce the same format. */
+	weston_log_scope_timestamp(f.scope, buf2, sizeof buf2);
+	assert(strlen(buf) == strlen(buf2));
+	assert(strstr(buf2, "][test]") != NULL);
+
+	weston_log_scope_timestamp(NULL, buf, sizeof buf);
+	assert(strstr(buf, "][no scope]") != NULL);
+
+	log_fixture_fini(&f);
+}
+
+TEST(flight_rec_file_survives_subscriber)
+{
+	struct weston_flight_rec_file_header header;
+	struct weston_log_context *log_ctx;
+	struct weston_log_scope *scope;
+	struct weston_log_subscriber *flight_rec;
+	char path[] = "/tmp/weston-flight-rec-test-XXXXXX";
+	char written[256] = "";
+	char ring[64];
+	char tail[64];
+	size_t written_len;
+	FILE *fp;
+	int fd;
+	int i;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	log_ctx = weston_log_ctx_create();
+	assert(log_ctx);
+	scope = weston_log_ctx_add_log_scope(log_ctx, "test", "test scope\n",
+					     NULL, NULL, NULL);
+	assert(scope);
+
+	flight_rec = weston_log_subscriber_create_flight_rec_file(path,
+								  sizeof ring);
+	assert(flight_rec);
+	weston_log_subscribe(log_ctx, flight_rec, "test");
+
+	/* wrap around the ring a couple of times */
+	for (i = 0; i < 20; i++) {
+		char line[16];
+
+		snprintf(line, sizeof line, "line %02d\n", i);
+		weston_log_scope_printf(scope, "%s", line);
+		strcat(written, line);
+	}
+	written_len = strlen(written);
+
+	/* as after a crash, only the file is left */
+	weston_log_subscriber_destroy(flight_rec);
+	weston_log_scope_destroy(scope);
+	weston_log_ctx_destroy(log_ctx);
+
+	fp = fopen(path, "r");
+	assert(fp);
+	assert(fread(&header, sizeof header, 1, fp) == 1);
+	assert(memcmp(header.magic, WESTON_FLIGHT_REC_MAGIC,
+		      sizeof header.magic) == 0);
+	assert(header.version == WESTON_FLIGHT_REC_VERSION);
+	assert(header.flags & WESTON_FLIGHT_REC_FLAG_CLOSED);
+	assert(header.pid == (uint32_t) getpid());
+	assert(header.size == sizeof ring - 1);
+	assert(header.overlap);
+	assert(header.append_pos < header.size);
+
+	assert(fseek(fp, header.header_size, SEEK_SET) == 0);
+	assert(fread(ring, 1, header.size, fp) == header.size);
+	fclose(fp);
+	unlink(path);
+
+	/* oldest data follows the append position */
+	memcpy(tail, ring + header.append_pos, header.size - header.append_pos);
+	memcpy(tail + header.size - header.append_pos, ring, header.append_pos);
+	assert(memcmp(tail, written + written_len - header.size,
+		      header.size) == 0);
+}
+
+/* Not a pass/fail criterion, reports the per-message cost in the test log. */
+TEST(log_scope_printf_benchmark)
+{
+	struct log_fixture f = {};
+	struct timespec begin, end;
+	const int count = 200000;
+	char ts[128];
+	FILE *fp;
+	int i;
+
+	fp = fopen("/dev/null", "w");
+	assert(fp);
+	log_fixture_init(&f, fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i++) {
+		weston_log_scope_printf(f.scope,
+					"%s view %p on plane %u, format %s\n",
+					weston_log_scope_timestamp(f.scope, ts,
+								   sizeof ts),
+					(void *) &f, i, "XRGB8888");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	testlog("%d messages, %.1f ns per message\n", count,
+		(double) timespec_sub_to_nsec(&end, &begin) / count);
+
+	log_fixture_fini(&f);
+}
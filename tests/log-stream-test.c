@@ -0,0 +1,240 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include <libweston/libweston.h>
+#include <libweston/weston-log.h>
+#include "weston-debug-client-protocol.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-test-runner.h"
+#include "weston-test-fixture-compositor.h"
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+
+	return weston_test_harness_execute_as_plugin(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/*
+ * A weston-debug client living in the compositor thread, so that the test
+ * can drive both ends of the connection.
+ */
+struct debug_client {
+	struct weston_compositor *compositor;
+	struct wl_client *client;
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct weston_debug_v1 *debug;
+	bool failed;
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct debug_client *dc = data;
+
+	if (strcmp(interface, weston_debug_v1_interface.name) == 0)
+		dc->debug = wl_registry_bind(registry, name,
+					     &weston_debug_v1_interface, 1);
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static void
+stream_handle_complete(void *data, struct weston_debug_stream_v1 *stream)
+{
+}
+
+static void
+stream_handle_failure(void *data, struct weston_debug_stream_v1 *stream,
+		      const char *message)
+{
+	struct debug_client *dc = data;
+
+	dc->failed = true;
+}
+
+static const struct weston_debug_stream_v1_listener stream_listener = {
+	stream_handle_complete,
+	stream_handle_failure
+};
+
+/* Lets the compositor handle the requests, and the client the events. */
+static void
+debug_client_pump(struct debug_client *dc)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(dc->compositor->wl_display);
+
+	assert(wl_display_flush(dc->display) >= 0);
+	wl_event_loop_dispatch(loop, 0);
+	wl_display_flush_clients(dc->compositor->wl_display);
+
+	while (wl_display_prepare_read(dc->display) != 0)
+		wl_display_dispatch_pending(dc->display);
+	assert(wl_display_read_events(dc->display) == 0);
+	wl_display_dispatch_pending(dc->display);
+}
+
+static void
+debug_client_init(struct debug_client *dc, struct weston_compositor *compositor)
+{
+	int sv[2];
+	int i;
+
+	memset(dc, 0, sizeof *dc);
+	dc->compositor = compositor;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+	dc->client = wl_client_create(compositor->wl_display, sv[0]);
+	assert(dc->client);
+	dc->display = wl_display_connect_to_fd(sv[1]);
+	assert(dc->display);
+
+	dc->registry = wl_display_get_registry(dc->display);
+	wl_registry_add_listener(dc->registry, &registry_listener, dc);
+	for (i = 0; i < 10 && !dc->debug; i++)
+		debug_client_pump(dc);
+	assert(dc->debug);
+}
+
+static void
+debug_client_fini(struct debug_client *dc)
+{
+	weston_debug_v1_destroy(dc->debug);
+	wl_registry_destroy(dc->registry);
+	wl_display_disconnect(dc->display);
+	wl_client_destroy(dc->client);
+}
+
+#define LINE_LEN 14 /* "line 00000000\n" */
+
+/*
+ * Writing to a stream whose reader is stuck must not block the compositor,
+ * and must only ever drop whole messages.
+ */
+PLUGIN_TEST(log_stream_slow_reader)
+{
+	const int count = 400000; /* well over what the stream queues */
+	struct debug_client dc;
+	struct weston_debug_stream_v1 *stream;
+	struct weston_log_scope *scope;
+	char *data, *notice, *p;
+	size_t size = 0;
+	size_t alloc = (size_t) count * LINE_LEN;
+	uint64_t dropped;
+	char line[LINE_LEN + 1];
+	int fds[2];
+	int lines;
+	int i;
+	ssize_t ret;
+
+	scope = weston_compositor_add_log_scope(compositor, "log-stream-test",
+						"test scope\n", NULL, NULL,
+						NULL);
+	assert(scope);
+
+	debug_client_init(&dc, compositor);
+
+	/* the compositor must not rely on the write end being non-blocking */
+	assert(pipe2(fds, O_CLOEXEC) == 0);
+	assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+	stream = weston_debug_v1_subscribe(dc.debug, "log-stream-test",
+					   fds[1]);
+	weston_debug_stream_v1_add_listener(stream, &stream_listener, &dc);
+	debug_client_pump(&dc);
+	close(fds[1]);
+	assert(weston_log_scope_is_enabled(scope));
+
+	/* nobody reads meanwhile */
+	for (i = 0; i < count; i++)
+		weston_log_scope_printf(scope, "line %08d\n", i);
+
+	/* Read until the notice about the dropped lines is complete, letting
+	 * the compositor write out its queue in between. */
+	data = xzalloc(alloc + 1);
+	notice = NULL;
+	for (i = 0; i < 100000; i++) {
+		debug_client_pump(&dc);
+
+		ret = read(fds[0], data + size, alloc - size);
+		if (ret > 0)
+			size += ret;
+		data[size] = '\0';
+
+		notice = strstr(data, "[weston-debug: reader too slow");
+		if (notice && data[size - 1] == '\n')
+			break;
+	}
+	assert(!dc.failed);
+	assert(notice);
+
+	/* whole lines, in order, then the notice */
+	lines = 0;
+	for (p = data; p < notice - 1; p += LINE_LEN) {
+		snprintf(line, sizeof line, "line %08d\n", lines);
+		assert(memcmp(p, line, LINE_LEN) == 0);
+		lines++;
+	}
+	assert(p == notice - 1 && *p == '\n');
+	assert(lines > 0 && lines < count);
+
+	assert(sscanf(notice, "[weston-debug: reader too slow, dropped %" SCNu64,
+		      &dropped) == 1);
+	assert(dropped == (uint64_t) (count - lines) * LINE_LEN);
+
+	weston_debug_stream_v1_destroy(stream);
+	debug_client_fini(&dc);
+	close(fds[0]);
+	free(data);
+	weston_log_scope_destroy(scope);
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shm-upload-plan.h"
+
+/* Damage as recorded from typical clients, see damage_patterns */
+struct damage_pattern {
+	const char *name;
+	int32_t width;
+	int32_t height;
+	void (*record)(pixman_region32_t *damage);
+	enum shm_upload_method expected;
+};
+
+static void
+record_cursor_blink(pixman_region32_t *damage)
+{
+	pixman_region32_union_rect(damage, damage, 640, 360, 2, 18);
+}
+
+static void
+record_two_windows(pixman_region32_t *damage)
+{
+	pixman_region32_union_rect(damage, damage, 0, 0, 200, 200);
+	pixman_region32_union_rect(damage, damage, 1000, 500, 200, 200);
+}
+
+/* A terminal redrawing 30 lines of a few words each */
+static void
+record_terminal_lines(pixman_region32_t *damage)
+{
+	int line;
+
+	for (line = 0; line < 30; line++) {
+		pixman_region32_union_rect(damage, damage, 0, line * 18,
+					   200 + line * 37 % 200, 18);
+		pixman_region32_union_rect(damage, damage, 480, line * 18,
+					   220 + line * 53 % 200, 18);
+		pixman_region32_union_rect(damage, damage, 960, line * 18,
+					   40 + line * 29 % 100, 18);
+	}
+}
+
+/* Hundreds of small sprites all over the surface */
+static void
+record_particles(pixman_region32_t *damage)
+{
+	uint32_t seed = 1;
+	int i;
+
+	for (i = 0; i < 400; i++) {
+		seed = seed * 1103515245 + 12345;
+		pixman_region32_union_rect(damage, damage,
+					   (seed >> 8) % 1020,
+					   (seed >> 20) % 764, 4, 4);
+	}
+}
+
+/* Everything but a small hole, e.g. a video behind a widget */
+static void
+record_near_full(pixman_region32_t *damage)
+{
+	pixman_region32_t hole;
+
+	pixman_region32_init_rect(&hole, 600, 300, 10, 10);
+	pixman_region32_union_rect(damage, damage, 0, 0, 1280, 720);
+	pixman_region32_subtract(damage, damage, &hole);
+	pixman_region32_fini(&hole);
+}
+
+static const struct damage_pattern damage_patterns[] = {
+	{ "cursor blink", 1280, 720, record_cursor_blink, SHM_UPLOAD_RECTS },
+	{ "two windows", 1280, 720, record_two_windows, SHM_UPLOAD_RECTS },
+	{ "terminal lines", 1280, 720, record_terminal_lines, SHM_UPLOAD_BANDS },
+	{ "particles", 1024, 768, record_particles, SHM_UPLOAD_FULL },
+	/* bands end up as a single full box, on par with a full upload */
+	{ "near full", 1280, 720, record_near_full, SHM_UPLOAD_BANDS },
+};
+
+static pixman_box32_t *
+plan_pattern(const struct damage_pattern *pattern,
+	     pixman_region32_t *damage, struct shm_upload_plan *plan)
+{
+	pixman_box32_t *rects;
+	pixman_box32_t *boxes;
+	int n;
+
+	pixman_region32_init(damage);
+	pattern->record(damage);
+	rects = pixman_region32_rectangles(damage, &n);
+
+	boxes = calloc(MAX(n, 1), sizeof *boxes);
+	assert(boxes);
+
+	shm_upload_plan_choose(plan, rects, n,
+			       pattern->width, pattern->height, 4, 1, boxes);
+
+	return boxes;
+}
+
+TEST_P(shm_upload_plan_pattern, damage_patterns)
+{
+	const struct damage_pattern *pattern = data;
+	struct shm_upload_plan plan;
+	pixman_region32_t damage, uploaded;
+	pixman_box32_t *boxes;
+	int i;
+
+	boxes = plan_pattern(pattern, &damage, &plan);
+
+	testlog("%s: %d damage rects as %s in %d boxes\n", pattern->name,
+		pixman_region32_n_rects(&damage),
+		shm_upload_method_name(plan.method), plan.n_boxes);
+	assert(plan.method == pattern->expected);
+	for (i = 0; i < SHM_UPLOAD_METHOD_COUNT; i++)
+		assert(plan.cost[plan.method] <= plan.cost[i]);
+
+	/* all the damage gets uploaded, and nothing outside the buffer */
+	pixman_region32_init_rects(&uploaded, boxes, plan.n_boxes);
+	pixman_region32_subtract(&damage, &damage, &uploaded);
+	assert(!pixman_region32_not_empty(&damage));
+	pixman_region32_intersect_rect(&damage, &uploaded, 0, 0,
+				       pattern->width, pattern->height);
+	assert(pixman_region32_equal(&damage, &uploaded));
+
+	pixman_region32_fini(&uploaded);
+	pixman_region32_fini(&damage);
+	free(boxes);
+}
+
+TEST(shm_upload_plan_no_damage)
+{
+	struct shm_upload_plan plan;
+	pixman_box32_t box;
+
+	shm_upload_plan_choose(&plan, NULL, 0, 1280, 720, 4, 1, &box);
+	assert(plan.method == SHM_UPLOAD_RECTS);
+	assert(plan.n_boxes == 0);
+}
+
+/* Planes of sub-sampled formats make every upload call count more */
+TEST(shm_upload_plan_planes)
+{
+	const pixman_box32_t rects[] = {
+		{ 0, 0, 64, 64 },
+		{ 0, 100, 64, 164 },
+		{ 0, 200, 64, 264 },
+	};
+	struct shm_upload_plan plan;
+	pixman_box32_t boxes[ARRAY_LENGTH(rects)];
+
+	shm_upload_plan_choose(&plan, rects, ARRAY_LENGTH(rects),
+			       512, 512, 1, 1, boxes);
+	assert(plan.method == SHM_UPLOAD_RECTS);
+
+	shm_upload_plan_choose(&plan, rects, ARRAY_LENGTH(rects),
+			       512, 512, 1, 3, boxes);
+	assert(plan.method == SHM_UPLOAD_FULL);
+	assert(plan.n_boxes == 1);
+	assert(boxes[0].x2 == 512 && boxes[0].y2 == 512);
+}
+
+/* Not a pass/fail criterion, reports the planning overhead and the
+ * estimated savings over per-rectangle uploads in the test log. */
+TEST(shm_upload_plan_benchmark)
+{
+	const int count = 2000;
+	unsigned int p;
+
+	for (p = 0; p < ARRAY_LENGTH(damage_patterns); p++) {
+		const struct damage_pattern *pattern = &damage_patterns[p];
+		struct shm_upload_plan plan;
+		struct timespec begin, end;
+		pixman_region32_t damage;
+		pixman_box32_t *rects, *boxes;
+		int i, n;
+
+		boxes = plan_pattern(pattern, &damage, &plan);
+		rects = pixman_region32_rectangles(&damage, &n);
+
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		for (i = 0; i < count; i++)
+			shm_upload_plan_choose(&plan, rects, n,
+					       pattern->width, pattern->height,
+					       4, 1, boxes);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		testlog("%s: %d rects, %.1f us per plan, %s costs %.0f%% "
+			"of rects\n", pattern->name, n,
+			(double) timespec_sub_to_nsec(&end, &begin) /
+			count / 1000,
+			shm_upload_method_name(plan.method),
+			100.0 * plan.cost[plan.method] /
+			plan.cost[SHM_UPLOAD_RECTS]);
+
+		pixman_region32_fini(&damage);
+		free(boxes);
+	}
+}
@@ -35,13 +35,20 @@
 
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <string.h>
+#include <time.h>
 
-#include "weston-test-runner.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
 #include "weston-test-fixture-compositor.h"
 
 static enum test_result_code
@@ -116,3 +123,304 @@ TEST(xwayland_client_test)
 
 	XCloseDisplay(display);
 }
+
+/* Not a pass/fail criterion on timing: reports how long the compositor
+ * stops answering Wayland clients while the window manager handles a
+ * burst of new X11 windows. */
+TEST(xwayland_window_burst)
+{
+	const int count = 300;
+	struct client *client;
+	Display *display;
+	Window root, windows[300];
+	Atom net_wm_name, utf8_string;
+	XEvent event;
+	struct timespec begin, end, t0, t1;
+	int64_t stall, max_stall = 0;
+	int mapped = 0, roundtrips = 0;
+	int screen, i;
+
+	if (access(XSERVER_PATH, X_OK) != 0)
+		exit(77);
+
+	client = create_client();
+
+	display = XOpenDisplay(NULL);
+	assert(display);
+	screen = DefaultScreen(display);
+	root = RootWindow(display, screen);
+	net_wm_name = XInternAtom(display, "_NET_WM_NAME", False);
+	utf8_string = XInternAtom(display, "UTF8_STRING", False);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i++) {
+		windows[i] = XCreateSimpleWindow(display, root,
+						 i % 64 * 8, i % 48 * 8,
+						 64, 48, 0,
+						 BlackPixel(display, screen),
+						 WhitePixel(display, screen));
+		XSelectInput(display, windows[i], StructureNotifyMask);
+		XStoreName(display, windows[i], "burst");
+		XChangeProperty(display, windows[i], net_wm_name, utf8_string,
+				8, PropModeReplace,
+				(const unsigned char *) "burst", 5);
+		XMapWindow(display, windows[i]);
+	}
+	XFlush(display);
+
+	/* Every window gets mapped by the window manager in the end */
+	while (mapped < count) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		wl_display_roundtrip(client->wl_display);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		stall = timespec_sub_to_nsec(&t1, &t0);
+		max_stall = MAX(max_stall, stall);
+		roundtrips++;
+
+		while (XPending(display)) {
+			XNextEvent(display, &event);
+			if (event.type == MapNotify)
+				mapped++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	testlog("%d windows mapped in %.1f ms, longest of %d compositor "
+		"round trips %.2f ms\n", count,
+		timespec_sub_to_nsec(&end, &begin) / 1e6, roundtrips,
+		max_stall / 1e6);
+
+	for (i = 0; i < count; i++)
+		XDestroyWindow(display, windows[i]);
+	XCloseDisplay(display);
+	client_destroy(client);
+}
+
+#define CLIPBOARD_SIZE (100 * 1024 * 1024)
+#define CLIPBOARD_WRITE_SIZE (64 * 1024)
+
+/* Serves the Wayland selection: the clipboard manager and the window
+ * manager may both ask for a copy. */
+struct clipboard_sender {
+	int fds[4];
+	size_t written[4];
+	char pattern[CLIPBOARD_WRITE_SIZE + 26];
+};
+
+static char
+clipboard_byte(size_t offset)
+{
+	return 'a' + offset % 26;
+}
+
+static void
+clipboard_source_target(void *data, struct wl_data_source *source,
+			const char *mime_type)
+{
+}
+
+static void
+clipboard_source_send(void *data, struct wl_data_source *source,
+		      const char *mime_type, int32_t fd)
+{
+	struct clipboard_sender *sender = data;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(sender->fds); i++) {
+		if (sender->fds[i] != -1)
+			continue;
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		sender->fds[i] = fd;
+		sender->written[i] = 0;
+		return;
+	}
+
+	close(fd);
+}
+
+static void
+clipboard_source_cancelled(void *data, struct wl_data_source *source)
+{
+}
+
+static const struct wl_data_source_listener clipboard_source_listener = {
+	clipboard_source_target,
+	clipboard_source_send,
+	clipboard_source_cancelled,
+};
+
+static void
+clipboard_sender_write(struct clipboard_sender *sender)
+{
+	unsigned int i;
+	size_t len;
+	ssize_t ret;
+
+	for (i = 0; i < ARRAY_LENGTH(sender->fds); i++) {
+		while (sender->fds[i] != -1) {
+			len = MIN(CLIPBOARD_SIZE - sender->written[i],
+				  CLIPBOARD_WRITE_SIZE);
+			ret = write(sender->fds[i],
+				    sender->pattern + sender->written[i] % 26,
+				    len);
+			if (ret == -1 && errno == EAGAIN)
+				break;
+
+			if (ret > 0)
+				sender->written[i] += ret;
+			if (ret == -1 || sender->written[i] == CLIPBOARD_SIZE) {
+				close(sender->fds[i]);
+				sender->fds[i] = -1;
+			}
+		}
+	}
+}
+
+/* Takes the selection property, returns the number of bytes in it */
+static size_t
+clipboard_receive(Display *display, Window window, Atom property,
+		  Atom *type, size_t offset)
+{
+	unsigned long nitems, bytes, i;
+	unsigned char *value;
+	int status, format;
+
+	status = XGetWindowProperty(display, window, property, 0L, 0x1fffffffL,
+				    True, AnyPropertyType, type, &format,
+				    &nitems, &bytes, &value);
+	assert(status == Success);
+	assert(bytes == 0);
+
+	if (*type == XInternAtom(display, "INCR", False))
+		nitems = 0;
+	for (i = 0; i < nitems; i++)
+		assert(value[i] == clipboard_byte(offset + i));
+	XFree(value);
+
+	return nitems;
+}
+
+/* Not a pass/fail criterion on timing: moves 100 MB from a Wayland
+ * selection through the window manager to an X11 client. */
+TEST(xwayland_clipboard_throughput)
+{
+	struct client *client;
+	struct wl_data_device_manager *manager;
+	struct wl_data_device *device;
+	struct wl_data_source *source;
+	struct clipboard_sender sender;
+	Display *display;
+	Window window;
+	Atom clipboard, utf8_string, property, incr, type;
+	XEvent event;
+	struct pollfd pfd[2 + ARRAY_LENGTH(sender.fds)];
+	struct timespec begin, end;
+	size_t received = 0, n;
+	bool incremental = false, done = false;
+	unsigned int i, nfds;
+	int64_t nsec;
+
+	if (access(XSERVER_PATH, X_OK) != 0)
+		exit(77);
+
+	for (i = 0; i < ARRAY_LENGTH(sender.pattern); i++)
+		sender.pattern[i] = clipboard_byte(i);
+	for (i = 0; i < ARRAY_LENGTH(sender.fds); i++)
+		sender.fds[i] = -1;
+
+	client = create_client();
+	manager = bind_to_singleton_global(client,
+					   &wl_data_device_manager_interface, 1);
+	device = wl_data_device_manager_get_data_device(manager,
+							client->input->wl_seat);
+	source = wl_data_device_manager_create_data_source(manager);
+	wl_data_source_add_listener(source, &clipboard_source_listener,
+				    &sender);
+	wl_data_source_offer(source, "text/plain;charset=utf-8");
+	wl_data_device_set_selection(device, source, 0);
+
+	display = XOpenDisplay(NULL);
+	assert(display);
+	clipboard = XInternAtom(display, "CLIPBOARD", False);
+	utf8_string = XInternAtom(display, "UTF8_STRING", False);
+	property = XInternAtom(display, "WESTON_TEST_SELECTION", False);
+	incr = XInternAtom(display, "INCR", False);
+	window = XCreateSimpleWindow(display, DefaultRootWindow(display),
+				     0, 0, 1, 1, 0, 0, 0);
+	XSelectInput(display, window, PropertyChangeMask);
+
+	/* The window manager claims the X selection for the Wayland one */
+	do {
+		wl_display_roundtrip(client->wl_display);
+		clipboard_sender_write(&sender);
+	} while (XGetSelectionOwner(display, clipboard) == None);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	XConvertSelection(display, clipboard, utf8_string, property, window,
+			  CurrentTime);
+	XFlush(display);
+
+	while (!done) {
+		while (!done && XPending(display)) {
+			XNextEvent(display, &event);
+			if (event.type == SelectionNotify) {
+				assert(event.xselection.property == property);
+				n = clipboard_receive(display, window, property,
+						      &type, received);
+				received += n;
+				incremental = type == incr;
+				done = !incremental;
+			} else if (event.type == PropertyNotify &&
+				   event.xproperty.atom == property &&
+				   event.xproperty.state == PropertyNewValue &&
+				   incremental) {
+				n = clipboard_receive(display, window, property,
+						      &type, received);
+				received += n;
+				done = n == 0;
+			}
+		}
+		if (done)
+			break;
+
+		pfd[0].fd = ConnectionNumber(display);
+		pfd[0].events = POLLIN;
+		pfd[1].fd = wl_display_get_fd(client->wl_display);
+		pfd[1].events = POLLIN;
+		nfds = 2;
+		for (i = 0; i < ARRAY_LENGTH(sender.fds); i++) {
+			if (sender.fds[i] == -1)
+				continue;
+			pfd[nfds].fd = sender.fds[i];
+			pfd[nfds].events = POLLOUT;
+			nfds++;
+		}
+
+		wl_display_flush(client->wl_display);
+		assert(poll(pfd, nfds, -1) > 0);
+
+		if (pfd[1].revents & POLLIN)
+			assert(wl_display_dispatch(client->wl_display) >= 0);
+		clipboard_sender_write(&sender);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	assert(received == CLIPBOARD_SIZE);
+
+	nsec = timespec_sub_to_nsec(&end, &begin);
+	testlog("%d MB %s transfer in %.1f ms, %.1f MB/s\n",
+		CLIPBOARD_SIZE / (1024 * 1024),
+		incremental ? "incremental" : "single property",
+		nsec / 1e6, CLIPBOARD_SIZE / (1024.0 * 1024.0) / (nsec / 1e9));
+
+	for (i = 0; i < ARRAY_LENGTH(sender.fds); i++)
+		if (sender.fds[i] != -1)
+			close(sender.fds[i]);
+	XDestroyWindow(display, window);
+	XCloseDisplay(display);
+	wl_data_source_destroy(source);
+	wl_data_device_destroy(device);
+	wl_data_device_manager_destroy(manager);
+	client_destroy(client);
+}
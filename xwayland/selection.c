@@ -25,6 +25,7 @@
 
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,8 +39,10 @@
 
 #ifdef WM_DEBUG
 #define wm_log(...) weston_log(__VA_ARGS__)
+#define wm_log_continue(...) weston_log_continue(__VA_ARGS__)
 #else
 #define wm_log(...) do {} while (0)
+#define wm_log_continue(...) do {} while (0)
 #endif
 
 static int
@@ -65,9 +68,9 @@ writable_callback(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("wrote %d (chunk size %d) of %d bytes\n",
-		wm->property_start + len,
-		len, xcb_get_property_value_length(wm->property_reply));
+	wm_log("wrote %d (chunk size %d) of %d bytes\n",
+	       wm->property_start + len,
+	       len, xcb_get_property_value_length(wm->property_reply));
 
 	wm->property_start += len;
 	if (len == remainder) {
@@ -82,7 +85,7 @@ writable_callback(int fd, uint32_t mask, void *data)
 					    wm->selection_window,
 					    wm->atom.wl_selection);
 		} else {
-			weston_log("transfer complete\n");
+			wm_log("transfer complete\n");
 			close(fd);
 		}
 	}
@@ -90,6 +93,27 @@ writable_callback(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+/* Dumping a property looks up atom names with a round trip each, so only
+ * do it when the log is going anywhere. */
+static void
+weston_wm_dump_selection_property(struct weston_wm *wm,
+				  xcb_get_property_reply_t *reply)
+{
+#ifdef WM_DEBUG
+	FILE *fp;
+	char *logstr;
+	size_t logsize;
+
+	fp = open_memstream(&logstr, &logsize);
+	if (fp) {
+		dump_property(fp, wm, wm->atom.wl_selection, reply);
+		if (fclose(fp) == 0)
+			wm_log("%s", logstr);
+		free(logstr);
+	}
+#endif
+}
+
 static void
 weston_wm_write_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
 {
@@ -110,9 +134,6 @@ weston_wm_get_incr_chunk(struct weston_wm *wm)
 {
 	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
-	FILE *fp;
-	char *logstr;
-	size_t logsize;
 
 	cookie = xcb_get_property(wm->conn,
 				  0, /* delete */
@@ -126,20 +147,14 @@ weston_wm_get_incr_chunk(struct weston_wm *wm)
 	if (reply == NULL)
 		return;
 
-	fp = open_memstream(&logstr, &logsize);
-	if (fp) {
-		dump_property(fp, wm, wm->atom.wl_selection, reply);
-		if (fclose(fp) == 0)
-			wm_log("%s", logstr);
-		free(logstr);
-	}
+	weston_wm_dump_selection_property(wm, reply);
 
 	if (xcb_get_property_value_length(reply) > 0) {
 		/* reply's ownership is transferred to wm, which is responsible
 		 * for freeing it */
 		weston_wm_write_property(wm, reply);
 	} else {
-		weston_log("transfer complete\n");
+		wm_log("transfer complete\n");
 		close(wm->data_source_fd);
 		free(reply);
 	}
@@ -195,9 +210,6 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 	xcb_atom_t *value;
 	char **p;
 	uint32_t i;
-	FILE *fp;
-	char *logstr;
-	size_t logsize;
 
 	cookie = xcb_get_property(wm->conn,
 				  1, /* delete */
@@ -211,13 +223,7 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 	if (reply == NULL)
 		return;
 
-	fp = open_memstream(&logstr, &logsize);
-	if (fp) {
-		dump_property(fp, wm, wm->atom.wl_selection, reply);
-		if (fclose(fp) == 0)
-			wm_log("%s", logstr);
-		free(logstr);
-	}
+	weston_wm_dump_selection_property(wm, reply);
 
 	if (reply->type != XCB_ATOM_ATOM) {
 		free(reply);
@@ -258,9 +264,6 @@ weston_wm_get_selection_data(struct weston_wm *wm)
 {
 	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
-	FILE *fp;
-	char *logstr;
-	size_t logsize;
 
 	cookie = xcb_get_property(wm->conn,
 				  1, /* delete */
@@ -272,13 +275,7 @@ weston_wm_get_selection_data(struct weston_wm *wm)
 
 	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
 
-	fp = open_memstream(&logstr, &logsize);
-	if (fp) {
-		dump_property(fp, wm, wm->atom.wl_selection, reply);
-		if (fclose(fp) == 0)
-			wm_log("%s", logstr);
-		free(logstr);
-	}
+	weston_wm_dump_selection_property(wm, reply);
 
 	if (reply == NULL) {
 		return;
@@ -309,7 +306,15 @@ weston_wm_handle_selection_notify(struct weston_wm *wm,
 	}
 }
 
-static const size_t incr_chunk_size = 64 * 1024;
+/* Data from Wayland goes out as a single property if it fits in the first
+ * chunk, and incrementally otherwise. The chunk size doubles every time
+ * the requestor takes a chunk, up to the largest property one X request
+ * can carry, so that big transfers need few round trips. */
+#define INCR_CHUNK_SIZE_MIN (64 * 1024)
+#define INCR_CHUNK_SIZE_MAX (8 * 1024 * 1024)
+
+/* Lets the data source write a whole chunk without waking us up */
+#define SOURCE_PIPE_SIZE (1024 * 1024)
 
 static void
 weston_wm_send_selection_notify(struct weston_wm *wm, xcb_atom_t property)
@@ -384,6 +389,10 @@ weston_wm_flush_source_data(struct weston_wm *wm)
 	length = wm->source_data.size;
 	wm->source_data.size = 0;
 
+	if (wm->incr)
+		wm->incr_chunk_size = MIN(wm->incr_chunk_size * 2,
+					  wm->incr_chunk_max);
+
 	return length;
 }
 
@@ -391,45 +400,50 @@ static int
 weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 {
 	struct weston_wm *wm = data;
-	int len, current, available;
+	size_t current, available;
+	uint32_t incr_size;
+	bool eof = false;
+	ssize_t len;
 	void *p;
 
-	current = wm->source_data.size;
-	if (wm->source_data.size < incr_chunk_size)
-		p = wl_array_add(&wm->source_data, incr_chunk_size);
-	else
-		p = (char *) wm->source_data.data + wm->source_data.size;
-	available = wm->source_data.alloc - current;
-
-	len = read(fd, p, available);
-	if (len == -1) {
-		weston_log("read error from data source: %s\n",
-			   strerror(errno));
-		weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
-		if (wm->property_source)
-			wl_event_source_remove(wm->property_source);
-		wm->property_source = NULL;
-		close(fd);
-		wl_array_release(&wm->source_data);
-		return 1;
+	/* Fill the chunk as far as the source allows without blocking */
+	while (wm->source_data.size < wm->incr_chunk_size) {
+		current = wm->source_data.size;
+		available = wm->incr_chunk_size - current;
+		p = wl_array_add(&wm->source_data, available);
+		if (p == NULL)
+			goto err;
+
+		len = read(fd, p, available);
+		wm->source_data.size = current;
+		if (len == -1 && errno == EAGAIN)
+			break;
+		if (len == -1)
+			goto err;
+		if (len == 0) {
+			eof = true;
+			break;
+		}
+		wm->source_data.size += len;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	wm_log("read %zu bytes (chunk size %u, mask 0x%x)\n",
+	       wm->source_data.size, wm->incr_chunk_size, mask);
 
-	wm->source_data.size = current + len;
-	if (wm->source_data.size >= incr_chunk_size) {
+	if (wm->source_data.size >= wm->incr_chunk_size) {
 		if (!wm->incr) {
-			weston_log("got %zu bytes, starting incr\n",
-				wm->source_data.size);
+			wm_log("got %zu bytes, starting incr\n",
+			       wm->source_data.size);
 			wm->incr = 1;
+			/* a lower bound on the total size */
+			incr_size = wm->source_data.size;
 			xcb_change_property(wm->conn,
 					    XCB_PROP_MODE_REPLACE,
 					    wm->selection_request.requestor,
 					    wm->selection_request.property,
 					    wm->atom.incr,
 					    32, /* format */
-					    1, &incr_chunk_size);
+					    1, &incr_size);
 			wm->selection_property_set = 1;
 			wm->flush_property_on_delete = 1;
 			if (wm->property_source)
@@ -437,21 +451,21 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 			wm->property_source = NULL;
 			weston_wm_send_selection_notify(wm, wm->selection_request.property);
 		} else if (wm->selection_property_set) {
-			weston_log("got %zu bytes, waiting for "
-				"property delete\n", wm->source_data.size);
+			wm_log("got %zu bytes, waiting for "
+			       "property delete\n", wm->source_data.size);
 
 			wm->flush_property_on_delete = 1;
 			if (wm->property_source)
 				wl_event_source_remove(wm->property_source);
 			wm->property_source = NULL;
 		} else {
-			weston_log("got %zu bytes, "
-				"property deleted, setting new property\n",
-				wm->source_data.size);
+			wm_log("got %zu bytes, "
+			       "property deleted, setting new property\n",
+			       wm->source_data.size);
 			weston_wm_flush_source_data(wm);
 		}
-	} else if (len == 0 && !wm->incr) {
-		weston_log("non-incr transfer complete\n");
+	} else if (eof && !wm->incr) {
+		wm_log("non-incr transfer complete\n");
 		/* Non-incr transfer all done. */
 		weston_wm_flush_source_data(wm);
 		weston_wm_send_selection_notify(wm, wm->selection_request.property);
@@ -462,17 +476,17 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		close(fd);
 		wl_array_release(&wm->source_data);
 		wm->selection_request.requestor = XCB_NONE;
-	} else if (len == 0 && wm->incr) {
-		weston_log("incr transfer complete\n");
+	} else if (eof && wm->incr) {
+		wm_log("incr transfer complete\n");
 
 		wm->flush_property_on_delete = 1;
 		if (wm->selection_property_set) {
-			weston_log("got %zu bytes, waiting for "
-				"property delete\n", wm->source_data.size);
+			wm_log("got %zu bytes, waiting for "
+			       "property delete\n", wm->source_data.size);
 		} else {
-			weston_log("got %zu bytes, "
-				"property deleted, setting new property\n",
-				wm->source_data.size);
+			wm_log("got %zu bytes, "
+			       "property deleted, setting new property\n",
+			       wm->source_data.size);
 			weston_wm_flush_source_data(wm);
 		}
 		xcb_flush(wm->conn);
@@ -483,10 +497,20 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		wm->data_source_fd = -1;
 		close(fd);
 	} else {
-		weston_log("nothing happened, buffered the bytes\n");
+		wm_log("nothing happened, buffered the bytes\n");
 	}
 
 	return 1;
+
+err:
+	weston_log("read error from data source: %s\n", strerror(errno));
+	weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
+	if (wm->property_source)
+		wl_event_source_remove(wm->property_source);
+	wm->property_source = NULL;
+	close(fd);
+	wl_array_release(&wm->source_data);
+	return 1;
 }
 
 static void
@@ -502,7 +526,13 @@ weston_wm_send_data(struct weston_wm *wm, xcb_atom_t target, const char *mime_ty
 		return;
 	}
 
+#ifdef F_SETPIPE_SZ
+	/* Best effort, the default pipe size works too */
+	fcntl(p[0], F_SETPIPE_SZ, SOURCE_PIPE_SIZE);
+#endif
+
 	wl_array_init(&wm->source_data);
+	wm->incr_chunk_size = INCR_CHUNK_SIZE_MIN;
 	wm->selection_target = target;
 	wm->data_source_fd = p[0];
 	wm->property_source = wl_event_loop_add_fd(wm->server->loop,
@@ -521,12 +551,12 @@ weston_wm_send_incr_chunk(struct weston_wm *wm)
 {
 	int length;
 
-	weston_log("property deleted\n");
+	wm_log("property deleted\n");
 
 	wm->selection_property_set = 0;
 	if (wm->flush_property_on_delete) {
-		weston_log("setting new property, %zu bytes\n",
-			wm->source_data.size);
+		wm_log("setting new property, %zu bytes\n",
+		       wm->source_data.size);
 		wm->flush_property_on_delete = 0;
 		length = weston_wm_flush_source_data(wm);
 
@@ -581,12 +611,13 @@ weston_wm_handle_selection_request(struct weston_wm *wm,
 	xcb_selection_request_event_t *selection_request =
 		(xcb_selection_request_event_t *) event;
 
-	weston_log("selection request, %s, ",
-		get_atom_name(wm->conn, selection_request->selection));
-	weston_log_continue("target %s, ",
-		get_atom_name(wm->conn, selection_request->target));
-	weston_log_continue("property %s\n",
-		get_atom_name(wm->conn, selection_request->property));
+	/* get_atom_name() returns a static buffer, so one name per call */
+	wm_log("selection request, %s, ",
+	       get_atom_name(wm->conn, selection_request->selection));
+	wm_log_continue("target %s, ",
+			get_atom_name(wm->conn, selection_request->target));
+	wm_log_continue("property %s\n",
+			get_atom_name(wm->conn, selection_request->property));
 
 	wm->selection_request = *selection_request;
 	wm->incr = 0;
@@ -715,16 +746,23 @@ weston_wm_set_selection(struct wl_listener *listener, void *data)
 				wm->selection_window,
 				wm->atom.clipboard,
 				XCB_TIME_CURRENT_TIME);
+	xcb_flush(wm->conn);
 }
 
 void
 weston_wm_selection_init(struct weston_wm *wm)
 {
 	struct weston_seat *seat;
-	uint32_t values[1], mask;
+	uint32_t values[1], mask, max_request;
 
 	wl_list_init(&wm->selection_listener.link);
 
+	/* In bytes, minus the ChangeProperty request header */
+	max_request = xcb_get_maximum_request_length(wm->conn) * 4;
+	wm->incr_chunk_max = max_request - sizeof(xcb_change_property_request_t);
+	wm->incr_chunk_max = MIN(wm->incr_chunk_max, INCR_CHUNK_SIZE_MAX);
+	wm->incr_chunk_max = MAX(wm->incr_chunk_max, INCR_CHUNK_SIZE_MIN);
+
 	wm->selection_request.requestor = XCB_NONE;
 
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
@@ -146,6 +146,10 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	struct weston_wm_property_fetch *properties_fetch;
+	/* Waiting for properties_fetch */
+	bool map_request_pending;
+	bool map_shell_surface_pending;
 	int pid;
 	char *machine;
 	char *class;
@@ -196,6 +200,15 @@ static void
 xserver_map_shell_surface(struct weston_wm_window *window,
 			  struct weston_surface *surface);
 
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window);
+
+static void
+weston_wm_window_map_request(struct weston_wm_window *window);
+
+static void
+weston_wm_window_map_shell_surface(struct weston_wm_window *window);
+
 static bool
 wm_debug_is_enabled(struct weston_wm *wm)
 {
@@ -494,26 +507,154 @@ read_and_dump_property(FILE *fp, struct weston_wm *wm,
 	free(reply);
 }
 
+/** Handles the reply to a queued request, see weston_wm_queue_reply()
+ *
+ * @param reply The reply, owned by the handler, or NULL on error.
+ */
+typedef void (*weston_wm_reply_func_t)(struct weston_wm_window *window,
+				       void *reply, void *data);
+
+/** A request whose reply is handled once it arrives
+ *
+ * Waiting for replies right away stalls the whole compositor on Xwayland
+ * round trips. Instead, requests are queued in the order they were sent,
+ * and weston_wm_handle_event() hands out the replies as they come in.
+ */
+struct weston_wm_pending_reply {
+	struct wl_list link; /* weston_wm::pending_replies */
+	unsigned int sequence;
+	struct weston_wm_window *window;
+	weston_wm_reply_func_t handler;
+	void *data;
+};
+
+/** Queue the handler for the reply to a request
+ *
+ * @return false if the reply could not be queued. It is then discarded,
+ * and the handler is never called.
+ */
+static bool
+weston_wm_queue_reply(struct weston_wm_window *window, unsigned int sequence,
+		      weston_wm_reply_func_t handler, void *data)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_pending_reply *pending;
+
+	pending = zalloc(sizeof *pending);
+	if (!pending) {
+		xcb_discard_reply(wm->conn, sequence);
+		return false;
+	}
+
+	pending->sequence = sequence;
+	pending->window = window;
+	pending->handler = handler;
+	pending->data = data;
+	wl_list_insert(wm->pending_replies.prev, &pending->link);
+
+	return true;
+}
+
+/** Drop the replies a window is still waiting for
+ *
+ * @param handler Only drop the replies for this handler, or all of them
+ * if NULL.
+ */
+static void
+weston_wm_window_cancel_replies(struct weston_wm_window *window,
+				weston_wm_reply_func_t handler)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_pending_reply *pending, *tmp;
+
+	wl_list_for_each_safe(pending, tmp, &wm->pending_replies, link) {
+		if (pending->window != window)
+			continue;
+		if (handler && pending->handler != handler)
+			continue;
+
+		xcb_discard_reply(wm->conn, pending->sequence);
+		wl_list_remove(&pending->link);
+		free(pending);
+	}
+}
+
+/** Hand out the replies which have arrived, in request order
+ *
+ * @return The number of replies handled.
+ */
+static int
+weston_wm_dispatch_replies(struct weston_wm *wm)
+{
+	struct weston_wm_pending_reply *pending;
+	xcb_generic_error_t *error;
+	void *reply;
+	int count = 0;
+
+	/* Handlers may cancel any other pending replies, so always start
+	 * over from the head of the queue. */
+	while (!wl_list_empty(&wm->pending_replies)) {
+		pending = container_of(wm->pending_replies.next,
+				       struct weston_wm_pending_reply, link);
+		if (!xcb_poll_for_reply(wm->conn, pending->sequence,
+					&reply, &error))
+			break;
+
+		free(error);
+		wl_list_remove(&pending->link);
+		pending->handler(pending->window, reply, pending->data);
+		free(pending);
+		count++;
+	}
+
+	return count;
+}
+
+static void
+weston_wm_window_handle_geometry_reply(struct weston_wm_window *window,
+				       void *reply, void *data)
+{
+	xcb_get_geometry_reply_t *geometry_reply = reply;
+
+	/* technically we should use XRender and check the visual format's
+	alpha_mask, but checking depth is simpler and works in all known cases */
+	if (geometry_reply != NULL)
+		window->has_alpha = geometry_reply->depth == 32;
+	free(geometry_reply);
+}
+
 /* We reuse some predefined, but otherwise useles atoms
  * as local type placeholders that never touch the X11 server,
- * to make weston_wm_window_read_properties() less exceptional.
+ * to make weston_wm_window_apply_properties() less exceptional.
  */
 #define TYPE_WM_PROTOCOLS	XCB_ATOM_CUT_BUFFER0
 #define TYPE_MOTIF_WM_HINTS	XCB_ATOM_CUT_BUFFER1
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+#define WM_WINDOW_PROPERTY_COUNT 11
+
+struct weston_wm_property {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	void *ptr;
+};
+
+/** Properties of a window being read, see
+ * weston_wm_window_fetch_properties() */
+struct weston_wm_property_fetch {
+	xcb_get_property_reply_t *replies[WM_WINDOW_PROPERTY_COUNT];
+	int remaining;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_window_get_properties(struct weston_wm_window *window,
+				struct weston_wm_property *props)
 {
 	struct weston_wm *wm = window->wm;
 
 #define F(field) (&window->field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		void *ptr;
-	} props[] = {
+	const struct weston_wm_property table[] = {
 		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
 		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
@@ -528,24 +669,25 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	static_assert(ARRAY_LENGTH(table) == WM_WINDOW_PROPERTY_COUNT,
+		      "property table size mismatch");
+	memcpy(props, table, sizeof table);
+}
+
+static void
+weston_wm_window_apply_properties(struct weston_wm_window *window,
+				  xcb_get_property_reply_t **replies)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property props[WM_WINDOW_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t i, j;
 	char name[1024];
 
-	if (!window->properties_dirty)
-		return;
-	window->properties_dirty = 0;
-
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_get_properties(window, props);
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -553,15 +695,13 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = replies[i];
 		if (!reply)
 			/* Bad window, typically */
 			continue;
-		if (reply->type == XCB_ATOM_NONE) {
+		if (reply->type == XCB_ATOM_NONE)
 			/* No such property */
-			free(reply);
 			continue;
-		}
 
 		p = props[i].ptr;
 
@@ -590,8 +730,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
 					break;
 				}
@@ -604,12 +744,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -630,7 +770,6 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		default:
 			break;
 		}
-		free(reply);
 	}
 
 	if (window->pid > 0) {
@@ -650,6 +789,103 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	}
 }
 
+static void
+weston_wm_window_property_fetch_destroy(struct weston_wm_window *window)
+{
+	struct weston_wm_property_fetch *fetch = window->properties_fetch;
+	int i;
+
+	for (i = 0; i < WM_WINDOW_PROPERTY_COUNT; i++)
+		free(fetch->replies[i]);
+	free(fetch);
+	window->properties_fetch = NULL;
+}
+
+static void
+weston_wm_window_handle_property_reply(struct weston_wm_window *window,
+				       void *reply, void *data)
+{
+	struct weston_wm_property_fetch *fetch = window->properties_fetch;
+	xcb_get_property_reply_t **slot = data;
+
+	*slot = reply;
+	if (--fetch->remaining > 0)
+		return;
+
+	weston_wm_window_apply_properties(window, fetch->replies);
+	weston_wm_window_property_fetch_destroy(window);
+
+	wm_printf(window->wm, "XWM: win %d properties read\n", window->id);
+
+	/* Mapping wants the latest properties, as it did when they were
+	 * read synchronously. */
+	if (window->map_request_pending || window->map_shell_surface_pending) {
+		weston_wm_window_fetch_properties(window);
+		if (window->properties_fetch)
+			return;
+	}
+
+	/* Whatever waited for the properties, in the order it would have
+	 * happened. The repaint picks up e.g. a new title. */
+	if (window->map_request_pending) {
+		window->map_request_pending = false;
+		weston_wm_window_map_request(window);
+	}
+	if (window->map_shell_surface_pending) {
+		window->map_shell_surface_pending = false;
+		if (window->surface)
+			weston_wm_window_map_shell_surface(window);
+	}
+	weston_wm_window_schedule_repaint(window);
+}
+
+/** Start reading the window properties if they changed
+ *
+ * The properties are applied all at once when the last reply arrives;
+ * until then, window->properties_fetch is set. Changes while a read is
+ * in flight are picked up by the next one.
+ */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property props[WM_WINDOW_PROPERTY_COUNT];
+	struct weston_wm_property_fetch *fetch;
+	xcb_get_property_cookie_t cookie;
+	uint32_t i;
+
+	if (!window->properties_dirty || window->properties_fetch)
+		return;
+
+	fetch = zalloc(sizeof *fetch);
+	if (!fetch)
+		return;
+
+	window->properties_dirty = 0;
+	window->properties_fetch = fetch;
+	fetch->remaining = ARRAY_LENGTH(props);
+
+	weston_wm_window_get_properties(window, props);
+	for (i = 0; i < ARRAY_LENGTH(props); i++) {
+		cookie = xcb_get_property(wm->conn,
+					  0, /* delete */
+					  window->id,
+					  props[i].atom,
+					  XCB_ATOM_ANY, 0, 2048);
+		if (!weston_wm_queue_reply(window, cookie.sequence,
+					   weston_wm_window_handle_property_reply,
+					   &fetch->replies[i])) {
+			/* give up, and read them all on the next change */
+			weston_wm_window_cancel_replies(window,
+				weston_wm_window_handle_property_reply);
+			weston_wm_window_property_fetch_destroy(window);
+			window->properties_dirty = 1;
+			break;
+		}
+	}
+	xcb_flush(wm->conn);
+}
+
 #undef TYPE_WM_PROTOCOLS
 #undef TYPE_MOTIF_WM_HINTS
 #undef TYPE_NET_WM_STATE
@@ -1166,7 +1402,6 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	xcb_map_request_event_t *map_request =
 		(xcb_map_request_event_t *) event;
 	struct weston_wm_window *window;
-	struct weston_output *output;
 
 	if (our_resource(wm, map_request->window)) {
 		wm_printf(wm, "XCB_MAP_REQUEST (window %d, ours)\n",
@@ -1177,7 +1412,22 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	if (!wm_lookup_window(wm, map_request->window, &window))
 		return;
 
-	weston_wm_window_read_properties(window);
+	weston_wm_window_fetch_properties(window);
+	if (window->properties_fetch) {
+		wm_printf(wm, "XCB_MAP_REQUEST (window %d), waiting for "
+			  "properties\n", window->id);
+		window->map_request_pending = true;
+		return;
+	}
+
+	weston_wm_window_map_request(window);
+}
+
+static void
+weston_wm_window_map_request(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_output *output;
 
 	/* For a new Window, MapRequest happens before the Window is realized
 	 * in Xwayland. We do the real xcb_map_window() here as a response to
@@ -1215,7 +1465,7 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 					   output);
 	}
 
-	xcb_map_window(wm->conn, map_request->window);
+	xcb_map_window(wm->conn, window->id);
 	xcb_map_window(wm->conn, window->frame_id);
 
 	/* Mapped in the X server, we can draw immediately.
@@ -1381,7 +1631,7 @@ weston_wm_window_do_repaint(void *data)
 	window->repaint_source = NULL;
 
 	weston_wm_window_set_allow_commits(window, false);
-	weston_wm_window_read_properties(window);
+	weston_wm_window_fetch_properties(window);
 
 	weston_wm_window_draw_decoration(window);
 	weston_wm_window_set_pending_state(window);
@@ -1469,12 +1719,6 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 			weston_log_scope_write(wm->server->wm_debug,
 						 logstr, logsize);
 		free(logstr);
-	} else {
-		/* read_and_dump_property() is a X11 roundtrip.
-		 * Mimic it to maintain ordering semantics between debug
-		 * and non-debug paths.
-		 */
-		get_atom_name(wm->conn, property_notify->atom);
 	}
 
 	if (property_notify->atom == wm->atom.net_wm_name ||
@@ -1489,7 +1733,6 @@ weston_wm_window_create(struct weston_wm *wm,
 	struct weston_wm_window *window;
 	uint32_t values[1];
 	xcb_get_geometry_cookie_t geometry_cookie;
-	xcb_get_geometry_reply_t *geometry_reply;
 
 	window = zalloc(sizeof *window);
 	if (window == NULL) {
@@ -1516,12 +1759,8 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->map_request_y = INT_MIN; /* out of range for valid positions */
 	weston_output_weak_ref_init(&window->legacy_fullscreen_output);
 
-	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
-	/* technically we should use XRender and check the visual format's
-	alpha_mask, but checking depth is simpler and works in all known cases */
-	if (geometry_reply != NULL)
-		window->has_alpha = geometry_reply->depth == 32;
-	free(geometry_reply);
+	weston_wm_queue_reply(window, geometry_cookie.sequence,
+			      weston_wm_window_handle_geometry_reply, NULL);
 
 	hash_table_insert(wm->window_hash, id, window);
 }
@@ -1533,6 +1772,10 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 
 	weston_output_weak_ref_clear(&window->legacy_fullscreen_output);
 
+	weston_wm_window_cancel_replies(window, NULL);
+	if (window->properties_fetch)
+		weston_wm_window_property_fetch_destroy(window);
+
 	if (window->configure_source)
 		wl_event_source_remove(window->configure_source);
 	if (window->repaint_source)
@@ -2256,6 +2499,26 @@ weston_wm_handle_focus_in(struct weston_wm *wm, xcb_generic_event_t *event)
 		weston_wm_send_focus_window(wm, wm->focus_window);
 }
 
+/** Get the next X event, handing out the replies once there is none left
+ *
+ * Polling for events reads in replies as well, and polling for replies
+ * reads in events. Events read that way get no wakeup of their own, so
+ * check for them again after the replies.
+ */
+static xcb_generic_event_t *
+weston_wm_poll_for_event(struct weston_wm *wm, int *count)
+{
+	xcb_generic_event_t *event;
+
+	event = xcb_poll_for_event(wm->conn);
+	if (event)
+		return event;
+
+	*count += weston_wm_dispatch_replies(wm);
+
+	return xcb_poll_for_queued_event(wm->conn);
+}
+
 static int
 weston_wm_handle_event(int fd, uint32_t mask, void *data)
 {
@@ -2263,7 +2526,7 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 	xcb_generic_event_t *event;
 	int count = 0;
 
-	while (event = xcb_poll_for_event(wm->conn), event != NULL) {
+	while (event = weston_wm_poll_for_event(wm, &count), event != NULL) {
 		if (weston_wm_handle_selection_event(wm, event)) {
 			free(event);
 			count++;
@@ -2583,6 +2846,7 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 		return NULL;
 
 	wm->server = wxs;
+	wl_list_init(&wm->pending_replies);
 	wm->window_hash = hash_table_create();
 	if (wm->window_hash == NULL) {
 		free(wm);
@@ -2672,6 +2936,11 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 void
 weston_wm_destroy(struct weston_wm *wm)
 {
+	struct weston_wm_pending_reply *pending, *tmp;
+
+	wl_list_for_each_safe(pending, tmp, &wm->pending_replies, link)
+		free(pending);
+
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
 	weston_wm_destroy_cursors(wm);
@@ -2902,12 +3171,16 @@ static void
 xserver_map_shell_surface(struct weston_wm_window *window,
 			  struct weston_surface *surface)
 {
-	struct weston_wm *wm = window->wm;
-	struct weston_desktop_xwayland *xwayland =
-		wm->server->compositor->xwayland;
-	const struct weston_desktop_xwayland_interface *xwayland_interface =
-		wm->server->compositor->xwayland_interface;
-	struct weston_wm_window *parent;
+	/* A weston_wm_window may have many different surfaces assigned
+	 * throughout its life, so we must make sure to remove the listener
+	 * from the old surface signal list. */
+	if (window->surface)
+		wl_list_remove(&window->surface_destroy_listener.link);
+
+	window->surface = surface;
+	window->surface_destroy_listener.notify = surface_destroy;
+	wl_signal_add(&window->surface->destroy_signal,
+		      &window->surface_destroy_listener);
 
 	/* This should be necessary only for override-redirected windows,
 	 * because otherwise MapRequest handler would have already updated
@@ -2918,18 +3191,26 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 	 * We only hit xserver_map_shell_surface() once per MapWindow and
 	 * wl_surface, so better ensure we get the window type right.
 	 */
-	weston_wm_window_read_properties(window);
+	weston_wm_window_fetch_properties(window);
+	if (window->properties_fetch) {
+		wm_printf(window->wm, "XWM: win %d waiting for properties "
+			  "to map shell surface\n", window->id);
+		window->map_shell_surface_pending = true;
+		return;
+	}
 
-	/* A weston_wm_window may have many different surfaces assigned
-	 * throughout its life, so we must make sure to remove the listener
-	 * from the old surface signal list. */
-	if (window->surface)
-		wl_list_remove(&window->surface_destroy_listener.link);
+	weston_wm_window_map_shell_surface(window);
+}
 
-	window->surface = surface;
-	window->surface_destroy_listener.notify = surface_destroy;
-	wl_signal_add(&window->surface->destroy_signal,
-		      &window->surface_destroy_listener);
+static void
+weston_wm_window_map_shell_surface(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_desktop_xwayland *xwayland =
+		wm->server->compositor->xwayland;
+	const struct weston_desktop_xwayland_interface *xwayland_interface =
+		wm->server->compositor->xwayland_interface;
+	struct weston_wm_window *parent;
 
 	if (!xwayland_interface)
 		return;
@@ -75,6 +75,8 @@ struct weston_wm {
 	struct wl_listener activate_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	/* struct weston_wm_pending_reply::link, in request order */
+	struct wl_list pending_replies;
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;
@@ -84,6 +86,9 @@ struct weston_wm {
 	xcb_get_property_reply_t *property_reply;
 	int property_start;
 	struct wl_array source_data;
+	/* bytes per INCR property chunk, grows up to incr_chunk_max */
+	uint32_t incr_chunk_size;
+	uint32_t incr_chunk_max;
 	xcb_selection_request_event_t selection_request;
 	xcb_atom_t selection_target;
 	xcb_timestamp_t selection_timestamp;